@@ -0,0 +1,59 @@
+#ifndef _FFT_PLAN_H_
+#define _FFT_PLAN_H_
+/*
+fft_plan.h:
+	Plan based interface to asf_fft.a.  Unlike the routines in fft.h
+and fft2d.h, these keep nothing in globals while transforming, so any
+number of threads can transform at once, and they handle any size, not
+just powers of two.
+
+	Get a plan for the size you want once, then use it as often as you
+like from as many threads as you like.  Plans are cached and never
+freed (until fft_plan_cleanup), so asking for the same size twice is
+cheap and returns the same plan.
+
+	When asf_fft is built with single precision FFTW (HAVE_FFTW3F), the
+plans use FFTW.  Otherwise they use the fftlib kernels for powers of
+two and a mixed radix transform for everything else.  Either way the
+conventions are those of ffts/iffts: the forward transform uses
+exp(-2 pi i jk/n), and the inverse transform is scaled by 1/n, so a
+forward transform followed by an inverse one gives back the input.
+*/
+#include "asf_complex.h"
+
+typedef struct fft_plan fft_plan;
+typedef struct fft2d_real_plan fft2d_real_plan;
+
+/* Complex, in-place, one dimensional transforms of length n. */
+fft_plan *fft_plan_get(int n);
+int fft_plan_size(const fft_plan *plan);
+void fft_forward(const fft_plan *plan, complexFloat *data);
+void fft_inverse(const fft_plan *plan, complexFloat *data);
+/* The same for rows transforms of consecutive vectors of n values,
+   which saves the per call overhead on short transforms. */
+void fft_forward_rows(const fft_plan *plan, complexFloat *data, int rows);
+void fft_inverse_rows(const fft_plan *plan, complexFloat *data, int rows);
+
+/* Real, in-place, two dimensional transforms of nl rows of ns samples.
+   The data has nl rows of fft2d_real_row_stride(plan) = 2*(ns/2+1)
+   floats.  Before the forward transform, the first ns floats of each
+   row hold the real input.  Afterwards, each row holds ns/2+1
+   complexFloats: the non-negative horizontal frequencies, with the
+   vertical frequencies running down the rows (the FFTW r2c layout).
+   The inverse transform goes back the other way. */
+fft2d_real_plan *fft2d_real_plan_get(int nl, int ns);
+int fft2d_real_row_stride(const fft2d_real_plan *plan);
+void fft2d_real_forward(const fft2d_real_plan *plan, float *data);
+void fft2d_real_inverse(const fft2d_real_plan *plan, float *data);
+
+/* The smallest n2 >= n with no prime factors other than 2, 3 and 5.
+   Transforms of these sizes are nearly as fast as powers of two. */
+int fft_good_size(int n);
+
+/* "fftw" or "builtin". */
+const char *fft_backend_name(void);
+
+/* Free all cached plans.  No plan may be in use, or used afterwards. */
+void fft_plan_cleanup(void);
+
+#endif
@@ -12,6 +12,7 @@ following defines.
 "   "ASF_NAME_STRING" [-format <output_format>] [-byte <sample mapping option>]\n"\
 "              [-rgb <red> <green> <blue>] [-band <band_id | all>]\n"\
 "              [-lut <look up table file>] [-truecolor] [-falsecolor]\n"\
+"              [-cog] [-compression <method>]\n"\
 "              [-log <log_file>] [-quiet] [-license] [-version] [-help]\n"\
 "              <in_base_name> <out_full_name>\n"
 
@@ -146,6 +147,16 @@ following defines.
 "        specified rather than a band_id, then export all available bands into\n"\
 "        individual files, one for each band.  Default is '-band all'.\n"\
 "        Cannot be chosen together with the -rgb option.\n"\
+"   -cog\n"\
+"        Writes a cloud optimized GeoTIFF (or TIFF): the image is stored in\n"\
+"        512x512 compressed tiles, followed by reduced resolution overviews\n"\
+"        (each half the size of the one before), laid out so that a viewer\n"\
+"        or tile server can fetch any part of it at any zoom level with a\n"\
+"        few small reads.  The tiles are compressed on all processors.\n"\
+"   -compression <method>\n"\
+"        Compression for the -cog option: DEFLATE (the default), LZW, ZSTD\n"\
+"        (if libtiff supports it) or NONE.  DEFLATE tiles are compressed in\n"\
+"        parallel; the others go through libtiff one at a time.\n"\
 "   -log <logFile>\n"\
 "        Output will be written to a specified log file.\n"\
 "   -quiet\n"\
@@ -300,7 +311,7 @@ main (int argc, char *argv[])
   command_line.use_pixel_is_point = 0;
 
   int formatFlag, logFlag, quietFlag, byteFlag, rgbFlag, bandFlag, lutFlag, pixelIsPointFlag;
-  int truecolorFlag, falsecolorFlag;
+  int truecolorFlag, falsecolorFlag, cogFlag, compressionFlag;
   int needed_args = 3;  //command & argument & argument
   int ii;
   char sample_mapping_string[25];
@@ -324,6 +335,8 @@ main (int argc, char *argv[])
   truecolorFlag = checkForOption("-truecolor", argc, argv);
   falsecolorFlag = checkForOption("-falsecolor", argc, argv);
   pixelIsPointFlag = checkForOption("-point", argc, argv);
+  cogFlag = checkForOption("-cog", argc, argv);
+  compressionFlag = checkForOption("-compression", argc, argv);
 
   if ( formatFlag != FLAG_NOT_SET ) {
     needed_args += 2;           // Option & parameter.
@@ -355,6 +368,12 @@ main (int argc, char *argv[])
   if ( pixelIsPointFlag != FLAG_NOT_SET ) {
     needed_args += 1;
   }
+  if ( cogFlag != FLAG_NOT_SET ) {
+    needed_args += 1;           // Option only
+  }
+  if ( compressionFlag != FLAG_NOT_SET ) {
+    needed_args += 2;           // Option & parameter.
+  }
   if ( argc != needed_args ) {
     print_usage ();                   // This exits with a failure.
   }
@@ -399,6 +418,11 @@ main (int argc, char *argv[])
       print_usage ();
     }
   }
+  if ( compressionFlag != FLAG_NOT_SET ) {
+    if ( argv[compressionFlag + 1][0] == '-' || compressionFlag >= argc - 3 ) {
+      print_usage ();
+    }
+  }
 
   // Make sure there are no flag incompatibilities
   if ( (rgbFlag != FLAG_NOT_SET           &&
@@ -768,6 +792,21 @@ main (int argc, char *argv[])
     command_line.use_pixel_is_point = pixelIsPointFlag != FLAG_NOT_SET; 
   }
 
+  if (compressionFlag != FLAG_NOT_SET && cogFlag == FLAG_NOT_SET)
+    asfPrintWarning("-compression option has no effect without -cog\n");
+  if (cogFlag != FLAG_NOT_SET) {
+    char *compression = compressionFlag != FLAG_NOT_SET ?
+      argv[compressionFlag + 1] : "DEFLATE";
+    if (strcmp_case(command_line.format, "GEOTIFF") != 0 &&
+        strcmp_case(command_line.format, "GEOTIF") != 0 &&
+        strcmp_case(command_line.format, "TIFF") != 0 &&
+        strcmp_case(command_line.format, "TIF") != 0)
+      asfPrintWarning("-cog option has no effect\n");
+    else if (!asf_export_set_cog(compression, 0))
+      asfPrintError("Can't write a cloud optimized GeoTIFF with "
+                    "compression '%s'.\n", compression);
+  }
+
 /***********************END COMMAND LINE PARSING STUFF***********************/
 
   if ( strcmp_case (command_line.format, "ENVI") == 0 ) {
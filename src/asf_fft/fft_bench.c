@@ -0,0 +1,219 @@
+// Checks the plans in fft_plan.c against the old fftlib based
+// transforms (or a plain DFT, for sizes those can't do), and times
+// both, on the transform sizes the tools actually use:
+//
+//   ardop:          complex 1D, 4096 (azimuth) and 8192 (range)
+//   create_roi_in:  complex 1D, 8192 and 16384 (doppler estimation)
+//   fftMatch, pta:  real 2D, 1024x1024 and 2048x2048
+//
+// plus a size that isn't a power of two, which the old routines can't
+// do at all.
+//
+// Usage: fft_bench [repeats]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "asf.h"
+#include "fft.h"
+#include "fft2d.h"
+#include "fft_plan.h"
+
+static void
+random_fill (float *data, int n, guint32 seed)
+{
+  GRand *rand = g_rand_new_with_seed (seed);
+  int ii;
+  for ( ii = 0 ; ii < n ; ii++ ) {
+    data[ii] = g_rand_double_range (rand, -1.0, 1.0);
+  }
+  g_rand_free (rand);
+}
+
+// Largest difference between a and b, relative to the largest
+// magnitude in b.
+static double
+max_rel_diff (const float *a, const float *b, int n)
+{
+  double diff = 0, mag = 0;
+  int ii;
+  for ( ii = 0 ; ii < n ; ii++ ) {
+    diff = MAX (diff, fabs (a[ii] - b[ii]));
+    mag = MAX (mag, fabs (b[ii]));
+  }
+  return mag > 0 ? diff / mag : diff;
+}
+
+// Forward transform of x the slow way, in double precision.
+static void
+slow_dft (const complexFloat *x, complexFloat *y, int n)
+{
+  int jj, kk;
+  for ( kk = 0 ; kk < n ; kk++ ) {
+    double re = 0, im = 0;
+    for ( jj = 0 ; jj < n ; jj++ ) {
+      double phase = -2.0 * M_PI * (double) ((long) jj * kk % n) / n;
+      re += x[jj].real * cos (phase) - x[jj].imag * sin (phase);
+      im += x[jj].real * sin (phase) + x[jj].imag * cos (phase);
+    }
+    y[kk].real = re;
+    y[kk].imag = im;
+  }
+}
+
+static void
+bench_1d (int n, int repeats)
+{
+  fft_plan *plan = fft_plan_get (n);
+  complexFloat *x = g_new (complexFloat, n);
+  complexFloat *y = g_new (complexFloat, n);
+  complexFloat *ref = g_new (complexFloat, n);
+  int M = -1, ii;
+  double old_time = 0, new_time;
+  GTimer *timer;
+
+  if ( (n & (n - 1)) == 0 ) {
+    for ( M = 0 ; (1 << M) < n ; M++ )
+      ;
+    fftInit (M);
+  }
+
+  // Check the forward transform, and the round trip.
+  random_fill ((float *) x, 2 * n, n);
+  memcpy (ref, x, sizeof (complexFloat) * n);
+  if ( M >= 0 ) {
+    ffts ((float *) ref, M, 1);
+  }
+  else {
+    slow_dft (x, ref, n);
+  }
+  memcpy (y, x, sizeof (complexFloat) * n);
+  fft_forward (plan, y);
+  double fwd_err = max_rel_diff ((float *) y, (float *) ref, 2 * n);
+  fft_inverse (plan, y);
+  double inv_err = max_rel_diff ((float *) y, (float *) x, 2 * n);
+  asfRequire (fwd_err < 1e-4 && inv_err < 1e-5,
+              "%d point transform is wrong: forward %g, round trip %g\n",
+              n, fwd_err, inv_err);
+
+  // Then time them.
+  timer = g_timer_new ();
+  if ( M >= 0 ) {
+    for ( ii = 0 ; ii < repeats ; ii++ ) {
+      ffts ((float *) y, M, 1);
+      iffts ((float *) y, M, 1);
+    }
+    old_time = g_timer_elapsed (timer, NULL) / repeats;
+  }
+  g_timer_start (timer);
+  for ( ii = 0 ; ii < repeats ; ii++ ) {
+    fft_forward (plan, y);
+    fft_inverse (plan, y);
+  }
+  new_time = g_timer_elapsed (timer, NULL) / repeats;
+  g_timer_destroy (timer);
+
+  if ( M >= 0 ) {
+    asfPrintStatus ("%14d %12.1f %12.1f\n", n, old_time * 1e6,
+                    new_time * 1e6);
+  }
+  else {
+    asfPrintStatus ("%14d %12s %12.1f\n", n, "-", new_time * 1e6);
+  }
+
+  g_free (ref);
+  g_free (y);
+  g_free (x);
+}
+
+static void
+bench_2d (int M2, int M, int repeats)
+{
+  int nl = 1 << M2, ns = 1 << M;
+  fft2d_real_plan *plan = fft2d_real_plan_get (nl, ns);
+  int rs = fft2d_real_row_stride (plan), nc = rs / 2;
+  float *x = g_new (float, nl * ns);
+  float *y = g_new (float, nl * rs);
+  complexFloat *ref = g_new0 (complexFloat, nl * ns);
+  int ii, jj;
+  GTimer *timer;
+
+  fft2dInit (M2, M);
+
+  // Check the forward transform against the old complex 2D
+  // transform of the same data, and the round trip.
+  random_fill (x, nl * ns, nl + ns);
+  for ( ii = 0 ; ii < nl ; ii++ ) {
+    for ( jj = 0 ; jj < ns ; jj++ ) {
+      ref[ii * ns + jj].real = x[ii * ns + jj];
+      y[ii * rs + jj] = x[ii * ns + jj];
+    }
+  }
+  fft2d ((float *) ref, M2, M);
+  fft2d_real_forward (plan, y);
+  double fwd_err = 0, mag = 0;
+  for ( ii = 0 ; ii < nl ; ii++ ) {
+    for ( jj = 0 ; jj < nc ; jj++ ) {
+      complexFloat a = ((complexFloat *) (y + ii * rs))[jj];
+      complexFloat b = ref[ii * ns + jj];
+      fwd_err = MAX (fwd_err, MAX (fabs (a.real - b.real),
+                                   fabs (a.imag - b.imag)));
+      mag = MAX (mag, MAX (fabs (b.real), fabs (b.imag)));
+    }
+  }
+  fwd_err /= mag;
+  fft2d_real_inverse (plan, y);
+  double inv_err = 0;
+  for ( ii = 0 ; ii < nl ; ii++ ) {
+    inv_err = MAX (inv_err, max_rel_diff (y + ii * rs, x + ii * ns, ns));
+  }
+  asfRequire (fwd_err < 1e-4 && inv_err < 1e-5,
+              "%dx%d real transform is wrong: forward %g, round trip %g\n",
+              nl, ns, fwd_err, inv_err);
+
+  // Then time them.
+  timer = g_timer_new ();
+  for ( ii = 0 ; ii < repeats ; ii++ ) {
+    rfft2d (x, M2, M);
+    rifft2d (x, M2, M);
+  }
+  double old_time = g_timer_elapsed (timer, NULL) / repeats;
+  g_timer_start (timer);
+  for ( ii = 0 ; ii < repeats ; ii++ ) {
+    fft2d_real_forward (plan, y);
+    fft2d_real_inverse (plan, y);
+  }
+  double new_time = g_timer_elapsed (timer, NULL) / repeats;
+  g_timer_destroy (timer);
+
+  asfPrintStatus ("%7dx%-6d %12.1f %12.1f\n", nl, ns, old_time * 1e6,
+                  new_time * 1e6);
+
+  g_free (ref);
+  g_free (y);
+  g_free (x);
+}
+
+int main (int argc, char **argv)
+{
+  int repeats = argc > 1 ? atoi (argv[1]) : 20;
+
+  asfPrintStatus ("FFT plan backend: %s\n", fft_backend_name ());
+  asfPrintStatus ("Microseconds per forward+inverse pair:\n");
+  asfPrintStatus ("%14s %12s %12s\n", "size", "old", "plan");
+  bench_1d (4096, repeats * 10);
+  bench_1d (8192, repeats * 10);
+  bench_1d (16384, repeats * 10);
+  bench_1d (fft_good_size (6000), repeats * 10);
+  bench_2d (10, 10, repeats);
+  bench_2d (11, 11, repeats / 4 + 1);
+
+  fft_plan_cleanup ();
+
+  asfPrintStatus ("Tests passed!\n");
+
+  return 0;
+}
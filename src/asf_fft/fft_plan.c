@@ -0,0 +1,641 @@
+/*******************************************************************
+fft_plan.c:
+	Plan based, reentrant transforms of any size.  See fft_plan.h
+for the interface.
+
+	A plan holds everything a transform of its size needs (twiddle
+and bit reversal tables, or FFTW plans), so transforming touches
+nothing shared but the read-only plan.  Plans are made on first use
+and cached under a lock; the transforms themselves take no locks.
+
+	Without FFTW, powers of two go straight to the fftlib kernels (the
+same ones ffts and iffts use), with tables owned by the plan instead
+of the global ones in fftext.c.  Other sizes use a recursive mixed
+radix (decimation in time) transform with special cased radix 2, 3
+and 4 butterflies, and a plain DFT butterfly for larger primes, which
+gets slow for sizes with big prime factors.  fft_good_size finds a
+nearby size that is fast.
+*******************************************************************/
+#include "asf.h"
+#include <glib.h>
+#include "fftlib.h"
+#include "fft_plan.h"
+#ifdef HAVE_FFTW3F
+#include <fftw3.h>
+#endif
+
+#define MAX_FACTORS 32
+
+struct fft_plan {
+	int n;
+	int M;			/* log2(n) if n is a power of two, else -1 */
+	float *Utbl;		/* fftlib cosine table (powers of two) */
+	short *BRLow;		/* fftlib bit reversed table (powers of two) */
+	int nfactors;
+	int factors[MAX_FACTORS];	/* radices, in the order they're applied */
+	complexFloat *twiddle;	/* exp(-2 pi i j/n), j < n (mixed radix) */
+#ifdef HAVE_FFTW3F
+	/* FFTW plans are made for in-place transforms of data with the
+	   alignment fftwf_malloc gives, with a second set for anything else. */
+	fftwf_plan forward, inverse;
+	fftwf_plan forward_unaligned, inverse_unaligned;
+#endif
+};
+
+struct fft2d_real_plan {
+	int nl, ns;
+	int nc;			/* complex values per row: ns/2+1 */
+	fft_plan *rows, *cols;	/* builtin transforms */
+#ifdef HAVE_FFTW3F
+	fftwf_plan forward, inverse;
+	fftwf_plan forward_unaligned, inverse_unaligned;
+#endif
+};
+
+/* Plan caches, keyed by size.  Guarded by the lock, which also keeps
+   the FFTW planner (which is not thread safe) to one thread at a time. */
+G_LOCK_DEFINE_STATIC(fft_plans);
+static GHashTable *plans1d = NULL;
+static GHashTable *plans2d = NULL;
+
+/* Columns gathered at a time in the builtin 2D transforms. */
+#define COL_BLOCK 8
+
+const char *fft_backend_name(void)
+{
+#ifdef HAVE_FFTW3F
+	return "fftw";
+#else
+	return "builtin";
+#endif
+}
+
+int fft_good_size(int n)
+{
+	int n2;
+	if (n < 1)
+		return 1;
+	for (n2 = n; ; n2++) {
+		int r = n2;
+		while (r % 2 == 0) r /= 2;
+		while (r % 3 == 0) r /= 3;
+		while (r % 5 == 0) r /= 5;
+		if (r == 1)
+			return n2;
+	}
+}
+
+/*************************************************
+ Builtin mixed radix transform.
+**************************************************/
+
+static void factor(fft_plan *plan)
+{
+	int r = plan->n, p;
+	plan->nfactors = 0;
+	while (r % 4 == 0) {
+		plan->factors[plan->nfactors++] = 4;
+		r /= 4;
+	}
+	for (p = 2; r > 1; p++) {
+		while (r % p == 0) {
+			g_assert(plan->nfactors < MAX_FACTORS);
+			plan->factors[plan->nfactors++] = p;
+			r /= p;
+		}
+	}
+}
+
+/* out[s*m+k] for the n point transform of in[0], in[stride], ...
+   in[(n-1)*stride], using factors[f] onwards. */
+static void mixed_radix(const fft_plan *plan, const complexFloat *in,
+			int stride, complexFloat *out, int n, int f,
+			int inverse, complexFloat *t)
+{
+	const complexFloat *tw = plan->twiddle;
+	int p, m, tw_step, q, k, s;
+
+	if (n == 1) {
+		out[0] = in[0];
+		return;
+	}
+	p = plan->factors[f];
+	m = n / p;
+	tw_step = plan->n / n;
+
+	/* Transform the p decimated subsequences into consecutive blocks. */
+	for (q = 0; q < p; q++)
+		mixed_radix(plan, in + q*stride, stride*p, out + q*m, m, f+1,
+			    inverse, t);
+
+	/* Then combine them with p point butterflies. */
+	for (k = 0; k < m; k++) {
+		t[0] = out[k];
+		for (q = 1; q < p; q++) {
+			complexFloat w = tw[q*k*tw_step];
+			complexFloat x = out[q*m+k];
+			if (inverse) w.imag = -w.imag;
+			t[q].real = x.real*w.real - x.imag*w.imag;
+			t[q].imag = x.real*w.imag + x.imag*w.real;
+		}
+		switch (p) {
+		case 2:
+			out[k].real = t[0].real + t[1].real;
+			out[k].imag = t[0].imag + t[1].imag;
+			out[m+k].real = t[0].real - t[1].real;
+			out[m+k].imag = t[0].imag - t[1].imag;
+			break;
+		case 3: {
+			/* sn is the imaginary part of exp(-+2 pi i/3) */
+			const float sn = inverse ? 0.86602540378443865 : -0.86602540378443865;
+			float ar = t[1].real + t[2].real, ai = t[1].imag + t[2].imag;
+			float br = t[1].real - t[2].real, bi = t[1].imag - t[2].imag;
+			float cr = t[0].real - 0.5*ar, ci = t[0].imag - 0.5*ai;
+			out[k].real = t[0].real + ar;
+			out[k].imag = t[0].imag + ai;
+			out[m+k].real = cr - sn*bi;
+			out[m+k].imag = ci + sn*br;
+			out[2*m+k].real = cr + sn*bi;
+			out[2*m+k].imag = ci - sn*br;
+			break;
+		}
+		case 4: {
+			float ar = t[0].real + t[2].real, ai = t[0].imag + t[2].imag;
+			float br = t[0].real - t[2].real, bi = t[0].imag - t[2].imag;
+			float cr = t[1].real + t[3].real, ci = t[1].imag + t[3].imag;
+			/* d = -i*(t1-t3) forward, +i*(t1-t3) inverse */
+			float dr = t[1].imag - t[3].imag, di = t[3].real - t[1].real;
+			if (inverse) {
+				dr = -dr;
+				di = -di;
+			}
+			out[k].real = ar + cr;
+			out[k].imag = ai + ci;
+			out[m+k].real = br + dr;
+			out[m+k].imag = bi + di;
+			out[2*m+k].real = ar - cr;
+			out[2*m+k].imag = ai - ci;
+			out[3*m+k].real = br - dr;
+			out[3*m+k].imag = bi - di;
+			break;
+		}
+		default:
+			/* Plain DFT of the p values. */
+			for (s = 0; s < p; s++) {
+				float yr = 0, yi = 0;
+				int step = plan->n / p;
+				for (q = 0; q < p; q++) {
+					complexFloat w = tw[((q*s) % p)*step];
+					if (inverse) w.imag = -w.imag;
+					yr += t[q].real*w.real - t[q].imag*w.imag;
+					yi += t[q].real*w.imag + t[q].imag*w.real;
+				}
+				out[s*m+k].real = yr;
+				out[s*m+k].imag = yi;
+			}
+			break;
+		}
+	}
+}
+
+/* Scratch space for the mixed radix transform, one per thread. */
+typedef struct {
+	int size;
+	complexFloat *buf;
+} scratch_t;
+
+static void scratch_free(gpointer data)
+{
+	scratch_t *s = data;
+	g_free(s->buf);
+	g_free(s);
+}
+
+static GPrivate scratch_key = G_PRIVATE_INIT(scratch_free);
+
+static complexFloat *scratch_buffer(int size)
+{
+	scratch_t *s = g_private_get(&scratch_key);
+	if (s == NULL) {
+		s = g_new0(scratch_t, 1);
+		g_private_set(&scratch_key, s);
+	}
+	if (s->size < size) {
+		g_free(s->buf);
+		s->buf = g_new(complexFloat, size);
+		s->size = size;
+	}
+	return s->buf;
+}
+
+static void builtin_transform(const fft_plan *plan, complexFloat *data,
+			      int inverse)
+{
+	int n = plan->n, p = 0, i;
+	complexFloat *scratch;
+
+	if (plan->M >= 0) {
+		if (inverse)
+			iffts1((float *)data, plan->M, 1, plan->Utbl, plan->BRLow);
+		else
+			ffts1((float *)data, plan->M, 1, plan->Utbl, plan->BRLow);
+		return;
+	}
+
+	/* The input is copied out, and transformed back into data.  The
+	   butterflies need room for the largest radix on top of that. */
+	for (i = 0; i < plan->nfactors; i++)
+		if (plan->factors[i] > p) p = plan->factors[i];
+	scratch = scratch_buffer(n + p);
+	memcpy(scratch, data, sizeof(complexFloat)*n);
+	mixed_radix(plan, scratch, 1, data, n, 0, inverse, scratch + n);
+	if (inverse) {
+		float scale = 1.0/n;
+		for (i = 0; i < n; i++) {
+			data[i].real *= scale;
+			data[i].imag *= scale;
+		}
+	}
+}
+
+static fft_plan *builtin_plan_new(int n)
+{
+	fft_plan *plan = g_new0(fft_plan, 1);
+	plan->n = n;
+	plan->M = -1;
+	if ((n & (n-1)) == 0) {
+		int M = 0;
+		while ((1 << M) < n) M++;
+		plan->M = M;
+		plan->Utbl = g_new(float, POW2(M)/4+1);
+		fftCosInit(M, plan->Utbl);
+		if (M > 1) {
+			plan->BRLow = g_new(short, POW2(M/2-1));
+			fftBRInit(M, plan->BRLow);
+		}
+	}
+	else {
+		int j;
+		factor(plan);
+		plan->twiddle = g_new(complexFloat, n);
+		for (j = 0; j < n; j++) {
+			double phase = -2.0*M_PI*j/n;
+			plan->twiddle[j].real = cos(phase);
+			plan->twiddle[j].imag = sin(phase);
+		}
+	}
+	return plan;
+}
+
+/*************************************************
+ One dimensional plans.
+**************************************************/
+
+#ifdef HAVE_FFTW3F
+/* Is data aligned the way the plan's aligned FFTW plans expect? */
+#define FFTW_ALIGNED(data) (fftwf_alignment_of((float *)(data)) == 0)
+
+static void fftw_plan_1d(fft_plan *plan)
+{
+	int n = plan->n;
+	fftwf_complex *buf = fftwf_malloc(sizeof(fftwf_complex)*n);
+	plan->forward = fftwf_plan_dft_1d(n, buf, buf, FFTW_FORWARD, FFTW_ESTIMATE);
+	plan->inverse = fftwf_plan_dft_1d(n, buf, buf, FFTW_BACKWARD, FFTW_ESTIMATE);
+	plan->forward_unaligned = fftwf_plan_dft_1d(n, buf, buf, FFTW_FORWARD,
+						    FFTW_ESTIMATE | FFTW_UNALIGNED);
+	plan->inverse_unaligned = fftwf_plan_dft_1d(n, buf, buf, FFTW_BACKWARD,
+						    FFTW_ESTIMATE | FFTW_UNALIGNED);
+	fftwf_free(buf);
+}
+#endif
+
+fft_plan *fft_plan_get(int n)
+{
+	fft_plan *plan;
+
+	if (n < 1)
+		asfPrintError("fft_plan_get: bad transform size %d\n", n);
+
+	G_LOCK(fft_plans);
+	if (plans1d == NULL)
+		plans1d = g_hash_table_new(g_direct_hash, g_direct_equal);
+	plan = g_hash_table_lookup(plans1d, GINT_TO_POINTER(n));
+	if (plan == NULL) {
+		plan = builtin_plan_new(n);
+#ifdef HAVE_FFTW3F
+		fftw_plan_1d(plan);
+#endif
+		g_hash_table_insert(plans1d, GINT_TO_POINTER(n), plan);
+	}
+	G_UNLOCK(fft_plans);
+
+	return plan;
+}
+
+int fft_plan_size(const fft_plan *plan)
+{
+	return plan->n;
+}
+
+void fft_forward(const fft_plan *plan, complexFloat *data)
+{
+#ifdef HAVE_FFTW3F
+	fftwf_execute_dft(FFTW_ALIGNED(data) ? plan->forward : plan->forward_unaligned,
+			  (fftwf_complex *)data, (fftwf_complex *)data);
+#else
+	builtin_transform(plan, data, FALSE);
+#endif
+}
+
+void fft_inverse(const fft_plan *plan, complexFloat *data)
+{
+#ifdef HAVE_FFTW3F
+	int i, n = plan->n;
+	float scale = 1.0/n;
+	fftwf_execute_dft(FFTW_ALIGNED(data) ? plan->inverse : plan->inverse_unaligned,
+			  (fftwf_complex *)data, (fftwf_complex *)data);
+	for (i = 0; i < n; i++) {
+		data[i].real *= scale;
+		data[i].imag *= scale;
+	}
+#else
+	builtin_transform(plan, data, TRUE);
+#endif
+}
+
+void fft_forward_rows(const fft_plan *plan, complexFloat *data, int rows)
+{
+	int i;
+#ifndef HAVE_FFTW3F
+	if (plan->M >= 0) {
+		ffts1((float *)data, plan->M, rows, plan->Utbl, plan->BRLow);
+		return;
+	}
+#endif
+	for (i = 0; i < rows; i++)
+		fft_forward(plan, data + (long)i*plan->n);
+}
+
+void fft_inverse_rows(const fft_plan *plan, complexFloat *data, int rows)
+{
+	int i;
+#ifndef HAVE_FFTW3F
+	if (plan->M >= 0) {
+		iffts1((float *)data, plan->M, rows, plan->Utbl, plan->BRLow);
+		return;
+	}
+#endif
+	for (i = 0; i < rows; i++)
+		fft_inverse(plan, data + (long)i*plan->n);
+}
+
+static void fft_plan_free(gpointer data)
+{
+	fft_plan *plan = data;
+#ifdef HAVE_FFTW3F
+	fftwf_destroy_plan(plan->forward);
+	fftwf_destroy_plan(plan->inverse);
+	fftwf_destroy_plan(plan->forward_unaligned);
+	fftwf_destroy_plan(plan->inverse_unaligned);
+#endif
+	g_free(plan->Utbl);
+	g_free(plan->BRLow);
+	g_free(plan->twiddle);
+	g_free(plan);
+}
+
+/*************************************************
+ Two dimensional real plans.
+**************************************************/
+
+/* Forward transform rows a and b (b may be NULL) at once, as the real
+   and imaginary parts of one complex row, and split the result. */
+static void row_pair_forward(const fft2d_real_plan *plan, float *a, float *b,
+			     complexFloat *z)
+{
+	int ns = plan->ns, j, k;
+	complexFloat *ca = (complexFloat *)a, *cb = (complexFloat *)b;
+
+	for (j = 0; j < ns; j++) {
+		z[j].real = a[j];
+		z[j].imag = b ? b[j] : 0.0;
+	}
+	fft_forward(plan->rows, z);
+	for (k = 0; k < plan->nc; k++) {
+		complexFloat zk = z[k], zn = z[(ns-k) % ns];
+		/* A = (Z[k] + conj(Z[-k]))/2, B = (Z[k] - conj(Z[-k]))/2i */
+		ca[k].real = 0.5*(zk.real + zn.real);
+		ca[k].imag = 0.5*(zk.imag - zn.imag);
+		if (cb) {
+			cb[k].real = 0.5*(zk.imag + zn.imag);
+			cb[k].imag = -0.5*(zk.real - zn.real);
+		}
+	}
+}
+
+/* The other way: rebuild the full spectra of rows a and b (b may be
+   NULL) from their halves, and inverse transform them together. */
+static void row_pair_inverse(const fft2d_real_plan *plan, float *a, float *b,
+			     complexFloat *z)
+{
+	int ns = plan->ns, nc = plan->nc, j, k;
+	complexFloat *ca = (complexFloat *)a, *cb = (complexFloat *)b;
+	complexFloat zero = {0.0, 0.0};
+
+	for (k = 0; k < ns; k++) {
+		complexFloat A, B;
+		if (k < nc) {
+			A = ca[k];
+			B = cb ? cb[k] : zero;
+		}
+		else {
+			A = ca[ns-k];
+			B = cb ? cb[ns-k] : zero;
+			A.imag = -A.imag;
+			B.imag = -B.imag;
+		}
+		/* The DC and Nyquist values of a real row's spectrum are real. */
+		if (k == 0 || 2*k == ns) {
+			A.imag = 0.0;
+			B.imag = 0.0;
+		}
+		z[k].real = A.real - B.imag;
+		z[k].imag = A.imag + B.real;
+	}
+	fft_inverse(plan->rows, z);
+	for (j = 0; j < ns; j++) {
+		a[j] = z[j].real;
+		if (b) b[j] = z[j].imag;
+	}
+}
+
+/* Transform the columns of the complex rows, a block at a time. */
+static void columns_transform(const fft2d_real_plan *plan, float *data,
+			      int inverse)
+{
+	int nl = plan->nl, nc = plan->nc, c0, c, r;
+	complexFloat *cdata = (complexFloat *)data;
+	complexFloat *cols = g_new(complexFloat, COL_BLOCK*nl);
+
+	for (c0 = 0; c0 < nc; c0 += COL_BLOCK) {
+		int width = MIN(COL_BLOCK, nc - c0);
+		for (r = 0; r < nl; r++)
+			for (c = 0; c < width; c++)
+				cols[c*nl + r] = cdata[r*nc + c0 + c];
+		for (c = 0; c < width; c++) {
+			if (inverse)
+				fft_inverse(plan->cols, cols + c*nl);
+			else
+				fft_forward(plan->cols, cols + c*nl);
+		}
+		for (r = 0; r < nl; r++)
+			for (c = 0; c < width; c++)
+				cdata[r*nc + c0 + c] = cols[c*nl + r];
+	}
+	g_free(cols);
+}
+
+static void builtin_2d_forward(const fft2d_real_plan *plan, float *data)
+{
+	int rs = 2*plan->nc, r;
+	complexFloat *z = g_new(complexFloat, plan->ns);
+	for (r = 0; r+1 < plan->nl; r += 2)
+		row_pair_forward(plan, data + r*rs, data + (r+1)*rs, z);
+	if (r < plan->nl)
+		row_pair_forward(plan, data + r*rs, NULL, z);
+	g_free(z);
+	columns_transform(plan, data, FALSE);
+}
+
+static void builtin_2d_inverse(const fft2d_real_plan *plan, float *data)
+{
+	int rs = 2*plan->nc, r;
+	complexFloat *z;
+	columns_transform(plan, data, TRUE);
+	z = g_new(complexFloat, plan->ns);
+	for (r = 0; r+1 < plan->nl; r += 2)
+		row_pair_inverse(plan, data + r*rs, data + (r+1)*rs, z);
+	if (r < plan->nl)
+		row_pair_inverse(plan, data + r*rs, NULL, z);
+	g_free(z);
+}
+
+fft2d_real_plan *fft2d_real_plan_get(int nl, int ns)
+{
+	fft2d_real_plan *plan;
+	gint64 key = ((gint64)nl << 32) | ns;
+
+	if (nl < 1 || ns < 1)
+		asfPrintError("fft2d_real_plan_get: bad transform size %dx%d\n",
+			      nl, ns);
+
+	/* The row and column plans come from the 1D cache, so get them
+	   before taking the lock. */
+	fft_plan *rows = fft_plan_get(ns);
+	fft_plan *cols = fft_plan_get(nl);
+
+	G_LOCK(fft_plans);
+	if (plans2d == NULL)
+		plans2d = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+						g_free, NULL);
+	plan = g_hash_table_lookup(plans2d, &key);
+	if (plan == NULL) {
+		plan = g_new0(fft2d_real_plan, 1);
+		plan->nl = nl;
+		plan->ns = ns;
+		plan->nc = ns/2 + 1;
+		plan->rows = rows;
+		plan->cols = cols;
+#ifdef HAVE_FFTW3F
+		{
+			float *buf = fftwf_malloc(sizeof(float)*nl*2*plan->nc);
+			fftwf_complex *cbuf = (fftwf_complex *)buf;
+			plan->forward = fftwf_plan_dft_r2c_2d(nl, ns, buf, cbuf,
+							      FFTW_ESTIMATE);
+			plan->inverse = fftwf_plan_dft_c2r_2d(nl, ns, cbuf, buf,
+							      FFTW_ESTIMATE);
+			plan->forward_unaligned =
+			  fftwf_plan_dft_r2c_2d(nl, ns, buf, cbuf,
+						FFTW_ESTIMATE | FFTW_UNALIGNED);
+			plan->inverse_unaligned =
+			  fftwf_plan_dft_c2r_2d(nl, ns, cbuf, buf,
+						FFTW_ESTIMATE | FFTW_UNALIGNED);
+			fftwf_free(buf);
+		}
+#endif
+		gint64 *plan_key = g_new(gint64, 1);
+		*plan_key = key;
+		g_hash_table_insert(plans2d, plan_key, plan);
+	}
+	G_UNLOCK(fft_plans);
+
+	return plan;
+}
+
+int fft2d_real_row_stride(const fft2d_real_plan *plan)
+{
+	return 2*plan->nc;
+}
+
+void fft2d_real_forward(const fft2d_real_plan *plan, float *data)
+{
+#ifdef HAVE_FFTW3F
+	fftwf_execute_dft_r2c(FFTW_ALIGNED(data) ? plan->forward
+			      : plan->forward_unaligned,
+			      data, (fftwf_complex *)data);
+#else
+	builtin_2d_forward(plan, data);
+#endif
+}
+
+void fft2d_real_inverse(const fft2d_real_plan *plan, float *data)
+{
+#ifdef HAVE_FFTW3F
+	int rs = 2*plan->nc, r, c;
+	float scale = 1.0/((double)plan->nl*plan->ns);
+	fftwf_execute_dft_c2r(FFTW_ALIGNED(data) ? plan->inverse
+			      : plan->inverse_unaligned,
+			      (fftwf_complex *)data, data);
+	for (r = 0; r < plan->nl; r++)
+		for (c = 0; c < plan->ns; c++)
+			data[r*rs + c] *= scale;
+#else
+	builtin_2d_inverse(plan, data);
+#endif
+}
+
+static void fft2d_real_plan_free(gpointer data)
+{
+	fft2d_real_plan *plan = data;
+#ifdef HAVE_FFTW3F
+	fftwf_destroy_plan(plan->forward);
+	fftwf_destroy_plan(plan->inverse);
+	fftwf_destroy_plan(plan->forward_unaligned);
+	fftwf_destroy_plan(plan->inverse_unaligned);
+#endif
+	g_free(plan);
+}
+
+void fft_plan_cleanup(void)
+{
+	G_LOCK(fft_plans);
+	if (plans2d) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, plans2d);
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+			fft2d_real_plan_free(value);
+		g_hash_table_destroy(plans2d);
+		plans2d = NULL;
+	}
+	if (plans1d) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, plans1d);
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+			fft_plan_free(value);
+		g_hash_table_destroy(plans1d);
+		plans1d = NULL;
+	}
+	G_UNLOCK(fft_plans);
+}
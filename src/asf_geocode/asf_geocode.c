@@ -26,7 +26,8 @@ trouble, and use edit_man_header. :)
 "             [-force] [-resample-method <method>] [-height <height>]\n"\
 "             [-datum <datum>] [-pixel-size <pixel size>] [-band <band_id | all>]\n"\
 "             [-log <file>] [-write-proj-file <file>] [-read-proj-file <file>]\n"\
-"             [-save-mapping] [-background <value>] [-quiet] [-license]\n"\
+"             [-save-mapping] [-background <value>] [-lattice <spacing>]\n"\
+"             [-quiet] [-license]\n"\
 "             [-version] [-help]\n"\
 "             <in_base_name> <out_base_name>\n"\
 "\n"\
@@ -58,6 +59,13 @@ trouble, and use edit_man_header. :)
 "          original file, the other the sample numbers.  Together, these\n"\
 "          define the mapping of pixels performed by the geocoding.\n"\
 "\n"\
+"     -lattice <spacing>\n"\
+"          Evaluate the mapping between output and input pixels only every\n"\
+"          <spacing> output pixels, and interpolate in between.  This is\n"\
+"          much faster, and the result is checked against the same\n"\
+"          accuracy requirement as the normal mapping.  A spacing of 16\n"\
+"          is a reasonable choice.\n"\
+"\n"\
 "     -log <log file>\n"\
 "          Output will be written to a specified log file.\n"\
 "\n"\
@@ -205,6 +213,10 @@ main (int argc, char **argv)
   }
   quietflag = detect_flag_options(argc, argv, "-quiet", "--quiet", NULL);
   save_map_flag = extract_flag_options(&argc, &argv, "-save-mapping", "--save_mapping", NULL);
+  int lattice_spacing = 0;
+  if (extract_int_options(&argc, &argv, &lattice_spacing, "-lattice",
+                          "--lattice", NULL))
+    asf_geocode_set_lattice_spacing(lattice_spacing);
 
   handle_license_and_version_args(argc, argv, ASF_NAME_STRING);
 
@@ -2,11 +2,12 @@
 NAME: asf_igram_coh - Calculates an interferogram, a coherence image and
                       multilooks interfergram
 
-SYNOPSIS: asf_igram_coh [-look linexsamp] [-step linexsample]
+SYNOPSIS: asf_igram_coh [-look linexsamp] [-step linexsample] [-ml-only]
              <master> <slave> <output>
 
         -look   Set look box line and sample.  Default 15x3
         -step   Set step boc line and sample.  Default 5x1
+        -ml-only  Skip the single look interferogram
         master  Complex master image
         slave   Complex slave image
         output  Basename of the output files
@@ -55,7 +56,8 @@ void usage(char *name)
 {
  printf("\n"
 	"USAGE:\n"
-	"   %s [-look lxs] [-step lxs] <master> <slave> <output>\n",name);
+	"   %s [-look lxs] [-step lxs] [-ml-only] <master> <slave> <output>\n",
+	name);
  printf("\n"
 	"REQUIRED ARGUMENTS:\n"
 	"   master   Complex master image\n"
@@ -65,7 +67,9 @@ void usage(char *name)
 	"   -look lxs   Change look box (l)ine and (s)ample.\n"
 	"               (Read from meta file by default)\n"
 	"   -step lxs   change step box (l)ine and (s)ample.\n"
-	"               (Read from meta file by default)\n");
+	"               (Read from meta file by default)\n"
+	"   -ml-only    Only write the multilooked interferogram and the\n"
+	"               coherence, not the single look amplitude and phase.\n");
  printf("\n"
 	"DESCRIPTION:\n"
 	"   A correlation calculator to estimate interferogram quality\n");
@@ -80,6 +84,7 @@ int main(int argc, char *argv[])
   char masterFile[255], slaveFile[255], outFile[255];
   int sample_count, line_count;
   int stepLine, stepSample, lookLine, lookSample, lookFlag=FALSE, stepFlag=FALSE;
+  int single_look=TRUE;
   meta_parameters *inMeta;
 
   logflag = 0;
@@ -111,6 +116,9 @@ int main(int argc, char *argv[])
       }
       stepFlag=TRUE;
     }
+    else if (strmatch(key,"-ml-only")) {
+      single_look=FALSE;
+    }
     else {printf("\n   ***Invalid option:  %s\n",argv[currArg-1]); usage(argv[0]);}
   }
   if ((argc-currArg) < 3) {printf("   Insufficient arguments.\n"); usage(argv[0]);}
@@ -145,8 +153,8 @@ int main(int argc, char *argv[])
 
   // Call the library function to get the work done
   float average;
-  asf_igram_coh(lookLine, lookSample, stepLine, stepSample, 
-		masterFile, slaveFile, outFile, &average);
+  asf_igram_coh_ext(lookLine, lookSample, stepLine, stepSample,
+		    masterFile, slaveFile, outFile, single_look, &average);
 
   return(0);
 }
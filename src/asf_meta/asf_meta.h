@@ -727,6 +727,17 @@ latitude and longitude.  Works with all image types.
 int meta_get_latLon(meta_parameters *sar,
                     double yLine, double xSample,double elev,
                     double *lat,double *lon);
+/* meta_get_latLon for n samples of a line (first_sample, first_sample
++ sample_step, ...), and for n arbitrary points (elev may be NULL).
+Same results as meta_get_latLon, but for slant and ground range images
+the orbit and geolocation setup is only done once per line.  Return
+the number of points that failed. */
+int meta_get_latLon_row(meta_parameters *meta, double yLine,
+                        double first_sample, double sample_step, int n,
+                        double elev, double *lat, double *lon);
+int meta_get_latLon_batch(meta_parameters *meta, int n,
+                          const double *yLine, const double *xSample,
+                          const double *elev, double *lat, double *lon);
 
 /* Finds line and sample corresponding to given
 latitude and longitude. */
@@ -735,6 +746,23 @@ double meta_get_lineSamp_tolerance(void);
 int meta_get_lineSamp(meta_parameters *meta,
                       double lat,double lon,double elev,
                       double *yLine,double *xSample);
+/* The general way meta_get_lineSamp works: a search using
+meta_get_latLon.  Slower, but works for all image types. */
+int meta_get_lineSamp_iterative(meta_parameters *meta,
+                                double lat, double lon, double elev,
+                                double *yLine, double *xSamp);
+/* meta_get_lineSamp for n points.  elev may be NULL (all zero).
+Returns the number of points that could not be converted. */
+int meta_get_lineSamp_batch(meta_parameters *meta, int n,
+                            const double *lat, const double *lon,
+                            const double *elev,
+                            double *yLine, double *xSamp);
+/* Direct range-doppler solution used by meta_get_lineSamp for slant and
+ground range images (see latLon2lineSamp.c).  *time and *xSamp give
+the starting point, and are updated.  Returns nonzero on failure. */
+int meta_uses_range_doppler(meta_parameters *meta);
+int meta_rd_lineSamp(meta_parameters *meta, double lat, double lon,
+                     double elev, double *time, double *yLine, double *xSamp);
 
 /* Converts a given line and sample in image into time,
 slant-range, and doppler.  Works with all image types.
@@ -1016,6 +1044,35 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
 		 float inDn, char *bandExt, int dbFlag);
 float get_rad_cal_dn(meta_parameters *meta, int line, int sample, char *bandExt,
 		     float inDn, float radCorr);
+
+// Calibration of whole lines at a time, to meta->general->radiometry.
+// The coefficients get_cal_dn works out for every pixel are worked out
+// once per line (or once altogether, when they don't vary), and then
+// applied to the whole line.  meta must stay around, unchanged, for
+// as long as the cal_line_t is in use.
+typedef struct {
+  meta_parameters *meta;
+  char *bandExt;
+  int dbFlag;
+  int sample_count, line_count;
+  // Coefficients for the current line: the scaled power is gain times
+  // the square of the data number, plus offset.
+  double *gain, *offset;
+  int line;                // Line gain and offset are for, or -1.
+  int fixed;               // The coefficients are the same for every line.
+  // Coefficients at the grid lines on either side of the current line.
+  int grid_line[2];
+  double *grid_gain[2], *grid_offset[2];
+} cal_line_t;
+
+cal_line_t *cal_line_new(meta_parameters *meta, const char *bandExt,
+			 int dbFlag);
+// Use the incidence angles incid (one per sample) for every line,
+// instead of working them out with meta_incid.
+void cal_line_set_incid(cal_line_t *self, const float *incid);
+// Calibrate line of data numbers buf, in place.
+void cal_line_apply(cal_line_t *self, int line, float *buf);
+void cal_line_free(cal_line_t *self);
 float cal2amp(meta_parameters *meta, float incid, int sample, char *bandExt, 
 	      float calValue);
 quadratic_2d find_quadratic(const double *out, const double *x,
@@ -709,21 +709,19 @@ float *incid_init(meta_parameters *meta)
     return incid;
 }
 
-/*----------------------------------------------------------------------
-  Get_cal_dn:
-        Convert amplitude image data number into calibrated image data
-        number (in power scale), given the current noise value.
-----------------------------------------------------------------------*/
-float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
-                 float inDn, char *bandExt, int dbFlag)
+// Work out the calibration coefficients for one sample: the scaled
+// power is *gain times the square of the data number, plus *offset.
+// UAVSAR data numbers are power already, so they aren't squared (see
+// cal_dn_is_power).
+static void cal_coefficients(meta_parameters *meta, float incidence_angle,
+                             int sample, const char *bandExt,
+                             double *gain, double *offset)
 {
-  double scaledPower=0, calValue=0, invIncAngle=1;
+  double invIncAngle=1;
   radiometry_t radiometry = meta->general->radiometry;
 
-  if (!meta->calibration) {
-    asfPrintWarning("Called get_cal_dn with no calibration block!\n");
-    return 0;
-  }
+  *gain = 0;
+  *offset = 0;
 
   // Calculate according to the calibration data type
   if (meta->calibration->type == asf_cal) { // ASF style data (PP and SSP)
@@ -736,24 +734,13 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
       invIncAngle = 1/sin(incidence_angle);
 
     asf_cal_params *p = meta->calibration->asf;
-    double scaling = (double)meta->sar->original_sample_count/meta->general->sample_count;
-    int orig_sample = meta->general->start_sample + scaling*sample;
-    double index = (double)orig_sample*256./(double)(p->sample_count);
-    if (index < 0) index = 0;
-    if (index > p->sample_count-2) index = p->sample_count-2;
 
-/*
-    // Determine the noise value
-    double *noise = p->noise;
-    int base = (int) index;
-    double frac = index - base;
-    double noiseValue = noise[base] + frac*(noise[base+1] - noise[base]);
-*/
     // Convert (amplitude) data number to scaled
     // Removed the noise floor removal
     //scaledPower =
     //(p->a1*(inDn*inDn-p->a0*noiseValue) + p->a2)*invIncAngle;
-    scaledPower = (p->a1*inDn*inDn + p->a2)*invIncAngle;
+    *gain = p->a1*invIncAngle;
+    *offset = p->a2*invIncAngle;
   }
   else if (meta->calibration->type == asf_scansar_cal) { // ASF style ScanSar
 
@@ -766,43 +753,25 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
     else if (radiometry == r_BETA || radiometry == r_BETA_DB)
       invIncAngle = 1/sin(incidence_angle);
 
-/*    
-    double look = 25.0; // FIXME: hack to get things compiled
-    double index = (look-16.3)*10.0;
-    double *noise = p->noise;
-    double noiseValue;
-    if (index <= 0)
-      noiseValue = noise[0];
-    else if (index >= 255)
-      noiseValue = noise[255];
-    else {
-      // Use linear interpolation on noise array
-      int base = (int)index;
-      double frac = index - base;
-
-      noiseValue = noise[base] + frac*(noise[base+1] - noise[base]);
-    }
-*/
     // Convert (amplitude) data number to scaled
     // Remove the noise floor removal
     //scaledPower =
     //  (p->a1*(inDn*inDn-p->a0*noiseValue) + p->a2)*invIncAngle;
-    scaledPower = (p->a1*inDn*inDn + p->a2)*invIncAngle;
+    *gain = p->a1*invIncAngle;
+    *offset = p->a2*invIncAngle;
   }
   else if (meta->calibration->type == esa_cal) { // ESA style ERS and JERS data
 
     esa_cal_params *p = meta->calibration->esa;
 
     if (radiometry == r_BETA || radiometry == r_BETA_DB)
-      scaledPower = inDn*inDn/p->k;
+      *gain = 1/p->k;
     else if (radiometry == r_SIGMA || radiometry == r_SIGMA_DB)
-      scaledPower =
-    inDn*inDn/p->k*sin(p->ref_incid*D2R)/sin(incidence_angle);
+      *gain = 1/p->k*sin(p->ref_incid*D2R)/sin(incidence_angle);
     else if (radiometry == r_GAMMA || radiometry == r_GAMMA_DB) {
       invIncAngle = 1/cos(incidence_angle*D2R);
-      scaledPower =
-    inDn*inDn/p->k*sin(p->ref_incid*D2R)/sin(incidence_angle) /
-    invIncAngle;
+      *gain = 1/p->k*sin(p->ref_incid*D2R)/sin(incidence_angle) /
+	invIncAngle;
     }
 
   }
@@ -829,9 +798,11 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
       a2 = p->lut[p->n-1] +
     ((p->lut[p->n-1] - p->lut[p->n-2])*((sample/p->samp_inc) - p->n-1));
     if (p->slc)
-      scaledPower = (inDn*inDn)/(a2*a2)*invIncAngle;
-    else
-      scaledPower = (inDn*inDn + p->a3)/a2*invIncAngle;
+      *gain = invIncAngle/(a2*a2);
+    else {
+      *gain = invIncAngle/a2;
+      *offset = p->a3*invIncAngle/a2;
+    }
   }
   else if (meta->calibration->type == alos_cal) { // ALOS data
 
@@ -855,7 +826,7 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
     else
       cf = p->cf_hh;
  
-    scaledPower = pow(10, cf/10.0)*inDn*inDn*invIncAngle;
+    *gain = pow(10, cf/10.0)*invIncAngle;
   }
   else if (meta->calibration->type == tsx_cal) { // TerraSAR-X data
 
@@ -867,13 +838,13 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
       invIncAngle = tan(incidence_angle);
 
     double cf = meta->calibration->tsx->k;
-    scaledPower = cf*inDn*inDn*invIncAngle;
+    *gain = cf*invIncAngle;
   }
   else if (meta->calibration->type == r2_cal) { // Radarsat-2 data
     
     if (sample > meta->calibration->r2->num_elements)
       asfPrintError("Calibration not defined for sample (%d)!\n", sample);
-    double a;
+    double a = 1.0;
     if (radiometry == r_BETA || radiometry == r_BETA_DB)
       a = meta->calibration->r2->a_beta[sample];
     else if (radiometry == r_SIGMA || radiometry == r_SIGMA_DB)
@@ -882,9 +853,11 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
       a = meta->calibration->r2->a_gamma[sample];
 
     if (meta->calibration->r2->slc)
-      scaledPower = inDn*inDn/(a*a);
-    else
-      scaledPower = (inDn*inDn + meta->calibration->r2->b)/a;
+      *gain = 1/(a*a);
+    else {
+      *gain = 1/a;
+      *offset = meta->calibration->r2->b/a;
+    }
   }
   else if (meta->calibration->type == uavsar_cal) {
     if (radiometry == r_BETA || radiometry == r_BETA_DB)
@@ -893,11 +866,62 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
       asfPrintError("Calibration currently does not support SIGMA values!\n");
     else
       // Values are already stored as "linear power"
-      scaledPower = inDn;
+      *gain = 1;
   }
   else
     // should never get here
     asfPrintError("Unknown calibration data type!\n");
+}
+
+// UAVSAR data numbers are linear power already; everything else is
+// amplitude, and gets squared.
+static int cal_dn_is_power(meta_parameters *meta)
+{
+  return meta->calibration->type == uavsar_cal;
+}
+
+// Whether the calibration coefficients depend on the incidence angle,
+// for the radiometry in meta.
+static int cal_uses_incid(meta_parameters *meta)
+{
+  radiometry_t radiometry = meta->general->radiometry;
+  int sigma = radiometry == r_SIGMA || radiometry == r_SIGMA_DB;
+  int beta = radiometry == r_BETA || radiometry == r_BETA_DB;
+
+  switch (meta->calibration->type) {
+    case asf_cal:
+    case asf_scansar_cal:
+    case alos_cal:
+      return !sigma;
+    case esa_cal:
+    case rsat_cal:
+    case tsx_cal:
+      return !beta;
+    default:
+      return FALSE;
+  }
+}
+
+/*----------------------------------------------------------------------
+  Get_cal_dn:
+        Convert amplitude image data number into calibrated image data
+        number (in power scale), given the current noise value.
+----------------------------------------------------------------------*/
+float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
+                 float inDn, char *bandExt, int dbFlag)
+{
+  double scaledPower=0, calValue=0, gain, offset;
+
+  if (!meta->calibration) {
+    asfPrintWarning("Called get_cal_dn with no calibration block!\n");
+    return 0;
+  }
+
+  cal_coefficients(meta, incidence_angle, sample, bandExt, &gain, &offset);
+  if (cal_dn_is_power(meta))
+    scaledPower = gain*inDn + offset;
+  else
+    scaledPower = gain*inDn*inDn + offset;
 
   // We don't want to convert the scaled power image into dB values
   // since it messes up the statistics
@@ -929,6 +953,181 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
   return calValue;
 }
 
+/*----------------------------------------------------------------------
+  Line calibration:
+        Calibrate whole lines at a time.  The coefficients get_cal_dn
+        would work out for each pixel are worked out once for a line
+        (once for the whole image, when they don't depend on the
+        incidence angle or the caller supplies fixed incidence angles).
+        Without fixed incidence angles, the coefficients are worked out
+        exactly every CAL_GRID_LINES lines, with meta_incid evaluated
+        every CAL_GRID_SAMPLES samples, and interpolated linearly in
+        between, as incidence angles vary slowly.
+----------------------------------------------------------------------*/
+#define CAL_GRID_LINES 64
+#define CAL_GRID_SAMPLES 16
+
+// Work out the coefficients for one line from the incidence angles
+// in incid (NULL if they aren't needed).
+static void cal_line_coefficients(cal_line_t *self, const float *incid,
+                                  double *gain, double *offset)
+{
+  int ii;
+  for (ii=0; ii<self->sample_count; ii++)
+    cal_coefficients(self->meta, incid ? incid[ii] : 0.0, ii,
+                     self->bandExt, &gain[ii], &offset[ii]);
+}
+
+// Work out the coefficients for grid line, into grid slot.
+static void cal_grid_line(cal_line_t *self, int slot, int line)
+{
+  int ns = self->sample_count;
+  int last = ns - 1;
+  float *incid = MALLOC(sizeof(float)*ns);
+  int ii;
+
+  // meta_incid every CAL_GRID_SAMPLES samples and at the last one,
+  // linear in between.
+  for (ii=0; ii<ns; ii+=CAL_GRID_SAMPLES)
+    incid[ii] = meta_incid(self->meta, line, ii);
+  incid[last] = meta_incid(self->meta, line, last);
+  for (ii=0; ii<last; ii++) {
+    int lo = ii - ii % CAL_GRID_SAMPLES;
+    int hi = lo + CAL_GRID_SAMPLES < last ? lo + CAL_GRID_SAMPLES : last;
+    if (ii != lo)
+      incid[ii] = incid[lo] + (incid[hi] - incid[lo])*(ii - lo)/(hi - lo);
+  }
+
+  cal_line_coefficients(self, incid, self->grid_gain[slot],
+                        self->grid_offset[slot]);
+  self->grid_line[slot] = line;
+  FREE(incid);
+}
+
+cal_line_t *cal_line_new(meta_parameters *meta, const char *bandExt,
+                         int dbFlag)
+{
+  if (!meta->calibration)
+    asfPrintError("Calibration requires a calibration block!\n");
+
+  int ns = meta->general->sample_count;
+  cal_line_t *self = MALLOC(sizeof(cal_line_t));
+  self->meta = meta;
+  self->bandExt = STRDUP(bandExt ? bandExt : "");
+  self->dbFlag = dbFlag;
+  self->sample_count = ns;
+  self->line_count = meta->general->line_count;
+  self->gain = MALLOC(sizeof(double)*ns);
+  self->offset = MALLOC(sizeof(double)*ns);
+  self->grid_gain[0] = self->grid_gain[1] = NULL;
+  self->grid_offset[0] = self->grid_offset[1] = NULL;
+  self->grid_line[0] = self->grid_line[1] = -1;
+  self->line = -1;
+  self->fixed = FALSE;
+
+  if (!cal_uses_incid(meta)) {
+    cal_line_coefficients(self, NULL, self->gain, self->offset);
+    self->fixed = TRUE;
+  }
+  else {
+    int kk;
+    for (kk=0; kk<2; kk++) {
+      self->grid_gain[kk] = MALLOC(sizeof(double)*ns);
+      self->grid_offset[kk] = MALLOC(sizeof(double)*ns);
+    }
+  }
+
+  return self;
+}
+
+void cal_line_set_incid(cal_line_t *self, const float *incid)
+{
+  if (!cal_uses_incid(self->meta))
+    return;
+  cal_line_coefficients(self, incid, self->gain, self->offset);
+  self->fixed = TRUE;
+}
+
+// Bring the coefficients up to date for line.
+static void cal_line_update(cal_line_t *self, int line)
+{
+  if (self->fixed || line == self->line)
+    return;
+
+  int g0 = (line / CAL_GRID_LINES) * CAL_GRID_LINES;
+  int g1 = g0 + CAL_GRID_LINES;
+  if (g1 > self->line_count - 1)
+    g1 = self->line_count - 1;
+  if (g1 < g0)
+    g1 = g0;
+
+  // The grid lines usually move on by one step at a time, so the
+  // upper one can be kept as the new lower one.
+  int kk;
+  if (self->grid_line[0] != g0) {
+    if (self->grid_line[1] == g0) {
+      double *tmp = self->grid_gain[0];
+      self->grid_gain[0] = self->grid_gain[1];
+      self->grid_gain[1] = tmp;
+      tmp = self->grid_offset[0];
+      self->grid_offset[0] = self->grid_offset[1];
+      self->grid_offset[1] = tmp;
+      self->grid_line[0] = g0;
+      self->grid_line[1] = -1;
+    }
+    else
+      cal_grid_line(self, 0, g0);
+  }
+  if (self->grid_line[1] != g1)
+    cal_grid_line(self, 1, g1);
+
+  double t = g1 > g0 ? (double)(line - g0)/(g1 - g0) : 0.0;
+  const double *gain0 = self->grid_gain[0], *gain1 = self->grid_gain[1];
+  const double *offset0 = self->grid_offset[0];
+  const double *offset1 = self->grid_offset[1];
+  for (kk=0; kk<self->sample_count; kk++) {
+    self->gain[kk] = gain0[kk] + (gain1[kk] - gain0[kk])*t;
+    self->offset[kk] = offset0[kk] + (offset1[kk] - offset0[kk])*t;
+  }
+  self->line = line;
+}
+
+void cal_line_apply(cal_line_t *self, int line, float *buf)
+{
+  cal_line_update(self, line);
+
+  const double *gain = self->gain, *offset = self->offset;
+  int ns = self->sample_count;
+  int ii;
+  if (cal_dn_is_power(self->meta)) {
+    for (ii=0; ii<ns; ii++)
+      buf[ii] = gain[ii]*buf[ii] + offset[ii];
+  }
+  else {
+    for (ii=0; ii<ns; ii++)
+      buf[ii] = gain[ii]*buf[ii]*buf[ii] + offset[ii];
+  }
+  if (self->dbFlag) {
+    for (ii=0; ii<ns; ii++)
+      buf[ii] = 10.0 * log10(buf[ii]);
+  }
+}
+
+void cal_line_free(cal_line_t *self)
+{
+  if (self) {
+    int kk;
+    for (kk=0; kk<2; kk++) {
+      FREE(self->grid_gain[kk]);
+      FREE(self->grid_offset[kk]);
+    }
+    FREE(self->gain);
+    FREE(self->offset);
+    FREE(self->bandExt);
+    FREE(self);
+  }
+}
+
 // Determine radiometrically correction amplitude value
 float get_rad_cal_dn(meta_parameters *meta, int line, int sample, char *bandExt,
 		     float inDn, float radCorr)
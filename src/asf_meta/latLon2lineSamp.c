@@ -0,0 +1,235 @@
+/****************************************************************
+FUNCTION NAME:  meta_rd_lineSamp, meta_get_lineSamp_batch
+
+DESCRIPTION:
+   Range-Doppler geolocation in reverse: finds the line and sample
+   of a latitude, longitude and height in a slant or ground range
+   image by solving the Doppler and slant range equations directly
+   against the state vectors, instead of searching with
+   meta_get_latLon.
+
+   The target is put on the same earth meta_get_latLon uses (the
+   WGS84 ellipsoid, grown by the height in both radii).  Then the
+   azimuth time is found by Newton's method on the Doppler equation,
+   and the slant range follows from the satellite position at that
+   time.  Line and sample come from inverting meta_get_time and
+   meta_get_slant.  Each Newton step costs one state vector
+   interpolation, and three or four steps are plenty.
+
+   Only images meta_get_latLon geolocates with state vectors and
+   doppler can be handled this way (meta_uses_range_doppler); the
+   rest still go through meta_get_lineSamp's iterative search.
+****************************************************************/
+#include "asf.h"
+#include "asf_meta.h"
+
+/* Convergence limits.  A microsecond is a small fraction of a line
+   for any sensor. */
+#define RD_TIME_TOL 1.0e-6
+#define RD_SAMPLE_TOL 1.0e-4
+#define RD_DOP_TOL 1.0e-3
+#define RD_MAX_ITER 20
+
+/* Earth model of getLatLongMeta (init_geolocate) */
+#define RD_RE 6378137.0
+#define RD_RP (RD_RE - RD_RE/298.257223563)
+
+/* Gravitational constant times mass of Earth, used to estimate the
+   satellite's acceleration for the Newton step. */
+#define RD_GM 3.986005e14
+
+/*******************************************************************
+ * meta_uses_range_doppler:
+ * TRUE if meta_get_latLon geolocates this image from state vectors,
+ * slant range and doppler, so meta_rd_lineSamp can invert it. */
+int meta_uses_range_doppler(meta_parameters *meta)
+{
+  return !meta->projection && !meta->airsar && !meta->uavsar &&
+    !meta->latlon && !meta->transform && meta->sar &&
+    (meta->sar->image_type=='S' || meta->sar->image_type=='G') &&
+    meta->state_vectors && meta->state_vectors->vector_count >= 2;
+}
+
+/* Earth fixed position of the given geodetic latitude, longitude and
+   height. */
+static vector target_position(double lat, double lon, double elev)
+{
+  double re = RD_RE + elev, rp = RD_RP + elev;
+  double gc = atan2(rp*rp*sin(lat*D2R), re*re*cos(lat*D2R));
+  double c = cos(gc), s = sin(gc);
+  double r = re*rp/sqrt(rp*rp*c*c + re*re*s*s);
+  vector p;
+
+  p.x = r*c*cos(lon*D2R);
+  p.y = r*c*sin(lon*D2R);
+  p.z = r*s;
+  return p;
+}
+
+/* Finds the time, starting from *time, at which the doppler between
+   the satellite and targ is dop, and the slant range then.  Returns
+   nonzero if Newton's method doesn't converge. */
+static int solve_time(meta_parameters *meta, vector targ, double dop,
+                      double *time, double *slant)
+{
+  double half_lambda_dop = 0.5*meta->sar->wavelength*dop;
+  double t = *time;
+  int iter;
+
+  for (iter=0; iter<RD_MAX_ITER; ++iter) {
+    stateVector st = meta_get_stVec(meta, t);
+    vector los, acc;
+    vecSub(targ, st.pos, &los);
+    double r = vecMagnitude(los);
+    double v_los = vecDot(st.vel, los);
+
+    // The doppler is 2 v.los/(lambda r), so solve
+    //   h(t) = v.los - lambda/2 dop r = 0
+    double h = v_los - half_lambda_dop*r;
+
+    acc = st.pos;
+    vecScale(&acc, -RD_GM/pow(vecDot(st.pos, st.pos), 1.5));
+    double dh = vecDot(acc, los) - vecDot(st.vel, st.vel)
+      + half_lambda_dop*v_los/r;
+
+    double dt = -h/dh;
+    t += dt;
+    if (fabs(dt) < RD_TIME_TOL) {
+      st = meta_get_stVec(meta, t);
+      vecSub(targ, st.pos, &los);
+      *time = t;
+      *slant = vecMagnitude(los);
+      return !meta_is_valid_double(t) || !meta_is_valid_double(*slant);
+    }
+  }
+  return 1;
+}
+
+/* meta_get_slant, backwards.  For ground range images the earth
+   radius and satellite height may depend on where we are, so iterate
+   from the sample in *xSamp. */
+static int slant_to_sample(meta_parameters *meta, double yLine,
+                           double slant, double *xSamp)
+{
+  meta_general *mg = meta->general;
+  meta_sar *ms = meta->sar;
+  double r = slant - ms->slant_shift;
+
+  if (ms->image_type == 'S') {
+    *xSamp = (r - ms->slant_range_first_pixel)/mg->x_pixel_size
+      - mg->start_sample;
+    return 0;
+  }
+  else {
+    double x = *xSamp;
+    int iter;
+    for (iter=0; iter<RD_MAX_ITER; ++iter) {
+      double er = meta_get_earth_radius(meta, yLine, x);
+      double ht = meta_get_sat_height(meta, yLine, x);
+      double srfp = ms->slant_range_first_pixel;
+      double minPhi = acos((ht*ht + er*er - srfp*srfp)/(2.0*ht*er));
+      double phi = acos((ht*ht + er*er - r*r)/(2.0*ht*er));
+      double x_new = (phi - minPhi)*er/mg->x_pixel_size - mg->start_sample;
+      if (!meta_is_valid_double(x_new))
+        return 1;
+      if (fabs(x_new - x) < RD_SAMPLE_TOL) {
+        *xSamp = x_new;
+        return 0;
+      }
+      x = x_new;
+    }
+    return 1;
+  }
+}
+
+/*******************************************************************
+ * meta_rd_lineSamp:
+ * Converts the given latitude, longitude and height to line and
+ * sample by solving the range-Doppler equations (see above).  *time
+ * and *xSamp are used as the starting point, and they are updated, so
+ * a caller converting nearby points can pass the last answer along.
+ * Only works when meta_uses_range_doppler is TRUE.  Returns nonzero
+ * on failure. */
+int meta_rd_lineSamp(meta_parameters *meta, double lat, double lon,
+                     double elev, double *time, double *yLine, double *xSamp)
+{
+  vector targ = target_position(lat, lon, elev);
+  double t = *time, x = *xSamp, y, slant, dop = 0.0;
+  int deskewed = meta->sar->deskewed == 1;
+  int iter;
+
+  if (!deskewed)
+    dop = meta_get_dop(meta, (t - meta->sar->time_shift) /
+                       meta->sar->azimuth_time_per_pixel
+                       - meta->general->start_line, x);
+
+  // The doppler of an image that isn't deskewed depends on the line
+  // and sample we're looking for, so go around until it settles.
+  for (iter=0; iter<RD_MAX_ITER; ++iter) {
+    if (solve_time(meta, targ, dop, &t, &slant))
+      return 1;
+    y = (t - meta->sar->time_shift)/meta->sar->azimuth_time_per_pixel
+      - meta->general->start_line;
+    if (slant_to_sample(meta, y, slant, &x))
+      return 1;
+    if (deskewed)
+      break;
+    double new_dop = meta_get_dop(meta, y, x);
+    if (fabs(new_dop - dop) < RD_DOP_TOL)
+      break;
+    dop = new_dop;
+  }
+  if (iter == RD_MAX_ITER)
+    return 1;
+
+  *time = t;
+  *yLine = y;
+  *xSamp = x;
+  return 0;
+}
+
+/*******************************************************************
+ * meta_get_lineSamp_batch:
+ * meta_get_lineSamp for n points at once.  elev can be NULL, for
+ * points on the ellipsoid.  For images meta_rd_lineSamp handles,
+ * each point starts from the answer for the one before, so runs of
+ * neighboring points (rows of a tie point grid, say) converge in a
+ * step or two.  Returns the number of points that could not be
+ * converted; those get the image center, as from meta_get_lineSamp. */
+int meta_get_lineSamp_batch(meta_parameters *meta, int n,
+                            const double *lat, const double *lon,
+                            const double *elev,
+                            double *yLine, double *xSamp)
+{
+  int ii, failed = 0;
+
+  if (meta_uses_range_doppler(meta)) {
+    double x0 = meta->general->sample_count/2;
+    double t0 = meta_get_time(meta, meta->general->line_count/2, x0);
+    double t = t0, x = x0;
+    for (ii=0; ii<n; ++ii) {
+      double h = elev ? elev[ii] : 0.0;
+      if (meta_rd_lineSamp(meta, lat[ii], lon[ii], h, &t, &yLine[ii], &x)) {
+        // bad start, or a hard point: try from the center, then the old way
+        t = t0; x = x0;
+        if (meta_rd_lineSamp(meta, lat[ii], lon[ii], h, &t, &yLine[ii], &x)) {
+          t = t0; x = x0;
+          if (meta_get_lineSamp_iterative(meta, lat[ii], lon[ii], h,
+                                          &yLine[ii], &xSamp[ii]))
+            ++failed;
+          continue;
+        }
+      }
+      xSamp[ii] = x;
+    }
+  }
+  else {
+    for (ii=0; ii<n; ++ii) {
+      if (meta_get_lineSamp(meta, lat[ii], lon[ii], elev ? elev[ii] : 0.0,
+                            &yLine[ii], &xSamp[ii]))
+        ++failed;
+    }
+  }
+
+  return failed;
+}
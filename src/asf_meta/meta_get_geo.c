@@ -14,11 +14,17 @@ PROGRAM HISTORY:
   1.0 - O. Lawlor.  9/10/98.  CEOS Independance.
 ****************************************************************/
 #include <assert.h>
+#include <glib.h>
 #include "asf.h"
 #include "asf_meta.h"
+#include "earthloc.h"
 #include <libasf_proj.h>
 //#include "jpl_proj.h"
 
+#ifndef SQR
+# define SQR(x) ((x)*(x))
+#endif
+
 /*******************************************************************
  * Prototypes                                                     */
 double *get_a_coeffs(meta_parameters *meta);
@@ -252,6 +258,120 @@ int meta_timeSlantDop2latLon(meta_parameters *meta,
                               lat,lon,&ignored);
 }
 
+/*******************************************************************
+ * meta_get_latLon_row:
+ * meta_get_latLon for n samples of one line: xSample = first_sample,
+ * first_sample + sample_step, ...  For slant and ground range images
+ * the satellite position and the geolocation setup only depend on the
+ * line, so they are done once for the whole row instead of once per
+ * sample.  The results are exactly those of meta_get_latLon.  Returns
+ * the number of samples that could not be geolocated. */
+int meta_get_latLon_row(meta_parameters *meta, double yLine,
+                        double first_sample, double sample_step, int n,
+                        double elev, double *lat, double *lon)
+{
+  int ii, failed = 0;
+
+  if (!meta_uses_range_doppler(meta)) {
+    for (ii=0; ii<n; ++ii)
+      if (meta_get_latLon(meta, yLine, first_sample + ii*sample_step, elev,
+                          &lat[ii], &lon[ii]))
+        ++failed;
+    return failed;
+  }
+
+  // Same steps as meta_get_timeSlantDop, meta_timeSlantDop2latLon and
+  // getLatLongMeta, with everything that doesn't depend on the sample
+  // pulled out of the loop.  meta_get_time ignores the sample.
+  meta_general *mg = meta->general;
+  meta_sar *ms = meta->sar;
+  double time = meta_get_time(meta, yLine, first_sample);
+  stateVector stVec = meta_get_stVec(meta, time);
+  fixed2gei(&stVec, 0.0);/*Subtract Earth's spin.*/
+  GEOLOCATE_REC *g = init_geolocate_meta(&stVec, meta);
+  double re = g->re, rp = g->rp;
+  g->re += elev;
+  g->rp += elev;
+
+  // Ground range: when the metadata has the earth radius and satellite
+  // height, meta_get_slant's setup is the same for every sample too.
+  int const_geometry = ms->image_type == 'G' &&
+    meta_is_valid_double(ms->earth_radius) &&
+    meta_is_valid_double(ms->satellite_height);
+  double er = ms->earth_radius, ht = ms->satellite_height;
+  double minPhi = 0, er2ht2 = 0, twoHtEr = 0;
+  if (const_geometry) {
+    minPhi = acos((SQR(ht)+SQR(er)
+      - SQR(ms->slant_range_first_pixel)) / (2.0*ht*er));
+    er2ht2 = SQR(ht)+SQR(er);
+    twoHtEr = 2.0*ht*er;
+  }
+
+  for (ii=0; ii<n; ++ii) {
+    double xSample = first_sample + ii*sample_step;
+    double slant, dop, la, lo, ignored;
+
+    if (const_geometry) {
+      double phi = minPhi +
+        (xSample+mg->start_sample)*(mg->x_pixel_size / er);
+      slant = sqrt(er2ht2-twoHtEr*cos(phi)) + ms->slant_shift;
+    }
+    else
+      slant = meta_get_slant(meta, yLine, xSample);
+    dop = ms->deskewed == 1 ? 0.0 : meta_get_dop(meta, yLine, xSample);
+
+    if (getLoc(g, slant, dop, &la, &lo, &ignored)) {
+      ++failed;
+      continue;
+    }
+    /*Convert longitude to (-pi, pi].*/
+    if (lo < -pi)
+      lo += 2*pi;
+    /*Convert latitude to geodetic, from geocentric.*/
+    la = atan(tan(la)*(g->re/g->rp)*(g->re/g->rp));
+    lon[ii] = lo*R2D;
+    lat[ii] = la*R2D;
+  }
+
+  g->re = re;
+  g->rp = rp;
+  free_geolocate(g);
+  return failed;
+}
+
+/*******************************************************************
+ * meta_get_latLon_batch:
+ * meta_get_latLon for n points.  elev may be NULL (all zero).  Runs of
+ * points on the same line with evenly spaced samples (a line, or a row
+ * of a grid) go through meta_get_latLon_row.  Returns the number of
+ * points that could not be geolocated. */
+int meta_get_latLon_batch(meta_parameters *meta, int n,
+                          const double *yLine, const double *xSample,
+                          const double *elev, double *lat, double *lon)
+{
+  int ii = 0, failed = 0;
+
+  while (ii < n) {
+    double h = elev ? elev[ii] : 0.0;
+    int jj = ii + 1;
+    if (jj < n) {
+      double step = xSample[jj] - xSample[ii];
+      while (jj < n && yLine[jj] == yLine[ii] &&
+             (elev ? elev[jj] : 0.0) == h &&
+             xSample[jj] == xSample[ii] + (jj-ii)*step)
+        ++jj;
+      failed += meta_get_latLon_row(meta, yLine[ii], xSample[ii], step,
+                                    jj-ii, h, &lat[ii], &lon[ii]);
+    }
+    else if (meta_get_latLon(meta, yLine[ii], xSample[ii], h,
+                             &lat[ii], &lon[ii]))
+      ++failed;
+    ii = jj;
+  }
+
+  return failed;
+}
+
 /*******************************************************************
  * meta_get_timeSlantDop:
  * Converts a given line and sample in image into time, slant-range,
@@ -403,6 +523,8 @@ static int meta_get_lineSamp_imp(meta_parameters *meta,
   return 0;
 }
 
+G_LOCK_DEFINE_STATIC(reverse_transform_choice);
+
 static double tolerance = 0.2;
 void meta_set_lineSamp_tolerance(double tol)
 {
@@ -448,6 +570,11 @@ int meta_get_lineSamp(meta_parameters *meta,
 
   if (meta->transform) {
 
+    // The choice of whether to use the reverse transform is made the
+    // first time through, and stored in the metadata.  Make sure only
+    // one thread does that.
+    G_LOCK(reverse_transform_choice);
+
     if (meta->transform->use_reverse_transform == MAGIC_UNSET_INT) {
       double *a = get_a_coeffs(meta);
       double *b = get_b_coeffs(meta);
@@ -472,6 +599,8 @@ int meta_get_lineSamp(meta_parameters *meta,
       meta->transform->use_reverse_transform = FALSE;
     }
 
+    G_UNLOCK(reverse_transform_choice);
+
     if (meta->transform->use_reverse_transform) {
       double *a = get_a_coeffs(meta); // Usually meta->transform->map2ls_a;
       double *b = get_b_coeffs(meta); // Usually meta->transform->map2ls_b;
@@ -691,7 +820,31 @@ int meta_get_lineSamp(meta_parameters *meta,
     }
   }
 
+  // Slant and ground range images: solve the range-doppler equations
+  if (meta_uses_range_doppler(meta)) {
+    double x = meta->general->sample_count/2;
+    double t = meta_get_time(meta, meta->general->line_count/2, x);
+    double y;
+    if (meta_rd_lineSamp(meta, lat, lon, elev, &t, &y, &x) == 0) {
+      *yLine = y;
+      *xSamp = x;
+      return 0;
+    }
+  }
+
   // no shortcuts -- use the iterative method
+  return meta_get_lineSamp_iterative(meta, lat, lon, elev, yLine, xSamp);
+}
+
+/******************************************************************
+ * meta_get_lineSamp_iterative:
+ * The general (and slow) way for meta_get_lineSamp: searches for the
+ * line and sample using meta_get_latLon.  Works for any image that
+ * meta_get_latLon works for. */
+int meta_get_lineSamp_iterative(meta_parameters *meta,
+                                double lat, double lon, double elev,
+                                double *yLine, double *xSamp)
+{
   double tol_incr = tolerance;
   double x0, y0, tol = tolerance;
   int err,num_iter = 0;
@@ -1,5 +1,6 @@
 #include "CUnit/Basic.h"
 #include "asf_meta.h"
+#include <glib.h>
 
 static int within_tol(double a, double b, double tol)
 {
@@ -146,15 +147,106 @@ static void smap_test(const char *filename)
 	meta_free(meta);
 }
 
+// meta_get_latLon_row has to give exactly what meta_get_latLon does
+static void row_test(const char *filename)
+{
+  meta_parameters *meta = meta_read(filename);
+  int nl = meta->general->line_count;
+  int ns = meta->general->sample_count;
+  int ii, jj;
+  double *lat = MALLOC(sizeof(double)*ns*2);
+  double *lon = MALLOC(sizeof(double)*ns*2);
+
+  for (ii=0; ii<nl; ii+=nl/4+1) {
+    CU_ASSERT(meta_get_latLon_row(meta, ii, 0, .5, ns*2, 100, lat, lon) == 0);
+    for (jj=0; jj<ns*2; ++jj) {
+      double lat1, lon1;
+      meta_get_latLon(meta, ii, jj*.5, 100, &lat1, &lon1);
+      CU_ASSERT(lat[jj] == lat1 && lon[jj] == lon1);
+    }
+  }
+
+  FREE(lat);
+  FREE(lon);
+  meta_free(meta);
+}
+
 void test_meta_get_latLon()
 {
   corner_test("test_input/ers1.meta");
   corner_test("test_input/palsar_fbd.meta");
   smap_test("test_input/smap.meta");
+  row_test("test_input/ers1.meta");
+  row_test("test_input/palsar_fbd.meta");
 }
 
 
+// Round trip a grid of points (with some height) through meta_get_latLon
+// and back, one at a time, as a batch, and the old iterative way.
+static void grid_test(const char *filename)
+{
+  meta_parameters *meta = meta_read(filename);
+  int nl = meta->general->line_count;
+  int ns = meta->general->sample_count;
+  int n = 0, ii, jj, rep;
+  const int N = 20;
+  double *lat = MALLOC(sizeof(double)*N*N);
+  double *lon = MALLOC(sizeof(double)*N*N);
+  double *elev = MALLOC(sizeof(double)*N*N);
+  double *line = MALLOC(sizeof(double)*N*N);
+  double *samp = MALLOC(sizeof(double)*N*N);
+
+  CU_ASSERT(meta_uses_range_doppler(meta));
+
+  for (ii=0; ii<N; ++ii) {
+    for (jj=0; jj<N; ++jj) {
+      double y = (double)ii*nl/(N-1), x = (double)jj*ns/(N-1);
+      double line1, samp1, line2, samp2;
+      elev[n] = (ii*jj)%5 * 400;
+      meta_get_latLon(meta, y, x, elev[n], &lat[n], &lon[n]);
+
+      CU_ASSERT(meta_get_lineSamp(meta, lat[n], lon[n], elev[n],
+                                  &line1, &samp1) == 0);
+      CU_ASSERT(fabs(line1-y) < .01 && fabs(samp1-x) < .01);
+
+      CU_ASSERT(meta_get_lineSamp_iterative(meta, lat[n], lon[n], elev[n],
+                                            &line2, &samp2) == 0);
+      CU_ASSERT(fabs(line2-y) < .5 && fabs(samp2-x) < .5);
+
+      if (fabs(line1-y) >= .01 || fabs(samp1-x) >= .01)
+        printf("(%g,%g) -> (%g,%g) -> (%g,%g)\n",
+               y, x, lat[n], lon[n], line1, samp1);
+      ++n;
+    }
+  }
+
+  CU_ASSERT(meta_get_lineSamp_batch(meta, n, lat, lon, elev, line, samp) == 0);
+  for (ii=0; ii<n; ++ii) {
+    double line1, samp1;
+    meta_get_lineSamp(meta, lat[ii], lon[ii], elev[ii], &line1, &samp1);
+    CU_ASSERT(fabs(line[ii]-line1) < .001 && fabs(samp[ii]-samp1) < .001);
+  }
+
+  // not a pass/fail thing, just to see how we're doing
+  GTimer *timer = g_timer_new();
+  for (rep=0; rep<20; ++rep)
+    meta_get_lineSamp_batch(meta, n, lat, lon, elev, line, samp);
+  double t_batch = g_timer_elapsed(timer, NULL);
+  g_timer_start(timer);
+  for (ii=0; ii<n; ++ii)
+    meta_get_lineSamp_iterative(meta, lat[ii], lon[ii], elev[ii],
+                                &line[ii], &samp[ii]);
+  double t_iter = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+  printf("\n%s: %.0f points/s (batch), %.0f points/s (iterative)\n",
+         filename, 20*n/t_batch, n/t_iter);
+
+  FREE(lat); FREE(lon); FREE(elev); FREE(line); FREE(samp);
+  meta_free(meta);
+}
+
 void test_meta_get_lineSamp()
 {
+  grid_test("test_input/ers1.meta");
 }
 
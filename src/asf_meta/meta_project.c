@@ -4,8 +4,8 @@
 #include "meta_init_stVec.h"
 #include "spheroids.h"
 #include "libasf_proj.h"
-#include "matrix.h"
 #include <assert.h>
+#include <glib.h>
 
 #define SQR(A) ((A)*(A))
 #define ecc2(minor,major) (1.0 - ((minor*minor)/(major*major)))
@@ -84,6 +84,114 @@ void rotate_y(vector *v,double theta)
   v->x = xNew; v->z = zNew;
 }
 
+// Transformation from the radar coordinates of a peg point system
+// (AirSAR and UAVSAR) to earth centered cartesian coordinates.
+typedef struct {
+    // Peg point these were computed for [degrees].
+    double lat_peg_point, lon_peg_point, head_peg_point;
+    double m[3][3];
+    double ra, o1, o2, o3;
+} peg_transform_t;
+
+static const double peg_a = 6378137.0;            // semi-major axis
+static const double peg_b = 6356752.3412;         // semi-minor axis
+static const double peg_e2 = 0.00669437999014;    // ellipticity
+static const double peg_e12 = 0.00673949674228;   // second eccentricity
+
+static void peg_transform_compute(peg_transform_t *t, double lat_peg_point,
+                                  double lon_peg_point, double head_peg_point)
+{
+    const double a = peg_a;
+    const double e2 = peg_e2;
+
+    t->lat_peg_point = lat_peg_point;
+    t->lon_peg_point = lon_peg_point;
+    t->head_peg_point = head_peg_point;
+
+    double lat_peg = lat_peg_point*D2R;
+    double lon_peg = lon_peg_point*D2R;
+    double head_peg = head_peg_point*D2R;
+    double re = a / sqrt(1-e2*sin(lat_peg)*sin(lat_peg));
+    double rn = (a*(1-e2)) / pow(1-e2*sin(lat_peg)*sin(lat_peg), 1.5);
+    t->ra = (re*rn) / (re*cos(head_peg)*cos(head_peg)+rn*sin(head_peg)*sin(head_peg));
+
+    double m1[3][3], m2[3][3];
+
+    m1[0][0] = -sin(lon_peg);
+    m1[0][1] = -sin(lat_peg)*cos(lon_peg);
+    m1[0][2] = cos(lat_peg)*cos(lon_peg);
+    m1[1][0] = cos(lon_peg);
+    m1[1][1] = -sin(lat_peg)*sin(lon_peg);
+    m1[1][2] = cos(lat_peg)*sin(lon_peg);
+    m1[2][0] = 0.0;
+    m1[2][1] = cos(lat_peg);
+    m1[2][2] = sin(lat_peg);
+
+    m2[0][0] = 0.0;
+    m2[0][1] = sin(head_peg);
+    m2[0][2] = -cos(head_peg);
+    m2[1][0] = 0.0;
+    m2[1][1] = cos(head_peg);
+    m2[1][2] = sin(head_peg);
+    m2[2][0] = 1.0;
+    m2[2][1] = 0.0;
+    m2[2][2] = 0.0;
+
+    t->o1 = re*cos(lat_peg)*cos(lon_peg)-t->ra*cos(lat_peg)*cos(lon_peg);
+    t->o2 = re*cos(lat_peg)*sin(lon_peg)-t->ra*cos(lat_peg)*sin(lon_peg);
+    t->o3 = re*(1-e2)*sin(lat_peg)-t->ra*sin(lat_peg);
+
+    int i, j, k;
+    for (i=0; i<3; ++i) {
+        for (j=0; j<3; ++j) {
+            t->m[i][j] = 0.0;
+            for (k=0; k<3; ++k)
+                t->m[i][j] += m1[i][k]*m2[k][j];
+        }
+    }
+}
+
+// Convert radar coordinates (cross track c_lat, along track s_lon, and
+// height) to geographic coordinates.
+static void peg_transform_to_latlon(const peg_transform_t *t,
+                                    double c_lat, double s_lon, double height,
+                                    double *lat, double *lon)
+{
+    const double a = peg_a;
+    const double b = peg_b;
+    const double e2 = peg_e2;
+    const double e12 = peg_e12;
+    double ra = t->ra;
+
+    // radar coordinates in WGS84
+    double t1 = (ra+height)*cos(c_lat)*cos(s_lon);
+    double t2 = (ra+height)*cos(c_lat)*sin(s_lon);
+    double t3 = (ra+height)*sin(c_lat);
+
+    double c1 = t->m[0][0]*t1 + t->m[0][1]*t2 + t->m[0][2]*t3;
+    double c2 = t->m[1][0]*t1 + t->m[1][1]*t2 + t->m[1][2]*t3;
+    double c3 = t->m[2][0]*t1 + t->m[2][1]*t2 + t->m[2][2]*t3;
+
+    // shift into local Cartesian coordinates
+    double x = c1 + t->o1;// + 9.0;
+    double y = c2 + t->o2;// - 161.0;
+    double z = c3 + t->o3;// - 179.0;
+
+    // local Cartesian coordinates into geographic coordinates
+    double d = sqrt(x*x+y*y);
+    double theta = atan2(z*a, d*b);
+    *lat = R2D*atan2(z+e12*b*sin(theta)*sin(theta)*sin(theta),
+                     d-e2*a*cos(theta)*cos(theta)*cos(theta));
+    *lon = R2D*atan2(y, x);
+}
+
+// We cache the transformation parameters for the last peg point seen,
+// since they are the same for every pixel of an image.  The caches
+// are shared by all threads, so are protected by these locks; callers
+// take a copy to work with.
+G_LOCK_DEFINE_STATIC(airsar_peg_transform);
+G_LOCK_DEFINE_STATIC(uavsar_peg_transform);
+
 void airsar_to_latlon(meta_parameters *meta,
                       double xSample, double yLine, double height,
                       double *lat, double *lon)
@@ -91,83 +199,26 @@ void airsar_to_latlon(meta_parameters *meta,
     if (!meta->airsar)
         asfPrintError("airsar_to_latlon() called with no airsar block!\n");
 
-    const double a = 6378137.0;           // semi-major axis
-    const double b = 6356752.3412;          // semi-minor axis
-    const double e2 = 0.00669437999014;   // ellipticity
-    const double e12 = 0.00673949674228;  // second eccentricity
-
-    // we try to cache the matrices needed for the computation
-    // this makes sure we don't reuse the cache incorrectly (i.e., on
-    // data (=> an airsar block) which doesn't match what we cached for)
-    static meta_airsar *cached_airsar_block = NULL;
-
-    // these are the cached transformation parameters
-    static matrix *m = NULL;
-    static double ra=-999, o1=-999, o2=-999, o3=-999;
-
-    if (!m)
-        m = matrix_alloc(3,3); // only needs to be done once
+    static peg_transform_t cached;
+    static int have_cached = FALSE;
+    peg_transform_t t;
 
     // if we aren't calculating with the exact same airsar block, we
     // need to recalculate the transformation block
-    int recalc = !cached_airsar_block ||
-        cached_airsar_block->lat_peg_point != meta->airsar->lat_peg_point ||
-        cached_airsar_block->lon_peg_point != meta->airsar->lon_peg_point ||
-        cached_airsar_block->head_peg_point != meta->airsar->head_peg_point;
-
-    if (recalc) {
-        // cache airsar block, so we can be sure we're not reusing
-        // the stored data incorrectly
-        if (cached_airsar_block)
-            free(cached_airsar_block);
-        cached_airsar_block = meta_airsar_init();
-        *cached_airsar_block = *(meta->airsar);
-
+    G_LOCK(airsar_peg_transform);
+    if (!have_cached ||
+        cached.lat_peg_point != meta->airsar->lat_peg_point ||
+        cached.lon_peg_point != meta->airsar->lon_peg_point ||
+        cached.head_peg_point != meta->airsar->head_peg_point)
+    {
         asfPrintStatus("Calculating airsar transformation parameters...\n");
-
-        // now precalculate data
-        double lat_peg = meta->airsar->lat_peg_point*D2R;
-        double lon_peg = meta->airsar->lon_peg_point*D2R;
-        double head_peg = meta->airsar->head_peg_point*D2R;
-        double re = a / sqrt(1-e2*sin(lat_peg)*sin(lat_peg));
-        double rn = (a*(1-e2)) / pow(1-e2*sin(lat_peg)*sin(lat_peg), 1.5);
-        ra = (re*rn) / (re*cos(head_peg)*cos(head_peg)+rn*sin(head_peg)*sin(head_peg));
-
-        matrix *m1, *m2;
-        m1 = matrix_alloc(3,3);
-        m2 = matrix_alloc(3,3);
-
-        m1->coeff[0][0] = -sin(lon_peg);
-        m1->coeff[0][1] = -sin(lat_peg)*cos(lon_peg);
-        m1->coeff[0][2] = cos(lat_peg)*cos(lon_peg);
-        m1->coeff[1][0] = cos(lon_peg);
-        m1->coeff[1][1] = -sin(lat_peg)*sin(lon_peg);
-        m1->coeff[1][2] = cos(lat_peg)*sin(lon_peg);
-        m1->coeff[2][0] = 0.0;
-        m1->coeff[2][1] = cos(lat_peg);
-        m1->coeff[2][2] = sin(lat_peg);
-
-        m2->coeff[0][0] = 0.0;
-        m2->coeff[0][1] = sin(head_peg);
-        m2->coeff[0][2] = -cos(head_peg);
-        m2->coeff[1][0] = 0.0;
-        m2->coeff[1][1] = cos(head_peg);
-        m2->coeff[1][2] = sin(head_peg);
-        m2->coeff[2][0] = 1.0;
-        m2->coeff[2][1] = 0.0;
-        m2->coeff[2][2] = 0.0;
-
-        o1 = re*cos(lat_peg)*cos(lon_peg)-ra*cos(lat_peg)*cos(lon_peg);
-        o2 = re*cos(lat_peg)*sin(lon_peg)-ra*cos(lat_peg)*sin(lon_peg);
-        o3 = re*(1-e2)*sin(lat_peg)-ra*sin(lat_peg);
-
-        matrix_mult(m,m1,m2);
-        matrix_free(m1);
-        matrix_free(m2);
+        peg_transform_compute(&cached, meta->airsar->lat_peg_point,
+                              meta->airsar->lon_peg_point,
+                              meta->airsar->head_peg_point);
+        have_cached = TRUE;
     }
-
-    // Make sure we didn't miss anything
-    assert(ra != -999 && o1 != -999 && o2 != -999 && o3 != -999);
+    t = cached;
+    G_UNLOCK(airsar_peg_transform);
 
     //------------------------------------------------------------------
     // Now the actual computation, using the cached matrix etc
@@ -179,31 +230,12 @@ void airsar_to_latlon(meta_parameters *meta,
     double xpix = meta->general->x_pixel_size/meta->general->sample_scaling;
 
     // radar coordinates
-    double c_lat = (xSample*xpix+c0)/ra;
-    double s_lon = (yLine*ypix+s0)/ra;
+    double c_lat = (xSample*xpix+c0)/t.ra;
+    double s_lon = (yLine*ypix+s0)/t.ra;
 
     //height += meta->airsar->gps_altitude;
 
-    // radar coordinates in WGS84
-    double t1 = (ra+height)*cos(c_lat)*cos(s_lon);
-    double t2 = (ra+height)*cos(c_lat)*sin(s_lon);
-    double t3 = (ra+height)*sin(c_lat);
-
-    double c1 = m->coeff[0][0]*t1 + m->coeff[0][1]*t2 + m->coeff[0][2]*t3;
-    double c2 = m->coeff[1][0]*t1 + m->coeff[1][1]*t2 + m->coeff[1][2]*t3;
-    double c3 = m->coeff[2][0]*t1 + m->coeff[2][1]*t2 + m->coeff[2][2]*t3;
-
-    // shift into local Cartesian coordinates
-    double x = c1 + o1;// + 9.0;
-    double y = c2 + o2;// - 161.0;
-    double z = c3 + o3;// - 179.0;
-
-    // local Cartesian coordinates into geographic coordinates
-    double d = sqrt(x*x+y*y);
-    double theta = atan2(z*a, d*b);
-    *lat = R2D*atan2(z+e12*b*sin(theta)*sin(theta)*sin(theta),
-                     d-e2*a*cos(theta)*cos(theta)*cos(theta));
-    *lon = R2D*atan2(y, x);
+    peg_transform_to_latlon(&t, c_lat, s_lon, height, lat, lon);
 }
 
 void uavsar_to_latlon(meta_parameters *meta,
@@ -213,81 +245,25 @@ void uavsar_to_latlon(meta_parameters *meta,
     if (!meta->uavsar)
         asfPrintError("uavsar_to_latlon() called with no uavsar block!\n");
 
-    const double a = 6378137.0;           // semi-major axis
-    const double b = 6356752.3412;          // semi-minor axis
-    const double e2 = 0.00669437999014;   // ellipticity
-    const double e12 = 0.00673949674228;  // second eccentricity
-
-    // we try to cache the matrices needed for the computation
-    // this makes sure we don't reuse the cache incorrectly (i.e., on
-    // data (=> an uavsar block) which doesn't match what we cached for)
-    static meta_uavsar *cached_uavsar_block = NULL;
-
-    // these are the cached transformation parameters
-    static matrix *m = NULL;
-    static double ra=-999, o1=-999, o2=-999, o3=-999;
+    static peg_transform_t cached;
+    static int have_cached = FALSE;
+    peg_transform_t t;
 
-    if (!m)
-        m = matrix_alloc(3,3); // only needs to be done once
-
-    // if we aren't calculating with the exact same airsar block, we
+    // if we aren't calculating with the exact same uavsar block, we
     // need to recalculate the transformation block
-    int recalc = !cached_uavsar_block ||
-        cached_uavsar_block->lat_peg_point != meta->uavsar->lat_peg_point ||
-        cached_uavsar_block->lon_peg_point != meta->uavsar->lon_peg_point ||
-        cached_uavsar_block->head_peg_point != meta->uavsar->head_peg_point;
-
-    if (recalc) {
-        // cache airsar block, so we can be sure we're not reusing
-        // the stored data incorrectly
-        if (cached_uavsar_block)
-            free(cached_uavsar_block);
-        cached_uavsar_block = meta_uavsar_init();
-        *cached_uavsar_block = *(meta->uavsar);
-
-        // now precalculate data
-        double lat_peg = meta->uavsar->lat_peg_point*D2R;
-        double lon_peg = meta->uavsar->lon_peg_point*D2R;
-        double head_peg = meta->uavsar->head_peg_point*D2R;
-        double re = a / sqrt(1-e2*sin(lat_peg)*sin(lat_peg));
-        double rn = (a*(1-e2)) / pow(1-e2*sin(lat_peg)*sin(lat_peg), 1.5);
-        ra = (re*rn) / (re*cos(head_peg)*cos(head_peg)+rn*sin(head_peg)*sin(head_peg));
-
-        matrix *m1, *m2;
-        m1 = matrix_alloc(3,3);
-        m2 = matrix_alloc(3,3);
-
-        m1->coeff[0][0] = -sin(lon_peg);
-        m1->coeff[0][1] = -sin(lat_peg)*cos(lon_peg);
-        m1->coeff[0][2] = cos(lat_peg)*cos(lon_peg);
-        m1->coeff[1][0] = cos(lon_peg);
-        m1->coeff[1][1] = -sin(lat_peg)*sin(lon_peg);
-        m1->coeff[1][2] = cos(lat_peg)*sin(lon_peg);
-        m1->coeff[2][0] = 0.0;
-        m1->coeff[2][1] = cos(lat_peg);
-        m1->coeff[2][2] = sin(lat_peg);
-
-        m2->coeff[0][0] = 0.0;
-        m2->coeff[0][1] = sin(head_peg);
-        m2->coeff[0][2] = -cos(head_peg);
-        m2->coeff[1][0] = 0.0;
-        m2->coeff[1][1] = cos(head_peg);
-        m2->coeff[1][2] = sin(head_peg);
-        m2->coeff[2][0] = 1.0;
-        m2->coeff[2][1] = 0.0;
-        m2->coeff[2][2] = 0.0;
-
-        o1 = re*cos(lat_peg)*cos(lon_peg)-ra*cos(lat_peg)*cos(lon_peg);
-        o2 = re*cos(lat_peg)*sin(lon_peg)-ra*cos(lat_peg)*sin(lon_peg);
-        o3 = re*(1-e2)*sin(lat_peg)-ra*sin(lat_peg);
-
-        matrix_mult(m,m1,m2);
-        matrix_free(m1);
-        matrix_free(m2);
+    G_LOCK(uavsar_peg_transform);
+    if (!have_cached ||
+        cached.lat_peg_point != meta->uavsar->lat_peg_point ||
+        cached.lon_peg_point != meta->uavsar->lon_peg_point ||
+        cached.head_peg_point != meta->uavsar->head_peg_point)
+    {
+        peg_transform_compute(&cached, meta->uavsar->lat_peg_point,
+                              meta->uavsar->lon_peg_point,
+                              meta->uavsar->head_peg_point);
+        have_cached = TRUE;
     }
-
-    // Make sure we didn't miss anything
-    assert(ra != -999 && o1 != -999 && o2 != -999 && o3 != -999);
+    t = cached;
+    G_UNLOCK(uavsar_peg_transform);
 
     //------------------------------------------------------------------
     // Now the actual computation, using the cached matrix etc
@@ -299,31 +275,10 @@ void uavsar_to_latlon(meta_parameters *meta,
     double xpix = meta->general->x_pixel_size/meta->general->sample_scaling;
 
     // radar coordinates
-    double c_lat = (xSample*xpix+c0)/ra;
-    double s_lon = (yLine*ypix+s0)/ra;
+    double c_lat = (xSample*xpix+c0)/t.ra;
+    double s_lon = (yLine*ypix+s0)/t.ra;
 
-    //height += meta->airsar->gps_altitude;
-
-    // radar coordinates in WGS84
-    double t1 = (ra+height)*cos(c_lat)*cos(s_lon);
-    double t2 = (ra+height)*cos(c_lat)*sin(s_lon);
-    double t3 = (ra+height)*sin(c_lat);
-
-    double c1 = m->coeff[0][0]*t1 + m->coeff[0][1]*t2 + m->coeff[0][2]*t3;
-    double c2 = m->coeff[1][0]*t1 + m->coeff[1][1]*t2 + m->coeff[1][2]*t3;
-    double c3 = m->coeff[2][0]*t1 + m->coeff[2][1]*t2 + m->coeff[2][2]*t3;
-
-    // shift into local Cartesian coordinates
-    double x = c1 + o1;// + 9.0;
-    double y = c2 + o2;// - 161.0;
-    double z = c3 + o3;// - 179.0;
-
-    // local Cartesian coordinates into geographic coordinates
-    double d = sqrt(x*x+y*y);
-    double theta = atan2(z*a, d*b);
-    *lat = R2D*atan2(z+e12*b*sin(theta)*sin(theta)*sin(theta),
-                     d-e2*a*cos(theta)*cos(theta)*cos(theta));
-    *lon = R2D*atan2(y, x);
+    peg_transform_to_latlon(&t, c_lat, s_lon, height, lat, lon);
 }
 
 void alos_to_latlon(meta_parameters *meta,
@@ -121,12 +121,13 @@ func (double t, const double y[], double f[], void *params)
   static const double gm = EARTH_GRAVITATIONAL_CONSTANT;
   static const double ae = EARTH_SEMIMAJOR_AXIS;
 
-  /* Create position and velocity vectors.  We use static vectors to
-     avoid allocation overhead.  */
-  static Vector p_st;
-  static Vector v_st;
-  static Vector *p = &p_st;
-  static Vector *v = &v_st;
+  /* Create position and velocity vectors.  We use automatic vectors
+     to avoid allocation overhead, and so that several threads can
+     propagate orbits at once.  */
+  Vector p_st;
+  Vector v_st;
+  Vector *p = &p_st;
+  Vector *v = &v_st;
 
   double r;
   double j2;
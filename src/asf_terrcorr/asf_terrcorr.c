@@ -10,7 +10,7 @@
 "          [-no-match] [-grid-match] [-offsets <range> <azimuth>]\n"\
 "          [-use-zero-offsets-if-match-fails] [-save-ground-range-dem]\n"\
 "          [-save-incidence-angles] [-use-nearest-neighbor]\n"\
-"          [-use-bilinear]\n"\
+"          [-use-bilinear] [-memory-budget <megabytes>]\n"\
 "          <in_base_name> <dem_base_name> <out_base_name>\n"
 
 #define ASF_DESCRIPTION_STRING \
@@ -225,6 +225,12 @@
 "          of the original radiometric charactaristics, using bilinear\n"\
 "          results in a smoother image.  Default is bilinear.\n"\
 "\n"\
+"     -memory-budget <megabytes>\n"\
+"          The intermediate images of the terrain correction step are\n"\
+"          passed along in memory, instead of through temporary files, when\n"\
+"          they fit in this much memory.  Default is a quarter of the\n"\
+"          physical memory.  Specify 0 to always use temporary files.\n"\
+"\n"\
 "     -log <log file>\n"\
 "          Output will be written to a specified log file.\n"\
 "\n"\
@@ -486,6 +492,11 @@ main (int argc, char *argv[])
     else if (strmatches(key,"-use-bilinear","--use-bilinear",NULL)) {
       use_nearest_neighbor = FALSE;
     }
+    else if (strmatches(key,"-memory-budget","--memory-budget",NULL)) {
+      CHECK_ARG(1);
+      double mb = atof(GET_ARG(1));
+      asf_terrcorr_set_memory_budget(mb > 0 ? (long long)(mb*1048576) : -1);
+    }
     else if (strmatches(key,"-help","--help",NULL)) {
         print_help(); // doesn't return
     }
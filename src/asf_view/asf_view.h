@@ -252,6 +252,7 @@ int open_seasat_h5_data(const char *filename,
                         meta_parameters *meta, ClientInterface *client);
 /* big_image.c */
 GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair);
+void refresh_big_image(void *data);
 void fill_big(ImageInfo *ii);
 void update_zoom(void);
 int get_big_image_width_full(void);
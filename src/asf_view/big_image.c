@@ -744,7 +744,16 @@ static void add_north_arrow(GdkPixbuf *pb, ImageInfo *ii)
   put_line(pb, y0, x0, y1, x1, GREEN, ii);
 }
 
-GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
+// Set when the last image drawn on the screen used lower resolution
+// data, for want of tiles that weren't in the cache yet
+static int big_image_incomplete = FALSE;
+
+// Draws the big image.  "wait" is FALSE when drawing to the screen: we
+// don't wait for parts of the image that aren't in the cache, but draw
+// them from a lower resolution level of the pyramid (if there is one),
+// and draw them again when they've been read (see refresh_big_image).
+static GdkPixbuf * make_big_image_ext(ImageInfo *ii, int show_crosshair,
+                                      int wait)
 {
     assert(ii->data_ci);
     assert(ii->meta);
@@ -767,7 +776,23 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
     }
 
     if (!mask) {
+        // zoomed out, draw from the level of the pyramid that matches
+        // the zoom (if it's been built) -- not when using a look up
+        // table, though, averaged values wouldn't mean anything
+        int level = have_lut() ? 0 :
+            cached_image_pyramid_level(ii->data_ci, zoom);
+        int complete = TRUE;
         int mm = 0;
+
+        // start reading what's on the screen (and around it)
+        if (!wait) {
+            double l0, l1, s0;
+            img2ls(0, 0, &l0, &s0);
+            img2ls(0, bih-1, &l1, &s0);
+            cached_image_prefetch(ii->data_ci, level, (int)floor(l0),
+                                  (int)ceil(l1));
+        }
+
         for (i=0; i<bih; ++i) {
             for (j=0; j<biw; ++j) {
                 double l, s;
@@ -783,10 +808,17 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
                 else {
                     // here we have some averaging, that will make the
                     // images look a bit smoother when zoomed out
-                    if (zoom<2) {
-                        // one-to-one (or thereabouts) view -- no averaging
-                        cached_image_get_rgb(ii->data_ci, (int)floor(l),
-                            (int)floor(s), &r, &g, &b);
+                    if (level > 0 || zoom<2) {
+                        // one-to-one (or thereabouts) view of the image,
+                        // or of the pyramid level that matches the zoom
+                        // (which is already averaged) -- no averaging
+                        if (wait)
+                            cached_image_get_rgb_level(ii->data_ci, level,
+                                (int)floor(l), (int)floor(s), &r, &g, &b);
+                        else if (!cached_image_get_rgb_nowait(ii->data_ci,
+                                level, (int)floor(l), (int)floor(s),
+                                &r, &g, &b))
+                            complete = FALSE;
                     }
                     else if (zoom<3) {
                         // 2x view -- average 4 pixels to produce 1.
@@ -848,6 +880,8 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
                 ++mm;
             }
         }
+        if (!wait && !complete)
+            big_image_incomplete = TRUE;
     }
     else { // mask applied
         // this code is largely the same as above except we need to
@@ -1014,19 +1048,33 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
     return pb;
 }
 
+GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
+{
+    return make_big_image_ext(ii, show_crosshair, TRUE);
+}
+
+// Called when the cache has read in tiles in the background: if we drew
+// without them, it's time to draw again
+void refresh_big_image(void *data)
+{
+    if (big_image_incomplete)
+        fill_big(curr);
+}
+
 void fill_big(ImageInfo *ii)
 {
     GdkPixbuf *pb = NULL;
+    big_image_incomplete = FALSE;
     if (subimages == 1) {
         // never show the crosshair for the planner -- not needed any longer
-        pb = make_big_image(ii, !planner_is_active());
+        pb = make_big_image_ext(ii, !planner_is_active(), FALSE);
     }
     else if (subimages == 2) {
         int next_image_info_index = (current_image_info_index + 1) % n_images_loaded;
         ImageInfo *ii1 = &image_info[next_image_info_index];
 
-        GdkPixbuf *pb1 = make_big_image(ii, !planner_is_active());
-        GdkPixbuf *pb2 = make_big_image(ii1, !planner_is_active());
+        GdkPixbuf *pb1 = make_big_image_ext(ii, !planner_is_active(), FALSE);
+        GdkPixbuf *pb2 = make_big_image_ext(ii1, !planner_is_active(), FALSE);
 
         int w = get_big_image_width_sub();
         int h = get_big_image_height_sub();
@@ -1049,10 +1097,10 @@ void fill_big(ImageInfo *ii)
         ImageInfo *ii2 = &image_info[ind2];
         ImageInfo *ii3 = &image_info[ind3];
 
-        GdkPixbuf *pb0 = make_big_image(ii, !planner_is_active());
-        GdkPixbuf *pb1 = make_big_image(ii1, !planner_is_active());
-        GdkPixbuf *pb2 = make_big_image(ii2, !planner_is_active());
-        GdkPixbuf *pb3 = make_big_image(ii3, !planner_is_active());
+        GdkPixbuf *pb0 = make_big_image_ext(ii, !planner_is_active(), FALSE);
+        GdkPixbuf *pb1 = make_big_image_ext(ii1, !planner_is_active(), FALSE);
+        GdkPixbuf *pb2 = make_big_image_ext(ii2, !planner_is_active(), FALSE);
+        GdkPixbuf *pb3 = make_big_image_ext(ii3, !planner_is_active(), FALSE);
 
         int w = get_big_image_width_sub();
         int h = get_big_image_height_sub();
@@ -75,57 +75,34 @@ static void print_cache_size(CachedImage *self)
         (float)size/1024./1024.);
 }
 
-static unsigned char *get_pixel(CachedImage *self, int line, int samp)
+// Finds a spot in the cache for another tile: a new one, while we can
+// allocate them (a buffer comes with it if "alloc" is set), otherwise
+// the least recently used one, which is emptied.
+static int take_spot(CachedImage *self, int alloc)
 {
-    // check if outside the image
-    static unsigned char zero = 0;
-    if (line<0 || samp<0 || line >= self->nl || samp >= self->ns)
-        return &zero;
-
-    // size of each pixel
     int ds = data_size(self);
+    int i, spot = 0;
 
-    int i;
-    for (i=0; i<self->n_tiles; ++i) {
-        int rs = self->rowstarts[i];
-        if (rs >= 0) {
-            if (line >= rs && line < rs+self->rows_per_tile) {
-                // found the right cache
-                assert(self->cache[i]);
-
-                // this probably won't ever happen, but here we go anyway
-                if (self->n_access > 1024*1024*1024) {
-                    asfPrintStatus("Resetting n_access.\n");
-                    for (i=0; i<self->n_tiles; ++i)
-                        self->access_counts[i] = 0;
-                    self->n_access = 1;
-                }
-
-                // mark this as the most recently accessed
-                self->access_counts[i] = self->n_access++;
-
-                // return pointer to the cached value
-                return &self->cache[i][((line-rs)*self->ns + samp)*ds];
-            }
-        }
-    }
-
-    int spot = 0;
     if (!self->reached_max_tiles) {
         assert(self->cache[self->n_tiles] == NULL);
-        unsigned char *data = malloc(ds*self->ns*self->rows_per_tile);
-        if (!data) {
-            // if this is the first tile -- abort, we are out of memory
-            if (self->n_tiles == 0)
-                asfPrintError("Failed to allocate cache of %ld bytes.\n"
-                              "Out of memory.\n",
-                              ds*self->ns*self->rows_per_tile);
-            // couldn't allocate the next tile -- must dump existing
-            if (!quiet)
-                asfPrintStatus("reached max # of tiles: %d\n", self->n_tiles);
-            print_cache_size(self);
-            self->reached_max_tiles = TRUE;
-        } else {
+        unsigned char *data = NULL;
+        if (alloc) {
+            data = malloc(ds*self->ns*self->rows_per_tile);
+            if (!data) {
+                // if this is the first tile -- abort, we are out of memory
+                if (self->n_tiles == 0)
+                    asfPrintError("Failed to allocate cache of %ld bytes.\n"
+                                  "Out of memory.\n",
+                                  ds*self->ns*self->rows_per_tile);
+                // couldn't allocate the next tile -- must dump existing
+                if (!quiet)
+                    asfPrintStatus("reached max # of tiles: %d\n",
+                                   self->n_tiles);
+                print_cache_size(self);
+                self->reached_max_tiles = TRUE;
+            }
+        }
+        if (!self->reached_max_tiles) {
             spot = self->n_tiles;
             self->cache[spot] = data;
             ++self->n_tiles;
@@ -142,6 +119,13 @@ static unsigned char *get_pixel(CachedImage *self, int line, int samp)
                 spot = i;
             }
         }
+        if (self->rowstarts[spot] >= 0)
+            self->tile_spot[self->rowstarts[spot]/self->rows_per_tile] = -1;
+        self->rowstarts[spot] = -1;
+        if (!alloc) {
+            free(self->cache[spot]);
+            self->cache[spot] = NULL;
+        }
     }
 
     if (!self->reached_max_tiles && self->n_tiles == MAX_TILES) {
@@ -151,51 +135,260 @@ static unsigned char *get_pixel(CachedImage *self, int line, int samp)
         self->reached_max_tiles = TRUE;
     }
 
-    // load info from file
     assert(spot >= 0 && spot < self->n_tiles);
-    assert(self->cache[spot] != NULL);
+    return spot;
+}
+
+// Marks a spot as holding the given tile, and as just used
+static void set_spot(CachedImage *self, int spot, int tile)
+{
+    self->rowstarts[spot] = tile*self->rows_per_tile;
+    self->tile_spot[tile] = spot;
+    self->access_counts[spot] = self->n_access++;
+}
+
+// Rows in the given tile -- the last may be short
+static int tile_rows(CachedImage *self, int tile)
+{
+    int rs = tile*self->rows_per_tile;
+    if (rs + self->rows_per_tile > self->nl)
+        return self->nl - rs;
+    return self->rows_per_tile;
+}
 
+// Reads a tile from the client into dest
+static void read_tile(CachedImage *self, int tile, unsigned char *dest)
+{
     // clear out the cache -- we may not fill up the tile, if
     // we are near the end of the file, and we don't want old data
     // to appear
-    int ns = self->ns;
-    memset(self->cache[spot], 0, ds*ns*self->rows_per_tile);
+    memset(dest, 0, data_size(self)*self->ns*self->rows_per_tile);
+
+    // the pyramid builder (and the loader) may be reading, too
+    g_mutex_lock(&self->read_lock);
+    self->client->read_fn(tile*self->rows_per_tile, tile_rows(self, tile),
+        (void*)dest, self->client->read_client_info, self->meta,
+        self->client->data_type);
+    g_mutex_unlock(&self->read_lock);
+}
 
-    // update where this cache entry starts
-    int rs = (line / self->rows_per_tile) * self->rows_per_tile;
-    self->rowstarts[spot] = rs;
+// Moves tiles the loader has finished into the cache
+static void install_loaded_tiles(CachedImage *self)
+{
+    int i;
 
-    // mark this tile as the most recently accessed
-    self->access_counts[spot] = self->n_access++;
+    g_mutex_lock(&self->load_lock);
+    for (i=0; i<self->n_loaded; ++i) {
+        int tile = self->loaded_tile[i];
+        if (self->tile_spot[tile] >= 0) {
+            // we needed it before the loader was done, and read it
+            free(self->loaded_data[i]);
+        } else {
+            int spot = take_spot(self, FALSE);
+            self->cache[spot] = self->loaded_data[i];
+            set_spot(self, spot, tile);
+            if (!quiet)
+                asfPrintStatus("Cache: loaded into spot #%d: rows %d-%d\n",
+                    spot, self->rowstarts[spot],
+                    self->rowstarts[spot]+tile_rows(self, tile));
+        }
+    }
+    if (self->n_loaded > 0) {
+        // there's room for the loader to go on
+        self->n_loaded = 0;
+        g_cond_broadcast(&self->load_cond);
+    }
+    g_mutex_unlock(&self->load_lock);
+}
 
-    //printf("Updated entry #%d:\n"
-    //    "     row start: %d\n"
-    //    "     row end: %d\n"
-    //    "     access count: %d\n", spot,
-    //    rs, rs+self->rows_per_tile-1, self->access_counts[spot]);
+// Looks up a pixel in the cache.  NULL if its tile isn't loaded.
+static unsigned char *find_pixel(CachedImage *self, int line, int samp)
+{
+    int tile = line / self->rows_per_tile;
+    int spot = self->tile_spot[tile];
+    if (spot < 0)
+        return NULL;
+
+    // this probably won't ever happen, but here we go anyway
+    if (self->n_access > 1024*1024*1024) {
+        int i;
+        asfPrintStatus("Resetting n_access.\n");
+        for (i=0; i<self->n_tiles; ++i)
+            self->access_counts[i] = 0;
+        self->n_access = 1;
+    }
 
-    // ensure we don't read past the end of the file
-    int rows_to_get = self->rows_per_tile;
-    if (rs + self->rows_per_tile > self->nl)
-        rows_to_get = self->nl - rs;
+    // mark this as the most recently accessed -- unless it already is
+    if (spot != self->last_spot || self->access_counts[spot] != self->n_access-1)
+        self->access_counts[spot] = self->n_access++;
+    self->last_spot = spot;
+
+    // return pointer to the cached value
+    int rs = self->rowstarts[spot];
+    return &self->cache[spot][((line-rs)*self->ns + samp)*data_size(self)];
+}
+
+static unsigned char *get_pixel(CachedImage *self, int line, int samp)
+{
+    // check if outside the image
+    static unsigned char zero = 0;
+    if (line<0 || samp<0 || line >= self->nl || samp >= self->ns)
+        return &zero;
+
+    unsigned char *p = find_pixel(self, line, samp);
+    if (p)
+        return p;
+
+    // Not in the cache.  If the loader is working on it, wait for it,
+    // otherwise read it ourselves (and tell the loader not to bother).
+    int tile = line / self->rows_per_tile;
+    int i, j;
+    g_mutex_lock(&self->load_lock);
+    while (self->loading == tile)
+        g_cond_wait(&self->load_cond, &self->load_lock);
+    for (i=0, j=0; i<self->n_wanted; ++i)
+        if (self->wanted[i] != tile)
+            self->wanted[j++] = self->wanted[i];
+    self->n_wanted = j;
+    g_mutex_unlock(&self->load_lock);
+
+    install_loaded_tiles(self);
+    p = find_pixel(self, line, samp);
+    if (p)
+        return p;
+
+    int spot = take_spot(self, TRUE);
+    assert(self->cache[spot] != NULL);
+    set_spot(self, spot, tile);
 
+    int rs = self->rowstarts[spot];
     if (!quiet) {
         asfPrintStatus("Cache: loading into spot #%d: rows %d-%d\n",
-            spot, rs, rs+rows_to_get);
+            spot, rs, rs+tile_rows(self, tile));
         //print_cache_size(self);
     }
 
-    self->client->read_fn(rs, rows_to_get, (void*)(self->cache[spot]),
-        self->client->read_client_info, self->meta, self->client->data_type);
+    read_tile(self, tile, self->cache[spot]);
+
+    self->last_spot = spot;
+    return &self->cache[spot][((line-rs)*self->ns + samp)*data_size(self)];
+}
+
+//---------------------------------------------------------------------------
+// Background loading.  cached_image_prefetch() gives the loader thread a
+// list of tiles we'll want soon; it reads them (one at a time, into
+// buffers of its own) and the main thread moves them into the cache when
+// it next looks, or when the idle callback the loader queues runs.
+
+static gboolean tiles_loaded_idle(gpointer data)
+{
+    CachedImage *self = (CachedImage*)data;
+
+    g_mutex_lock(&self->load_lock);
+    self->idle_id = 0;
+    g_mutex_unlock(&self->load_lock);
+
+    install_loaded_tiles(self);
+    if (self->refresh_fn)
+        self->refresh_fn(self->refresh_data);
+    return FALSE;
+}
+
+static gpointer loader_thread(gpointer data)
+{
+    CachedImage *self = (CachedImage*)data;
+    int ds = data_size(self);
+
+    g_mutex_lock(&self->load_lock);
+    while (!self->stop_loader) {
+        if (self->n_wanted == 0 || self->n_loaded >= MAX_LOADED_TILES) {
+            g_cond_wait(&self->load_cond, &self->load_lock);
+            continue;
+        }
+
+        int tile = self->wanted[0];
+        memmove(self->wanted, self->wanted+1, --self->n_wanted*sizeof(int));
+        self->loading = tile;
+        g_mutex_unlock(&self->load_lock);
+
+        unsigned char *buf = malloc(ds*self->ns*self->rows_per_tile);
+        if (buf)
+            read_tile(self, tile, buf);
+
+        g_mutex_lock(&self->load_lock);
+        self->loading = -1;
+        if (buf) {
+            self->loaded_tile[self->n_loaded] = tile;
+            self->loaded_data[self->n_loaded] = buf;
+            ++self->n_loaded;
+            if (!self->idle_id && !self->stop_loader)
+                self->idle_id = g_idle_add(tiles_loaded_idle, self);
+        }
+        g_cond_broadcast(&self->load_cond);
+    }
+    g_mutex_unlock(&self->load_lock);
+
+    return NULL;
+}
+
+// Asks the loader for a tile, unless it's loaded or on its way already
+static void want_tile(CachedImage *self, int tile)
+{
+    int i;
+    if (tile < 0 || tile >= self->n_tiles_total)
+        return;
+    if (self->tile_spot[tile] >= 0) {
+        // already have it -- make sure it isn't what gets dumped to
+        // make room for the others
+        self->access_counts[self->tile_spot[tile]] = self->n_access++;
+        return;
+    }
+    if (self->loading == tile || self->n_wanted >= MAX_TILES)
+        return;
+    for (i=0; i<self->n_loaded; ++i)
+        if (self->loaded_tile[i] == tile)
+            return;
+    for (i=0; i<self->n_wanted; ++i)
+        if (self->wanted[i] == tile)
+            return;
+    self->wanted[self->n_wanted++] = tile;
+}
 
-    assert((line-rs)*self->ns + samp <= self->ns*self->rows_per_tile);
-    return &self->cache[spot][((line-rs)*self->ns + samp)*ds];
+// The cache for a level of the pyramid, if it's ready.  Level 0 is the
+// image itself.
+static CachedImage *level_image(CachedImage *self, int level)
+{
+    if (level <= 0 || !self->pyramid || !image_pyramid_ready(self->pyramid))
+        return self;
+    assert(level < self->pyramid->n_levels);
+    return self->pyramid->level_ci[level];
 }
 
 void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
                          void *dest_void)
 {
-    if (self->entire_image_fits || !self->client->thumb_fn) {
+    int sf = self->meta->general->line_count / thumb_size_y;
+    int level = cached_image_pyramid_level(self, sf);
+
+    if (level > 0) {
+        // Sample the pyramid level closest to the thumbnail's size --
+        // same pixels as below, only already averaged, and a small read.
+        CachedImage *lci = level_image(self, level);
+        int ds = data_size(self);
+        unsigned char *dest = (unsigned char*)dest_void;
+
+        quiet=TRUE;
+
+        int i,j;
+        for (i=0; i<thumb_size_y; ++i) {
+            for (j=0; j<thumb_size_x; ++j) {
+                unsigned char *p = get_pixel(lci, (i*sf)>>level, (j*sf)>>level);
+                memcpy(dest+(i*thumb_size_x+j)*ds, p, ds);
+            }
+        }
+
+        quiet=FALSE;
+    } else if (self->entire_image_fits || !self->client->thumb_fn) {
         // Either we don't have thumbnailing support from the client,
         // or the image will fit entirely in memory.  In both cases, we
         // can just call get_pixel() on the subset necessary to show
@@ -206,7 +399,6 @@ void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
         unsigned char *dest = (unsigned char*)dest_void;
 
         // this will fill the cache with the image data
-        int sf = self->meta->general->line_count / thumb_size_y;
         //assert(sf == self->meta->general->sample_count / thumb_size_x);
 
         // supress the "populating cache" msgs when loading the whole thing
@@ -224,21 +416,40 @@ void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
 
         quiet=FALSE;
     } else {
+        g_mutex_lock(&self->read_lock);
         self->client->thumb_fn(thumb_size_x, thumb_size_y,
             self->meta, self->client->read_client_info, dest_void,
             self->client->data_type);
+        g_mutex_unlock(&self->read_lock);
     }
 }
 
 CachedImage * cached_image_new_from_file(
-    const char *file, meta_parameters *meta, ClientInterface *client,
+    const char *file, const char *band, meta_parameters *meta,
+    ClientInterface *client, ImageStats *stats, ImageStatsRGB *stats_r,
+    ImageStatsRGB *stats_g, ImageStatsRGB *stats_b)
+{
+    asfPrintStatus("Opening cache: %s\n", file);
+
+    CachedImage *self =
+        cached_image_new(meta, client, stats, stats_r, stats_g, stats_b);
+
+    // find the pyramid for this image, or start building one
+    if (!client->require_full_load)
+        self->pyramid = image_pyramid_new(self, file, band);
+
+    return self;
+}
+
+// Same as cached_image_new_from_file, without the pyramid.  The
+// pyramid's own levels are opened this way.
+CachedImage * cached_image_new(
+    meta_parameters *meta, ClientInterface *client,
     ImageStats *stats, ImageStatsRGB *stats_r, ImageStatsRGB *stats_g,
     ImageStatsRGB *stats_b)
 {
     CachedImage *self = MALLOC(sizeof(CachedImage));
 
-    asfPrintStatus("Opening cache: %s\n", file);
-
     self->data_type = client->data_type;
     assert(self->data_type != UNDEFINED);
 
@@ -292,6 +503,30 @@ CachedImage * cached_image_new_from_file(
     }
 
     self->n_access = 0;
+    self->last_spot = -1;
+
+    self->n_tiles_total = n_tiles_required;
+    self->tile_spot = MALLOC(sizeof(int)*n_tiles_required);
+    for (i=0; i<n_tiles_required; ++i)
+        self->tile_spot[i] = -1;
+
+    g_mutex_init(&self->read_lock);
+    self->pyramid = NULL;
+
+    // the loader thread is started when first needed
+    self->loader = NULL;
+    g_mutex_init(&self->load_lock);
+    g_cond_init(&self->load_cond);
+    self->wanted = MALLOC(sizeof(int)*MAX_TILES);
+    self->n_wanted = 0;
+    self->loading = -1;
+    self->n_loaded = 0;
+    self->stop_loader = FALSE;
+    self->idle_id = 0;
+    self->refresh_fn = NULL;
+    self->refresh_data = NULL;
+    self->last_center = -1;
+    self->pan_dir = 1;
 
     asfPrintStatus("Number of tiles required for the entire image: %d\n",
         n_tiles_required);
@@ -399,9 +634,166 @@ void cached_image_get_rgb_float(CachedImage *self, int line, int samp,
     }
 }
 
+// Which level of the pyramid to draw from at the given zoom (image
+// pixels per screen pixel): the smallest one that still has at least
+// one pixel per screen pixel.  0 (the image itself) when there's no
+// pyramid yet, or we aren't zoomed out far enough.
+int cached_image_pyramid_level(CachedImage *self, double zoom)
+{
+    if (zoom < 2 || !self->pyramid || !image_pyramid_ready(self->pyramid))
+        return 0;
+
+    int level = 0;
+    while (level+1 < self->pyramid->n_levels && (2<<level) <= zoom)
+        ++level;
+    return level;
+}
+
+// cached_image_get_rgb, from a level of the pyramid.  line and samp are
+// in the full resolution image.
+void cached_image_get_rgb_level(CachedImage *self, int level, int line,
+                                int samp, unsigned char *r, unsigned char *g,
+                                unsigned char *b)
+{
+    if (level <= 0)
+        cached_image_get_rgb(self, line, samp, r, g, b);
+    else
+        cached_image_get_rgb(level_image(self, level), line>>level,
+                             samp>>level, r, g, b);
+}
+
+// Asks for the tiles of a level of the pyramid (0: the image itself)
+// that are needed to show the given lines (of the full resolution
+// image) to be loaded in the background, followed by the tile just past
+// them in the direction we seem to be panning, and the one on the other
+// side.  Anything asked for before, and not started on, is dropped.
+void cached_image_prefetch(CachedImage *self, int level, int line_min,
+                           int line_max)
+{
+    CachedImage *ci = level_image(self, level);
+    if (ci != self) {
+        cached_image_prefetch(ci, 0, line_min>>level, line_max>>level);
+        return;
+    }
+
+    install_loaded_tiles(self);
+
+    if (line_min < 0) line_min = 0;
+    if (line_max >= self->nl) line_max = self->nl-1;
+    if (line_max < line_min)
+        return;
+
+    int center = (line_min + line_max)/2;
+    if (self->last_center >= 0 && center != self->last_center)
+        self->pan_dir = center > self->last_center ? 1 : -1;
+    self->last_center = center;
+
+    int t0 = line_min / self->rows_per_tile;
+    int t1 = line_max / self->rows_per_tile;
+    int tc = center / self->rows_per_tile;
+    int i;
+
+    g_mutex_lock(&self->load_lock);
+    self->n_wanted = 0;
+
+    // what's on the screen, from the middle out
+    want_tile(self, tc);
+    for (i=1; tc-i >= t0 || tc+i <= t1; ++i) {
+        if (tc+i <= t1) want_tile(self, tc+i);
+        if (tc-i >= t0) want_tile(self, tc-i);
+    }
+
+    // and what's next to it, ahead first
+    if (self->pan_dir > 0) {
+        want_tile(self, t1+1);
+        want_tile(self, t0-1);
+    } else {
+        want_tile(self, t0-1);
+        want_tile(self, t1+1);
+    }
+
+    if (self->n_wanted > 0) {
+        if (!self->loader)
+            self->loader = g_thread_new("tile loader", loader_thread, self);
+        g_cond_broadcast(&self->load_cond);
+    }
+    g_mutex_unlock(&self->load_lock);
+}
+
+// cached_image_get_rgb_level, without waiting for the disk: if the tile
+// isn't in the cache, the pixel comes from the next smaller level of the
+// pyramid that has it (the smallest level is read if need be, it's
+// small).  Returns FALSE when it had to do that.  Without a pyramid,
+// this is the same as cached_image_get_rgb_level.
+int cached_image_get_rgb_nowait(CachedImage *self, int level, int line,
+                                int samp, unsigned char *r, unsigned char *g,
+                                unsigned char *b)
+{
+    int n_levels = self->pyramid && image_pyramid_ready(self->pyramid) ?
+        self->pyramid->n_levels : 1;
+    int k;
+
+    for (k=level; k<n_levels-1; ++k) {
+        CachedImage *ci = level_image(self, k);
+        int l = line>>k, s = samp>>k;
+        if (l<0 || s<0 || l >= ci->nl || s >= ci->ns || find_pixel(ci, l, s)) {
+            cached_image_get_rgb(ci, l, s, r, g, b);
+            return k == level;
+        }
+    }
+
+    cached_image_get_rgb_level(self, n_levels-1, line, samp, r, g, b);
+    return n_levels-1 == level;
+}
+
+// Sets a function to call (from the main loop) when tiles have been
+// loaded in the background, to redraw whatever was drawn without them.
+void cached_image_set_refresh(CachedImage *self, void (*fn)(void *data),
+                              void *data)
+{
+    self->refresh_fn = fn;
+    self->refresh_data = data;
+}
+
+// Stats of one channel (0 for greyscale, 0-2 for RGB) of a level of
+// the pyramid, computed over all of the level's pixels when it was
+// built.  Returns FALSE if there's no pyramid (yet).
+int cached_image_get_level_stats(CachedImage *self, int level, int channel,
+                                 double *min, double *max, double *avg,
+                                 double *stddev)
+{
+    if (!self->pyramid || !image_pyramid_ready(self->pyramid) ||
+        level < 0 || level >= self->pyramid->n_levels)
+        return FALSE;
+
+    PyramidLevel *pl = &self->pyramid->levels[level];
+    *min = pl->min[channel];
+    *max = pl->max[channel];
+    *avg = pl->avg[channel];
+    *stddev = pl->stddev[channel];
+    return TRUE;
+}
+
 void cached_image_free (CachedImage *self)
 {
     int i;
+
+    // stops the builder, if it's still going
+    image_pyramid_free(self->pyramid);
+
+    // and the loader
+    if (self->loader) {
+        g_mutex_lock(&self->load_lock);
+        self->stop_loader = TRUE;
+        g_cond_broadcast(&self->load_cond);
+        g_mutex_unlock(&self->load_lock);
+        g_thread_join(self->loader);
+    }
+    if (self->idle_id)
+        g_source_remove(self->idle_id);
+    for (i=0; i<self->n_loaded; ++i)
+        free(self->loaded_data[i]);
+
     for (i=0; i<self->n_tiles; ++i) {
         if (self->cache[i])
             free(self->cache[i]);
@@ -414,6 +806,11 @@ void cached_image_free (CachedImage *self)
     free(self->access_counts);
     free(self->cache);
     free(self->client);
+    free(self->tile_spot);
+    free(self->wanted);
+    g_mutex_clear(&self->read_lock);
+    g_mutex_clear(&self->load_lock);
+    g_cond_clear(&self->load_cond);
 
     // we do not own the metadata -- don't free it!
 
@@ -23,6 +23,8 @@
 //    generate_thumbnail_data()
 //  big_image.c:
 //    update_pixel_info()
+//  pyramid.c:
+//    pixel_size(), is_float_type()
 //  read_X.c: (for clients that will handle the data type)
 //    open_X_data()
 //     
@@ -94,7 +96,13 @@ typedef struct {
 //---------------------------------------------------------------------------
 // Here is the ImageCache stuff.  The global ImageCache that holds the
 // loaded image is "data_ci".  This is all private data.
-typedef struct {
+typedef struct CachedImage CachedImage;
+
+// Most tiles the loader reads ahead, before they go in the cache
+#define MAX_LOADED_TILES 2
+typedef struct ImagePyramid ImagePyramid;
+
+struct CachedImage {
   int nl, ns;               // Image dimensions.
   ClientInterface *client;  // pointers to data read implementations
   int n_tiles;              // Number of tiles in memory
@@ -111,10 +119,65 @@ typedef struct {
   ImageStatsRGB *stats_r;   // not owned by us, not populated by us
   ImageStatsRGB *stats_g;   // not owned by us, not populated by us
   ImageStatsRGB *stats_b;   // not owned by us, not populated by us
-} CachedImage;
+  GMutex read_lock;         // held around calls into the client
+  ImagePyramid *pyramid;    // reduced resolution levels, or NULL
+  int n_tiles_total;        // Tiles it takes to hold the whole image
+  int *tile_spot;           // Cache spot holding each tile, or -1
+  int last_spot;            // Spot of the last pixel looked up
+  // Background loading (see cached_image_prefetch) -- all but the
+  // thread itself are protected by load_lock
+  GThread *loader;          // Reads tiles ahead of when they're needed
+  GMutex load_lock;
+  GCond load_cond;          // Signalled when there's news, either way
+  int *wanted;              // Tiles to load, most wanted first
+  int n_wanted;
+  int loading;              // Tile being loaded now, or -1
+  int loaded_tile[MAX_LOADED_TILES]; // Loaded, but not yet in the cache
+  unsigned char *loaded_data[MAX_LOADED_TILES];
+  int n_loaded;
+  int stop_loader;          // Tells the loader to quit
+  guint idle_id;            // Idle callback installing loaded tiles, or 0
+  void (*refresh_fn)(void *data); // Called after installing them
+  void *refresh_data;
+  int last_center;          // Middle line of the last prefetch
+  int pan_dir;              // Direction the view last moved: 1 or -1
+};
+
+//---------------------------------------------------------------------------
+// Image pyramid -- copies of a large image at 1/2, 1/4, 1/8 ... of the
+// resolution, kept in a sidecar file so they are only built once (in the
+// background, the first time the image is opened).  When zoomed out, and
+// for the thumbnail, the cache reads the level that matches the zoom
+// instead of the full resolution data.  See pyramid.c.
+#define MAX_PYRAMID_LEVELS 24
+
+typedef struct {
+    int nl, ns;               // Dimensions of this level
+    long long offset;         // Where the level starts in the sidecar
+    double min[3], max[3];    // Stats for each channel (1 for greyscale),
+    double avg[3], stddev[3]; //   over all of this level's valid pixels
+} PyramidLevel;
+
+struct ImagePyramid {
+    CachedImage *image;       // The image these are levels of
+    char *file;               // The sidecar file
+    int n_levels;             // Level 0 is the full resolution image
+    PyramidLevel levels[MAX_PYRAMID_LEVELS];
+    CachedImage **level_ci;   // Caches for levels 1..n_levels-1, when open
+    meta_parameters **level_meta; // metadata for the level caches
+    GThread *builder;         // Thread building the sidecar, or NULL
+    gint built;               // Set (atomically) when the builder is done
+    gint cancel;              // Set (atomically) to stop the builder
+    int ready;                // TRUE once the levels can be read
+    int failed;               // TRUE if the sidecar is no good
+};
 
 CachedImage * cached_image_new_from_file(
-    const char *file, meta_parameters *meta, ClientInterface *client,
+    const char *file, const char *band, meta_parameters *meta,
+    ClientInterface *client, ImageStats *stats, ImageStatsRGB *stats_r,
+    ImageStatsRGB *stats_g, ImageStatsRGB *stats_b);
+CachedImage * cached_image_new(
+    meta_parameters *meta, ClientInterface *client,
     ImageStats *stats, ImageStatsRGB *stats_r, ImageStatsRGB *stats_g,
     ImageStatsRGB *stats_b);
 
@@ -128,6 +191,27 @@ void cached_image_get_rgb_float(CachedImage *self, int line, int samp,
 void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
                          void *dest);
 
+int cached_image_pyramid_level(CachedImage *self, double zoom);
+void cached_image_get_rgb_level(CachedImage *self, int level, int line,
+                                int samp, unsigned char *r, unsigned char *g,
+                                unsigned char *b);
+void cached_image_prefetch(CachedImage *self, int level, int line_min,
+                           int line_max);
+int cached_image_get_rgb_nowait(CachedImage *self, int level, int line,
+                                int samp, unsigned char *r, unsigned char *g,
+                                unsigned char *b);
+void cached_image_set_refresh(CachedImage *self, void (*fn)(void *data),
+                              void *data);
+int cached_image_get_level_stats(CachedImage *self, int level, int channel,
+                                 double *min, double *max, double *avg,
+                                 double *stddev);
+
 void cached_image_free (CachedImage *self);
 
+// pyramid.c
+ImagePyramid *image_pyramid_new(CachedImage *ci, const char *file,
+                                const char *band);
+int image_pyramid_ready(ImagePyramid *self);
+void image_pyramid_free(ImagePyramid *self);
+
 #endif
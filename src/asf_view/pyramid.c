@@ -0,0 +1,634 @@
+// Image pyramids -- reduced resolution copies of large images.
+//
+// Level k of the pyramid is the image at 1/2^k of the resolution in
+// each direction, each pixel the average of the 2x2 block of the level
+// before it.  All the levels go into one sidecar file next to the data
+// ("<data file>.pyr", or in the temporary directory if we can't write
+// there), along with the stats of each level, so a big image only has
+// to be read in full once.  The first time it's opened, a thread builds
+// the sidecar in the background, and until it's done asf_view works
+// from the full resolution data as before.
+//
+// The sidecar is rebuilt when the data file's size or modification time
+// change, or when a different band (or multilook setting) is viewed.
+//
+// The sidecar is a cache, not a data product -- it is written in the
+// native byte order, and is simply rebuilt if anything doesn't match.
+
+#include "asf_view.h"
+#include <sys/stat.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+
+// Images smaller than this (full resolution, in bytes) are left alone,
+// the cache handles those well enough by itself.
+#define PYRAMID_MIN_BYTES (256*1024*1024)
+
+// Levels are halved until they are no bigger than this either way
+#define PYRAMID_MIN_SIZE 512
+
+// How much the builder reads from the client at a time
+#define PYRAMID_READ_BYTES (16*1024*1024)
+
+#define PYRAMID_MAGIC "ASFPYR1"
+
+// values this big (or bigger) are bogus -- same as in stats.c
+#define PYRAMID_BIG_VALUE 999999999
+
+typedef struct {
+    char magic[8];
+    int version;
+    int nl, ns;
+    int data_type;
+    int n_levels;
+    long long src_size;
+    long long src_mtime;
+    char band[256];
+} PyramidHeader;
+
+// State of the builder thread
+typedef struct {
+    ImagePyramid *pyr;
+    CachedImage *ci;          // the image we are building for
+    meta_parameters *meta;    // our own copy of ci->meta
+    PyramidHeader hdr;
+    char *tmp_file;           // where the sidecar is written
+    FILE *fp;
+    unsigned char **pending;  // row of each level waiting for its pair
+    long long *rows_done;     // rows written to each level
+    double *n, *mean, *m2;    // running stats, per level and channel
+    int have_no_data;
+    float no_data;
+} PyramidBuilder;
+
+// Reading client for one level of the sidecar
+typedef struct {
+    FILE *fp;
+    long long offset;
+    int ns;
+    int ds;
+} PyramidLevelInfo;
+
+static int pixel_size(ssv_data_type_t data_type)
+{
+    switch (data_type) {
+        case GREYSCALE_FLOAT: return 4;
+        case RGB_BYTE:        return 3;
+        case GREYSCALE_BYTE:  return 1;
+        case RGB_FLOAT:       return 12;
+        default:              assert(FALSE); return 0;
+    }
+}
+
+static int is_float_type(ssv_data_type_t data_type)
+{
+    return data_type == GREYSCALE_FLOAT || data_type == RGB_FLOAT;
+}
+
+static int channel_count(ssv_data_type_t data_type)
+{
+    return data_type == RGB_BYTE || data_type == RGB_FLOAT ? 3 : 1;
+}
+
+static int source_info(const char *file, long long *size, long long *mtime)
+{
+    struct stat st;
+    if (stat(file, &st) != 0)
+        return FALSE;
+    *size = (long long)st.st_size;
+    *mtime = (long long)st.st_mtime;
+    return TRUE;
+}
+
+// The places the sidecar can be: next to the data, or in the temporary
+// directory when that isn't writable.
+static char *sidecar_name(const char *file, int in_tmp_dir)
+{
+    char *name = g_strdup_printf("%s.pyr", file);
+    if (in_tmp_dir) {
+        char *base = g_path_get_basename(name);
+        char *tmp_name = g_build_filename(g_get_tmp_dir(), base, NULL);
+        g_free(base);
+        g_free(name);
+        name = tmp_name;
+    }
+    return name;
+}
+
+// Sets up the header (and level sizes) of the pyramid for an image
+static void init_header(PyramidHeader *hdr, ImagePyramid *pyr,
+                        CachedImage *ci, const char *band,
+                        long long src_size, long long src_mtime)
+{
+    memset(hdr, 0, sizeof(PyramidHeader));
+    strcpy(hdr->magic, PYRAMID_MAGIC);
+    hdr->version = 1;
+    hdr->nl = ci->nl;
+    hdr->ns = ci->ns;
+    hdr->data_type = ci->data_type;
+    hdr->src_size = src_size;
+    hdr->src_mtime = src_mtime;
+    strncpy(hdr->band, band ? band : "", sizeof(hdr->band)-1);
+
+    int ds = pixel_size(ci->data_type);
+    long long offset = sizeof(PyramidHeader) +
+        sizeof(PyramidLevel)*MAX_PYRAMID_LEVELS;
+    int nl = ci->nl, ns = ci->ns, k = 0;
+
+    memset(pyr->levels, 0, sizeof(pyr->levels));
+    pyr->levels[0].nl = nl;
+    pyr->levels[0].ns = ns;
+    while ((nl > PYRAMID_MIN_SIZE || ns > PYRAMID_MIN_SIZE) &&
+           k+1 < MAX_PYRAMID_LEVELS)
+    {
+        nl = (nl+1)/2;
+        ns = (ns+1)/2;
+        ++k;
+        pyr->levels[k].nl = nl;
+        pyr->levels[k].ns = ns;
+        pyr->levels[k].offset = offset;
+        offset += (long long)nl*ns*ds;
+    }
+    pyr->n_levels = hdr->n_levels = k+1;
+}
+
+// Checks that an existing sidecar is for this image as it is now, and
+// reads in its level table.
+static int read_sidecar(ImagePyramid *pyr, const char *file,
+                        PyramidHeader *want)
+{
+    FILE *fp = fopen(file, "rb");
+    if (!fp)
+        return FALSE;
+
+    PyramidHeader hdr;
+    PyramidLevel levels[MAX_PYRAMID_LEVELS];
+    int ok =
+        fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+        fread(levels, sizeof(levels), 1, fp) == 1 &&
+        memcmp(&hdr, want, sizeof(hdr)) == 0;
+    fclose(fp);
+
+    if (ok) {
+        int k;
+        for (k=1; k<hdr.n_levels; ++k)
+            if (levels[k].nl != pyr->levels[k].nl ||
+                levels[k].ns != pyr->levels[k].ns ||
+                levels[k].offset != pyr->levels[k].offset)
+                ok = FALSE;
+    }
+    if (ok)
+        memcpy(pyr->levels, levels, sizeof(levels));
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+// Building
+
+static int is_valid_value(PyramidBuilder *b, float v)
+{
+    return meta_is_valid_double(v) && fabs(v) < PYRAMID_BIG_VALUE &&
+        !(b->have_no_data && v == b->no_data);
+}
+
+// Adds a row to the stats of a level
+static void add_stats(PyramidBuilder *b, int level, unsigned char *row,
+                      int ns)
+{
+    int nc = channel_count(b->hdr.data_type);
+    int j, c;
+    for (c=0; c<nc; ++c) {
+        int k = level*3 + c;
+        double n = b->n[k], mean = b->mean[k], m2 = b->m2[k];
+        double min = b->pyr->levels[level].min[c];
+        double max = b->pyr->levels[level].max[c];
+        for (j=0; j<ns; ++j) {
+            double v;
+            if (is_float_type(b->hdr.data_type)) {
+                float f = ((float*)row)[j*nc+c];
+                if (!is_valid_value(b, f))
+                    continue;
+                v = f;
+            } else {
+                v = row[j*nc+c];
+            }
+            if (n == 0 || v < min) min = v;
+            if (n == 0 || v > max) max = v;
+            n += 1;
+            double d = v - mean;
+            mean += d/n;
+            m2 += d*(v - mean);
+        }
+        b->n[k] = n; b->mean[k] = mean; b->m2[k] = m2;
+        b->pyr->levels[level].min[c] = min;
+        b->pyr->levels[level].max[c] = max;
+    }
+}
+
+// Averages rows a and b (b may be NULL, at the bottom of an image with
+// an odd number of rows) of a level of ns pixels into out.  Floating
+// point data skips "no data" and invalid values; if a block has nothing
+// else, it gets the first one.
+static void average_rows(PyramidBuilder *b, const unsigned char *ra,
+                         const unsigned char *rb, int ns, unsigned char *out)
+{
+    int nc = channel_count(b->hdr.data_type);
+    int ns_out = (ns+1)/2;
+    int j, c, m;
+
+    for (j=0; j<ns_out; ++j) {
+        int s[2] = { 2*j, 2*j+1 < ns ? 2*j+1 : 2*j };
+        for (c=0; c<nc; ++c) {
+            if (is_float_type(b->hdr.data_type)) {
+                const float *fa = (const float*)ra, *fb = (const float*)rb;
+                float v[4];
+                int nv = 0;
+                v[nv++] = fa[s[0]*nc+c];
+                if (s[1] != s[0]) v[nv++] = fa[s[1]*nc+c];
+                if (fb) {
+                    v[nv++] = fb[s[0]*nc+c];
+                    if (s[1] != s[0]) v[nv++] = fb[s[1]*nc+c];
+                }
+                double sum = 0;
+                int n = 0;
+                for (m=0; m<nv; ++m) {
+                    if (is_valid_value(b, v[m])) {
+                        sum += v[m];
+                        ++n;
+                    }
+                }
+                ((float*)out)[j*nc+c] = n > 0 ? (float)(sum/n) : v[0];
+            } else {
+                int sum = 0, n = 0;
+                sum += ra[s[0]*nc+c]; ++n;
+                if (s[1] != s[0]) { sum += ra[s[1]*nc+c]; ++n; }
+                if (rb) {
+                    sum += rb[s[0]*nc+c]; ++n;
+                    if (s[1] != s[0]) { sum += rb[s[1]*nc+c]; ++n; }
+                }
+                out[j*nc+c] = (unsigned char)((sum + n/2)/n);
+            }
+        }
+    }
+}
+
+// Hands a row to a level: it goes into the level's stats and (above
+// level 0) into the sidecar, and every second row makes a row of the
+// next level.
+static int put_row(PyramidBuilder *b, int level, unsigned char *row)
+{
+    ImagePyramid *pyr = b->pyr;
+    int ns = pyr->levels[level].ns;
+    int ds = pixel_size(b->hdr.data_type);
+
+    add_stats(b, level, row, ns);
+
+    if (level > 0) {
+        long long off = pyr->levels[level].offset +
+            b->rows_done[level]*ns*ds;
+        FSEEK64(b->fp, off, SEEK_SET);
+        if (fwrite(row, ds, ns, b->fp) != (size_t)ns)
+            return FALSE;
+    }
+    ++b->rows_done[level];
+
+    if (level+1 < pyr->n_levels) {
+        if (b->rows_done[level] % 2 == 1) {
+            memcpy(b->pending[level], row, (size_t)ns*ds);
+        } else {
+            unsigned char *out =
+                MALLOC((size_t)pyr->levels[level+1].ns*ds);
+            average_rows(b, b->pending[level], row, ns, out);
+            int ok = put_row(b, level+1, out);
+            FREE(out);
+            return ok;
+        }
+    }
+    return TRUE;
+}
+
+// Pushes the last row of levels with an odd number of rows up
+static int flush_rows(PyramidBuilder *b)
+{
+    ImagePyramid *pyr = b->pyr;
+    int ds = pixel_size(b->hdr.data_type);
+    int k;
+
+    for (k=0; k+1<pyr->n_levels; ++k) {
+        if (b->rows_done[k] % 2 == 1) {
+            unsigned char *out = MALLOC((size_t)pyr->levels[k+1].ns*ds);
+            average_rows(b, b->pending[k], NULL, pyr->levels[k].ns, out);
+            int ok = put_row(b, k+1, out);
+            FREE(out);
+            if (!ok)
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void finish_stats(PyramidBuilder *b)
+{
+    int nc = channel_count(b->hdr.data_type);
+    int k, c;
+    for (k=0; k<b->pyr->n_levels; ++k) {
+        for (c=0; c<nc; ++c) {
+            int i = k*3 + c;
+            b->pyr->levels[k].avg[c] = b->mean[i];
+            b->pyr->levels[k].stddev[c] =
+                b->n[i] > 0 ? sqrt(b->m2[i]/b->n[i]) : 0;
+        }
+    }
+}
+
+static gpointer build_pyramid(gpointer data)
+{
+    PyramidBuilder *b = (PyramidBuilder*)data;
+    ImagePyramid *pyr = b->pyr;
+    CachedImage *ci = b->ci;
+    int ds = pixel_size(b->hdr.data_type);
+    int nl = ci->nl, ns = ci->ns;
+    int ok = TRUE;
+    int k;
+
+    int rows_per_read = PYRAMID_READ_BYTES / ((long long)ns*ds);
+    if (rows_per_read < 2) rows_per_read = 2;
+    rows_per_read -= rows_per_read % 2;
+    unsigned char *buf = MALLOC((size_t)rows_per_read*ns*ds);
+
+    // header first, with no magic -- in case we don't finish
+    PyramidHeader blank;
+    memset(&blank, 0, sizeof(blank));
+    ok = fwrite(&blank, sizeof(blank), 1, b->fp) == 1 &&
+        fwrite(pyr->levels, sizeof(pyr->levels), 1, b->fp) == 1;
+
+    int row;
+    for (row=0; ok && row<nl; row+=rows_per_read) {
+        if (g_atomic_int_get(&pyr->cancel)) {
+            ok = FALSE;
+            break;
+        }
+
+        int n = rows_per_read;
+        if (row + n > nl)
+            n = nl - row;
+
+        memset(buf, 0, (size_t)n*ns*ds);
+        g_mutex_lock(&ci->read_lock);
+        ci->client->read_fn(row, n, (void*)buf, ci->client->read_client_info,
+            b->meta, ci->client->data_type);
+        g_mutex_unlock(&ci->read_lock);
+
+        for (k=0; ok && k<n; ++k)
+            ok = put_row(b, 0, buf + (size_t)k*ns*ds);
+    }
+    FREE(buf);
+
+    if (ok)
+        ok = flush_rows(b);
+
+    if (ok) {
+        finish_stats(b);
+        FSEEK64(b->fp, 0, SEEK_SET);
+        ok = fwrite(&b->hdr, sizeof(b->hdr), 1, b->fp) == 1 &&
+            fwrite(pyr->levels, sizeof(pyr->levels), 1, b->fp) == 1;
+    }
+    if (fclose(b->fp) != 0)
+        ok = FALSE;
+    b->fp = NULL;
+
+    if (ok)
+        ok = g_rename(b->tmp_file, pyr->file) == 0;
+    if (!ok)
+        g_unlink(b->tmp_file);
+
+    for (k=0; k<pyr->n_levels; ++k)
+        FREE(b->pending[k]);
+    FREE(b->pending);
+    FREE(b->rows_done);
+    FREE(b->n);
+    FREE(b->mean);
+    FREE(b->m2);
+    meta_free(b->meta);
+    g_free(b->tmp_file);
+    FREE(b);
+
+    g_atomic_int_set(&pyr->built, ok ? 1 : -1);
+    return NULL;
+}
+
+// Starts building the sidecar, if we can write it anywhere
+static int start_builder(ImagePyramid *pyr, CachedImage *ci,
+                         const char *file, PyramidHeader *hdr)
+{
+    int in_tmp_dir;
+    FILE *fp = NULL;
+    char *tmp_file = NULL;
+
+    for (in_tmp_dir=0; in_tmp_dir<2 && !fp; ++in_tmp_dir) {
+        g_free(pyr->file);
+        pyr->file = sidecar_name(file, in_tmp_dir);
+        g_free(tmp_file);
+        tmp_file = g_strdup_printf("%s.tmp", pyr->file);
+        fp = fopen(tmp_file, "wb");
+    }
+    if (!fp) {
+        asfPrintStatus("Can't write an image pyramid for %s: %s\n",
+                       file, strerror(errno));
+        g_free(tmp_file);
+        return FALSE;
+    }
+
+    PyramidBuilder *b = CALLOC(1, sizeof(PyramidBuilder));
+    int k, ds = pixel_size(ci->data_type);
+    b->pyr = pyr;
+    b->ci = ci;
+    b->meta = meta_copy(ci->meta);
+    b->hdr = *hdr;
+    b->tmp_file = tmp_file;
+    b->fp = fp;
+    b->pending = CALLOC(pyr->n_levels, sizeof(unsigned char*));
+    for (k=0; k<pyr->n_levels; ++k)
+        b->pending[k] = MALLOC((size_t)pyr->levels[k].ns*ds);
+    b->rows_done = CALLOC(pyr->n_levels, sizeof(long long));
+    b->n = CALLOC(pyr->n_levels*3, sizeof(double));
+    b->mean = CALLOC(pyr->n_levels*3, sizeof(double));
+    b->m2 = CALLOC(pyr->n_levels*3, sizeof(double));
+    b->no_data = (float)ci->meta->general->no_data;
+    b->have_no_data = meta_is_valid_double(ci->meta->general->no_data) &&
+        ci->meta->general->no_data != MAGIC_UNSET_DOUBLE;
+
+    asfPrintStatus("Building image pyramid (%d levels) in the background:"
+                   "\n  %s\n", pyr->n_levels-1, pyr->file);
+    pyr->builder = g_thread_new("pyramid", build_pyramid, b);
+    return TRUE;
+}
+
+//---------------------------------------------------------------------------
+// Reading
+
+static int read_level_client(int row_start, int n_rows_to_get,
+                             void *dest, void *read_client_info,
+                             meta_parameters *meta, int data_type)
+{
+    PyramidLevelInfo *info = (PyramidLevelInfo*)read_client_info;
+    size_t row_bytes = (size_t)info->ns*info->ds;
+
+    FSEEK64(info->fp, info->offset + row_start*(long long)row_bytes,
+            SEEK_SET);
+    if (fread(dest, row_bytes, n_rows_to_get, info->fp) !=
+        (size_t)n_rows_to_get)
+    {
+        asfPrintWarning("Failed to read the image pyramid.\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void free_level_client_info(void *read_client_info)
+{
+    PyramidLevelInfo *info = (PyramidLevelInfo*)read_client_info;
+    if (info->fp)
+        fclose(info->fp);
+    FREE(info);
+}
+
+// Opens a cache for each level of a finished sidecar
+static void open_levels(ImagePyramid *pyr)
+{
+    CachedImage *ci = pyr->image;
+    int k;
+
+    pyr->level_ci = CALLOC(pyr->n_levels, sizeof(CachedImage*));
+    pyr->level_meta = CALLOC(pyr->n_levels, sizeof(meta_parameters*));
+    for (k=1; k<pyr->n_levels; ++k) {
+        // each level gets its own FILE, they may be read from
+        // different threads (see cached_image_prefetch)
+        PyramidLevelInfo *info = MALLOC(sizeof(PyramidLevelInfo));
+        info->fp = fopen(pyr->file, "rb");
+        if (!info->fp) {
+            FREE(info);
+            pyr->failed = TRUE;
+            return;
+        }
+        info->offset = pyr->levels[k].offset;
+        info->ns = pyr->levels[k].ns;
+        info->ds = pixel_size(ci->data_type);
+
+        ClientInterface *client = MALLOC(sizeof(ClientInterface));
+        client->read_fn = read_level_client;
+        client->thumb_fn = NULL;
+        client->free_fn = free_level_client_info;
+        client->read_client_info = info;
+        client->data_type = ci->data_type;
+        client->require_full_load = FALSE;
+
+        meta_parameters *meta = meta_copy(ci->meta);
+        meta->general->line_count = pyr->levels[k].nl;
+        meta->general->sample_count = pyr->levels[k].ns;
+        pyr->level_meta[k] = meta;
+
+        pyr->level_ci[k] = cached_image_new(meta, client, ci->stats,
+            ci->stats_r, ci->stats_g, ci->stats_b);
+        cached_image_set_refresh(pyr->level_ci[k], ci->refresh_fn,
+                                 ci->refresh_data);
+    }
+
+    pyr->ready = TRUE;
+}
+
+//---------------------------------------------------------------------------
+// Interface
+
+// Looks for an up-to-date sidecar for an image, and starts building one
+// if there isn't one.  Returns NULL for images too small to bother with.
+// "file" is the image's data file, "band" what is being viewed of it.
+ImagePyramid *image_pyramid_new(CachedImage *ci, const char *file,
+                                const char *band)
+{
+    long long src_size, src_mtime;
+    long long bytes = (long long)ci->nl*ci->ns*pixel_size(ci->data_type);
+
+    if (bytes < PYRAMID_MIN_BYTES || !source_info(file, &src_size, &src_mtime))
+        return NULL;
+
+    ImagePyramid *self = CALLOC(1, sizeof(ImagePyramid));
+    self->image = ci;
+    PyramidHeader hdr;
+    init_header(&hdr, self, ci, band, src_size, src_mtime);
+
+    int in_tmp_dir;
+    for (in_tmp_dir=0; in_tmp_dir<2; ++in_tmp_dir) {
+        self->file = sidecar_name(file, in_tmp_dir);
+        if (read_sidecar(self, self->file, &hdr)) {
+            asfPrintStatus("Using image pyramid: %s\n", self->file);
+            self->built = 1;
+            return self;
+        }
+        g_free(self->file);
+        self->file = NULL;
+    }
+
+    if (!start_builder(self, ci, file, &hdr)) {
+        image_pyramid_free(self);
+        return NULL;
+    }
+    return self;
+}
+
+// TRUE if the levels can be read.  Once the builder is done, this opens
+// them (so it must be called from the thread using the cache).
+int image_pyramid_ready(ImagePyramid *self)
+{
+    if (self->ready)
+        return TRUE;
+    if (self->failed)
+        return FALSE;
+
+    int built = g_atomic_int_get(&self->built);
+    if (built == 0)
+        return FALSE;
+
+    if (self->builder) {
+        g_thread_join(self->builder);
+        self->builder = NULL;
+        if (built > 0)
+            asfPrintStatus("Image pyramid is ready: %s\n", self->file);
+    }
+
+    if (built < 0) {
+        asfPrintStatus("Failed to build the image pyramid.\n");
+        self->failed = TRUE;
+        return FALSE;
+    }
+
+    open_levels(self);
+    return self->ready;
+}
+
+void image_pyramid_free(ImagePyramid *self)
+{
+    if (!self)
+        return;
+
+    if (self->builder) {
+        g_atomic_int_set(&self->cancel, 1);
+        g_thread_join(self->builder);
+    }
+
+    int k;
+    if (self->level_ci) {
+        for (k=1; k<self->n_levels; ++k)
+            if (self->level_ci[k])
+                cached_image_free(self->level_ci[k]);
+        FREE(self->level_ci);
+    }
+    if (self->level_meta) {
+        for (k=1; k<self->n_levels; ++k)
+            if (self->level_meta[k])
+                meta_free(self->level_meta[k]);
+        FREE(self->level_meta);
+    }
+    g_free(self->file);
+    FREE(self);
+}
@@ -40,14 +40,15 @@ int try_prepension(const char *filename, const char *prepension)
 int read_file(const char *filename, const char *band, int multilook,
               int on_fail_abort)
 {
-    if (curr->meta)
-        meta_free(curr->meta);
-    curr->meta = NULL;
-
+    // the cache goes first, it may still be using the metadata
     if (curr->data_ci)
         cached_image_free(curr->data_ci);
     curr->data_ci = NULL;
 
+    if (curr->meta)
+        meta_free(curr->meta);
+    curr->meta = NULL;
+
     void (*err_func) (const char *format, ...);
     err_func = on_fail_abort ? asfPrintError : message_box;
 
@@ -252,10 +253,11 @@ int read_file(const char *filename, const char *band, int multilook,
 
     // set up the ImageInfo for this image
     curr->meta = meta;
-    curr->data_ci = cached_image_new_from_file(data_name, meta, client,
+    curr->data_ci = cached_image_new_from_file(data_name, band, meta, client,
                         &(curr->stats), &(curr->stats_r), &(curr->stats_g),
                         &(curr->stats_b));
     assert(curr->data_ci);
+    cached_image_set_refresh(curr->data_ci, refresh_big_image, NULL);
 
     int nl = meta->general->line_count;
     curr->nl = nl;
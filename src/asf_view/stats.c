@@ -428,6 +428,14 @@ unsigned char *generate_thumbnail_data(ImageInfo *ii, int tsx, int tsy)
                 }
             }
             stats->stddev = sqrt(stats->stddev / (double)(tsx*tsy));
+
+            // If the image has a pyramid, it has the stats of every
+            // pixel -- better than our estimate, and the thumbnail may
+            // have come from an averaged level, which would shrink the
+            // standard deviation.
+            cached_image_get_level_stats(ii->data_ci, 0, 0,
+                &stats->act_min, &stats->act_max, &stats->avg,
+                &stats->stddev);
         }
 
         //printf("Avg, StdDev: %f, %f\n", stats->avg, stats->stddev);
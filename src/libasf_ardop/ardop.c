@@ -60,6 +60,9 @@ PROGRAM HISTORY:
     3.0     10/02   J. Nicoll   Made calibrateable, added beta, sigma, gamma
                     products. Fixed deskew to exclude data wedges.
     3.1     6/03    J. Nicoll   Expanded debug options and change debug flags.
+    3.2             Patch lines are processed on all processors, and the
+                    next patch is read and the previous one written while
+                    the current one is processed.
 
 HARDWARE/SOFTWARE LIMITATIONS:
     This program requires large amounts of memory to run.  The main
@@ -74,6 +77,13 @@ HARDWARE/SOFTWARE LIMITATIONS:
     this is combined with the rest of the storage requirements for the
     program, 200+ Mbytes are needed.
 
+    When more than one thread is used (see ardop_set_thread_count), a
+    second patch is kept so the previous patch can be written while the
+    current one is processed.  The raw signal data for a patch is also
+    kept (n_az * (n_range + range reference length) complex samples),
+    so the next patch can be read in the meantime.  That roughly doubles
+    the memory needed.
+
     Because of the 1000+ azimuth lines of overhead per patch, it is best
     NOT to decrease the defined value of n_az.  Rather, one should decrease
     n_range by processing fewer range bins at a time.  Regardless, n_az should
@@ -82,11 +92,13 @@ HARDWARE/SOFTWARE LIMITATIONS:
 ALGORITHM DESCRIPTION:
     Deal with setting all of the parameters
     For each patch
-    read the patch and range compress (rciq)
+    read the patch (in the background, while the previous patch is processed)
+    range compress (rciq)
     transform via fft
     perform range migration (rmpatch)
     perform azimuth compression (acpatch)
     transpose the patch and write it in azimuth lines to output
+        (in the background, while the next patch is processed)
 
 ALGORITHM REFERENCES:
     This program and all subroutines were converted from Fortran programs
@@ -100,6 +112,36 @@ BUGS:
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
+#include <glib.h>
+
+/*Background jobs for the patch pipeline.*/
+typedef struct {
+    rawPatch *raw;
+    const getRec *signalGetRec;
+    int fromLine,fromSample;
+} readJob;
+
+typedef struct {
+    const patch *p;
+    const satellite *s;
+    meta_parameters *meta;
+    const file *f;
+    int patchNo;
+} writeJob;
+
+static gpointer readThread(gpointer data)
+{
+    readJob *j=(readJob *)data;
+    readRawPatch(j->raw,j->signalGetRec,j->fromLine,j->fromSample);
+    return NULL;
+}
+
+static gpointer writeThread(gpointer data)
+{
+    writeJob *j=(writeJob *)data;
+    writePatch(j->p,j->s,j->meta,j->f,j->patchNo);
+    return NULL;
+}
 
 int ardop(struct INPUT_ARDOP_PARAMS * params_in)
 {
@@ -109,7 +151,9 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
     fill_default_ardop_params(&params);
 
 /*Structures: these are passed to the sub-routines which need them.*/
-    patch *p;
+    patch *p[2];/*Two, so one can be written while the other is processed.*/
+    rawPatch *raw;/*Signal data of the next patch to process.*/
+    meta_parameters *writeMeta;
     satellite *s;
     rangeRef *r;
     getRec *signalGetRec;
@@ -118,6 +162,11 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
 /*Variables.*/
     int n_az,n_range;/*Region to be processed.*/
     int patchNo;/*Loop counter.*/
+    int nPatches;/*Number of patches that fit in the input.*/
+    int pipelined;/*Read and write in the background?*/
+    GThread *reader=NULL,*writer=NULL;
+    readJob readArgs;
+    writeJob writeArgs;
 
 /*Setup metadata*/
     /*Create ARDOP_PARAMS struct as well as meta_parameters.*/
@@ -195,33 +244,94 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
       printf("   Of the %d azimuth lines, only %d are valid.\n",n_az,f->n_az_valid);
     }
 
+/*Figure out how many patches fit in the input file.*/
+    nPatches=0;
+    for (patchNo=1; patchNo<=f->nPatches; patchNo++)
+    {
+        int lineToBeRead = f->firstLineToProcess + (patchNo-1) * f->n_az_valid;
+        if (lineToBeRead+n_az>signalGetRec->nLines)
+          break;
+        nPatches=patchNo;
+    }
+
+/*With more than one thread, patch N+1 is read and patch N-1 is
+written while patch N is processed.  The output is the same either way.*/
+    pipelined = ardop_get_thread_count()>1 && nPatches>1;
+
 /*
 Create "patch" of data.  This patch is re-used to process
-all of the input data.
+all of the input data.  When pipelined, there are two, so one can be
+written while the other is processed.
 */
-    p=newPatch(n_az,n_range);
+    p[0]=newPatch(n_az,n_range);
+    p[1]=pipelined ? newPatch(n_az,n_range) : p[0];
+    raw=newRawPatch(n_az,n_range+r->refLen);
+    /*The writer gets its own metadata: writePatch updates it.*/
+    writeMeta=pipelined ? meta_copy(meta) : meta;
 
 /*Loop over each patch of data present, and process it.*/
-    for (patchNo=1; patchNo<=f->nPatches; patchNo++)
+    for (patchNo=1; patchNo<=nPatches; patchNo++)
     {
-        int lineToBeRead;
+        patch *cur=p[(patchNo-1)%2];
+        int lineToBeRead = f->firstLineToProcess + (patchNo-1) * f->n_az_valid;
         if (!quietflag) printf("\n   *****    PROCESSING PATCH %i    *****\n\n",patchNo);
 
-        lineToBeRead = f->firstLineToProcess + (patchNo-1) * f->n_az_valid;
-        if (lineToBeRead+p->n_az>signalGetRec->nLines) {
-          if (!quietflag) printf("   Read all the patches in the input file.\n");
-          if (logflag) printLog("   Read all the patches in the input file.\n");
-          break;
+        /*Update patch parameters for location.*/
+        setPatchLoc(cur,s,meta,f->skipFile,f->skipSamp,lineToBeRead);
+
+        /*Get this patch's signal data, if it wasn't read in the background.*/
+        if (reader) {
+            g_thread_join(reader);
+            reader=NULL;
+        }
+        else
+            readRawPatch(raw,signalGetRec,cur->fromLine,cur->fromSample);
+
+        /*SAR Process patch.*/
+        update_status("Range compressing");
+        if (!quietflag) printf("   RANGE COMPRESSING CHANNELS...\n");
+        elapse(0);
+        rciq_raw(cur,raw,r);
+        if (!quietflag) elapse(1);
+
+        /*The signal data is used up, so start reading the next patch.*/
+        if (pipelined && patchNo<nPatches) {
+            readArgs.raw=raw;
+            readArgs.signalGetRec=signalGetRec;
+            readArgs.fromLine=lineToBeRead+f->n_az_valid;
+            readArgs.fromSample=f->skipFile;
+            reader=g_thread_new("ardop reader",readThread,&readArgs);
         }
 
-        /*Update patch parameters for location.*/
-        setPatchLoc(p,s,meta,f->skipFile,f->skipSamp,lineToBeRead);
-        processPatch(p,signalGetRec,r,s);/*SAR Process patch.*/
-        writePatch(p,s,meta,f,patchNo);/*Output patch data to file.*/
+        azimuthCompressPatch(cur,s);
+
+        /*Output patch data to file, after the previous patch.*/
+        if (writer) {
+            g_thread_join(writer);
+            writer=NULL;
+        }
+        writeArgs.p=cur;
+        writeArgs.s=s;
+        writeArgs.meta=writeMeta;
+        writeArgs.f=f;
+        writeArgs.patchNo=patchNo;
+        if (pipelined)
+            writer=g_thread_new("ardop writer",writeThread,&writeArgs);
+        else
+            writeThread(&writeArgs);
     } /***********************end patch loop***********************************/
+    if (writer)
+        g_thread_join(writer);
 
+    if (nPatches<f->nPatches) {
+      if (!quietflag) printf("   Read all the patches in the input file.\n");
+      if (logflag) printLog("   Read all the patches in the input file.\n");
+    }
 
-    destroyPatch(p);
+    destroyRawPatch(raw);
+    if (p[1]!=p[0]) destroyPatch(p[1]);
+    if (writeMeta!=meta) meta_free(writeMeta);
+    destroyPatch(p[0]);
 /*  if (!quietflag) printf("\nPROGRAM COMPLETED\n\n");*/
 
     if (logflag) {
@@ -51,6 +51,9 @@ complexFloat Cmul (complexFloat,complexFloat);
 	dir<0 -> forward; 
 	dir>0 -> backward*/
 void cfft1d(int n, complexFloat *c, int dir);
+/*cfft1d_rows: the same for rows consecutive vectors of n values
+(forward or backward only; initialize with cfft1d).*/
+void cfft1d_rows(int n, int rows, complexFloat *c, int dir);
 
 /*-----------------------*/
 /* Constants Definitions */
@@ -87,6 +90,7 @@ void cfft1d(int n, complexFloat *c, int dir);
 /*-------------Structures:---------------
 patch: a chunk of SAR data, throughout the processor.
 rangeRef: the range reference function, for rciq.
+rawPatch: the signal data for a patch, before range compression.
 satellite: sundry imaging-related parameters, for rmpatch and acpatch.
 file: parameters describing output file.
 */
@@ -107,6 +111,13 @@ typedef struct {
 	complexFloat *ref;/*FFT'd range reference function.*/
 } rangeRef;
 
+typedef struct {
+	int n_az;/*Number of lines of signal data.*/
+	int lineLen;/*Samples allocated per line.*/
+	int nRead;/*Samples actually read per line (the rest are not valid).*/
+	complexFloat *lines;/*Signal data-- indexed as lines[y*lineLen+x].*/
+} rawPatch;
+
 typedef struct {
   int intensity;/* Intensity image flag */
   int power;/*Intensity squared image flag*/
@@ -186,10 +197,34 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
 	const file *f,int patchNo);
 void destroyPatch(patch *p);
 
+void azimuthCompressPatch(patch *p,const satellite *s);
+
+/*-------Raw signal data for a patch.----------*/
+rawPatch *newRawPatch(int n_az,int lineLen);
+void readRawPatch(rawPatch *raw,const getRec *signalGetRec,int fromLine,int fromSample);
+void destroyRawPatch(rawPatch *raw);
+
 /*-------Routines to manipulate patches.----------*/
 void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r);
+void rciq_raw(patch *p,const rawPatch *raw,const rangeRef *r);
 void rmpatch(patch *p,const satellite *s);
 void acpatch(patch *p,const satellite *s);
 void antptn_correct(meta_parameters *meta,complexFloat *outputBuf,int curLine,int numSamples,const satellite *s);
 void writeTable(meta_parameters *meta, const satellite *s, int numSamples);
+
+/*-------Threads (ardop_threads.c).----------
+ardop_parallel_lines calls func(data,worker,line) for each line in
+[0,n_lines), spread over n_workers threads (the caller's thread is worker 0).
+Get n_workers from ardop_worker_count, which never returns more workers
+than there is work for.  0 threads (the default) means one per processor.*/
+typedef void (*ardop_line_func)(void *data,int worker,int line);
+void ardop_set_thread_count(int thread_count);
+int ardop_get_thread_count(void);
+int ardop_worker_count(int n_lines);
+void ardop_parallel_lines(int n_lines,int n_workers,ardop_line_func func,void *data);
+/*ardop_parallel_blocks is the same, but calls func(data,worker,first,last)
+for each block of lines [first,last) (at most ARDOP_BLOCK_LINES of them).*/
+#define ARDOP_BLOCK_LINES 16
+typedef void (*ardop_block_func)(void *data,int worker,int first,int last);
+void ardop_parallel_blocks(int n_lines,int n_workers,ardop_block_func func,void *data);
 #endif
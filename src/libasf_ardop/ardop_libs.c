@@ -47,20 +47,18 @@ PROGRAM HISTORY:  Ver 1.0  T. Logan - Most routines are new
 #include <sys/time.h>
 #include "ardop_defs.h"
 #include "locinc.h"
+#include <glib.h>
 
-/* Global Variables used by the complexFloat Arithmetic Routines */
-complexFloat a,b,x;
-float d;
-int i;
-
+/* The complexFloat Arithmetic Routines keep nothing outside their own
+   stack frames, so they can be used from any number of threads. */
 float  Cabs(complexFloat a)
 {
-  d = sqrt (a.real*a.real + a.imag*a.imag);
-  return d;
+  return sqrt (a.real*a.real + a.imag*a.imag);
 }
 
 complexFloat Cconj(complexFloat a)
 {
+  complexFloat x;
   x.real = a.real;
   x.imag = -a.imag;
   return x;
@@ -68,6 +66,7 @@ complexFloat Cconj(complexFloat a)
 
 complexFloat Czero()
 {
+  complexFloat x;
   x.real = 0.0;
   x.imag = 0.0;
   return x;
@@ -75,6 +74,7 @@ complexFloat Czero()
 
 complexFloat Cadd (complexFloat a, complexFloat b)
 {
+  complexFloat x;
   x.real = a.real+b.real;
   x.imag = a.imag+b.imag;
   return x;
@@ -82,6 +82,7 @@ complexFloat Cadd (complexFloat a, complexFloat b)
 
 complexFloat Cmplx(float a, float b)
 {
+  complexFloat x;
   x.real = a;
   x.imag = b;
   return x;
@@ -89,6 +90,7 @@ complexFloat Cmplx(float a, float b)
 
 complexFloat Csmul(float s, complexFloat a)
 {
+  complexFloat x;
   x.real=s*a.real;
   x.imag=s*a.imag;
   return x;
@@ -96,6 +98,7 @@ complexFloat Csmul(float s, complexFloat a)
 
 complexFloat Cmul (complexFloat a, complexFloat b)
 {
+  complexFloat x;
   x.real = a.real*b.real - a.imag*b.imag;
   x.imag = a.real*b.imag + a.imag*b.real;
   return x;
@@ -113,13 +116,20 @@ HISTORY: 1.0 - Tom Logan   4/97  Modified from stopwatch functions
 void elapse(int fnc)
   {
     struct timeval tp2;
-    static struct timeval tp1;
-
+    /* One start time per thread: ardop writes one patch while it
+       processes the next. */
+    static GPrivate tp1_key = G_PRIVATE_INIT (g_free);
+    struct timeval *tp1 = g_private_get (&tp1_key);
+
+    if (tp1 == NULL) {
+      tp1 = g_new0 (struct timeval, 1);
+      g_private_set (&tp1_key, tp1);
+    }
     if (fnc == 0)
-      gettimeofday(&tp1,NULL);
+      gettimeofday(tp1,NULL);
     else {
       gettimeofday(&tp2,NULL);
-      if (!quietflag) printf("   elapsed time = %i seconds.\n\n",(int)(tp2.tv_sec-tp1.tv_sec));
+      if (!quietflag) printf("   elapsed time = %i seconds.\n\n",(int)(tp2.tv_sec-tp1->tv_sec));
     }
   }
 
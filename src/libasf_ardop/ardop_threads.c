@@ -0,0 +1,126 @@
+/*****************************************************************************
+NAME: ardop_threads.c
+
+DESCRIPTION:
+    Helpers for spreading the per-line work of the patch routines
+    (rciq, the azimuth transforms, rmpatch, acpatch) over several
+    threads.  Each of those loops treats its lines independently, so
+    the lines are simply handed out in blocks to worker threads.
+    Each worker gets a number, so the caller can give it its own
+    scratch buffers.  Loops that do better working on several lines
+    at once (rciq) can take whole blocks instead.
+
+    The number of threads defaults to one per processor, and can be
+    changed with ardop_set_thread_count.  With one thread, everything
+    runs on the calling thread just like it used to.
+*****************************************************************************/
+#include "asf.h"
+#include "asf_meta.h"
+#include "ardop_defs.h"
+#include <glib.h>
+
+/*Lines are handed to a worker ARDOP_BLOCK_LINES (ardop_defs.h) at a
+time.  Neighboring lines share cache lines in the transposed trans
+array, so it pays to keep them together.*/
+
+static int ardop_thread_count = 0;
+
+void ardop_set_thread_count(int thread_count)
+{
+  ardop_thread_count = thread_count;
+}
+
+int ardop_get_thread_count(void)
+{
+  if (ardop_thread_count > 0)
+    return ardop_thread_count;
+  return g_get_num_processors();
+}
+
+typedef struct {
+  int n_lines;
+  ardop_block_func func;
+  void *data;
+  gint next_line;/*Next block to hand out (atomic).*/
+} blockJob;
+
+typedef struct {
+  blockJob *job;
+  int worker;
+} blockWorker;
+
+static gpointer blockWorkerThread(gpointer data)
+{
+  blockWorker *w = data;
+  blockJob *job = w->job;
+
+  while (TRUE) {
+    int first = g_atomic_int_add(&job->next_line, ARDOP_BLOCK_LINES);
+    if (first >= job->n_lines)
+      break;
+    job->func(job->data, w->worker, first,
+              MIN(first + ARDOP_BLOCK_LINES, job->n_lines));
+  }
+  return NULL;
+}
+
+int ardop_worker_count(int n_lines)
+{
+  int n_workers = ardop_get_thread_count();
+  int n_blocks = (n_lines + ARDOP_BLOCK_LINES - 1) / ARDOP_BLOCK_LINES;
+  if (n_workers > n_blocks)
+    n_workers = n_blocks;
+  if (n_workers < 1)
+    n_workers = 1;
+  return n_workers;
+}
+
+void ardop_parallel_blocks(int n_lines, int n_workers,
+                           ardop_block_func func, void *data)
+{
+  blockJob job;
+  blockWorker *workers = g_new(blockWorker, n_workers);
+  GThread **threads = g_new(GThread *, n_workers);
+  int i;
+
+  job.n_lines = n_lines;
+  job.func = func;
+  job.data = data;
+  job.next_line = 0;
+
+  for (i=0; i<n_workers; i++) {
+    workers[i].job = &job;
+    workers[i].worker = i;
+  }
+  /*Worker 0 runs on the calling thread.*/
+  for (i=1; i<n_workers; i++)
+    threads[i] = g_thread_new("ardop", blockWorkerThread, &workers[i]);
+  blockWorkerThread(&workers[0]);
+  for (i=1; i<n_workers; i++)
+    g_thread_join(threads[i]);
+
+  g_free(threads);
+  g_free(workers);
+}
+
+typedef struct {
+  ardop_line_func func;
+  void *data;
+} lineJob;
+
+static void lineBlock(void *data, int worker, int first, int last)
+{
+  lineJob *job = data;
+  int line;
+  for (line=first; line<last; line++)
+    job->func(job->data, worker, line);
+}
+
+void ardop_parallel_lines(int n_lines, int n_workers,
+                          ardop_line_func func, void *data)
+{
+  lineJob job;
+  job.func = func;
+  job.data = data;
+  ardop_parallel_blocks(n_lines, n_workers, lineBlock, &job);
+}
@@ -21,12 +21,14 @@
 /****************************************************************
 FUNCTION NAME: cfft1d - performs forward and reverse 1d ffts 
 SYNTAX: cfft1d(int n, complexFloat *c, int dir)
+        cfft1d_rows(int n, int rows, complexFloat *c, int dir)
 PARAMETERS:
     NAME:   TYPE:       PURPOSE:
     --------------------------------------------------------
     n       int	      length of the vector to transform
     c 	    complexFloat *  pointer to vector to transform
     dir	    int	      operations flag: -1 forward, 1 reverse, 0 init.
+    rows    int	      number of consecutive vectors to transform
     
 DESCRIPTION:
     Performs a fourier transform of the input data using the asf_fft.a
@@ -36,38 +38,42 @@ RETURN VALUE:	None
 
 SPECIAL CONSIDERATIONS:
    Automatically initializes fft cosine/coefficients array.
-   Keeps work array EVEN if different size fft is called for.
+   The transforms go through the plans in fft_plan.h, which hold their
+   own tables, so different sized ffts (range and azimuth) can be
+   running in different threads at once.  The plans for every size
+   initialized are kept until the program exits.  Initialization is
+   serialized, but it must be finished before any thread transforms
+   with that size.  n must be a power of two.
 
 ****************************************************************/
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
-#include "fft.h"
+#include "fft_plan.h"
+#include <glib.h>
+
+G_LOCK_DEFINE_STATIC(fft_init);
+
+/*Plans by log2 of their size.*/
+static fft_plan *plans[8*sizeof(int)];
 
 void cfft1d(int n, complexFloat *c, int dir)
 {
-        static int prev_m = 0;
  	int m=(int)(log(n)/log(2.0)+0.5);
 	if (dir == 0)
 	{
-            //printf("fftInit called for m=%d\n", m);
-            if (prev_m != m) {
-                if (prev_m > 0) {
-                    //printf("Freeing FFT data for m=%d\n", prev_m);
-                    fftFree();
-                }
-		int ret=fftInit(m);
-		if (ret!=0) {
-		  sprintf(errbuf,"   ERROR: Problem %d in FFT!\n",ret);
-		  printErr(errbuf);
-		}
-                prev_m = m;
-            } else {
-                //printf("Already initialized FFT for m=%d.\n", m);
-            }
+		G_LOCK(fft_init);
+		if (plans[m]==NULL)
+		  plans[m]=fft_plan_get(n);
+		G_UNLOCK(fft_init);
 	}
-	if (dir > 0)  iffts((float *)c,m,1);
-	if (dir < 0)  ffts((float *)c,m, 1);
+	if (dir > 0)  fft_inverse(plans[m],c);
+	if (dir < 0)  fft_forward(plans[m],c);
 }
 
-
+void cfft1d_rows(int n, int rows, complexFloat *c, int dir)
+{
+ 	int m=(int)(log(n)/log(2.0)+0.5);
+	if (dir > 0)  fft_inverse_rows(plans[m],c,rows);
+	if (dir < 0)  fft_forward_rows(plans[m],c,rows);
+}
@@ -286,6 +286,13 @@ void debugWritePatch(const patch *p,char *basename)
   patchToRGBImage(outname, TRUE);
 }
 
+/*Forward transform one range line of the patch along azimuth.*/
+static void transformLine(void *data,int worker,int lineNo)
+{
+  patch *p=data;
+  cfft1d(p->n_az,&p->trans[lineNo*p->n_az],-1);
+}
+
 /*
   processPatch:
   Performs all processing necessary on the given patch.
@@ -300,20 +307,29 @@ void debugWritePatch(const patch *p,char *basename)
 void processPatch(patch *p,const getRec *signalGetRec,const rangeRef *r,
           const satellite *s)
 {
-  int i;
-
   update_status("Range compressing");
   if (!quietflag) printf("   RANGE COMPRESSING CHANNELS...\n");
   elapse(0);
   rciq(p,signalGetRec,r);
   if (!quietflag) elapse(1);
+  azimuthCompressPatch(p,s);
+}
+
+/*
+  azimuthCompressPatch:
+  Everything processPatch does after range compression.  Each step
+  works on the lines of the patch in parallel.
+*/
+void azimuthCompressPatch(patch *p,const satellite *s)
+{
   if (s->debugFlag & AZ_RAW_T) debugWritePatch(p,"az_raw_t");
 
   update_status("Starting azimuth compression");
   if (!quietflag) printf("   TRANSFORMING LINES...\n");
   elapse(0);
   cfft1d(p->n_az,NULL,0);
-  for (i=0; i<p->n_range; i++) cfft1d(p->n_az,&p->trans[i*p->n_az],-1);
+  ardop_parallel_lines(p->n_range,ardop_worker_count(p->n_range),
+                       transformLine,p);
   if (!quietflag) elapse(1);
   if (s->debugFlag & AZ_RAW_F) debugWritePatch(p,"az_raw_f");
   if (!(s->debugFlag & NO_RCM))
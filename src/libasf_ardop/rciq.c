@@ -19,15 +19,17 @@
 *									      *
 ******************************************************************************/
 /****************************************************************
-FUNCTION NAME: rciq - Read a patch from file
+FUNCTION NAME: rciq - Read and range compress a patch
 
 SYNTAX: rciq(p,signalGetRec,r)
+        rciq_raw(p,raw,r)
 
 PARAMETERS:
     NAME:       TYPE:           PURPOSE:
     --------------------------------------------------------
     p		patch 		Output storage
     signalGetRec getRec		Allow raw signal data input.
+    raw		rawPatch	Signal data already read by readRawPatch.
     r		rangeRef	Range Reference Function
 
 DESCRIPTION:
@@ -36,6 +38,12 @@ DESCRIPTION:
     Multiply the data by the reference function,
     Perform a reverse transform on the data.
 
+    rciq reads the data itself; rciq_raw works on data that was read
+    beforehand (so that ardop can read the next patch while it
+    processes this one).  The lines are compressed in parallel, in
+    blocks of ARDOP_BLOCK_LINES lines that are transformed with one
+    call and transposed into the patch together.
+
 RETURN VALUE: None
 
 SPECIAL CONSIDERATIONS:
@@ -49,81 +57,167 @@ PROGRAM HISTORY:  Converted from H Zebker's rciq.c - T. Logan 8/96
 
 extern struct ARDOP_PARAMS g;/*ARDOP Globals, defined in ardop_params.h*/
 
-void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r)
+/*newRawPatch: allocates room for n_az lines of lineLen signal samples.*/
+rawPatch *newRawPatch(int n_az,int lineLen)
 {
-  static complexFloat *fft=NULL;
-  register int i,lineNo;
-  int readSamples=p->n_range+r->refLen;/*readSamples is the number of samples 
-				  of uncompressed signal which are to be read in.*/
-  patch *r_f=NULL, *raw_f=NULL, *raw_t=NULL, *r_x_f = NULL;
-
-  if (g.iflag & RANGE_REF_MAP) r_f=copyPatch(p);
-  if (g.iflag & RANGE_RAW_F) raw_f=copyPatch(p);
-  if (g.iflag & RANGE_RAW_T) raw_t=copyPatch(p);
-  if (g.iflag & RANGE_X_F) r_x_f=copyPatch(p);
+  rawPatch *raw=(rawPatch *)MALLOC(sizeof(rawPatch));
+  raw->n_az=n_az;
+  raw->lineLen=lineLen;
+  raw->nRead=0;
+  raw->lines=(complexFloat *)MALLOC(sizeof(complexFloat)*n_az*lineLen);
+  return raw;
+}
 
-/*Initialize fft buffer.*/
-  if (fft==NULL)
-    fft=(complexFloat *)MALLOC(sizeof(complexFloat)*r->rangeFFT);
+/*readRawPatch: reads the signal data for the patch starting at
+fromLine and fromSample in the input file.  This is the only place the
+signal file is read while processing, and it must only be called from
+one thread at a time.*/
+void readRawPatch(rawPatch *raw,const getRec *signalGetRec,int fromLine,int fromSample)
+{
+  int lineNo;
 
 /*Check to see if we're reading past the end of the file.*/
-  if (p->fromSample+readSamples>signalGetRec->nSamples)
-    readSamples=signalGetRec->nSamples-p->fromSample;
+  raw->nRead=raw->lineLen;
+  if (fromSample+raw->nRead>signalGetRec->nSamples)
+    raw->nRead=signalGetRec->nSamples-fromSample;
 
-/* Initialize the FFT routine */
-  cfft1d(r->rangeFFT,fft,0);	
-
-  for (lineNo=0; lineNo<p->n_az; lineNo++)
-  {
-    if(!quietflag && ((lineNo%1024) == 0)) 
-      asfPrintStatus("   ...Processing Line %i\n",lineNo); 
-
-  /*Read i/q values into fft input buffer.*/
-    getSignalLine(signalGetRec,p->fromLine+lineNo,fft,p->fromSample,readSamples);
-
-  /*Zero-fill the end of the FFT buffer.*/	
-    for (i=readSamples;i<r->rangeFFT;i++)
-      fft[i].real = fft[i].imag = 0.0;
-    if (raw_t) {
-      for (i=0; i<p->n_range; i++) 
-        raw_t->trans[i*p->n_az+lineNo]=fft[i];
-    }
-  /* forward transform the data.*/
-      cfft1d(r->rangeFFT,fft,-1);
-      if (raw_f) {
-        for (i=0; i<p->n_range; i++)
-          raw_f->trans[i*p->n_az+lineNo]=fft[i];
-      }
-  /*Multiply by the reference function*/
-    if (!(g.iflag & NO_RANGE))
-    {
-      for (i=0; i<r->rangeFFT; i++)
-      {
-        float tmp_r = fft[i].real;
-        fft[i].real = tmp_r*r->ref[i].real - fft[i].imag*r->ref[i].imag;
-        fft[i].imag = tmp_r*r->ref[i].imag + fft[i].imag*r->ref[i].real;
-      }
-    }
-    if (r_x_f) {
-      for (i=0; i<p->n_range; i++) 
-	r_x_f->trans[i*p->n_az+lineNo] = fft[i];
-    }
+  for (lineNo=0; lineNo<raw->n_az; lineNo++)
+    getSignalLine(signalGetRec,fromLine+lineNo,&raw->lines[lineNo*raw->lineLen],
+                  fromSample,raw->nRead);
+}
+
+void destroyRawPatch(rawPatch *raw)
+{
+  FREE(raw->lines);
+  FREE(raw);
+}
 
-  /*Reverse transform the (now range-compressed) data.*/
-    cfft1d(r->rangeFFT,fft,1);
+typedef struct {
+  patch *p;
+  const rawPatch *raw;
+  const rangeRef *r;
+  complexFloat **fft;/*One FFT buffer per worker, for a block of lines.*/
+  patch *r_f, *raw_f, *raw_t, *r_x_f;/*Debugging output (may be NULL).*/
+} rciqJob;
+
+/*transposeLines: copies nLines lines of src (stride values apart) into
+lines [first,first+nLines) of the transposed trans array of dest.  The
+nLines values of each range bin are adjacent in trans, so each range
+bin is one short run of writes (instead of one write per cache line, as
+with a line at a time), while the reads walk nLines rows in step.*/
+static void transposeLines(patch *dest,const complexFloat *src,int stride,
+                           int first,int nLines)
+{
+  register int i,l;
+  for (i=0; i<dest->n_range; i++) {
+    complexFloat *out=&dest->trans[i*dest->n_az+first];
+    for (l=0; l<nLines; l++)
+      out[l]=src[l*stride+i];
+  }
+}
 
-  /* Copy data into the p->trans array - transposed */
-    for (i=0; i<p->n_range; i++) 
-      p->trans[i*p->n_az+lineNo]=fft[i];
-    if (r_f) {
-      for (i=0; i<p->n_range; i++)
-       r_f->trans[i*p->n_az+lineNo] = r->ref[i];
+/*refMultiply: multiplies each of the rows vectors of n values in x by
+ref.  Kept to simple loads and stores with no aliasing between the
+temporaries, so the compiler can vectorize it.*/
+static void refMultiply(complexFloat *x,const complexFloat *ref,int n,int rows)
+{
+  register int i,l;
+  for (l=0; l<rows; l++) {
+    complexFloat *line=&x[l*n];
+    for (i=0; i<n; i++)
+    {
+      float re = line[i].real, im = line[i].imag;
+      line[i].real = re*ref[i].real - im*ref[i].imag;
+      line[i].imag = re*ref[i].imag + im*ref[i].real;
     }
   }
-  if (r_f) {debugWritePatch(r_f,"range_ref_map"); destroyPatch(r_f);}
-  if (raw_t) {debugWritePatch(raw_t,"range_raw_t"); destroyPatch(raw_t);}
-  if (raw_f) {debugWritePatch(raw_f,"range_raw_f"); destroyPatch(raw_f);}
-  if (r_x_f) {debugWritePatch(r_x_f,"range_X_f"); destroyPatch(r_x_f);}
+}
+
+/*rciq_block: range compresses lines [first,last).  The lines are
+transformed together, and written to trans together.*/
+static void rciq_block(void *data,int worker,int first,int last)
+{
+  rciqJob *job=data;
+  patch *p=job->p;
+  const rangeRef *r=job->r;
+  complexFloat *fft=job->fft[worker];
+  int n=r->rangeFFT,nLines=last-first;
+  int readSamples=job->raw->nRead;
+  register int i,l;
+
+  if(!quietflag && ((first%1024) == 0))
+    asfPrintStatus("   ...Processing Line %i\n",first);
+
+/*Copy i/q values into fft input buffer, zero-filling the end of each line.*/
+  for (l=0; l<nLines; l++) {
+    complexFloat *line=&fft[l*n];
+    memcpy(line,&job->raw->lines[(first+l)*job->raw->lineLen],
+           sizeof(complexFloat)*readSamples);
+    for (i=readSamples;i<n;i++)
+      line[i].real = line[i].imag = 0.0;
+  }
+  if (job->raw_t) transposeLines(job->raw_t,fft,n,first,nLines);
+
+/* forward transform the data.*/
+  cfft1d_rows(n,nLines,fft,-1);
+  if (job->raw_f) transposeLines(job->raw_f,fft,n,first,nLines);
+
+/*Multiply by the reference function*/
+  if (!(g.iflag & NO_RANGE))
+    refMultiply(fft,r->ref,n,nLines);
+  if (job->r_x_f) transposeLines(job->r_x_f,fft,n,first,nLines);
+
+/*Reverse transform the (now range-compressed) data.*/
+  cfft1d_rows(n,nLines,fft,1);
+
+/* Copy data into the p->trans array - transposed */
+  transposeLines(p,fft,n,first,nLines);
+  if (job->r_f) {
+    for (i=0; i<p->n_range; i++)
+      for (l=first; l<last; l++)
+        job->r_f->trans[i*p->n_az+l] = r->ref[i];
+  }
+}
+
+void rciq_raw(patch *p,const rawPatch *raw,const rangeRef *r)
+{
+  rciqJob job;
+  int n_workers=ardop_worker_count(p->n_az);
+  int i;
+
+  job.p=p;
+  job.raw=raw;
+  job.r=r;
+  job.r_f=job.raw_f=job.raw_t=job.r_x_f=NULL;
+  if (g.iflag & RANGE_REF_MAP) job.r_f=copyPatch(p);
+  if (g.iflag & RANGE_RAW_F) job.raw_f=copyPatch(p);
+  if (g.iflag & RANGE_RAW_T) job.raw_t=copyPatch(p);
+  if (g.iflag & RANGE_X_F) job.r_x_f=copyPatch(p);
+
+/*Initialize fft buffers.*/
+  job.fft=(complexFloat **)MALLOC(sizeof(complexFloat *)*n_workers);
+  for (i=0; i<n_workers; i++)
+    job.fft[i]=(complexFloat *)MALLOC(sizeof(complexFloat)*ARDOP_BLOCK_LINES*r->rangeFFT);
+
+/* Initialize the FFT routine */
+  cfft1d(r->rangeFFT,NULL,0);
+
+  ardop_parallel_blocks(p->n_az,n_workers,rciq_block,&job);
+
+  for (i=0; i<n_workers; i++)
+    FREE(job.fft[i]);
+  FREE(job.fft);
+  if (job.r_f) {debugWritePatch(job.r_f,"range_ref_map"); destroyPatch(job.r_f);}
+  if (job.raw_t) {debugWritePatch(job.raw_t,"range_raw_t"); destroyPatch(job.raw_t);}
+  if (job.raw_f) {debugWritePatch(job.raw_f,"range_raw_f"); destroyPatch(job.raw_f);}
+  if (job.r_x_f) {debugWritePatch(job.r_x_f,"range_X_f"); destroyPatch(job.r_x_f);}
   return;
 }
 
+void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r)
+{
+  rawPatch *raw=newRawPatch(p->n_az,p->n_range+r->refLen);
+  readRawPatch(raw,signalGetRec,p->fromLine,p->fromSample);
+  rciq_raw(p,raw,r);
+  destroyRawPatch(raw);
+}
@@ -54,18 +54,90 @@ PROGRAM HISTORY:  converted from H. Zebker's RMpatch.f - T. Logan 8/96
 #include "ardop_defs.h"
 void create_sinc(int nfilter, float *xintp);
 
-void rmpatch(patch *p,const satellite *s)
-{
 #define OVERLAP 10 /*Zero pixels to append to end of single-line buffer*/
 #define NUM_SINC 2048
-    static float *sincInterp=NULL;
-    static complexFloat *trans_buf,*interpolated_line;
-    static double  *SR;
-    static float   *f0, *f_rate, *xResampVec;
 
+typedef struct {
+    patch *p;
+    const satellite *s;
+    const float *sincInterp;
     double wavPerPix;/*Wavelengths per pixel*/
     double invN_azPRF,invPRF;
-    int     azimuth_line;
+    float *f0, *f_rate, *xResampVec;/*Per range pixel*/
+    complexFloat **trans_buf,**interpolated_line;/*Per worker*/
+} rmpatchJob;
+
+/*Range migrate one line along range.*/
+static void rmpatch_line(void *data,int worker,int azimuth_line)
+{
+    rmpatchJob *job=data;
+    patch *p=job->p;
+    const satellite *s=job->s;
+    const float *sincInterp=job->sincInterp;
+    const float *f0=job->f0,*f_rate=job->f_rate,*xResampVec=job->xResampVec;
+    complexFloat *trans_buf=job->trans_buf[worker];
+    complexFloat *interpolated_line=job->interpolated_line[worker];
+    register int i;
+
+    /*Buffer this line of complex data (adding zeros at the ends).*/
+    for (i=0;i<OVERLAP;i++)
+        trans_buf[i]=Czero();
+    for (i=0; i<p->n_range; i++)
+        trans_buf[i+OVERLAP]=p->trans[i*p->n_az+azimuth_line];
+    for (i=0;i<OVERLAP;i++)
+        trans_buf[i+OVERLAP+p->n_range]=Czero();
+    /*.. for each pixel along range...*/
+    for (i=0; i<p->n_range; i++)
+    {
+        /*Get the amount to move this pixel along range. */
+        register float interp_real,interp_imag;
+        float st,offset,offset_frac;
+        int offset_int;
+        float freq=(float)azimuth_line*job->invN_azPRF;
+        /* frequencies must be within 0.5*prf of centroid */
+        freq -= (float) (NINT((freq-f0[i])*job->invPRF) * s->prf);
+
+        /*Figure out the slow time for this line*/
+        st=(freq-f0[i])/f_rate[i];
+        offset = xResampVec[i]+i-0.5*job->wavPerPix*(
+                 f0[i]*st+f_rate[i]*0.5*st*st);
+        offset_int = (int) offset;
+        offset_frac = offset - floor(offset);
+        /*Now interpolate 8 pixels of the trans array into one pixel of this new array,*/
+        interp_real=interp_imag=0.0;
+        if (offset_int >= 0 && offset_int < p->n_range)
+        {
+            register int k,index=offset_int-3+OVERLAP;
+            int kernelNo = (int)(offset_frac*(float)NUM_SINC);
+            if (kernelNo>=NUM_SINC)
+            {
+                if (!quietflag) printf("   Kernel_no=%i,offset_frac=%f!\n",kernelNo,offset_frac);
+                kernelNo=NUM_SINC-1;
+            }
+            kernelNo*=8;/*Each interpolation kernel has size 8.*/
+            for (k = 0; k < 8; k++)
+            {
+                float scale=sincInterp[kernelNo+k];
+                interp_real += scale*trans_buf[index].real;
+                interp_imag += scale*trans_buf[index++].imag;
+            }
+        }
+        interpolated_line[i].real = interp_real;
+        interpolated_line[i].imag = interp_imag;
+    }
+    /*Write this interpolated range line back into the trans array.*/
+    for (i=0; i<p->n_range; i++)
+        p->trans[i*p->n_az+azimuth_line] = interpolated_line[i];
+}
+
+void rmpatch(patch *p,const satellite *s)
+{
+    /*The sinc table never changes, so it's only built once.  rmpatch
+    itself is only called from one thread at a time.*/
+    static float *sincInterp=NULL;
+    double  *SR;
+    rmpatchJob job;
+    int n_workers=ardop_worker_count(p->n_az);
     register int i;
     float outScale,outOffset;
 
@@ -74,19 +146,27 @@ void rmpatch(patch *p,const satellite *s)
     {
         sincInterp=(float *)MALLOC(8*sizeof(float)*NUM_SINC);
         create_sinc(NUM_SINC,sincInterp);
-        trans_buf=(complexFloat *)MALLOC(sizeof(complexFloat)*(p->n_range+2*OVERLAP));
-        interpolated_line=(complexFloat *)MALLOC(sizeof(complexFloat)*p->n_range);
-        SR=(double *)MALLOC(sizeof(double)*p->n_range);
-        f0=(float *)MALLOC(sizeof(float)*p->n_range);
-        f_rate=(float *)MALLOC(sizeof(float)*p->n_range);
-        xResampVec=(float *)MALLOC(sizeof(float)*p->n_range);
+    }
+    SR=(double *)MALLOC(sizeof(double)*p->n_range);
+    job.p=p;
+    job.s=s;
+    job.sincInterp=sincInterp;
+    job.f0=(float *)MALLOC(sizeof(float)*p->n_range);
+    job.f_rate=(float *)MALLOC(sizeof(float)*p->n_range);
+    job.xResampVec=(float *)MALLOC(sizeof(float)*p->n_range);
+    job.trans_buf=(complexFloat **)MALLOC(sizeof(complexFloat *)*n_workers);
+    job.interpolated_line=(complexFloat **)MALLOC(sizeof(complexFloat *)*n_workers);
+    for (i=0; i<n_workers; i++)
+    {
+        job.trans_buf[i]=(complexFloat *)MALLOC(sizeof(complexFloat)*(p->n_range+2*OVERLAP));
+        job.interpolated_line[i]=(complexFloat *)MALLOC(sizeof(complexFloat)*p->n_range);
     }
 
     /*Azimuth distance on the ground per pulse.*/
-    wavPerPix=s->wavl/p->slantPer;
+    job.wavPerPix=s->wavl/p->slantPer;
 
-    invN_azPRF=s->prf/(float)(p->n_az);
-    invPRF=1.0/s->prf;
+    job.invN_azPRF=s->prf/(float)(p->n_az);
+    job.invPRF=1.0/s->prf;
 
 /*Since we resample based on the output pixel, but we are given the scale
 and offset as a function of input pixel, we must convert:*/
@@ -96,66 +176,27 @@ and offset as a function of input pixel, we must convert:*/
     for (i=0; i<p->n_range; i++)
     {
         SR[i]     = p->slantToFirst + i*p->slantPer;/* slant range to the line */
-        f0[i]= p->fd+p->fdd*i+p->fddd*i*i;    /* Doppler coefficient*/
-        f_rate[i] = getDopplerRate(SR[i],f0[i],p->g);
-        xResampVec[i]   = outScale * i + outOffset; /* interferogram range resampling. */
+        job.f0[i]= p->fd+p->fdd*i+p->fddd*i*i;    /* Doppler coefficient*/
+        job.f_rate[i] = getDopplerRate(SR[i],job.f0[i],p->g);
+        job.xResampVec[i]   = outScale * i + outOffset; /* interferogram range resampling. */
         if (s->ideskew == 1)
-          xResampVec[i]+=((SR[i]-SR[0]-(s->wavl/4.0)*f0[i]*f0[i]/f_rate[i]))/p->slantPer-i;
+          job.xResampVec[i]+=((SR[i]-SR[0]-(s->wavl/4.0)*job.f0[i]*job.f0[i]/job.f_rate[i]))/p->slantPer-i;
     }
     /*For each line along range...*/
-    for (azimuth_line=0; azimuth_line<p->n_az; azimuth_line++)
+    ardop_parallel_lines(p->n_az,n_workers,rmpatch_line,&job);
+    /* ... end of along-range line loop */
+
+    for (i=0; i<n_workers; i++)
     {
-    /*Buffer this line of complex data (adding zeros at the ends).*/
-        for (i=0;i<OVERLAP;i++)
-            trans_buf[i]=Czero();
-        for (i=0; i<p->n_range; i++)
-            trans_buf[i+OVERLAP]=p->trans[i*p->n_az+azimuth_line];
-        for (i=0;i<OVERLAP;i++)
-            trans_buf[i+OVERLAP+p->n_range]=Czero();
-        /*.. for each pixel along range...*/
-        for (i=0; i<p->n_range; i++)
-        {
-            /*Get the amount to move this pixel along range. */
-            register float interp_real,interp_imag;
-            float st,offset,offset_frac;
-            int offset_int;
-            float freq=(float)azimuth_line*invN_azPRF;
-            /* frequencies must be within 0.5*prf of centroid */
-            freq -= (float) (NINT((freq-f0[i])*invPRF) * s->prf);
-
-            /*Figure out the slow time for this line*/
-            st=(freq-f0[i])/f_rate[i];
-            offset = xResampVec[i]+i-0.5*wavPerPix*(
-                     f0[i]*st+f_rate[i]*0.5*st*st);
-            offset_int = (int) offset;
-            offset_frac = offset - floor(offset);
-            /*Now interpolate 8 pixels of the trans array into one pixel of this new array,*/
-            interp_real=interp_imag=0.0;
-            if (offset_int >= 0 && offset_int < p->n_range)
-            {
-                register int k,index=offset_int-3+OVERLAP;
-                int kernelNo = (int)(offset_frac*(float)NUM_SINC);
-                if (kernelNo>=NUM_SINC)
-                {
-                    if (!quietflag) printf("   Kernel_no=%i,offset_frac=%f!\n",kernelNo,offset_frac);
-                    kernelNo=NUM_SINC-1;
-                }
-                kernelNo*=8;/*Each interpolation kernel has size 8.*/
-                for (k = 0; k < 8; k++)
-                {
-                    float scale=sincInterp[kernelNo+k];
-                    interp_real += scale*trans_buf[index].real;
-                    interp_imag += scale*trans_buf[index++].imag;
-                }
-            }
-            interpolated_line[i].real = interp_real;
-            interpolated_line[i].imag = interp_imag;
-        }
-        /*Write this interpolated range line back into the trans array.*/
-        for (i=0; i<p->n_range; i++)
-            p->trans[i*p->n_az+azimuth_line] = interpolated_line[i];
+        FREE(job.trans_buf[i]);
+        FREE(job.interpolated_line[i]);
     }
-    /* ... end of along-range line loop */
+    FREE(job.trans_buf);
+    FREE(job.interpolated_line);
+    FREE(job.f0);
+    FREE(job.f_rate);
+    FREE(job.xResampVec);
+    FREE(SR);
 }
 /****************************************************************
 FUNCTION NAME:  create_sinc
@@ -19,6 +19,7 @@
 #include "dateUtil.h"
 #include <ctype.h>
 #include <string.h>
+#include <glib.h>
 #include <sys/types.h> /* 'DIR' structure (for opendir) */
 #include <dirent.h>    /* for opendir itself            */
 
@@ -1764,6 +1765,17 @@ static int check_config(const char *configFileName, convert_config *cfg)
       asfPrintError("Export format 'POLSARPRO' requires the same format "
 		    "as input format!\n");
 
+    // Cloud optimized GeoTIFF: tiled and compressed, with overviews
+    if (cfg->export->cog &&
+	strncmp(uc(cfg->export->format), "TIFF", 4) != 0 &&
+	strncmp(uc(cfg->export->format), "GEOTIFF", 7) != 0)
+      asfPrintError("Cloud optimized output requires TIFF or GEOTIFF as "
+		    "export format!\n");
+    if (!asf_export_set_cog(cfg->export->cog ?
+			    cfg->export->compression : NULL, 0))
+      asfPrintError("Selected compression (%s) not supported\n",
+		    cfg->export->compression);
+
     // If RGB Banding option is "ignore,ignore,ignore" then the
     // user has probably been using the gui, and didn't pick
     // anything for any of the RGB channels.
@@ -2183,6 +2195,12 @@ static char *do_processing(convert_config *cfg, const char *inFile_in, int saveD
     uavsar = TRUE;
   meta_free(meta);
 
+  // Steps that work line by line can be done while the next step reads
+  // their input, instead of writing a complete image into the tmp dir.
+  // When the intermediates are kept, every step writes its result.
+  int streaming = !cfg->general->intermediates;
+  LineFilter *stream_filter = NULL;
+
   if (cfg->general->external) {
     
     update_status("Running external program...");
@@ -2587,9 +2605,23 @@ static char *do_processing(convert_config *cfg, const char *inFile_in, int saveD
     else
       asfPrintError("No valid radiometry (%s) given!\n", 
 		    cfg->calibrate->radiometry);
-    check_return(asf_calibrate(inFile, outFile, radiometry,
-			       cfg->calibrate->wh_scale),
-		 "Applying calibration parameters (asf_calibrate)\n");
+
+    // Geocoding reads its input into tiles anyway, so it can calibrate
+    // the lines on the way in.  Only the metadata is written here.
+    // (Woods Hole scaled output is bytes, which geocoding would handle
+    // differently, so it is still written out.)
+    if (streaming && cfg->general->geocoding && !cfg->general->polarimetry &&
+	!cfg->calibrate->wh_scale)
+      stream_filter = asf_calibrate_filter(inFile, radiometry,
+					   cfg->calibrate->wh_scale);
+    if (stream_filter) {
+      meta_write(stream_filter->meta, outFile);
+      asfPrintStatus("Calibrating while geocoding.\n");
+    }
+    else
+      check_return(asf_calibrate(inFile, outFile, radiometry,
+				 cfg->calibrate->wh_scale),
+		   "Applying calibration parameters (asf_calibrate)\n");
 
   }
 
@@ -2681,10 +2713,18 @@ static char *do_processing(convert_config *cfg, const char *inFile_in, int saveD
     }
     
     // Pass in command line
+    asf_geocode_set_input_filter(stream_filter);
     check_return(asf_geocode_from_proj_file(cfg->geocoding->projection,
                                             force_flag, resample_method, average_height, datum,
 					    pixel_size, NULL, inFile, outFile, background_val),
 		   "geocoding data file (asf_geocode)\n");
+    asf_geocode_set_input_filter(NULL);
+    if (stream_filter) {
+      asfPrintStatus("Avoided about %.1f MB of temporary file I/O.\n",
+		     2*memory_image_file_bytes(stream_filter->meta)/1048576.0);
+      line_filter_free(stream_filter);
+      stream_filter = NULL;
+    }
   }
   
   if (cfg->general->testdata) {
@@ -2735,6 +2775,25 @@ static char *do_processing(convert_config *cfg, const char *inFile_in, int saveD
   return save_before_export;
 }
 
+// Applies the "job memory" and "job threads" settings.
+static void set_job_resources(convert_config *cfg)
+{
+  if (cfg->general->job_memory > 0)
+    asf_terrcorr_set_memory_budget((long long)cfg->general->job_memory*1048576);
+
+  int threads = cfg->general->job_threads;
+  if (threads > 0) {
+    ardop_set_thread_count(threads);
+    fftMatch_set_thread_count(threads);
+    raster_calc_set_thread_count(threads);
+    rtc_set_thread_count(threads);
+    deskew_dem_set_thread_count(threads);
+    polarimetric_decomp_set_thread_count(threads);
+    asf_geocode_set_thread_count(threads);
+    asf_export_set_thread_count(threads);
+  }
+}
+
 static int asf_convert_file(char *configFileName, int saveDEM)
 {
   char inFile[512], outFile[512];
@@ -2742,6 +2801,7 @@ static int asf_convert_file(char *configFileName, int saveDEM)
   convert_config *cfg = read_convert_config(configFileName);
   if (cfg->general->status_file && strlen(cfg->general->status_file) > 0)
     set_status_file(cfg->general->status_file);
+  set_job_resources(cfg);
   
   update_status("Processing...");
   
@@ -3434,6 +3494,171 @@ static int asf_convert_file(char *configFileName, int saveDEM)
   return TRUE;
 }
 
+static long long physical_memory(void)
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  long page_count = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (page_count > 0 && page_size > 0)
+    return (long long)page_count * page_size;
+#endif
+  return 0;
+}
+
+// One data set of a batch run.  Each is processed by its own
+// asf_mapready, so the quiet flag, tmp dir, log file and so on of one
+// can't get mixed up with another's.
+typedef struct {
+  char item[255];
+  char cfg_name[255];
+  char log[512];        // its own log, when several run at once
+  int ret;
+  double seconds;
+} batch_job_t;
+
+typedef struct {
+  batch_job_t *jobs;
+  int n_jobs;
+  int parallel;         // more than one job at a time
+  gint next_job;        // next job to hand out (atomic)
+  int n_ok, n_bad;
+  GMutex lock;          // for the counts, the log and the terminal
+} batch_run_t;
+
+// Adds a job's own log to ours.
+static void merge_job_log(const char *job_log)
+{
+  FILE *fp = fopen(job_log, "r");
+  if (!fp)
+    return;
+  if (fLog) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+      fwrite(buf, 1, n, fLog);
+    fflush(fLog);
+  }
+  fclose(fp);
+  remove(job_log);
+}
+
+static gpointer batch_worker(gpointer data)
+{
+  batch_run_t *run = data;
+  int ii;
+
+  while ((ii = g_atomic_int_add(&run->next_job, 1)) < run->n_jobs) {
+    batch_job_t *job = &run->jobs[ii];
+    char cmd[1024];
+
+    // The jobs running at once each get their own log, and stay
+    // quiet, so their output doesn't end up interleaved.
+    if (run->parallel)
+      sprintf(cmd, "%sasf_mapready%s -quiet -log %s %s",
+              get_argv0(), bin_postfix(), job->log, job->cfg_name);
+    else if (logflag)
+      sprintf(cmd, "%sasf_mapready%s -log %s %s",
+              get_argv0(), bin_postfix(), logFile, job->cfg_name);
+    else
+      sprintf(cmd, "%sasf_mapready%s %s",
+              get_argv0(), bin_postfix(), job->cfg_name);
+
+    g_mutex_lock(&run->lock);
+    asfPrintStatus("\nProcessing %s ...\n", job->item);
+    g_mutex_unlock(&run->lock);
+
+    gint64 start = g_get_monotonic_time();
+    job->ret = asfSystem("%s", cmd);
+    job->seconds = (g_get_monotonic_time() - start) / 1e6;
+
+    g_mutex_lock(&run->lock);
+    if (run->parallel)
+      merge_job_log(job->log);
+    if (job->ret != 0) {
+      asfPrintStatus("%s: failed\n", job->item);
+      ++run->n_bad;
+    }
+    else {
+      asfPrintStatus("%s: ok\n", job->item);
+      ++run->n_ok;
+    }
+    g_mutex_unlock(&run->lock);
+  }
+  return NULL;
+}
+
+// Number of jobs to run at once: "batch jobs" of them (0 for one per
+// processor), but no more than fit into the physical memory with
+// "job memory" each.
+static int batch_job_count(convert_config *cfg, int n_jobs)
+{
+  int n = cfg->general->batch_jobs;
+  if (n <= 0)
+    n = g_get_num_processors();
+  if (cfg->general->job_memory > 0) {
+    long long mem = physical_memory();
+    long long fit = mem / ((long long)cfg->general->job_memory*1048576);
+    if (mem > 0 && fit < n) {
+      asfPrintStatus("Only %lld data sets at a time fit into memory.\n", fit);
+      n = (int) fit;
+    }
+  }
+  if (n > n_jobs)
+    n = n_jobs;
+  return n < 1 ? 1 : n;
+}
+
+// Runs the jobs, n_threads at a time, and writes how each went into
+// summary_file.
+static void run_batch_jobs(batch_job_t *jobs, int n_jobs, int n_threads,
+                           const char *summary_file)
+{
+  batch_run_t run;
+  GThread **threads = MALLOC(sizeof(GThread *)*n_threads);
+  int ii;
+
+  run.jobs = jobs;
+  run.n_jobs = n_jobs;
+  run.parallel = n_threads > 1;
+  run.next_job = 0;
+  run.n_ok = run.n_bad = 0;
+  g_mutex_init(&run.lock);
+
+  if (run.parallel)
+    asfPrintStatus("Processing %d data sets at a time.\n", n_threads);
+  gint64 start = g_get_monotonic_time();
+
+  // The first worker runs in this thread.
+  for (ii=1; ii<n_threads; ++ii)
+    threads[ii] = g_thread_new("batch", batch_worker, &run);
+  batch_worker(&run);
+  for (ii=1; ii<n_threads; ++ii)
+    g_thread_join(threads[ii]);
+
+  double seconds = (g_get_monotonic_time() - start) / 1e6;
+  g_mutex_clear(&run.lock);
+  FREE(threads);
+
+  FILE *fp = FOPEN(summary_file, "w");
+  fprintf(fp, "# asf_mapready batch summary\n");
+  fprintf(fp, "# data set, status, processing time (s)\n");
+  for (ii=0; ii<n_jobs; ++ii)
+    fprintf(fp, "%s\t%s\t%.1f\n", jobs[ii].item,
+            jobs[ii].ret ? "failed" : "ok", jobs[ii].seconds);
+  fprintf(fp, "# %d ok, %d failed, %d at a time, %.1f s in all\n",
+          run.n_ok, run.n_bad, n_threads, seconds);
+  FCLOSE(fp);
+
+  asfPrintStatus("\n\nBatch Complete.\n");
+  asfPrintStatus("Successfully processed %d/%d file%s.\n", run.n_ok,
+      run.n_ok + run.n_bad, run.n_ok + run.n_bad == 1 ? "" : "s");
+
+  if (run.n_bad > 0)
+      asfPrintStatus("  *** %d file%s failed. ***\n", run.n_bad,
+          run.n_bad==1 ? "" : "s");
+  asfPrintStatus("Summary: %s\n", summary_file);
+}
+
 int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
 {
   convert_config *cfg;
@@ -3778,7 +4003,8 @@ int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
     char tmp_dir[255];
     char tmpCfgName[255];
     char line[255];
-    int n_ok = 0, n_bad = 0;
+    batch_job_t *jobs = NULL;
+    int n_jobs = 0;
     FILE *fBatch = FOPEN(cfg->general->batchFile, "r");
 
     strcpy(tmp_dir, cfg->general->tmp_dir);
@@ -3813,8 +4039,20 @@ int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
       FREE(tmpDir);
       FREE(tmpFile);
 
-      // Create temporary configuration file
-      create_and_set_tmp_dir(batchItem, cfg->general->default_out_dir, tmp_dir);
+      // Create temporary configuration file.  Every item gets a tmp dir
+      // of its own, numbered so that items of the same name do not share
+      // one: they may run at the same time, and each removes its tmp dir
+      // when done.  A "tmp dir" given in the configuration file holds
+      // them.
+      char itemName[512];
+      sprintf(itemName, "%s-%d", batchItemFile, n_jobs+1);
+      if (strlen(cfg->general->tmp_dir) > 0) {
+        create_and_set_tmp_dir(batchItem, batchItem, tmp_dir);
+        sprintf(tmp_dir, "%s%c%s", cfg->general->tmp_dir, DIR_SEPARATOR,
+                itemName);
+        create_clean_dir(tmp_dir);
+      }
+      create_and_set_tmp_dir(itemName, cfg->general->default_out_dir, tmp_dir);
       sprintf(tmpCfgName, "%s/%s.cfg", tmp_dir, batchItemFile);
 
 
@@ -3831,6 +4069,8 @@ int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
                 cfg->general->default_out_dir, DIR_SEPARATOR,
                 cfg->general->prefix, batchItemFile, cfg->general->suffix);
       fprintf(fConfig, "tmp dir = %s\n", tmp_dir);
+      fprintf(fConfig, "job memory = %d\n", cfg->general->job_memory);
+      fprintf(fConfig, "job threads = %d\n", cfg->general->job_threads);
       FCLOSE(fConfig);
       FREE(defaults);
 
@@ -3840,45 +4080,46 @@ int asf_convert_ext(int createflag, char *configFileName, int saveDEM)
                    "Could not update configuration file");
       free_convert_config(tmp_cfg);
 
-      // Run asf_mapready for temporary configuration file
-
-      // This is really quite a kludge-- we used to call the library
-      // function here, now we shell out and run the tool directly, sort
-      // of a step backwards, it seems.  Unfortunately, in order to keep
-      // processing the batch even if an error occurs, we're stuck with
-      // this method.  (Otherwise, we'd have to teach asfPrintError to
-      // get us back here, to continue the loop.)
-      asfPrintStatus("\nProcessing %s ...\n", batchItem);
-      char cmd[1024];
-      if (logflag) {
-          sprintf(cmd, "%sasf_mapready%s -log %s %s",
-                get_argv0(), bin_postfix(), logFile, tmpCfgName);
-      }
-      else {
-          sprintf(cmd, "%sasf_mapready%s %s",
-                get_argv0(), bin_postfix(), tmpCfgName);
-      }
-      int ret = asfSystem(cmd);
-
-      if (ret != 0) {
-          asfPrintStatus("%s: failed\n", batchItem);
-          ++n_bad;
-      } else {
-          asfPrintStatus("%s: ok\n", batchItem);
-          ++n_ok;
-      }
+      jobs = realloc(jobs, sizeof(batch_job_t)*(n_jobs+1));
+      batch_job_t *job = &jobs[n_jobs++];
+      strcpy(job->item, batchItem);
+      strcpy(job->cfg_name, tmpCfgName);
+      // next to the tmp dir, which asf_mapready removes when done
+      sprintf(job->log, "%s.log", tmp_dir);
+      job->ret = 0;
+      job->seconds = 0;
 
       strcpy(tmp_dir, cfg->general->tmp_dir);
     }
     FCLOSE(fBatch);
 
-    asfPrintStatus("\n\nBatch Complete.\n");
-    asfPrintStatus("Successfully processed %d/%d file%s.\n", n_ok,
-        n_ok + n_bad, n_ok + n_bad == 1 ? "" : "s");
+    // Run asf_mapready for each temporary configuration file
+
+    // This is really quite a kludge-- we used to call the library
+    // function here, now we shell out and run the tool directly, sort
+    // of a step backwards, it seems.  Unfortunately, in order to keep
+    // processing the batch even if an error occurs, we're stuck with
+    // this method.  (Otherwise, we'd have to teach asfPrintError to
+    // get us back here, to continue the loop.)  It does keep the data
+    // sets we process at the same time out of each other's way.
+    int n_threads = batch_job_count(cfg, n_jobs);
+    if (cfg->general->job_threads <= 0 && n_threads > 1) {
+      // share the processors
+      int ii, threads = MAX(1, (int)g_get_num_processors() / n_threads);
+      for (ii=0; ii<n_jobs; ++ii) {
+        tmp_cfg = read_convert_config(jobs[ii].cfg_name);
+        tmp_cfg->general->job_threads = threads;
+        write_convert_config(jobs[ii].cfg_name, tmp_cfg);
+        free_convert_config(tmp_cfg);
+      }
+    }
 
-    if (n_bad > 0)
-        asfPrintStatus("  *** %d file%s failed. ***\n", n_bad,
-            n_bad==1 ? "" : "s");
+    char *summary = appendToBasename(cfg->general->batchFile, "_summary");
+    char *summaryFile = appendExt(summary, ".txt");
+    run_batch_jobs(jobs, n_jobs, n_threads, summaryFile);
+    FREE(summaryFile);
+    FREE(summary);
+    free(jobs);
   }
   // Regular processing
   else {
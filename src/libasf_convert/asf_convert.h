@@ -34,6 +34,9 @@ typedef struct
   int dump_envi;          // true if we should dump .hdr files
   char *defaults;         // default values file
   char *batchFile;        // batch file name
+  int batch_jobs;         // batch items processed at once, 0: one per CPU
+  int job_memory;         // memory budget per item (MB), 0: default
+  int job_threads;        // threads per item, 0: one per CPU
   char *prefix;           // prefix for output file naming scheme
   char *suffix;           // suffix for output file naming scheme
   char *tmp_dir;          // name of the directory for intermediate files
@@ -239,6 +242,9 @@ typedef struct
   int truecolor;          // True color flag (bands 3-2-1 w/2-sigma contrast expansion)
   int falsecolor;         // False color flag (ditto, but bands 4-3-2)
   char *band;             // Band ID string ("HH", "HV", "01", etc) for single-band export
+  int cog;                // Cloud optimized GeoTIFF flag (tiled, with overviews)
+  char *compression;      // Cloud optimized GeoTIFF compression: DEFLATE, LZW,
+                          // ZSTD, NONE
 } s_export;
 
 typedef struct
@@ -284,7 +284,8 @@ int init_convert_config(char *configFile)
   // intermediates flag
   fprintf(fConfig, "# The intermediates flag indicates whether the intermediate processing\n"
           "# results are kept (1 for keeping them, 0 for deleting them at the end of the\n"
-          "# processing).\n\n");
+          "# processing).  When they are not kept, calibration followed by geocoding\n"
+          "# is done while geocoding reads its input, without an intermediate file.\n\n");
   fprintf(fConfig, "intermediates = 0\n\n");
   // quiet flag
   fprintf(fConfig, "# The quiet flag determines how much information is reported by the\n"
@@ -306,6 +307,21 @@ int init_convert_config(char *configFile)
   fprintf(fConfig, "# asf_mapready can be used in a batch mode to run a large number of data\n"
           "# sets through the processing flow with the same processing parameters.\n\n");
   fprintf(fConfig, "batch file = \n\n");
+  // batch jobs
+  fprintf(fConfig, "# In batch mode, this many data sets are processed at the same time\n"
+          "# (0 for one per processor).\n\n");
+  fprintf(fConfig, "batch jobs = 1\n\n");
+  // job memory
+  fprintf(fConfig, "# Memory (in MB) each data set may use to keep intermediate images in\n"
+          "# memory rather than in temporary files (0 for the default, a quarter of\n"
+          "# the physical memory).  In batch mode, no more data sets are processed at\n"
+          "# the same time than fit into the physical memory.\n\n");
+  fprintf(fConfig, "job memory = 0\n\n");
+  // job threads
+  fprintf(fConfig, "# Number of threads each data set is processed with (0 for one per\n"
+          "# processor, or in batch mode, the processors shared among the data sets\n"
+          "# processed at the same time).\n\n");
+  fprintf(fConfig, "job threads = 0\n\n");
   // prefix
   fprintf(fConfig, "# A prefix can be added to the outfile name to avoid overwriting\n"
           "# files (e.g. when running the same data sets through the processing flow\n"
@@ -416,6 +432,7 @@ void free_convert_config(convert_config *cfg)
             FREE(cfg->export->byte);
             FREE(cfg->export->lut);
             FREE(cfg->export->rgb);
+            FREE(cfg->export->compression);
             FREE(cfg->export);
         }
 	if (cfg->mosaic) {
@@ -486,6 +503,9 @@ convert_config *init_fill_convert_config(char *configFile)
   cfg->general->mosaic = 0;
   cfg->general->batchFile = (char *)MALLOC(sizeof(char)*255);
   strcpy(cfg->general->batchFile, "");
+  cfg->general->batch_jobs = 1;
+  cfg->general->job_memory = 0;
+  cfg->general->job_threads = 0;
   cfg->general->defaults = (char *)MALLOC(sizeof(char)*255);
   strcpy(cfg->general->defaults, "");
   cfg->general->status_file = (char *)MALLOC(sizeof(char)*1024);
@@ -655,6 +675,9 @@ convert_config *init_fill_convert_config(char *configFile)
   strcpy(cfg->export->band, "");
   cfg->export->truecolor = 0;
   cfg->export->falsecolor = 0;
+  cfg->export->cog = 0;
+  cfg->export->compression = (char *)MALLOC(sizeof(char)*25);
+  strcpy(cfg->export->compression, "DEFLATE");
 
   cfg->mosaic->overlap = (char *)MALLOC(sizeof(char)*25);
   strcpy(cfg->mosaic->overlap, "OVERLAY");
@@ -734,6 +757,12 @@ convert_config *init_fill_convert_config(char *configFile)
           strcpy(cfg->general->tmp_dir, read_str(line, "tmp dir"));
         if (strncmp(test, "status file", 11)==0)
           strcpy(cfg->general->status_file, read_str(line, "status file"));
+        if (strncmp(test, "batch jobs", 10)==0)
+          cfg->general->batch_jobs = read_int(line, "batch jobs");
+        if (strncmp(test, "job memory", 10)==0)
+          cfg->general->job_memory = read_int(line, "job memory");
+        if (strncmp(test, "job threads", 11)==0)
+          cfg->general->job_threads = read_int(line, "job threads");
         if (strncmp(test, "prefix", 6)==0)
           strcpy(cfg->general->prefix, read_str(line, "prefix"));
         if (strncmp(test, "suffix", 6)==0)
@@ -937,6 +966,10 @@ convert_config *init_fill_convert_config(char *configFile)
           cfg->export->falsecolor = read_int(line, "falsecolor");
         if (strncmp(test, "band", 4)==0)
           strcpy(cfg->export->band, read_str(line, "band"));
+        if (strncmp(test, "cloud optimized", 15)==0)
+          cfg->export->cog = read_int(line, "cloud optimized");
+        if (strncmp(test, "compression", 11)==0)
+          strcpy(cfg->export->compression, read_str(line, "compression"));
 
         // Mosaic
         if (strncmp(test, "overlap", 7)==0)
@@ -1049,6 +1082,12 @@ convert_config *init_fill_convert_config(char *configFile)
             strcpy(cfg->general->status_file, read_str(line, "status file"));
         if (strncmp(test, "batch file", 10)==0)
             strcpy(cfg->general->batchFile, read_str(line, "batch file"));
+        if (strncmp(test, "batch jobs", 10)==0)
+            cfg->general->batch_jobs = read_int(line, "batch jobs");
+        if (strncmp(test, "job memory", 10)==0)
+            cfg->general->job_memory = read_int(line, "job memory");
+        if (strncmp(test, "job threads", 11)==0)
+            cfg->general->job_threads = read_int(line, "job threads");
         if (strncmp(test, "prefix", 6)==0)
             strcpy(cfg->general->prefix, read_str(line, "prefix"));
         if (strncmp(test, "suffix", 6)==0)
@@ -1131,6 +1170,12 @@ convert_config *read_convert_config(char *configFile)
         strcpy(cfg->general->status_file, read_str(line, "status file"));
       if (strncmp(test, "batch file", 10)==0)
         strcpy(cfg->general->batchFile, read_str(line, "batch file"));
+      if (strncmp(test, "batch jobs", 10)==0)
+        cfg->general->batch_jobs = read_int(line, "batch jobs");
+      if (strncmp(test, "job memory", 10)==0)
+        cfg->general->job_memory = read_int(line, "job memory");
+      if (strncmp(test, "job threads", 11)==0)
+        cfg->general->job_threads = read_int(line, "job threads");
       if (strncmp(test, "prefix", 6)==0)
         strcpy(cfg->general->prefix, read_str(line, "prefix"));
       if (strncmp(test, "suffix", 6)==0)
@@ -1424,6 +1469,10 @@ convert_config *read_convert_config(char *configFile)
         cfg->export->falsecolor = read_int(line, "falsecolor");
       if (strncmp(test, "band", 4)==0)
         strcpy(cfg->export->band, read_str(line, "band"));
+      if (strncmp(test, "cloud optimized", 15)==0)
+        cfg->export->cog = read_int(line, "cloud optimized");
+      if (strncmp(test, "compression", 11)==0)
+        strcpy(cfg->export->compression, read_str(line, "compression"));
       FREE(test);
     }
 
@@ -1639,7 +1688,8 @@ int write_convert_config(char *configFile, convert_config *cfg)
     if (!shortFlag)
       fprintf(fConfig, "\n# The intermediates flag indicates whether the intermediate processing\n"
               "# results are kept (1 for keeping them, 0 for deleting them at the end of the\n"
-              "# processing).\n\n");
+              "# processing).  When they are not kept, calibration followed by geocoding\n"
+              "# is done while geocoding reads its input, without an intermediate file.\n\n");
     fprintf(fConfig, "intermediates = %i\n", cfg->general->intermediates);
     if (!shortFlag)
       fprintf(fConfig, "\n# The short configuration file flag allows the experienced user to\n"
@@ -1657,6 +1707,14 @@ int write_convert_config(char *configFile, convert_config *cfg)
               "# be kept until processing is completed. Then the entire directory and its\n"
               "# contents will be deleted.\n\n");
     fprintf(fConfig, "tmp dir = %s\n", cfg->general->tmp_dir);
+    if (!shortFlag)
+      fprintf(fConfig, "\n# Memory (in MB) the processing may use to keep intermediate images in\n"
+              "# memory rather than in temporary files (0 for the default, a quarter of\n"
+              "# the physical memory).\n\n");
+    fprintf(fConfig, "job memory = %d\n", cfg->general->job_memory);
+    if (!shortFlag)
+      fprintf(fConfig, "\n# Number of threads to process with (0 for one per processor).\n\n");
+    fprintf(fConfig, "job threads = %d\n", cfg->general->job_threads);
     // Test data generation flag - for internal use only
     if (cfg->general->testdata)
       fprintf(fConfig, "testdata = %d\n", cfg->general->testdata);
@@ -2266,7 +2324,17 @@ int write_convert_config(char *configFile, convert_config *cfg)
         fprintf(fConfig, "\n# If you wish to export a single band from the list of\n"
             "# available bands, e.g. HH, HV, VH, VV ...enter VV to export just\n"
                 "# the VV band (alone.)\n\n");
-      fprintf(fConfig, "band = %s\n\n", cfg->export->band);
+      fprintf(fConfig, "band = %s\n", cfg->export->band);
+      if (!shortFlag)
+        fprintf(fConfig, "\n# Setting the cloud optimized flag writes a GeoTIFF (or TIFF) in\n"
+                "# compressed 512x512 tiles, with reduced resolution overviews inside the\n"
+                "# file, so that a viewer or tile server can read any part of it at any\n"
+                "# zoom level with a few small reads.\n\n");
+      fprintf(fConfig, "cloud optimized = %i\n", cfg->export->cog);
+      if (!shortFlag)
+        fprintf(fConfig, "\n# Compression of the cloud optimized GeoTIFF tiles: DEFLATE, LZW, ZSTD\n"
+                "# or NONE.  DEFLATE tiles are compressed on all processors at once.\n\n");
+      fprintf(fConfig, "compression = %s\n\n", cfg->export->compression);
     }
     // Mosaic
     if (cfg->general->mosaic) {
@@ -2289,6 +2357,20 @@ int write_convert_config(char *configFile, convert_config *cfg)
       fprintf(fConfig, "# asf_mapready has a batch mode to run a large number of data sets\n"
               "# through the processing flow with the same processing parameters\n\n");
     fprintf(fConfig, "batch file = %s\n\n", cfg->general->batchFile);
+    if (!shortFlag)
+      fprintf(fConfig, "# In batch mode, this many data sets are processed at the same\n"
+              "# time (0 for one per processor).\n\n");
+    fprintf(fConfig, "batch jobs = %d\n\n", cfg->general->batch_jobs);
+    if (!shortFlag)
+      fprintf(fConfig, "# Memory (in MB) each data set may use to keep intermediate images\n"
+              "# in memory rather than in temporary files (0 for the default, a quarter\n"
+              "# of the physical memory).  No more data sets are processed at the same\n"
+              "# time than fit into the physical memory.\n\n");
+    fprintf(fConfig, "job memory = %d\n\n", cfg->general->job_memory);
+    if (!shortFlag)
+      fprintf(fConfig, "# Number of threads each data set is processed with (0 to share\n"
+              "# the processors among the data sets processed at the same time).\n\n");
+    fprintf(fConfig, "job threads = %d\n\n", cfg->general->job_threads);
     if (!shortFlag)
       fprintf(fConfig, "# A prefix can be added to the outfile name to avoid overwriting\n"
               "# files (e.g. when running the same data sets through the processing flow\n"
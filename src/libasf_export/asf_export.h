@@ -200,6 +200,14 @@ int lut_to_tiff_palette(unsigned short **colors, int size, char *look_up_table_n
 void dump_palette_tiff_color_map(unsigned short *colors, int map_size);
 int meta_colormap_to_tiff_palette(unsigned short **colors, int *byte_image, meta_colormap *colormap);
 
+// Prototypes from cog.c
+int asf_export_set_cog(const char *compression, int tile_size);
+int asf_export_cog(void);
+void asf_export_set_thread_count(int thread_count);
+void cog_open(TIFF *otif, const char *output_file_name);
+void tiff_write_scanline(TIFF *otif, void *buf, int line);
+void cog_close(TIFF *otif);
+
 // Prototypes from export_netcdf.c
 void export_netcdf(const char *in_base_name, char *output_file_name,
   int *noutputs, char ***output_names);
@@ -0,0 +1,567 @@
+// Cloud optimized GeoTIFF output: tiled, compressed, and with internal
+// reduced resolution overviews, for the tile servers and the archive.
+// Turned on with asf_export_set_cog(); initialize_tiff_file() and
+// finalize_tiff_file() take care of the rest.
+//
+// The export writes its TIFFs a scanline at a time, from the top down
+// (tiff_write_scanline() in write_line.c).  In COG mode the lines are
+// gathered into a row of tiles, and when the row is full its tiles are
+// compressed (several at once, when the compression is DEFLATE, which
+// is done here with zlib rather than through libtiff's codec) and put
+// in a spool file next to the output.  Each pair of lines is also
+// averaged down into a line of the first overview, which is tiled the
+// same way, and so on down to an overview that fits in a single tile.
+// So the overviews come out of the same pass over the data.
+//
+// Nothing is written to the TIFF itself until cog_close(), at which
+// point we know everything the directories need.  All the image
+// directories go at the front of the file, with their tile offsets
+// filled in afterwards (libtiff's deferred strile arrays, hence the
+// libtiff 4.1 requirement), and then the tiles, smallest overview first
+// and the full resolution image last, which is the layout a COG reader
+// expects.
+
+#include <string.h>
+#include <zlib.h>
+#include <glib.h>
+
+#include <asf.h>
+#include <asf_nan.h>
+#include <asf_export.h>
+
+// The name our state is stored under in the TIFF (TIFFSetClientInfo).
+#define COG_CLIENT_INFO "asf_cog"
+
+#define COG_DEFAULT_TILE_SIZE 512
+
+#if defined(TIFFLIB_VERSION) && TIFFLIB_VERSION >= 20191103
+#define HAVE_COG 1
+#else
+#define HAVE_COG 0
+#endif
+
+#ifndef COMPRESSION_ZSTD
+#define COMPRESSION_ZSTD 50000
+#endif
+
+// COMPRESSION_* to use, or -1 for the old striped output.
+static int cog_compression = -1;
+static int cog_tile_size = COG_DEFAULT_TILE_SIZE;
+
+// Number of threads to use, 0 means one per processor.
+static int export_thread_count = 0;
+
+int asf_export_set_cog(const char *compression, int tile_size)
+{
+  if (!compression) {
+    cog_compression = -1;
+    return TRUE;
+  }
+
+  int c;
+  if (strcmp_case(compression, "DEFLATE") == 0 ||
+      strcmp_case(compression, "ZIP") == 0)
+    c = COMPRESSION_ADOBE_DEFLATE;
+  else if (strcmp_case(compression, "LZW") == 0)
+    c = COMPRESSION_LZW;
+  else if (strcmp_case(compression, "ZSTD") == 0)
+    c = COMPRESSION_ZSTD;
+  else if (strcmp_case(compression, "NONE") == 0)
+    c = COMPRESSION_NONE;
+  else {
+    asfPrintWarning("Unknown GeoTIFF compression: %s\n", compression);
+    return FALSE;
+  }
+
+  if (!HAVE_COG) {
+    asfPrintWarning("Cloud optimized GeoTIFF output needs libtiff 4.1 or "
+                    "newer.\n");
+    return FALSE;
+  }
+  if (c != COMPRESSION_ADOBE_DEFLATE && !TIFFIsCODECConfigured(c)) {
+    asfPrintWarning("This libtiff was built without %s compression.\n",
+                    compression);
+    return FALSE;
+  }
+  if (tile_size < 0 || tile_size % 16 != 0) {
+    asfPrintWarning("GeoTIFF tile size must be a multiple of 16 (not %d).\n",
+                    tile_size);
+    return FALSE;
+  }
+
+  cog_compression = c;
+  cog_tile_size = tile_size > 0 ? tile_size : COG_DEFAULT_TILE_SIZE;
+  return TRUE;
+}
+
+int asf_export_cog(void)
+{
+  return cog_compression >= 0;
+}
+
+void asf_export_set_thread_count(int thread_count)
+{
+  export_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+static int get_export_thread_count(void)
+{
+  if (export_thread_count > 0)
+    return export_thread_count;
+  return (int) g_get_num_processors();
+}
+
+// One resolution level: the full image, or one of the overviews.
+typedef struct {
+  int width, height;
+  int tiles_across, tiles_down;
+  size_t line_bytes;       // bytes in a line of tiles_across whole tiles
+  unsigned char *lines;    // one row of tiles
+  int line;                // lines received so far
+  unsigned char *pending;  // an even line, waiting for the odd one below it
+  long long *offset;       // where each tile is in the spool file
+  int *size;               // and its size there
+} cog_level_t;
+
+typedef struct {
+  int compression, predictor;
+  int tile;
+  int spp, bps, sample_format, photometric;
+  unsigned short *colormap;  // palette images only
+  int n_levels;
+  cog_level_t *level;
+  size_t pixel_bytes, tile_bytes;
+  char *spool_name;
+  FILE *spool;
+  int threads;
+} cog_t;
+
+// Tiles of a row being compressed by the worker threads.
+typedef struct {
+  cog_t *cog;
+  cog_level_t *level;
+  unsigned char **out;
+  int *out_size;
+  gint next_tile;
+} cog_row_t;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Setting up.
+
+void cog_open(TIFF *otif, const char *output_file_name)
+{
+  cog_t *cog = MALLOC(sizeof(cog_t));
+  uint32 width, height;
+  uint16 spp, bps, sample_format, photometric;
+
+  TIFFGetField(otif, TIFFTAG_IMAGEWIDTH, &width);
+  TIFFGetField(otif, TIFFTAG_IMAGELENGTH, &height);
+  TIFFGetField(otif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+  TIFFGetField(otif, TIFFTAG_BITSPERSAMPLE, &bps);
+  TIFFGetField(otif, TIFFTAG_SAMPLEFORMAT, &sample_format);
+  TIFFGetField(otif, TIFFTAG_PHOTOMETRIC, &photometric);
+
+  cog->compression = cog_compression;
+  cog->tile = cog_tile_size;
+  cog->spp = spp;
+  cog->bps = bps/8;
+  cog->sample_format = sample_format;
+  cog->photometric = photometric;
+  cog->pixel_bytes = cog->spp*cog->bps;
+  cog->tile_bytes = (size_t)cog->tile*cog->tile*cog->pixel_bytes;
+  cog->threads = cog->compression == COMPRESSION_ADOBE_DEFLATE ?
+    get_export_thread_count() : 1;
+
+  // Horizontal differencing suits our integer data, and the floating
+  // point predictor the floats.  Palette indices don't difference well.
+  if (cog->compression == COMPRESSION_NONE)
+    cog->predictor = PREDICTOR_NONE;
+  else if (sample_format == SAMPLEFORMAT_IEEEFP)
+    cog->predictor = PREDICTOR_FLOATINGPOINT;
+  else if (photometric == PHOTOMETRIC_PALETTE || cog->bps > 2)
+    cog->predictor = PREDICTOR_NONE;
+  else
+    cog->predictor = PREDICTOR_HORIZONTAL;
+
+  // The overviews need the color map too.  libtiff keeps its own copy,
+  // which goes away with the directory.
+  cog->colormap = NULL;
+  if (photometric == PHOTOMETRIC_PALETTE) {
+    unsigned short *red, *green, *blue;
+    int n = 1 << bps;
+    TIFFGetField(otif, TIFFTAG_COLORMAP, &red, &green, &blue);
+    cog->colormap = MALLOC(sizeof(unsigned short)*3*n);
+    memcpy(cog->colormap, red, sizeof(unsigned short)*n);
+    memcpy(cog->colormap + n, green, sizeof(unsigned short)*n);
+    memcpy(cog->colormap + 2*n, blue, sizeof(unsigned short)*n);
+  }
+
+  // Halve the image until it fits in a tile.
+  int w = width, h = height, ii;
+  cog->n_levels = 1;
+  while (w > cog->tile || h > cog->tile) {
+    w = (w + 1)/2;
+    h = (h + 1)/2;
+    cog->n_levels++;
+  }
+  cog->level = MALLOC(sizeof(cog_level_t)*cog->n_levels);
+  w = width;
+  h = height;
+  for (ii=0; ii<cog->n_levels; ++ii) {
+    cog_level_t *lev = &cog->level[ii];
+    lev->width = w;
+    lev->height = h;
+    lev->tiles_across = (w + cog->tile - 1)/cog->tile;
+    lev->tiles_down = (h + cog->tile - 1)/cog->tile;
+    lev->line_bytes = (size_t)lev->tiles_across*cog->tile*cog->pixel_bytes;
+    lev->lines = CALLOC(cog->tile, lev->line_bytes);
+    lev->line = 0;
+    lev->pending = MALLOC(lev->line_bytes);
+    lev->offset = MALLOC(sizeof(long long)*lev->tiles_across*lev->tiles_down);
+    lev->size = MALLOC(sizeof(int)*lev->tiles_across*lev->tiles_down);
+    w = (w + 1)/2;
+    h = (h + 1)/2;
+  }
+
+  cog->spool_name = MALLOC(strlen(output_file_name) + 10);
+  sprintf(cog->spool_name, "%s.cog.tmp", output_file_name);
+  cog->spool = FOPEN(cog->spool_name, "w+b");
+
+  TIFFSetField(otif, TIFFTAG_COMPRESSION, cog->compression);
+  if (cog->predictor != PREDICTOR_NONE)
+    TIFFSetField(otif, TIFFTAG_PREDICTOR, cog->predictor);
+  TIFFSetField(otif, TIFFTAG_TILEWIDTH, cog->tile);
+  TIFFSetField(otif, TIFFTAG_TILELENGTH, cog->tile);
+
+  TIFFSetClientInfo(otif, cog, COG_CLIENT_INFO);
+
+  asfPrintStatus("Writing a cloud optimized GeoTIFF: %dx%d tiles, "
+                 "%d overview(s).\n", cog->tile, cog->tile, cog->n_levels - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Tiles.
+
+// The same differencing libtiff's predictor does, on one line of a
+// tile.
+static void predict_line(cog_t *cog, unsigned char *buf, unsigned char *tmp)
+{
+  int n = cog->tile*cog->spp, stride = cog->spp, ii;
+
+  if (cog->predictor == PREDICTOR_HORIZONTAL) {
+    if (cog->bps == 1) {
+      for (ii=n-1; ii>=stride; --ii)
+        buf[ii] -= buf[ii - stride];
+    }
+    else {
+      unsigned short *s = (unsigned short *) buf;
+      for (ii=n-1; ii>=stride; --ii)
+        s[ii] -= s[ii - stride];
+    }
+  }
+  else if (cog->predictor == PREDICTOR_FLOATINGPOINT) {
+    // Split the floats into byte planes, most significant first, then
+    // difference the bytes.
+    int bps = cog->bps, bb, nb = n*bps;
+    memcpy(tmp, buf, nb);
+    for (ii=0; ii<n; ++ii) {
+      for (bb=0; bb<bps; ++bb) {
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+        buf[bb*n + ii] = tmp[bps*ii + bb];
+#else
+        buf[(bps - bb - 1)*n + ii] = tmp[bps*ii + bb];
+#endif
+      }
+    }
+    for (ii=nb-1; ii>=stride; --ii)
+      buf[ii] -= buf[ii - stride];
+  }
+}
+
+// Compresses tile t of the level's current row of tiles.  Without
+// DEFLATE, the tile is passed on as it is, for libtiff to encode.
+static void compress_tile(cog_t *cog, cog_level_t *lev, int t,
+                          unsigned char *tile, unsigned char *tmp,
+                          unsigned char **out, int *out_size)
+{
+  size_t tile_line_bytes = (size_t)cog->tile*cog->pixel_bytes;
+  int ii;
+
+  for (ii=0; ii<cog->tile; ++ii)
+    memcpy(tile + ii*tile_line_bytes,
+           lev->lines + ii*lev->line_bytes + t*tile_line_bytes,
+           tile_line_bytes);
+
+  if (cog->compression != COMPRESSION_ADOBE_DEFLATE) {
+    *out = g_malloc(cog->tile_bytes);
+    memcpy(*out, tile, cog->tile_bytes);
+    *out_size = cog->tile_bytes;
+    return;
+  }
+
+  for (ii=0; ii<cog->tile; ++ii)
+    predict_line(cog, tile + ii*tile_line_bytes, tmp);
+
+  uLongf size = compressBound(cog->tile_bytes);
+  *out = g_malloc(size);
+  if (compress2(*out, &size, tile, cog->tile_bytes,
+                Z_DEFAULT_COMPRESSION) != Z_OK)
+    asfPrintError("Error compressing a GeoTIFF tile.\n");
+  *out_size = size;
+}
+
+static gpointer compress_row_worker(gpointer data)
+{
+  cog_row_t *r = data;
+  cog_t *cog = r->cog;
+  unsigned char *tile = MALLOC(cog->tile_bytes);
+  unsigned char *tmp = MALLOC((size_t)cog->tile*cog->pixel_bytes);
+
+  for (;;) {
+    int t = g_atomic_int_add(&r->next_tile, 1);
+    if (t >= r->level->tiles_across)
+      break;
+    compress_tile(cog, r->level, t, tile, tmp, &r->out[t], &r->out_size[t]);
+  }
+
+  FREE(tile);
+  FREE(tmp);
+  return NULL;
+}
+
+// Compresses the level's current row of tiles, and spools it.
+static void flush_row(cog_t *cog, cog_level_t *lev)
+{
+  int row = (lev->line - 1)/cog->tile;
+  int n = lev->tiles_across, tt;
+
+  // Whatever is below the bottom of the image goes out as zeros.
+  int used = lev->line - row*cog->tile;
+  if (used < cog->tile)
+    memset(lev->lines + used*lev->line_bytes, 0,
+           (cog->tile - used)*lev->line_bytes);
+
+  cog_row_t r;
+  r.cog = cog;
+  r.level = lev;
+  r.out = MALLOC(sizeof(unsigned char *)*n);
+  r.out_size = MALLOC(sizeof(int)*n);
+  r.next_tile = 0;
+
+  int n_workers = MIN(cog->threads, n);
+  GThread **threads = g_new(GThread *, n_workers);
+  for (tt = 1; tt < n_workers; tt++)
+    threads[tt] = g_thread_new("cog", compress_row_worker, &r);
+  compress_row_worker(&r);
+  for (tt = 1; tt < n_workers; tt++)
+    g_thread_join(threads[tt]);
+  g_free(threads);
+
+  for (tt = 0; tt < n; tt++) {
+    lev->offset[row*n + tt] = FTELL64(cog->spool);
+    lev->size[row*n + tt] = r.out_size[tt];
+    ASF_FWRITE(r.out[tt], 1, r.out_size[tt], cog->spool);
+    g_free(r.out[tt]);
+  }
+  FREE(r.out);
+  FREE(r.out_size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Overviews.
+
+// Averages one sample of the next level down from up to four samples
+// of this one.  Zeros (the export's no data value) and NaNs don't
+// count.
+#define AVERAGE(type, round)                                          \
+  {                                                                   \
+    const type *p = (const type *) a, *q = (const type *) b;          \
+    type *o = (type *) out;                                           \
+    for (ii=0; ii<width; ++ii) {                                      \
+      int i0 = 2*ii, i1 = MIN(2*ii + 1, in_width - 1);                \
+      for (ss=0; ss<spp; ++ss) {                                      \
+        type v[4];                                                    \
+        v[0] = p[i0*spp + ss]; v[1] = p[i1*spp + ss];                 \
+        v[2] = q[i0*spp + ss]; v[3] = q[i1*spp + ss];                 \
+        double sum = 0;                                               \
+        int n = 0, kk;                                                \
+        for (kk=0; kk<4; ++kk) {                                      \
+          if (v[kk] != 0 && !ISNAN((double)v[kk])) {                  \
+            sum += v[kk];                                             \
+            ++n;                                                      \
+          }                                                           \
+        }                                                             \
+        o[ii*spp + ss] = n > 0 ? (type)(sum/n + round) : 0;           \
+      }                                                               \
+    }                                                                 \
+  }
+
+// Makes a line of the next level from lines a and b of this one.  For
+// the last line of an image with an odd number of lines, b is a.
+static void shrink_line(cog_t *cog, int in_width, int width,
+                        const unsigned char *a, const unsigned char *b,
+                        unsigned char *out)
+{
+  int spp = cog->spp, ii, ss;
+
+  if (cog->photometric == PHOTOMETRIC_PALETTE) {
+    // Averaging color indices makes no sense, take every other pixel
+    for (ii=0; ii<width; ++ii)
+      memcpy(out + ii*cog->pixel_bytes, a + 2*ii*cog->pixel_bytes,
+             cog->pixel_bytes);
+  }
+  else if (cog->sample_format == SAMPLEFORMAT_IEEEFP)
+    AVERAGE(float, 0.0)
+  else if (cog->bps == 2)
+    AVERAGE(unsigned short, 0.5)
+  else
+    AVERAGE(unsigned char, 0.5)
+}
+
+// Adds a line to level k, which is spooled when its row of tiles is
+// done, and is passed down to make the next level.
+static void put_level_line(cog_t *cog, int k, const unsigned char *buf)
+{
+  cog_level_t *lev = &cog->level[k];
+  int y = lev->line;
+
+  memcpy(lev->lines + (y % cog->tile)*lev->line_bytes, buf,
+         (size_t)lev->width*cog->pixel_bytes);
+  lev->line++;
+  if (lev->line % cog->tile == 0 || lev->line == lev->height)
+    flush_row(cog, lev);
+
+  if (k + 1 < cog->n_levels) {
+    cog_level_t *next = &cog->level[k + 1];
+    unsigned char *out;
+    if (y % 2 == 0) {
+      memcpy(lev->pending, buf, (size_t)lev->width*cog->pixel_bytes);
+      if (y == lev->height - 1) {
+        out = CALLOC(1, next->line_bytes);
+        shrink_line(cog, lev->width, next->width, lev->pending,
+                    lev->pending, out);
+        put_level_line(cog, k + 1, out);
+        FREE(out);
+      }
+    }
+    else {
+      out = CALLOC(1, next->line_bytes);
+      shrink_line(cog, lev->width, next->width, lev->pending, buf, out);
+      put_level_line(cog, k + 1, out);
+      FREE(out);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// The export side.
+
+// All the write_tiff_* functions come through here.
+void tiff_write_scanline(TIFF *otif, void *buf, int line)
+{
+  cog_t *cog = TIFFGetClientInfo(otif, COG_CLIENT_INFO);
+
+  if (!cog) {
+    TIFFWriteScanline(otif, buf, line, 0);
+    return;
+  }
+  if (line != cog->level[0].line)
+    asfPrintError("Cloud optimized GeoTIFF lines must be written in order "
+                  "(got line %d, expected %d).\n", line, cog->level[0].line);
+  put_level_line(cog, 0, buf);
+}
+
+#if HAVE_COG
+// Sets up the directory of overview k, after the full resolution
+// directory (whose tags were set by initialize_tiff_file) is written.
+static void overview_directory(TIFF *otif, cog_t *cog, int k)
+{
+  cog_level_t *lev = &cog->level[k];
+
+  TIFFSetField(otif, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+  TIFFSetField(otif, TIFFTAG_IMAGEWIDTH, lev->width);
+  TIFFSetField(otif, TIFFTAG_IMAGELENGTH, lev->height);
+  TIFFSetField(otif, TIFFTAG_BITSPERSAMPLE, cog->bps*8);
+  TIFFSetField(otif, TIFFTAG_SAMPLESPERPIXEL, cog->spp);
+  TIFFSetField(otif, TIFFTAG_SAMPLEFORMAT, cog->sample_format);
+  TIFFSetField(otif, TIFFTAG_PHOTOMETRIC, cog->photometric);
+  TIFFSetField(otif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(otif, TIFFTAG_COMPRESSION, cog->compression);
+  if (cog->predictor != PREDICTOR_NONE)
+    TIFFSetField(otif, TIFFTAG_PREDICTOR, cog->predictor);
+  TIFFSetField(otif, TIFFTAG_TILEWIDTH, cog->tile);
+  TIFFSetField(otif, TIFFTAG_TILELENGTH, cog->tile);
+  if (cog->colormap) {
+    int n = 1 << (cog->bps*8);
+    TIFFSetField(otif, TIFFTAG_COLORMAP, cog->colormap, cog->colormap + n,
+                 cog->colormap + 2*n);
+  }
+}
+#endif
+
+// Writes out everything, see the top of the file.  The GeoTIFF keys
+// must already be set.
+void cog_close(TIFF *otif)
+{
+  cog_t *cog = TIFFGetClientInfo(otif, COG_CLIENT_INFO);
+  int k, tt;
+
+  if (!cog)
+    return;
+  for (k=0; k<cog->n_levels; ++k)
+    if (cog->level[k].line != cog->level[k].height)
+      asfPrintError("Cloud optimized GeoTIFF is missing lines (got %d of "
+                    "%d).\n", cog->level[k].line, cog->level[k].height);
+
+#if HAVE_COG
+  // The directories, with room for the tile offsets and sizes.
+  for (k=0; k<cog->n_levels; ++k) {
+    if (k > 0)
+      overview_directory(otif, cog, k);
+    TIFFDeferStrileArrayWriting(otif);
+    TIFFWriteCheck(otif, TRUE, "cog_close");
+    if (!TIFFWriteDirectory(otif))
+      asfPrintError("Error writing GeoTIFF directory.\n");
+  }
+
+  // The tiles, smallest overview first.
+  unsigned char *buf = MALLOC(MAX(compressBound(cog->tile_bytes),
+                                  cog->tile_bytes));
+  for (k=cog->n_levels-1; k>=0; --k) {
+    cog_level_t *lev = &cog->level[k];
+    int n = lev->tiles_across*lev->tiles_down;
+    if (!TIFFSetDirectory(otif, k))
+      asfPrintError("Error reading back GeoTIFF directory %d.\n", k);
+    for (tt=0; tt<n; ++tt) {
+      FSEEK64(cog->spool, lev->offset[tt], SEEK_SET);
+      ASF_FREAD(buf, 1, lev->size[tt], cog->spool);
+      tsize_t ret = cog->compression == COMPRESSION_ADOBE_DEFLATE ?
+        TIFFWriteRawTile(otif, tt, buf, lev->size[tt]) :
+        TIFFWriteEncodedTile(otif, tt, buf, lev->size[tt]);
+      if (ret < 0)
+        asfPrintError("Error writing GeoTIFF tile.\n");
+    }
+    if (!TIFFForceStrileArrayWriting(otif))
+      asfPrintError("Error writing GeoTIFF tile offsets.\n");
+  }
+  FREE(buf);
+#endif
+
+  FCLOSE(cog->spool);
+  remove(cog->spool_name);
+  FREE(cog->spool_name);
+  for (k=0; k<cog->n_levels; ++k) {
+    FREE(cog->level[k].lines);
+    FREE(cog->level[k].pending);
+    FREE(cog->level[k].offset);
+    FREE(cog->level[k].size);
+  }
+  FREE(cog->level);
+  FREE(cog->colormap);
+  FREE(cog);
+  TIFFSetClientInfo(otif, NULL, COG_CLIENT_INFO);
+}
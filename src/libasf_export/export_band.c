@@ -275,13 +275,18 @@ void initialize_tiff_file (TIFF **otif, GTIF **ogtif,
                    //((OPT_STRIP_BYTES / (sample_size * md->general->sample_count)) < 16) ? 8  :
                    //((OPT_STRIP_BYTES / (sample_size * md->general->sample_count)) < 32) ? 16 :
                      //                                             (unsigned short) USHORT_MAX;
-  TIFFSetField(*otif, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+  if (!asf_export_cog())
+    TIFFSetField(*otif, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
 
   TIFFSetField(*otif, TIFFTAG_XRESOLUTION, 1.0);
   TIFFSetField(*otif, TIFFTAG_YRESOLUTION, 1.0);
   TIFFSetField(*otif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_NONE);
   TIFFSetField(*otif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
 
+  // Tiled and compressed, with overviews (see cog.c)
+  if (asf_export_cog())
+    cog_open(*otif, output_file_name);
+
   if (is_geotiff) {
       *ogtif = write_tags_for_geotiff (*otif, metadata_file_name, rgb, band_names,
                    palette_color, use_pixel_is_point);
@@ -1298,6 +1303,7 @@ void finalize_tiff_file(TIFF *otif, GTIF *ogtif, int is_geotiff)
 
   // Finalize the TIFF file
   if (otif != NULL) {
+    cog_close (otif);
     XTIFFClose (otif);
   }
 }
@@ -1342,6 +1348,31 @@ int multiband(char *format, char **band_name, int band_count)
     return FALSE;
 }
 
+// Pixels to base the statistics of a band on, when a sample of the band
+// is good enough.
+#define EXPORT_STATS_SAMPLES 4000000
+
+// Statistics for scaling a band to byte, when the metadata doesn't have
+// them.  The 2-sigma and histogram equalization scalings only need a
+// sample of the lines, so that the band is read in full just the once,
+// for the export itself.  The others use the true min and max, which
+// takes one more pass.  Only histogram equalization gets a histogram.
+static void export_stats(const char *image_data_file_name, char *band,
+                         meta_parameters *md, scale_t sample_mapping,
+                         channel_stats_t *stats)
+{
+  long long max_samples =
+    sample_mapping == SIGMA || sample_mapping == HISTOGRAM_EQUALIZE ?
+    EXPORT_STATS_SAMPLES : 0;
+
+  calc_stats_from_file_sampled(image_data_file_name, band,
+                               md->general->no_data, max_samples,
+                               &stats->min, &stats->max, &stats->mean,
+                               &stats->standard_deviation,
+                               sample_mapping == HISTOGRAM_EQUALIZE ?
+                               &stats->hist : NULL);
+}
+
 void
 export_band_image (const char *metadata_file_name,
                    const char *image_data_file_name,
@@ -1539,10 +1570,8 @@ export_band_image (const char *metadata_file_name,
           // Calculate the stats if you have to...
           if (sample_mapping != NONE && !ignored[red_channel]) { // byte image
             asfPrintStatus("\nGathering red channel statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[0],
-                                md->general->no_data,
-                                &red_stats.min, &red_stats.max, &red_stats.mean,
-                                &red_stats.standard_deviation, &red_stats.hist);
+            export_stats(image_data_file_name, band_name[0],
+                         md, sample_mapping, &red_stats);
             if (sample_mapping == SIGMA) {
               double omin = red_stats.mean - 2*red_stats.standard_deviation;
               double omax = red_stats.mean + 2*red_stats.standard_deviation;
@@ -1594,12 +1623,8 @@ export_band_image (const char *metadata_file_name,
           // Calculate the stats if you have to...
           if (sample_mapping != NONE && !ignored[green_channel]) { // byte image
             asfPrintStatus("\nGathering green channel statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[1],
-                                md->general->no_data,
-                                &green_stats.min, &green_stats.max,
-                                &green_stats.mean,
-                                &green_stats.standard_deviation,
-                                &green_stats.hist);
+            export_stats(image_data_file_name, band_name[1],
+                         md, sample_mapping, &green_stats);
             if (sample_mapping == SIGMA) {
               double omin = green_stats.mean - 2*green_stats.standard_deviation;
               double omax = green_stats.mean + 2*green_stats.standard_deviation;
@@ -1651,12 +1676,8 @@ export_band_image (const char *metadata_file_name,
           // Calculate the stats if you have to...
           if (sample_mapping != NONE && !ignored[blue_channel]) { // byte image
             asfPrintStatus("\nGathering blue channel statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[2],
-                                md->general->no_data,
-                                &blue_stats.min, &blue_stats.max,
-                                &blue_stats.mean,
-                                &blue_stats.standard_deviation,
-                                &blue_stats.hist);
+            export_stats(image_data_file_name, band_name[2],
+                         md, sample_mapping, &blue_stats);
             if (sample_mapping == SIGMA) {
               double omin = blue_stats.mean - 2*blue_stats.standard_deviation;
               double omax = blue_stats.mean + 2*blue_stats.standard_deviation;
@@ -1775,10 +1796,8 @@ export_band_image (const char *metadata_file_name,
       }
       else {
         asfPrintStatus("\nGathering red channel statistics...\n");
-        calc_stats_from_file(image_data_file_name, band_name[0],
-                             md->general->no_data,
-                             &red_stats.min, &red_stats.max, &red_stats.mean,
-                             &red_stats.standard_deviation, &red_stats.hist);
+        export_stats(image_data_file_name, band_name[0],
+                     md, SIGMA, &red_stats);
       }
       r_omin = red_stats.mean - 2*red_stats.standard_deviation;
       r_omax = red_stats.mean + 2*red_stats.standard_deviation;
@@ -1805,10 +1824,8 @@ export_band_image (const char *metadata_file_name,
       }
       else {
         asfPrintStatus("\nGathering green channel statistics...\n");
-        calc_stats_from_file(image_data_file_name, band_name[1],
-                              md->general->no_data,
-                              &green_stats.min, &green_stats.max, &green_stats.mean,
-                              &green_stats.standard_deviation, &green_stats.hist);
+        export_stats(image_data_file_name, band_name[1],
+                     md, SIGMA, &green_stats);
       }
       g_omin = green_stats.mean - 2*green_stats.standard_deviation;
       g_omax = green_stats.mean + 2*green_stats.standard_deviation;
@@ -1835,10 +1852,8 @@ export_band_image (const char *metadata_file_name,
       }
       else {
         asfPrintStatus("\nGathering blue channel statistics...\n\n");
-        calc_stats_from_file(image_data_file_name, band_name[2],
-                             md->general->no_data,
-                             &blue_stats.min, &blue_stats.max, &blue_stats.mean,
-                             &blue_stats.standard_deviation, &blue_stats.hist);
+        export_stats(image_data_file_name, band_name[2],
+                     md, SIGMA, &blue_stats);
       }
       b_omin = blue_stats.mean - 2*blue_stats.standard_deviation;
       b_omax = blue_stats.mean + 2*blue_stats.standard_deviation;
@@ -2526,10 +2541,8 @@ export_band_image (const char *metadata_file_name,
           }
           else {
             asfPrintStatus("Gathering statistics ...\n");
-            calc_stats_from_file(image_data_file_name, band_name[kk],
-              md->general->no_data,
-              &stats.min, &stats.max, &stats.mean,
-              &stats.standard_deviation, &stats.hist);
+            export_stats(image_data_file_name, band_name[kk],
+                         md, sample_mapping, &stats);
           }
           if (sample_mapping == TRUNCATE && !have_look_up_table) {
             if (stats.mean >= 255)
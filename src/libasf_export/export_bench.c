@@ -0,0 +1,111 @@
+// Counts the bytes read, and times, the GeoTIFF export of a multi-band
+// product (a 4-band polarimetric one, say) with each of the scalings
+// that need statistics.
+//
+// The statistics used to come from calc_stats_from_file, which reads
+// each band twice (once for the min and max and moments, once for the
+// histogram) before the export reads it a third time.  Now the sigma
+// and histogram equalization scalings work from a sample of the lines,
+// and min/max takes a single pass, so the export should read each band
+// about 1.1 times for sigma and histogram equalization, and twice for
+// min/max.  The "old stats" line shows what calc_stats_from_file alone
+// read for the same bands.
+//
+// Statistics stored in the .meta are used as they are, without reading
+// anything, so use a product without a statistics block to see the
+// difference.
+//
+// Link with -Wl,--wrap=fread (the Makefile target does) so that the
+// reads get counted.
+//
+// Usage: export_bench <in_base_name>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_raster.h"
+#include "asf_export.h"
+
+static gint64 bytes_read = 0;
+
+size_t __real_fread (void *ptr, size_t size, size_t nmemb, FILE *stream);
+
+size_t
+__wrap_fread (void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+  size_t n = __real_fread (ptr, size, nmemb, stream);
+  bytes_read += (gint64) n * size;
+  return n;
+}
+
+static void
+report (const char *what, double seconds, gint64 bytes, double image_bytes)
+{
+  printf ("%-20s %8.3f s, %12lld bytes read, %6.2f times the image\n",
+          what, seconds, (long long) bytes, bytes / image_bytes);
+}
+
+int
+main (int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    fprintf (stderr, "Usage: %s <in_base_name>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char *in_base_name = argv[1];
+  char *img = appendExt (in_base_name, ".img");
+  meta_parameters *meta = meta_read (in_base_name);
+  double image_bytes = (double) fileSize (img);
+  int band_count = meta->general->band_count;
+  char **bands = extract_band_names (meta->general->bands, band_count);
+  GTimer *timer = g_timer_new ();
+  gint64 before;
+  int ii;
+
+  quietflag = TRUE;
+
+  before = bytes_read;
+  g_timer_start (timer);
+  for ( ii = 0 ; ii < band_count ; ii++ ) {
+    double min, max, mean, sdev;
+    gsl_histogram *hist = NULL;
+    calc_stats_from_file (img, bands ? bands[ii] : NULL,
+                          meta->general->no_data, &min, &max, &mean, &sdev,
+                          &hist);
+    gsl_histogram_free (hist);
+  }
+  report ("old stats", g_timer_elapsed (timer, NULL), bytes_read - before,
+          image_bytes);
+
+  struct { scale_t mapping; const char *name; } mappings[] = {
+    { SIGMA, "sigma" },
+    { MINMAX, "minmax" },
+    { HISTOGRAM_EQUALIZE, "histogram" },
+  };
+  for ( ii = 0 ; ii < (int) G_N_ELEMENTS (mappings) ; ii++ ) {
+    char out[256], what[64];
+    snprintf (out, sizeof (out), "export_bench_%s", mappings[ii].name);
+    snprintf (what, sizeof (what), "export %s", mappings[ii].name);
+    before = bytes_read;
+    g_timer_start (timer);
+    asf_export (GEOTIFF, mappings[ii].mapping, in_base_name, out);
+    report (what, g_timer_elapsed (timer, NULL), bytes_read - before,
+            image_bytes);
+  }
+
+  g_timer_destroy (timer);
+  if ( bands ) {
+    for ( ii = 0 ; ii < band_count ; ii++ )
+      FREE (bands[ii]);
+    FREE (bands);
+  }
+  meta_free (meta);
+  FREE (img);
+
+  return EXIT_SUCCESS;
+}
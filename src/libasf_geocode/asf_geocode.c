@@ -360,103 +360,178 @@ struct data_to_fit {
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// Hold your nose...
+// Reverse mapping.
 //
-// These used to be function scoped statics in reverse_map_x and
-// reverse_map_y routines, but that broke horribly when this program
-// got converted into a library function because they never got reset
-// between calls, so now these are globals so that we can reset them
-// all to their initial state when we get to the end of the function.
-// The little '_rmx' and '_rmy' suffixes help remind us that these
-// globals go with the reverse_map_x and reverse_map_y routines,
-// repsectively.
-
-  // True iff this is our first time through this routine.
-  static gboolean first_time_through_rmx = TRUE;
-  // Accelerators and interpolators for the all the vertical columns
-  // of sample points.  Filled in first time through routine.
-  static gsl_interp_accel **y_accel_rmx;
-  static gsl_spline **y_spline_rmx;
+// The mapping from projection coordinates to input pixel coordinates
+// is done with splines: first a vertical spline through each column of
+// the sparse grid of tie points, then for a given projection y a
+// horizontal spline through the values of the column splines at that
+// y.  The column splines are built once per input image and only read
+// afterwards, so they are shared by everybody.  The horizontal spline
+// depends on y and has to be rebuilt whenever y changes, so it lives
+// in a reverse_map_t, along with the accelerators for the column
+// splines.  Each thread that does reverse mapping needs its own
+// reverse_map_t.  Since the splines depend only on the tie points and
+// y, the results don't depend on which thread (or in which order) the
+// mapping is done.
+
+// Column splines for one of the two input pixel coordinates.
+typedef struct {
+  size_t sgs;               // Sparse grid size, see struct data_to_fit.
+  const double *xprojs;     // Projection x coordinates of the columns.
+  gsl_spline **y_spline;    // One spline for each grid point column.
+} reverse_map_columns_t;
+
+// Per-thread reverse mapping state for one pixel coordinate.
+typedef struct {
+  const reverse_map_columns_t *columns;
+  // Accelerators for the column splines.
+  gsl_interp_accel **y_accel;
   // Current accelerator and interpolator.  Updated when y argument is
   // different between calls.
-  static gsl_interp_accel *crnt_accel_rmx;
-  static gsl_spline *crnt_rmx;
-  // Value of y for which current interpolator works.
-  static double last_y_rmx;
-
-  // True iff this is our first time through this routine.
-  static gboolean first_time_through_rmy = TRUE;
-  // Accelerators and interpolators for the all the vertical columns
-  // of sample points.  Filled in first time through routine.
-  static gsl_interp_accel **y_accel_rmy;
-  static gsl_spline **y_spline_rmy;
-  // Current accelerator and interpolator.  Updated when y argument is
-  // different between calls.
-  static gsl_interp_accel *crnt_accel_rmy;
-  static gsl_spline *crnt_rmy;
-  // Value of y for which current interpolator works.
-  static double last_y_rmy;
+  gsl_interp_accel *crnt_accel;
+  gsl_spline *crnt;
+  double *crnt_points;
+  // True iff crnt has been set up, and then the value of y for which
+  // it works.
+  gboolean have_crnt;
+  double last_y;
+} reverse_map_coord_t;
+
+// Per-thread reverse mapping state for both pixel coordinates.
+typedef struct {
+  reverse_map_coord_t x, y;
+} reverse_map_t;
+
+// Set up the column splines mapping projection coordinates to input
+// pixel coordinates pixs (either dtf->sparse_x_pix or
+// dtf->sparse_y_pix).  The dtf must stay around and unchanged until
+// the result is freed.
+static reverse_map_columns_t *
+reverse_map_columns_new (const struct data_to_fit *dtf, const double *pixs)
+{
+  size_t sgs = dtf->sparse_grid_size;
+  const double *yprojs = dtf->sparse_y_proj;
+
+  reverse_map_columns_t *self = g_new (reverse_map_columns_t, 1);
+  self->sgs = sgs;
+  self->xprojs = dtf->sparse_x_proj;
+  self->y_spline = g_new (gsl_spline *, sgs);
+
+  // Current column y projection and pixel values.
+  double *cyp = g_new (double, sgs);
+  double *cpix = g_new (double, sgs);
+  size_t ii;
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    size_t jj;
+    for ( jj = 0 ; jj < sgs ; jj++ ) {
+      cyp[jj] = yprojs[jj * sgs + ii];
+      cpix[jj] = pixs[jj * sgs + ii];
+    }
+    self->y_spline[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
+    gsl_spline_init (self->y_spline[ii], cyp, cpix, sgs);
+  }
+  g_free (cpix);
+  g_free (cyp);
 
-///////////////////////////////////////////////////////////////////////////////
+  return self;
+}
 
-// Reverse map from projection coordinates x, y to input pixel
-// coordinate X.  This function looks at the data to fit on the first
-// time through, in order to set up vertical splines, after which this
-// argument is mostly ignored.  But not entirely, so you can't free or
-// change the dtf.  Mapping is efficient only if the y coordinates are
-// usually identical between calls, since when y changes a new spline
-// between splines has to be created.
+static void
+reverse_map_columns_free (reverse_map_columns_t *self)
+{
+  size_t ii;
+  for ( ii = 0 ; ii < self->sgs ; ii++ ) {
+    gsl_spline_free (self->y_spline[ii]);
+  }
+  g_free (self->y_spline);
+  g_free (self);
+}
+
+static void
+reverse_map_coord_init (reverse_map_coord_t *self,
+                        const reverse_map_columns_t *columns)
+{
+  size_t sgs = columns->sgs;
+
+  self->columns = columns;
+  self->y_accel = g_new (gsl_interp_accel *, sgs);
+  size_t ii;
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    self->y_accel[ii] = gsl_interp_accel_alloc ();
+  }
+  self->crnt_accel = gsl_interp_accel_alloc ();
+  self->crnt = gsl_spline_alloc (gsl_interp_cspline, sgs);
+  self->crnt_points = g_new (double, sgs);
+  self->have_crnt = FALSE;
+  self->last_y = 0.0;
+}
+
+static void
+reverse_map_coord_clear (reverse_map_coord_t *self)
+{
+  size_t ii;
+  for ( ii = 0 ; ii < self->columns->sgs ; ii++ ) {
+    gsl_interp_accel_free (self->y_accel[ii]);
+  }
+  g_free (self->y_accel);
+  gsl_interp_accel_free (self->crnt_accel);
+  gsl_spline_free (self->crnt);
+  g_free (self->crnt_points);
+}
+
+// Make a new reverse mapping context using the given column splines,
+// which must outlive it.
+static reverse_map_t *
+reverse_map_new (const reverse_map_columns_t *x_columns,
+                 const reverse_map_columns_t *y_columns)
+{
+  reverse_map_t *self = g_new (reverse_map_t, 1);
+  reverse_map_coord_init (&self->x, x_columns);
+  reverse_map_coord_init (&self->y, y_columns);
+  return self;
+}
+
+static void
+reverse_map_free (reverse_map_t *self)
+{
+  reverse_map_coord_clear (&self->x);
+  reverse_map_coord_clear (&self->y);
+  g_free (self);
+}
+
+// Evaluate one pixel coordinate at projection coordinates x, y.
+// Mapping is efficient only if the y coordinates are usually identical
+// between calls, since when y changes a new spline between the column
+// splines has to be created.
 static double
-reverse_map_x (struct data_to_fit *dtf, double x, double y)
+reverse_map_coord (reverse_map_coord_t *self, double x, double y)
 {
-  // Convenience aliases.
-  size_t sgs = dtf->sparse_grid_size;
-  double *xprojs = dtf->sparse_x_proj;
-  double *yprojs = dtf->sparse_y_proj;
-  double *xpixs = dtf->sparse_x_pix;
-
-  if ( G_UNLIKELY (first_time_through_rmx || y != last_y_rmx) ) {
-    if ( !first_time_through_rmx ) {
-      // Free the spline from the last line.
-      gsl_interp_accel_free (crnt_accel_rmx);
-      gsl_spline_free (crnt_rmx);
-    } else {
-      // Its our first time through, so set up the splines for the
-      // grid point columns.
-      y_accel_rmx = g_new (gsl_interp_accel *, sgs);
-      y_spline_rmx = g_new (gsl_spline *, sgs);
-      size_t ii;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-  gsl_vector *cypv = gsl_vector_alloc (sgs);
-  gsl_vector *cxpixv = gsl_vector_alloc (sgs);
-  size_t jj;
-  for ( jj = 0 ; jj < sgs ; jj++ ) {
-    gsl_vector_set (cypv, jj, yprojs[jj * sgs + ii]);
-    gsl_vector_set (cxpixv, jj, xpixs[jj * sgs + ii]);
-  }
-  y_accel_rmx[ii] = gsl_interp_accel_alloc ();
-  y_spline_rmx[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
-  gsl_spline_init (y_spline_rmx[ii], cypv->data, cxpixv->data, sgs);
-  gsl_vector_free (cxpixv);
-  gsl_vector_free (cypv);
-      }
-      first_time_through_rmx = FALSE;
-    }
+  if ( G_UNLIKELY (!self->have_crnt || y != self->last_y) ) {
     // Set up the spline that runs horizontally, between the column
     // splines.
-    crnt_accel_rmx = gsl_interp_accel_alloc ();
-    crnt_rmx = gsl_spline_alloc (gsl_interp_cspline, sgs);
-    double *crnt_points = g_new (double, sgs);
+    const reverse_map_columns_t *columns = self->columns;
     size_t ii;
-    for ( ii = 0 ; ii < sgs ; ii++ ) {
-      crnt_points[ii] = gsl_spline_eval_check (y_spline_rmx[ii], y, y_accel_rmx[ii]);
+    for ( ii = 0 ; ii < columns->sgs ; ii++ ) {
+      self->crnt_points[ii]
+        = gsl_spline_eval_check (columns->y_spline[ii], y, self->y_accel[ii]);
     }
-    gsl_spline_init (crnt_rmx, xprojs, crnt_points, sgs);
-    g_free (crnt_points);
-    last_y_rmx = y;
+    gsl_spline_init (self->crnt, columns->xprojs, self->crnt_points,
+                     columns->sgs);
+    gsl_interp_accel_reset (self->crnt_accel);
+    self->have_crnt = TRUE;
+    self->last_y = y;
   }
 
-  double ret = gsl_spline_eval_check (crnt_rmx, x, crnt_accel_rmx);
+  return gsl_spline_eval_check (self->crnt, x, self->crnt_accel);
+}
+
+// Reverse map from projection coordinates x, y to input pixel
+// coordinate X.
+static double
+reverse_map_x (reverse_map_t *rm, double x, double y)
+{
+  double ret = reverse_map_coord (&rm->x, x, y);
 
   if (!meta_is_valid_double(ret)) {
     asfPrintError("reverse_map_x invalid at L,S: %f,%f: %f\n", y,x,ret);
@@ -465,60 +540,12 @@ reverse_map_x (struct data_to_fit *dtf, double x, double y)
   return ret;
 }
 
-// This routine is analagous to reverse_map_x, including the same
-// caveats and confusing behavior.
+// Reverse map from projection coordinates x, y to input pixel
+// coordinate Y.
 static double
-reverse_map_y (struct data_to_fit *dtf, double x, double y)
+reverse_map_y (reverse_map_t *rm, double x, double y)
 {
-  size_t sgs = dtf->sparse_grid_size;
-  double *xprojs = dtf->sparse_x_proj;
-  double *yprojs = dtf->sparse_y_proj;
-  double *ypixs = dtf->sparse_y_pix;
-
-  if ( G_UNLIKELY (first_time_through_rmy || y != last_y_rmy) ) {
-    if ( !first_time_through_rmy ) {
-      // Free the spline from the last line.
-      gsl_interp_accel_free (crnt_accel_rmy);
-      gsl_spline_free (crnt_rmy);
-    } else {
-      // Its our first time through, so set up the splines for the
-      // grid point columns.
-      y_accel_rmy = g_new (gsl_interp_accel *, sgs);
-      y_spline_rmy = g_new (gsl_spline *, sgs);
-      size_t ii;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-  // Current y projection value.
-  gsl_vector *cypv = gsl_vector_alloc (sgs);
-  // Current y pixel value.
-  gsl_vector *cypixv = gsl_vector_alloc (sgs);
-  size_t jj;
-  for ( jj = 0 ; jj < sgs ; jj++ ) {
-    gsl_vector_set (cypv, jj, yprojs[jj * sgs + ii]);
-    gsl_vector_set (cypixv, jj, ypixs[jj * sgs + ii]);
-  }
-  y_accel_rmy[ii] = gsl_interp_accel_alloc ();
-  y_spline_rmy[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
-  gsl_spline_init (y_spline_rmy[ii], cypv->data, cypixv->data, sgs);
-  gsl_vector_free (cypixv);
-  gsl_vector_free (cypv);
-      }
-      first_time_through_rmy = FALSE;
-    }
-    // Set up the spline that runs horizontally, between the column
-    // splines.
-    crnt_accel_rmy = gsl_interp_accel_alloc ();
-    crnt_rmy = gsl_spline_alloc (gsl_interp_cspline, sgs);
-    double *crnt_points = g_new (double, sgs);
-    size_t ii;
-    for ( ii = 0 ; ii < sgs ; ii++ ) {
-      crnt_points[ii] = gsl_spline_eval_check (y_spline_rmy[ii], y, y_accel_rmy[ii]);
-    }
-    gsl_spline_init (crnt_rmy, xprojs, crnt_points, sgs);
-    g_free (crnt_points);
-    last_y_rmy = y;
-  }
-
-  double ret = gsl_spline_eval_check (crnt_rmy, x, crnt_accel_rmy);
+  double ret = reverse_map_coord (&rm->y, x, y);
 
   if (!meta_is_valid_double(ret)) {
     asfPrintError("reverse_map_y invalid at L,S %f,%f: %f\n", y, x, ret);
@@ -527,6 +554,168 @@ reverse_map_y (struct data_to_fit *dtf, double x, double y)
   return ret;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Reverse mapping lattice.
+//
+// Evaluating the splines for every output pixel is expensive, and the
+// mapping is very smooth, so optionally we evaluate it only on a
+// coarse lattice of output pixels (every spacing pixels in each
+// direction, plus the last row and column) and fill in the rest by
+// bilinear interpolation.  Interpolating a whole output line at once
+// comes down to a couple of simple loops over each lattice cell, which
+// the compiler can vectorize.
+
+typedef struct {
+  size_t spacing;         // Output pixels between nodes.
+  size_t nx, ny;          // Number of lattice nodes in each direction.
+  size_t *node_x;         // Output pixel indices of the node columns...
+  size_t *node_y;         // ...and rows.
+  double *x_pix, *y_pix;  // Input pixel coordinates of the nodes, nx per row.
+} reverse_map_lattice_t;
+
+// Output pixel spacing to use for the reverse mapping lattice, 0
+// means the splines are evaluated for every output pixel.
+static int geocode_lattice_spacing = 0;
+
+void asf_geocode_set_lattice_spacing(int spacing)
+{
+  geocode_lattice_spacing = spacing > 0 ? spacing : 0;
+}
+
+// Node positions for an axis of size pixels.
+static size_t *lattice_nodes(size_t size, size_t spacing, size_t *n)
+{
+  *n = size > 1 ? (size - 2) / spacing + 2 : 1;
+  size_t *nodes = g_new(size_t, *n);
+  size_t ii;
+  for (ii = 0; ii < *n; ii++)
+    nodes[ii] = MIN(ii * spacing, size - 1);
+  return nodes;
+}
+
+// Find the cell of nodes containing position pos: the returned index k
+// and fraction f are such that the value at pos is
+// v[k] + f * (v[k+1] - v[k]).  For a single node lattice, k+1 is
+// clamped to k by the callers.
+static size_t lattice_cell(const size_t *nodes, size_t n, size_t spacing,
+                           double pos, double *f)
+{
+  if (n < 2) {
+    *f = 0;
+    return 0;
+  }
+  size_t k = pos > 0 ? (size_t) (pos / spacing) : 0;
+  if (k > n - 2)
+    k = n - 2;
+  *f = (pos - nodes[k]) / (double) (nodes[k+1] - nodes[k]);
+  return k;
+}
+
+// Evaluate the reverse mapping with the splines at every node of a
+// lattice covering an oix_max by oiy_max output image whose pixel
+// centers are at projection coordinates start_x + oix * per_x,
+// start_y + oiy * per_y.
+static reverse_map_lattice_t *
+reverse_map_lattice_new (reverse_map_t *rm, size_t spacing,
+                         size_t oix_max, size_t oiy_max,
+                         double start_x, double per_x,
+                         double start_y, double per_y)
+{
+  reverse_map_lattice_t *self = g_new (reverse_map_lattice_t, 1);
+  self->spacing = spacing;
+  self->node_x = lattice_nodes (oix_max, spacing, &self->nx);
+  self->node_y = lattice_nodes (oiy_max, spacing, &self->ny);
+  self->x_pix = g_new (double, self->nx * self->ny);
+  self->y_pix = g_new (double, self->nx * self->ny);
+
+  size_t ii, jj;
+  for ( jj = 0 ; jj < self->ny ; jj++ ) {
+    double y = start_y + self->node_y[jj] * per_y;
+    for ( ii = 0 ; ii < self->nx ; ii++ ) {
+      double x = start_x + self->node_x[ii] * per_x;
+      self->x_pix[jj * self->nx + ii] = reverse_map_x (rm, x, y);
+      self->y_pix[jj * self->nx + ii] = reverse_map_y (rm, x, y);
+    }
+  }
+
+  return self;
+}
+
+static void
+reverse_map_lattice_free (reverse_map_lattice_t *self)
+{
+  g_free (self->y_pix);
+  g_free (self->x_pix);
+  g_free (self->node_y);
+  g_free (self->node_x);
+  g_free (self);
+}
+
+// Interpolate the lattice at (possibly fractional) output pixel
+// position ox, oy.
+static void
+reverse_map_lattice_eval (const reverse_map_lattice_t *self,
+                          double ox, double oy, double *x_pix, double *y_pix)
+{
+  double fx, fy;
+  size_t kx = lattice_cell (self->node_x, self->nx, self->spacing, ox, &fx);
+  size_t ky = lattice_cell (self->node_y, self->ny, self->spacing, oy, &fy);
+  size_t kx1 = MIN (kx + 1, self->nx - 1);
+  size_t ky1 = MIN (ky + 1, self->ny - 1);
+
+  size_t ul = ky * self->nx + kx, ur = ky * self->nx + kx1;
+  size_t ll = ky1 * self->nx + kx, lr = ky1 * self->nx + kx1;
+
+  double ux = self->x_pix[ul] + (self->x_pix[ur] - self->x_pix[ul]) * fx;
+  double lx = self->x_pix[ll] + (self->x_pix[lr] - self->x_pix[ll]) * fx;
+  *x_pix = ux + (lx - ux) * fy;
+
+  double uy = self->y_pix[ul] + (self->y_pix[ur] - self->y_pix[ul]) * fx;
+  double ly = self->y_pix[ll] + (self->y_pix[lr] - self->y_pix[ll]) * fx;
+  *y_pix = uy + (ly - uy) * fy;
+}
+
+// Fill in the input pixel coordinates of every pixel in output line
+// oiy.  The work arrays row_x and row_y must have room for nx values.
+static void
+reverse_map_lattice_line (const reverse_map_lattice_t *self, size_t oiy,
+                          double *row_x, double *row_y,
+                          double *x_pix, double *y_pix)
+{
+  double fy;
+  size_t ky = lattice_cell (self->node_y, self->ny, self->spacing, oiy, &fy);
+  size_t ky1 = MIN (ky + 1, self->ny - 1);
+  const double *ux = self->x_pix + ky * self->nx;
+  const double *lx = self->x_pix + ky1 * self->nx;
+  const double *uy = self->y_pix + ky * self->nx;
+  const double *ly = self->y_pix + ky1 * self->nx;
+
+  // Interpolate between the lattice rows above and below...
+  size_t ii;
+  for ( ii = 0 ; ii < self->nx ; ii++ ) {
+    row_x[ii] = ux[ii] + (lx[ii] - ux[ii]) * fy;
+    row_y[ii] = uy[ii] + (ly[ii] - uy[ii]) * fy;
+  }
+
+  // ...and then along the line, a cell at a time.
+  for ( ii = 0 ; ii + 1 < self->nx ; ii++ ) {
+    size_t start = self->node_x[ii];
+    size_t width = self->node_x[ii + 1] - start;
+    double x0 = row_x[ii], dx = (row_x[ii + 1] - x0) / width;
+    double y0 = row_y[ii], dy = (row_y[ii + 1] - y0) / width;
+    double *xp = x_pix + start;
+    double *yp = y_pix + start;
+    size_t jj;
+    for ( jj = 0 ; jj < width ; jj++ ) {
+      xp[jj] = x0 + jj * dx;
+      yp[jj] = y0 + jj * dy;
+    }
+  }
+  x_pix[self->node_x[self->nx - 1]] = row_x[self->nx - 1];
+  y_pix[self->node_x[self->nx - 1]] = row_y[self->nx - 1];
+}
+
 static void determine_projection_fns(int projection_type, project_t **project,
                                      project_arr_t **project_arr, unproject_t **unproject,
                                      unproject_arr_t **unproject_arr)
@@ -670,6 +859,401 @@ static float dem_sample(FloatImage *dem, float x, float y,
     return 0; // not reached
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Resampling the input image into the output image.
+//
+// The output image is produced a chunk of lines at a time.  The lines
+// of a chunk are split into small blocks which are handed out to the
+// worker threads as they ask for more work, each worker using its own
+// reverse mapping context.  The workers only look up the input image
+// values for the output pixels; once the whole chunk is done, the
+// results are folded into the output line by line, in order, by the
+// calling thread.  So the output is the same no matter how many
+// threads we use.
+
+// Number of threads to use, 0 means one per processor.
+static int geocode_thread_count = 0;
+
+void asf_geocode_set_thread_count(int thread_count)
+{
+  geocode_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+// Applied to the (single) input image as it is read, see
+// asf_geocode_set_input_filter.
+static LineFilter *geocode_input_filter = NULL;
+
+void asf_geocode_set_input_filter(LineFilter *filter)
+{
+  geocode_input_filter = filter;
+}
+
+static int get_geocode_thread_count(void)
+{
+  if (geocode_thread_count > 0)
+    return geocode_thread_count;
+  return (int) g_get_num_processors();
+}
+
+// Output lines per block handed out to a worker, and blocks per worker
+// in each chunk.
+#define GEOCODE_BLOCK_LINES 4
+#define GEOCODE_BLOCKS_PER_THREAD 4
+
+// Everything the workers need, and the current chunk.
+typedef struct {
+  // Set up once per band, read only while the workers run.
+  meta_parameters *imd, *omd;
+  FloatImage *iim;        // One of these two is non-NULL.
+  UInt8Image *iim_b;
+  float_image_sample_method_t float_image_sample_method;
+  uint8_image_sample_method_t uint8_image_sample_method;
+  size_t ii_size_x, ii_size_y;
+  size_t oix_max;
+  int want_line_sample;   // Fill in line_out and samp_out.
+  // Reverse mapping lattice, or NULL to use the splines directly.
+  const reverse_map_lattice_t *lattice;
+
+  // The current chunk: lines first_line through
+  // first_line + line_count - 1.
+  size_t first_line, line_count;
+  gint next_block;        // Next block to hand out (atomic).
+
+  // Results for the chunk, oix_max values per line.
+  float *value;           // Sampled input value (valid iff inside).
+  guchar *inside;         // Non-zero iff pixel maps into the input image.
+  float *line_out, *samp_out; // NULL unless want_line_sample.
+} geocode_chunk_t;
+
+// Per-worker state.
+typedef struct {
+  geocode_chunk_t *chunk;
+  reverse_map_t *rm;
+  // Work space for the lattice, if there is one.
+  double *row_x, *row_y, *x_pix, *y_pix;
+  // Input image coordinates of the output pixels of a line which fall
+  // inside the input image, and the values sampled there.
+  double *in_x, *in_y;
+  float *in_value;
+  unsigned long out_of_range_negative;
+  unsigned long out_of_range_positive;
+} geocode_worker_t;
+
+// Look up the input image values for output line oiy, which is line
+// ll of the current chunk.
+static void geocode_chunk_line(geocode_worker_t *w, size_t ll)
+{
+  geocode_chunk_t *c = w->chunk;
+  meta_parameters *imd = c->imd;
+  meta_parameters *omd = c->omd;
+  size_t oiy = c->first_line + ll;
+  size_t oix;
+
+  float *value = c->value + ll * c->oix_max;
+  guchar *inside = c->inside + ll * c->oix_max;
+  float *line_out = c->line_out ? c->line_out + ll * c->oix_max : NULL;
+  float *samp_out = c->samp_out ? c->samp_out + ll * c->oix_max : NULL;
+
+  g_assert (c->ii_size_x <= SSIZE_MAX);
+  g_assert (c->ii_size_y <= SSIZE_MAX);
+  ssize_t ii_size_x = c->ii_size_x;
+  ssize_t ii_size_y = c->ii_size_y;
+
+  if (c->lattice)
+    reverse_map_lattice_line(c->lattice, oiy, w->row_x, w->row_y,
+                             w->x_pix, w->y_pix);
+
+  size_t in_count = 0;
+
+  for ( oix = 0 ; oix < c->oix_max ; oix++ ) {
+
+    // Determine pixel of interest in input image.  The fractional
+    // part is desired, we will use some sampling method to
+    // interpolate between pixel values.
+    double input_x_pixel, input_y_pixel;
+    if (c->lattice) {
+      input_x_pixel = w->x_pix[oix];
+      input_y_pixel = w->y_pix[oix];
+    }
+    else {
+      // Projection coordinates for the center of this pixel.
+      double oix_pc = omd->projection->startX + oix * omd->projection->perX;
+      double oiy_pc = omd->projection->startY + oiy * omd->projection->perY;
+
+      input_x_pixel = reverse_map_x (w->rm, oix_pc, oiy_pc);
+      input_y_pixel = reverse_map_y (w->rm, oix_pc, oiy_pc);
+    }
+
+    int is_inside = !(input_x_pixel < 0 ||
+                      input_x_pixel > ii_size_x - 1.0 ||
+                      input_y_pixel < 0 ||
+                      input_y_pixel > ii_size_y - 1.0);
+
+    if (line_out)
+      line_out[oix] = is_inside ? input_y_pixel : 0;
+    if (samp_out)
+      samp_out[oix] = is_inside ? input_x_pixel : 0;
+
+    inside[oix] = is_inside;
+    if (!is_inside) {
+      value[oix] = 0;
+      continue;
+    }
+
+    w->in_x[in_count] = input_x_pixel;
+    w->in_y[in_count] = input_y_pixel;
+    in_count++;
+  }
+
+  // Sample the whole line at once.  DEMs go through dem_sample, which
+  // has to look out for no data values, a pixel at a time.
+  float *in_value = w->in_value;
+  size_t ii;
+  if (c->iim_b) {
+    uint8_image_sample_row(c->iim_b, in_count, w->in_x, w->in_y,
+                           c->uint8_image_sample_method, in_value);
+  }
+  else if ( imd->general->image_data_type == DEM ) {
+    for ( ii = 0 ; ii < in_count ; ii++ )
+      in_value[ii] = dem_sample(c->iim, w->in_x[ii], w->in_y[ii],
+                                c->float_image_sample_method);
+  }
+  else {
+    float_image_sample_row(c->iim, in_count, w->in_x, w->in_y,
+                           c->float_image_sample_method, in_value);
+    int db = imd->general->radiometry >= r_SIGMA_DB &&
+      imd->general->radiometry <= r_GAMMA_DB;
+    for ( ii = 0 ; ii < in_count ; ii++ ) {
+      float v = in_value[ii];
+      if (db)
+        v = 10.0 * log10(v);
+
+      if (omd->general->data_type == ASF_BYTE && v < 0.0) {
+        v = 0.0;
+        w->out_of_range_negative++;
+      }
+      if (omd->general->data_type == ASF_BYTE && v > 255.0) {
+        v = 255.0;
+        w->out_of_range_positive++;
+      }
+      in_value[ii] = v;
+    }
+  }
+
+  for ( oix = 0, ii = 0 ; oix < c->oix_max ; oix++ ) {
+    if (inside[oix])
+      value[oix] = in_value[ii++];
+  }
+}
+
+static gpointer geocode_chunk_worker(gpointer data)
+{
+  geocode_worker_t *w = data;
+  geocode_chunk_t *c = w->chunk;
+  size_t n_blocks =
+    (c->line_count + GEOCODE_BLOCK_LINES - 1) / GEOCODE_BLOCK_LINES;
+
+  while (TRUE) {
+    size_t block = g_atomic_int_add(&c->next_block, 1);
+    if (block >= n_blocks)
+      break;
+    size_t ll = block * GEOCODE_BLOCK_LINES;
+    size_t end = MIN(ll + GEOCODE_BLOCK_LINES, c->line_count);
+    for ( ; ll < end ; ll++ )
+      geocode_chunk_line(w, ll);
+  }
+
+  return NULL;
+}
+
+// Fill in the results for line_count lines starting at first_line,
+// using n_workers workers.  The first worker runs in the calling
+// thread.
+static void geocode_chunk(geocode_chunk_t *c, geocode_worker_t *workers,
+                          int n_workers, size_t first_line,
+                          size_t line_count)
+{
+  c->first_line = first_line;
+  c->line_count = line_count;
+  c->next_block = 0;
+
+  GThread **threads = g_new(GThread *, n_workers);
+  int tt;
+  for (tt = 1; tt < n_workers; tt++)
+    threads[tt] = g_thread_new("geocode", geocode_chunk_worker, &workers[tt]);
+  geocode_chunk_worker(&workers[0]);
+  for (tt = 1; tt < n_workers; tt++)
+    g_thread_join(threads[tt]);
+  g_free(threads);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Tie point grid.
+//
+// Each point of the grid needs an unprojection and then either a
+// projection into the input image's projection or a
+// meta_get_lineSamp, which is an iterative solve and is slow.  The
+// points are independent, so the rows of the grid are handed out to
+// worker threads.  Every point goes to a fixed place in the dense and
+// sparse grids, so the result doesn't depend on the number of threads.
+
+typedef struct {
+  // Inputs, read only while the workers run.
+  project_parameters_t *pp;
+  unproject_t *unproject;
+  datum_type_t datum;
+  meta_parameters *imd;
+  int input_projected;
+  project_t *project_input;
+  double average_height;
+  double lon_0;           // Longitude of the input image center.
+  double min_x, min_y;    // Projection coordinates of the first point.
+  double x_spacing, y_spacing;
+
+  // Output.  The grid sizes are set in here too.
+  struct data_to_fit *dtf;
+  size_t sparse_grid_sample_stride;
+
+  gint next_row;          // Next row to hand out (atomic).
+  gint rows_done;         // For the progress meter (atomic).
+} tie_point_grid_t;
+
+// Compute tie point grid row ii.
+static void tie_point_grid_row(tie_point_grid_t *g, size_t ii)
+{
+  struct data_to_fit *dtf = g->dtf;
+  meta_parameters *imd = g->imd;
+  size_t grid_size = dtf->grid_size;
+  size_t stride = g->sparse_grid_sample_stride;
+  int ret;
+  size_t jj;
+
+  for ( jj = 0 ; jj < grid_size ; jj++ ) {
+    // Projection coordinates for the current grid point.
+    double cxproj = g->min_x + g->x_spacing * jj;
+    double cyproj = g->min_y + g->y_spacing * ii;
+
+    // Corresponding latitude and longitude.
+    double lat, lon;
+    ret = g->unproject (g->pp, cxproj, cyproj, ASF_PROJ_NO_HEIGHT,
+                        &lat, &lon, NULL, g->datum);
+    if ( !ret ) {
+      // Details of the error should have already been printed.
+      asfPrintError ("Projection Error!\n");
+    }
+    else if ( !meta_is_valid_double(lat) || !meta_is_valid_double(lon)) {
+      asfPrintError ("unproject nan: %d,%d: %f, %f -> %f, %f\n",
+                     ii, jj, cxproj, cyproj, lat, lon);
+    }
+    lat *= R2D;
+    lon *= R2D;
+
+    // here we have some kludgery to handle crossing the meridian
+    if (fabs(lon-g->lon_0) > 300) {
+      if (g->lon_0 < 0 && lon > 0) lon -= 360;
+      if (g->lon_0 > 0 && lon < 0) lon += 360;
+    }
+
+    // Corresponding pixel indicies in input image.
+    double x_pix, y_pix;
+    if ( g->input_projected ) {
+      meta_projection *ipb = imd->projection;
+      // Input projection coordinates of the current pixel.
+      double ipcx, ipcy, ipcz;
+      ret = g->project_input (&ipb->param, D2R*lat, D2R*lon,
+                              g->average_height, &ipcx, &ipcy, &ipcz,
+                              ipb->datum);
+      if ( ret == 0 ) {
+        asfPrintError ("Projection Error!\n");
+      }
+      else if ( !meta_is_valid_double(ipcx) || !meta_is_valid_double(ipcy)) {
+        asfPrintError ("project nan: %d,%d: %f, %f -> %f, %f\n",
+                       ii, jj, lat, lon, ipcx, ipcy);
+      }
+      // Find the input image pixel indicies corresponding to input
+      // projection coordinates.
+      x_pix = (ipcx - ipb->startX) / ipb->perX;
+      y_pix = (ipcy - ipb->startY) / ipb->perY;
+    }
+    else {
+      ret = meta_get_lineSamp (imd, lat, lon, g->average_height,
+                               &y_pix, &x_pix);
+      if (ret != 0) {
+        asfPrintError("Failed to determine line and sample from "
+                      "latitude and longitude\n"
+                      "Lat: %f, Lon: %f\n", lat, lon);
+      }
+      else if ( !meta_is_valid_double(x_pix) || !meta_is_valid_double(y_pix)) {
+        asfPrintError ("meta_get_lineSamp nan: %d,%d: %f, %f -> %f, %f\n",
+                       ii, jj, lat, lon, x_pix, y_pix);
+      }
+    }
+
+    size_t mapping = ii * grid_size + jj;
+    dtf->x_proj[mapping] = cxproj;
+    dtf->y_proj[mapping] = cyproj;
+    dtf->x_pix[mapping] = x_pix;
+    dtf->y_pix[mapping] = y_pix;
+
+    if ( ii % stride == 0 && jj % stride == 0 ) {
+      size_t sparse_mapping
+        = (ii / stride) * dtf->sparse_grid_size + jj / stride;
+      g_assert (sparse_mapping < dtf->sparse_n);
+      dtf->sparse_x_proj[sparse_mapping] = cxproj;
+      dtf->sparse_y_proj[sparse_mapping] = cyproj;
+      dtf->sparse_x_pix[sparse_mapping] = x_pix;
+      dtf->sparse_y_pix[sparse_mapping] = y_pix;
+    }
+  }
+}
+
+// Compute grid rows until there are none left.  Only the calling
+// thread updates the progress meter.
+static void tie_point_grid_rows(tie_point_grid_t *g, int show_progress)
+{
+  size_t grid_size = g->dtf->grid_size;
+
+  while (TRUE) {
+    size_t ii = g_atomic_int_add (&g->next_row, 1);
+    if ( ii >= grid_size )
+      break;
+    tie_point_grid_row (g, ii);
+    int done = g_atomic_int_add (&g->rows_done, 1) + 1;
+    if ( show_progress )
+      asfPercentMeter ((float) done / (float) grid_size);
+  }
+}
+
+static gpointer tie_point_grid_thread(gpointer data)
+{
+  tie_point_grid_rows (data, FALSE);
+  return NULL;
+}
+
+// Fill in the dense and sparse tie point grids in g->dtf.
+static void tie_point_grid_compute(tie_point_grid_t *g)
+{
+  int n_threads = get_geocode_thread_count ();
+  if ( (size_t) n_threads > g->dtf->grid_size )
+    n_threads = g->dtf->grid_size;
+
+  g->next_row = 0;
+  g->rows_done = 0;
+
+  GThread **threads = g_new (GThread *, n_threads);
+  int tt;
+  for ( tt = 1 ; tt < n_threads ; tt++ )
+    threads[tt] = g_thread_new ("tie points", tie_point_grid_thread, g);
+  tie_point_grid_rows (g, TRUE);
+  for ( tt = 1 ; tt < n_threads ; tt++ )
+    g_thread_join (threads[tt]);
+  g_free (threads);
+
+  asfPercentMeter (1.0);
+}
+
 int asf_geocode_utm(resample_method_t resample_method, double average_height,
                     datum_type_t datum, double pixel_size,
                     char *band_id, char *in_base_name, char *out_base_name,
@@ -1373,7 +1957,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 
     // If all input metadata is byte, we will store everything as bytes,
     // in order to save memory.  (But the math will use floating point.)
-    if (imd->general->data_type != ASF_BYTE || resample_method == RESAMPLE_BICUBIC)
+    if (imd->general->data_type != ASF_BYTE || resample_method == RESAMPLE_BICUBIC ||
+        geocode_input_filter)
         process_as_byte = FALSE;
     if (imd->general->data_type == ASF_BYTE && resample_method == RESAMPLE_BICUBIC) {
       asfPrintWarning(
@@ -1773,6 +2358,12 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
     char *input_image = appendExt(in_base_name, "img");
     char *input_meta_data = appendExt(in_base_name, "meta");
 
+    // The input image may not have been written, only its metadata, and
+    // instead be made from another as we read it.
+    LineFilter *filter = geocode_input_filter;
+    if (filter && n_input_images > 1)
+      asfPrintError("Input filters only work when geocoding a single image.\n");
+
     // Input metadata.
     meta_parameters *imd = meta_read (input_meta_data);
     meta_pixel_sizes_same_units(imd, projection_type);
@@ -1818,6 +2409,12 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
       double resample_psy = pixel_size_y / 2.;
       char *resample_file = appendToBasename(in_base_name, "_down");
 
+      // resample needs the input file
+      if (filter) {
+        line_filter_store(filter, in_base_name);
+        filter = NULL;
+      }
+
       asfPrintStatus("Downsampling input image to %gx%gm.\n", 
 		     resample_psx, resample_psy);
       resample_to_pixsiz(in_base_name, resample_file, 
@@ -1935,103 +2532,36 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
       // Spacing between grid points, in output projection coordinates.
       double x_spacing = x_range_size / (grid_size - 1);
       double y_spacing = y_range_size / (grid_size - 1);
-      // Index into the flattened list of mappings we want to produce.
-      size_t current_mapping = 0;
-      size_t current_sparse_mapping = 0;
       size_t ii;
+
+      tie_point_grid_t tpg;
+      tpg.pp = pp;
+      tpg.unproject = unproject;
+      tpg.datum = datum;
+      tpg.imd = imd;
+      tpg.input_projected = input_projected;
+      tpg.project_input = input_projected ? project_input : NULL;
+      tpg.average_height = average_height;
+      tpg.lon_0 = lon_0;
+      tpg.min_x = min_x;
+      tpg.min_y = min_y;
+      tpg.x_spacing = x_spacing;
+      tpg.y_spacing = y_spacing;
+      tpg.dtf = &dtf;
+      tpg.sparse_grid_sample_stride = sparse_grid_sample_stride;
+      tie_point_grid_compute (&tpg);
       
-      for ( ii = 0 ; ii < grid_size ; ii++ ) {
-        size_t jj;
-        for ( jj = 0 ; jj < grid_size ; jj++ ) {
-					g_assert (sizeof (long int) >= sizeof (size_t));
-					// Projection coordinates for the current grid point.
-					double cxproj = min_x + x_spacing * jj;
-					double cyproj = min_y + y_spacing * ii;
-		
-					// Corresponding latitude and longitude.
-					double lat, lon;
-					ret = unproject (pp, cxproj, cyproj, ASF_PROJ_NO_HEIGHT,
-							 &lat, &lon, NULL, datum);
-					if ( !ret ) {
-						// Details of the error should have already been printed.
-						asfPrintError ("Projection Error!\n");
-					}
-					else if ( !meta_is_valid_double(lat) || !meta_is_valid_double(lon)) {
-						asfPrintError ("unproject nan: %d,%d: %f, %f -> %f, %f\n",
-																 ii, jj, cxproj, cyproj, lat, lon);
-								} 
-					lat *= R2D;
-					lon *= R2D;
-					//printf("%zu,%zu: %f %f -> %f %f\n", ii, jj, cxproj, cyproj, lat, lon); 
-
-					// here we have some kludgery to handle crossing the meridian
-					if (fabs(lon-lon_0) > 300) {
-						if (lon_0 < 0 && lon > 0) lon -= 360;
-						if (lon_0 > 0 && lon < 0) lon += 360;
-					}
-		
-					// Corresponding pixel indicies in input image.
-					double x_pix, y_pix;
-					if ( input_projected ) {
-						// Input projection coordinates of the current pixel.
-						double ipcx, ipcy, ipcz;
-						ret = project_input (ipp, D2R*lat, D2R*lon, average_height,
-							 &ipcx, &ipcy, &ipcz, imd->projection->datum);
-						if ( ret == 0 ) {
-							asfPrintError ("Projection Error!\n");
-						}
-						else if ( !meta_is_valid_double(ipcx) || !meta_is_valid_double(ipcy)) {
-							asfPrintError ("project nan: %d,%d: %f, %f -> %f, %f\n",
-																	 ii, jj, lat, lon, ipcx, ipcy);
-									} 
-						g_assert (ret);
-						// Find the input image pixel indicies corresponding to input
-						// projection coordinates.
-						x_pix = (ipcx - ipb->startX) / ipb->perX;
-						y_pix = (ipcy - ipb->startY) / ipb->perY;
-						//printf("%zu,%zu: %f %f -> %f %f\n", ii, jj, lat, lon, x_pix, y_pix); 
-					}
-					else {
-						ret = meta_get_lineSamp (imd, lat, lon, average_height,
-									 &y_pix, &x_pix);
-						//printf("lat: %f, lon: %f, x_pix: %f, y_pix: %f\n", 
-						//	lat, lon, x_pix, y_pix);
-						//g_assert (ret == 0);
-						if (ret != 0) {
-							asfPrintError("Failed to determine line and sample from "
-								"latitude and longitude\n"
-								"Lat: %f, Lon: %f\n", lat, lon);
-						}
-						else if ( !meta_is_valid_double(x_pix) || !meta_is_valid_double(y_pix)) {
-							asfPrintError ("meta_get_lineSamp nan: %d,%d: %f, %f -> %f, %f\n",
-																	 ii, jj, lat, lon, x_pix, y_pix);
-						} 
-					}
-		
-					g_assert(current_mapping < mapping_count);
-					dtf.x_proj[current_mapping] = cxproj;
-					dtf.y_proj[current_mapping] = cyproj;
-					dtf.x_pix[current_mapping] = x_pix;
-					dtf.y_pix[current_mapping] = y_pix;
-
-					if ( ii % sparse_grid_sample_stride == 0 &&
-							 jj % sparse_grid_sample_stride == 0 ) {
-						g_assert(current_sparse_mapping < sparse_mapping_count);
-						dtf.sparse_x_proj[current_sparse_mapping] = cxproj;
-						dtf.sparse_y_proj[current_sparse_mapping] = cyproj;
-						dtf.sparse_x_pix[current_sparse_mapping] = x_pix;
-						dtf.sparse_y_pix[current_sparse_mapping] = y_pix;
-						current_sparse_mapping++;
-					}
-					current_mapping++;
-		
-					asfPercentMeter((float)current_mapping / (float)(grid_size*grid_size));
-        }
-      }
-      
+      // Build the spline model.  The column splines are shared by all
+      // the reverse mapping contexts; rm is the one used by this thread.
+      reverse_map_columns_t *x_columns =
+        reverse_map_columns_new (&dtf, dtf.sparse_x_pix);
+      reverse_map_columns_t *y_columns =
+        reverse_map_columns_new (&dtf, dtf.sparse_y_pix);
+      reverse_map_t *rm = reverse_map_new (x_columns, y_columns);
+
       // Here are some convenience macros for the spline model.
-#define X_PIXEL(x, y) reverse_map_x (&dtf, x, y)
-#define Y_PIXEL(x, y) reverse_map_y (&dtf, x, y)
+#define X_PIXEL(x, y) reverse_map_x (rm, x, y)
+#define Y_PIXEL(x, y) reverse_map_y (rm, x, y)
       
       // We want to choke if our worst point in the model is off by this
       // many pixels or more.
@@ -2285,6 +2815,78 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
         }
       }
       
+      // If asked to, evaluate the mapping on a lattice and interpolate
+      // from that, rather than evaluating the splines for every output
+      // pixel.  The lattice is held to the same standard as the spline
+      // model: at the control points within the output image, it must
+      // be within max_allowable_error of the analytically projected
+      // values.  If it isn't, we try a finer lattice, and eventually
+      // fall back to using the splines.
+      reverse_map_lattice_t *lattice = NULL;
+      if (geocode_lattice_spacing > 0) {
+        size_t spacing = geocode_lattice_spacing;
+        const size_t min_spacing = 4;
+        double start_x = omd->projection->startX;
+        double per_x = omd->projection->perX;
+        double start_y = omd->projection->startY;
+        double per_y = omd->projection->perY;
+        while (TRUE) {
+          asfPrintStatus ("Evaluating mapping on a lattice with spacing %d "
+                          "pixels...\n", (int) spacing);
+          lattice = reverse_map_lattice_new (rm, spacing, oix_max, oiy_max,
+                                             start_x, per_x, start_y, per_y);
+
+          double largest_error = 0.0;
+          for ( ii = 0 ; ii < dtf.n ; ii++ ) {
+            double ox = (dtf.x_proj[ii] - start_x) / per_x;
+            double oy = (dtf.y_proj[ii] - start_y) / per_y;
+            if ( ox < 0 || ox > oix_max - 1 || oy < 0 || oy > oiy_max - 1 )
+              continue;
+            double xpfl, ypfl;
+            reverse_map_lattice_eval (lattice, ox, oy, &xpfl, &ypfl);
+            double error_distance = hypot (xpfl - dtf.x_pix[ii],
+                                           ypfl - dtf.y_pix[ii]);
+            if ( error_distance > largest_error )
+              largest_error = error_distance;
+          }
+
+          // Also see how far the lattice strays from the splines, which
+          // is where it should be worst: in the middle of the cells.
+          double largest_deviation = 0.0;
+          size_t jj;
+          for ( jj = 0 ; jj + 1 < lattice->ny ; jj++ ) {
+            double oy = 0.5 * (lattice->node_y[jj] + lattice->node_y[jj+1]);
+            for ( ii = 0 ; ii + 1 < lattice->nx ; ii++ ) {
+              double ox = 0.5 * (lattice->node_x[ii] + lattice->node_x[ii+1]);
+              double xpfl, ypfl;
+              reverse_map_lattice_eval (lattice, ox, oy, &xpfl, &ypfl);
+              double xpfm = X_PIXEL (start_x + ox * per_x, start_y + oy * per_y);
+              double ypfm = Y_PIXEL (start_x + ox * per_x, start_y + oy * per_y);
+              double deviation = hypot (xpfl - xpfm, ypfl - ypfm);
+              if ( deviation > largest_deviation )
+                largest_deviation = deviation;
+            }
+          }
+
+          asfPrintStatus ("Maximum lattice error at control points: %g\n",
+                          largest_error);
+          asfPrintStatus ("Maximum lattice deviation from spline model: %g\n",
+                          largest_deviation);
+
+          if ( largest_error <= max_allowable_error )
+            break;
+
+          reverse_map_lattice_free (lattice);
+          lattice = NULL;
+          if ( spacing / 2 < min_spacing ) {
+            asfPrintWarning ("Could not get the mapping lattice accurate "
+                             "enough, using the spline model directly.\n");
+            break;
+          }
+          spacing /= 2;
+        }
+      }
+      
       // Now the mapping function is calculated and we can apply that to
       // all the bands in the file (or to the single band selected with
       // the -band option)
@@ -2316,7 +2918,6 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 		
 					// Set up the line/sample mapping files, if requested to do so
 					FILE *outLineFp=NULL, *outSampFp=NULL;
-					float *line_out=NULL, *samp_out=NULL;
 					if (save_line_sample_mapping) {
 						asfPrintStatus("Setting up line/sample mapping files...\n");
 			
@@ -2334,9 +2935,6 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 						FREE(sample_filename);
 						FREE(sample_metaname);
 			
-						line_out = MALLOC(sizeof(float)*oix_max);
-						samp_out = MALLOC(sizeof(float)*oix_max);
-			
 						// prevent doing the line/sample file again
 						save_line_sample_mapping = FALSE;
 					}
@@ -2349,7 +2947,9 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 					asfPrintStatus("Creating tiles for the input image ...\n");
 		
 					// open up the input image
-					if (process_as_byte)
+					if (filter)
+						iim = line_filter_band_float_image(filter, kk);
+					else if (process_as_byte)
 						iim_b = uint8_image_band_new_from_metadata(imd, kk, input_image);
 					else
 						iim = float_image_band_new_from_metadata(imd, kk, input_image);
@@ -2368,11 +2968,83 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 					else
 						g_assert(!outFp && !output_line && output_bfi);
 		
-					// Set the pixels of the output image.
+					// Set the pixels of the output image.  The input image values
+					// are looked up a chunk of lines at a time by a set of workers
+					// (see geocode_chunk), and then put into the output here, in
+					// order.  UInt8Image can't be read by several threads at once,
+					// so byte input gets just the one worker.
+					int n_workers = process_as_byte ? 1 : get_geocode_thread_count();
+					if (n_workers > 1)
+						float_image_begin_concurrent_reads(iim,
+							n_workers * float_image_get_default_cache_size());
+
+					size_t chunk_lines =
+						n_workers * GEOCODE_BLOCKS_PER_THREAD * GEOCODE_BLOCK_LINES;
+					if (chunk_lines > oiy_max)
+						chunk_lines = oiy_max;
+
+					geocode_chunk_t chunk;
+					chunk.imd = imd;
+					chunk.omd = omd;
+					chunk.iim = iim;
+					chunk.iim_b = iim_b;
+					chunk.float_image_sample_method = float_image_sample_method;
+					chunk.uint8_image_sample_method = uint8_image_sample_method;
+					chunk.ii_size_x = ii_size_x;
+					chunk.ii_size_y = ii_size_y;
+					chunk.oix_max = oix_max;
+					chunk.want_line_sample = outLineFp != NULL;
+					chunk.lattice = lattice;
+					chunk.first_line = chunk.line_count = 0;
+					chunk.value = MALLOC(sizeof(float)*oix_max*chunk_lines);
+					chunk.inside = MALLOC(sizeof(guchar)*oix_max*chunk_lines);
+					chunk.line_out = chunk.samp_out = NULL;
+					if (chunk.want_line_sample) {
+						chunk.line_out = MALLOC(sizeof(float)*oix_max*chunk_lines);
+						chunk.samp_out = MALLOC(sizeof(float)*oix_max*chunk_lines);
+					}
+
+					// The first worker runs in this thread, and uses our own
+					// reverse mapping context.
+					geocode_worker_t *workers =
+						MALLOC(sizeof(geocode_worker_t)*n_workers);
+					int tt;
+					for (tt = 0; tt < n_workers; tt++) {
+						workers[tt].chunk = &chunk;
+						workers[tt].rm =
+							tt == 0 ? rm : reverse_map_new(x_columns, y_columns);
+						workers[tt].row_x = workers[tt].row_y = NULL;
+						workers[tt].x_pix = workers[tt].y_pix = NULL;
+						if (lattice) {
+							workers[tt].row_x = MALLOC(sizeof(double)*lattice->nx);
+							workers[tt].row_y = MALLOC(sizeof(double)*lattice->nx);
+							workers[tt].x_pix = MALLOC(sizeof(double)*oix_max);
+							workers[tt].y_pix = MALLOC(sizeof(double)*oix_max);
+						}
+						workers[tt].in_x = MALLOC(sizeof(double)*oix_max);
+						workers[tt].in_y = MALLOC(sizeof(double)*oix_max);
+						workers[tt].in_value = MALLOC(sizeof(float)*oix_max);
+						workers[tt].out_of_range_negative = 0;
+						workers[tt].out_of_range_positive = 0;
+					}
+
 					size_t oix, oiy;    // Output image pixel indicies.
 					for (oiy = 0 ; oiy < oiy_max ; oiy++) {
 			
 						asfLineMeter(oiy, oiy_max);
+
+						if (oiy == chunk.first_line + chunk.line_count)
+							geocode_chunk(&chunk, workers, n_workers, oiy,
+													MIN(chunk_lines, oiy_max - oiy));
+
+						// This line's results from the chunk.
+						size_t ll = oiy - chunk.first_line;
+						float *chunk_value = chunk.value + ll*oix_max;
+						guchar *chunk_inside = chunk.inside + ll*oix_max;
+						float *line_out =
+							chunk.line_out ? chunk.line_out + ll*oix_max : NULL;
+						float *samp_out =
+							chunk.samp_out ? chunk.samp_out + ll*oix_max : NULL;
 			
 						int oix_first_valid = -1;
 						int oix_last_valid = -1;
@@ -2380,50 +3052,15 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 						for ( oix = 0 ; oix < oix_max ; oix++ ) {
 
 							// Projection coordinates for the center of this pixel.
-										double oix_pc = omd->projection->startX + oix * omd->projection->perX;
-										double oiy_pc = omd->projection->startY + oiy * omd->projection->perY;
-
-							projX[oix] = oix_pc;
-							projY[oix] = oiy_pc;
+							projX[oix] = omd->projection->startX + oix * omd->projection->perX;
+							projY[oix] = omd->projection->startY + oiy * omd->projection->perY;
 				
-							// Determine pixel of interest in input image.  The fractional
-							// part is desired, we will use some sampling method to
-							// interpolate between pixel values.
-							double input_x_pixel = X_PIXEL (oix_pc, oiy_pc);
-							double input_y_pixel = Y_PIXEL (oix_pc, oiy_pc);
-	
-							if (line_out) {
-								if (input_y_pixel < 0 || input_x_pixel < 0)
-									line_out[oix] = 0;
-								else if (input_y_pixel > (ssize_t) ii_size_y - 1.0 ||
-												 input_x_pixel > (ssize_t) ii_size_x - 1.0)
-									line_out[oix] = 0;
-								else
-									line_out[oix] = input_y_pixel;
-							}
-				
-							if (samp_out) {
-								if (input_y_pixel < 0 || input_x_pixel < 0)
-									samp_out[oix] = 0;
-								else if (input_y_pixel > (ssize_t) ii_size_y - 1.0 ||
-												 input_x_pixel > (ssize_t) ii_size_x - 1.0)
-									samp_out[oix] = 0;
-								else
-									samp_out[oix] = input_x_pixel;
-							}
-				
-							g_assert (ii_size_x <= SSIZE_MAX);
-							g_assert (ii_size_y <= SSIZE_MAX);
-				
-							float value, ref_value, power;
+							float value, ref_value;
 				
 							// If we are outside the extent of the input image, set to the
 							// fill value.  We do this only on the first image -- subsequent
 							// images will work out the overlap with real data.
-							if (input_x_pixel < 0 || 
-									input_x_pixel > (ssize_t) ii_size_x - 1.0 || 
-									input_y_pixel < 0 || 
-									input_y_pixel > (ssize_t) ii_size_y - 1.0 ) {
+							if (!chunk_inside[oix]) {
 								if (i == 0) { // first image
 									if (output_by_line)
 										output_line[oix] = background_val;
@@ -2435,37 +3072,7 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 							// Otherwise, set to the value from the appropriate position in
 							// the input image.
 							else {
-					if (process_as_byte) {
-						value = 
-							uint8_image_sample(iim_b, input_x_pixel, input_y_pixel,
-										 uint8_image_sample_method);
-					}
-					else if ( imd->general->image_data_type == DEM ) {
-						value = dem_sample(iim, input_x_pixel, input_y_pixel,
-									 float_image_sample_method);
-					}
-					else {
-						if (imd->general->radiometry >= r_SIGMA_DB &&
-								imd->general->radiometry <= r_GAMMA_DB) {
-							power = 
-								float_image_sample(iim, input_x_pixel, input_y_pixel,
-								 float_image_sample_method);
-							value = 10.0 * log10(power);
-						}
-						else
-							value = 
-								float_image_sample(iim, input_x_pixel, input_y_pixel,
-								 float_image_sample_method);		
-			
-						if (omd->general->data_type == ASF_BYTE && value < 0.0) {
-							value = 0.0;
-							out_of_range_negative++;
-						}
-						if (omd->general->data_type == ASF_BYTE && value > 255.0) {
-							value = 255.0;
-							out_of_range_positive++;
-						}
-					}
+					value = chunk_value[oix];
 		
 					// Now we are ready to put the pixel value into the output image
 					if (i > 0 && imd->general->image_data_type == DEM &&
@@ -2598,6 +3205,27 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
               put_float_line(outSampFp, omd, oiy, samp_out);
 	    
 	  } // End of for-each-line set output values
+
+	  for (tt = 0; tt < n_workers; tt++) {
+	    out_of_range_negative += workers[tt].out_of_range_negative;
+	    out_of_range_positive += workers[tt].out_of_range_positive;
+	    if (tt > 0)
+	      reverse_map_free(workers[tt].rm);
+	    FREE(workers[tt].row_x);
+	    FREE(workers[tt].row_y);
+	    FREE(workers[tt].x_pix);
+	    FREE(workers[tt].y_pix);
+	    FREE(workers[tt].in_x);
+	    FREE(workers[tt].in_y);
+	    FREE(workers[tt].in_value);
+	  }
+	  FREE(workers);
+	  FREE(chunk.value);
+	  FREE(chunk.inside);
+	  FREE(chunk.line_out);
+	  FREE(chunk.samp_out);
+	  if (n_workers > 1)
+	    float_image_end_concurrent_reads(iim);
 	  
 	  // done writing this band
 	  if (output_by_line)
@@ -2608,8 +3236,6 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 	    FCLOSE(outLineFp);
 	  if (outSampFp)
 	    FCLOSE(outSampFp);
-	  FREE(line_out);
-	  FREE(samp_out);
 	  
 	  // free up the input image
 	  g_assert(!iim_b || !iim);
@@ -2638,31 +3264,12 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
         unlink(input_image);
       }
       
-      /////////////////////////////////////////////////////////////////////////
-      //
-      // Clear out all the persistent spline memory goop used by the
-      // reverse_map_x and reverse_map_y routines (see comments near the
-      // declarations of these variables).
-      //
-      
-      size_t sgs = dtf.sparse_grid_size; // Convenience alias.
-      
-      first_time_through_rmx = TRUE;
-      first_time_through_rmy = TRUE;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-				gsl_interp_accel_free (y_accel_rmx[ii]);
-				gsl_interp_accel_free (y_accel_rmy[ii]);
-				gsl_spline_free (y_spline_rmx[ii]);
-				gsl_spline_free (y_spline_rmy[ii]);
-      }
-      g_free (y_accel_rmx);
-      g_free (y_accel_rmy);
-      g_free (y_spline_rmx);
-      g_free (y_spline_rmy);
-      gsl_interp_accel_free (crnt_accel_rmx);
-      gsl_interp_accel_free (crnt_accel_rmy);
-      gsl_spline_free (crnt_rmx);
-      gsl_spline_free (crnt_rmy);
+      // Done with the spline model.
+      if (lattice)
+        reverse_map_lattice_free (lattice);
+      reverse_map_free (rm);
+      reverse_map_columns_free (x_columns);
+      reverse_map_columns_free (y_columns);
       
       /////////////////////////////////////////////////////////////////////////
       // Done with the data being modeled.
@@ -1,4 +1,5 @@
 #include "asf_meta.h"
+#include "asf_raster.h"
 
 // sometimes we don't have this - choose a conservative value
 #ifndef SSIZE_MAX
@@ -140,6 +141,21 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
                char *out_base_name, float background_val, double lat_min,
                double lat_max, double lon_min, double lon_max,
 	       const char *overlap, int save_line_sample_mapping);
+// Set the number of threads asf_geocode_ext and asf_mosaic use to
+// resample the input images.  0 (the default) means one per processor.
+// The output is the same whatever the number of threads.
+void asf_geocode_set_thread_count(int thread_count);
+// Have asf_geocode_ext and asf_mosaic read their input image through
+// filter (see asf_raster.h), so that a line by line processing step
+// before geocoding doesn't need to write out its result.  Only the
+// input's metadata has to exist.  Only for a single input image.  NULL
+// (the default) reads the input as it is.
+void asf_geocode_set_input_filter(LineFilter *filter);
+// Evaluate the mapping from output to input pixels only every spacing
+// output pixels in each direction, and interpolate bilinearly in
+// between, which is much faster than evaluating the spline model for
+// every pixel.  0 (the default) evaluates the spline model everywhere.
+void asf_geocode_set_lattice_spacing(int spacing);
 void sigsegv_handler (int signal_number);
 int geoid_adjust(const char *input, const char *output);
 void test_geoid(void);
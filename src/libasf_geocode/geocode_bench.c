@@ -0,0 +1,137 @@
+// Times geocoding a scene to UTM with the spline model evaluated for
+// every output pixel, and with the reverse mapping lattice at each
+// spacing given, and reports how far (in input pixels) the lattice
+// mapping strays from the spline one anywhere in the output image, and
+// how much the geocoded values differ.
+//
+// The positions come from the line/sample mapping files asf_geocode
+// saves on request; those runs are separate from the timed ones, so
+// that writing the mapping doesn't count in the times.
+//
+// Usage: geocode_bench <in_base_name> [spacing ...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_geocode.h"
+
+static double
+geocode (char *in, char *out, int spacing, int save_mapping)
+{
+  project_parameters_t pp;
+  pp.utm.zone = MAGIC_UNSET_INT;
+  pp.utm.lon0 = MAGIC_UNSET_DOUBLE;
+  pp.utm.lat0 = MAGIC_UNSET_DOUBLE;
+
+  asf_geocode_set_lattice_spacing (spacing);
+  GTimer *timer = g_timer_new ();
+  asf_geocode (&pp, UNIVERSAL_TRANSVERSE_MERCATOR, FALSE, RESAMPLE_BILINEAR,
+               0.0, WGS84_DATUM, -1, NULL, in, out, 0.0, save_mapping);
+  double seconds = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  return seconds;
+}
+
+// Largest and mean distance, in input pixels, between the positions
+// the spline and lattice runs mapped each output pixel to, over the
+// pixels both put inside the input image, and the largest difference
+// between the geocoded values.
+static void
+compare (double *largest, double *mean, double *value_largest)
+{
+  // spline lines, samples and values, then the same for the lattice
+  const char *names[6] = {
+    "geocode_bench_spline_map_lines.img",
+    "geocode_bench_spline_map_samples.img",
+    "geocode_bench_spline_map.img",
+    "geocode_bench_lattice_map_lines.img",
+    "geocode_bench_lattice_map_samples.img",
+    "geocode_bench_lattice_map.img",
+  };
+  meta_parameters *meta = meta_read (names[0]);
+  int ns = meta->general->sample_count, nl = meta->general->line_count;
+  FILE *fp[6];
+  float *buf[6];
+  double sum = 0.0;
+  long long n = 0;
+  int ii, jj, kk;
+
+  for ( kk = 0 ; kk < 6 ; kk++ ) {
+    fp[kk] = fopenImage (names[kk], "rb");
+    buf[kk] = g_new (float, ns);
+  }
+  float *sl = buf[0], *ss = buf[1], *sv = buf[2];
+  float *ll = buf[3], *ls = buf[4], *lv = buf[5];
+
+  *largest = *value_largest = 0.0;
+  for ( ii = 0 ; ii < nl ; ii++ ) {
+    for ( kk = 0 ; kk < 6 ; kk++ ) {
+      get_float_line (fp[kk], meta, ii, buf[kk]);
+    }
+    for ( jj = 0 ; jj < ns ; jj++ ) {
+      // The mapping files hold 0 where the pixel fell outside.
+      if ( (sl[jj] == 0.0 && ss[jj] == 0.0)
+           || (ll[jj] == 0.0 && ls[jj] == 0.0) ) {
+        continue;
+      }
+      double d = hypot (sl[jj] - ll[jj], ss[jj] - ls[jj]);
+      if ( d > *largest ) {
+        *largest = d;
+      }
+      if ( fabs (sv[jj] - lv[jj]) > *value_largest ) {
+        *value_largest = fabs (sv[jj] - lv[jj]);
+      }
+      sum += d;
+      n++;
+    }
+  }
+  *mean = n ? sum / n : 0.0;
+
+  for ( kk = 0 ; kk < 6 ; kk++ ) {
+    FCLOSE (fp[kk]);
+    g_free (buf[kk]);
+  }
+  meta_free (meta);
+}
+
+int
+main (int argc, char **argv)
+{
+  if ( argc < 2 ) {
+    fprintf (stderr, "Usage: %s <in_base_name> [spacing ...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char *in = argv[1];
+  int default_spacings[] = { 16, 32, 64 };
+  int n_spacings = argc > 2 ? argc - 2 : (int) G_N_ELEMENTS (default_spacings);
+  int ii;
+
+  quietflag = TRUE;
+  double spline_seconds = geocode (in, "geocode_bench_spline", 0, FALSE);
+  geocode (in, "geocode_bench_spline_map", 0, TRUE);
+  printf ("%8s %10s %8s %12s %12s %12s\n", "spacing", "seconds", "speedup",
+          "max dev", "mean dev", "max value");
+  printf ("%8s %10.2f\n", "spline", spline_seconds);
+
+  for ( ii = 0 ; ii < n_spacings ; ii++ ) {
+    int spacing = argc > 2 ? atoi (argv[ii + 2]) : default_spacings[ii];
+    double seconds = geocode (in, "geocode_bench_lattice", spacing, FALSE);
+    geocode (in, "geocode_bench_lattice_map", spacing, TRUE);
+
+    double largest, mean, value_largest;
+    compare (&largest, &mean, &value_largest);
+    printf ("%8d %10.2f %7.1fx %12.4g %12.4g %12.4g\n", spacing, seconds,
+            spline_seconds / seconds, largest, mean, value_largest);
+  }
+
+  asf_geocode_set_lattice_spacing (0);
+
+  return EXIT_SUCCESS;
+}
@@ -1650,6 +1650,22 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
     incid = incid_init(meta);
   }
 
+  // Calibration, a line at a time.  The incidence angles of
+  // unprojected images are taken to be the same for every line;
+  // projected ones get them from the quadratic fit, line by line.
+  // A LUT replaces the calibration of detected data only: complex data
+  // are calibrated either way.
+  cal_line_t *cal = NULL;
+  float *line_incid = NULL;
+  if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB &&
+      (!lutName || data_type >= COMPLEX_BYTE)) {
+    cal = cal_line_new(meta, bandExt, db_flag);
+    if (projected)
+      line_incid = MALLOC(sizeof(float)*ns);
+    else
+      cal_line_set_incid(cal, incid);
+  }
+
   // Check whether image needs to be flipped
   if (meta->general->orbit_direction == 'D' &&
       (!meta->projection || meta->projection->type != SCANSAR_PROJECTION) &&
@@ -1834,16 +1850,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
               cpx_float_ml_buf[ll*ns + kk].imag = cpx.imag;
             }
             else {
-                double incidence_angle;
-                if (projected) {
-		  incidence_angle = quadratic_2_incidence_angle(ll, kk, incid);
-                }
-                else {
-		  incidence_angle = incid[kk];
-                }
-                amp_float_buf[ll*ns + kk] = 
-		  get_cal_dn(meta, incidence_angle, kk, fValue, bandExt, 
-			     db_flag);
+                // Calibrated a line at a time below
+                amp_float_buf[ll*ns + kk] = fValue;
                 phase_float_buf[ll*ns + kk] =  atan2(cpx.imag, cpx.real);
             }
           }
@@ -1871,6 +1879,15 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
             }
           }
         }
+
+        if (cal && !multilook_flag) {
+          if (projected) {
+            for (kk=0; kk<ns; kk++)
+              line_incid[kk] = quadratic_2_incidence_angle(ll, kk, incid);
+            cal_line_set_incid(cal, line_incid);
+          }
+          cal_line_apply(cal, line, amp_float_buf + ll*ns);
+        }
       }
 
       // Multilook if requested
@@ -2094,16 +2111,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         byte_buf[kk] = tmp_byte_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)byte_buf[kk], bandExt, db_flag);
+                        // Calibrated a line at a time below
+                        amp_float_buf[kk] = (float) byte_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = (float) byte_buf[kk]*byte_buf[kk];
@@ -2126,16 +2135,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         short_buf[kk] = tmp_short_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)short_buf[kk], bandExt, db_flag);
+                        // Calibrated a line at a time below
+                        amp_float_buf[kk] = (float) short_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = (float) short_buf[kk]*short_buf[kk];
@@ -2149,16 +2150,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         int_buf[kk] = tmp_int_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)int_buf[kk], bandExt, db_flag);
+                        // Calibrated a line at a time below
+                        amp_float_buf[kk] = (float) int_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[ns+kk] = (float) int_buf[kk]*int_buf[kk];
@@ -2172,16 +2165,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         float_buf[kk] = tmp_float_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, float_buf[kk], 
-				     bandExt, db_flag);
+                        // Calibrated a line at a time below
+                        amp_float_buf[kk] = float_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = float_buf[kk]*float_buf[kk];
@@ -2195,16 +2180,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                         double_buf[kk] = tmp_double_buf[ns-kk-1];
                     }
                     if (radiometry >= r_SIGMA && radiometry <= r_GAMMA_DB) {
-                        double incidence_angle;
-                        if (projected) {
-                            incidence_angle = quadratic_2_incidence_angle(ii, kk, incid);
-                        }
-                        else {
-                            incidence_angle = incid[kk];
-                        }
-                        amp_float_buf[kk] = 
-			  get_cal_dn(meta, incidence_angle, kk, 
-				     (float)double_buf[kk], bandExt, db_flag);
+                        // Calibrated a line at a time below
+                        amp_float_buf[kk] = (float) double_buf[kk];
                     }
                     else if (radiometry == r_POWER) {
                         amp_float_buf[kk] = (float) double_buf[kk]*double_buf[kk];
@@ -2221,9 +2198,19 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
                     break;
             }
         }
-            if (strcmp(meta->general->sensor,"ERS2") == 0 && apply_ers2_gain_fix_flag)
-            amp_float_buf[kk] =
-                apply_ers2_gain_fix(radiometry, gain_adj, amp_float_buf[kk]);
+      }
+      if (cal) {
+        if (projected) {
+          for (kk=0; kk<ns; kk++)
+            line_incid[kk] = quadratic_2_incidence_angle(ii, kk, incid);
+          cal_line_set_incid(cal, line_incid);
+        }
+        cal_line_apply(cal, ii, amp_float_buf);
+      }
+      if (strcmp(meta->general->sensor,"ERS2") == 0 && apply_ers2_gain_fix_flag) {
+        for (kk = 0; kk < ns; kk++)
+          amp_float_buf[kk] =
+            apply_ers2_gain_fix(radiometry, gain_adj, amp_float_buf[kk]);
       }
       if (import_single_band) {
           put_band_float_line(fpOut, meta, 0, ii, amp_float_buf);
@@ -2262,6 +2249,8 @@ void import_ceos_data(char *inDataName, char *inMetaName, char *outDataName,
   */
 
   // Clean up
+  cal_line_free(cal);
+  FREE(line_incid);
   if (incid)
     FREE(incid);
   if (byte_buf) {
@@ -2,25 +2,263 @@
 #include "asf_meta.h"
 #include "asf_insar.h"
 #include "asf_raster.h"
+#include <glib.h>
+
+// The interferogram, the coherence and the multilooked interferogram
+// all come out of one pass over the master and slave images.  Output
+// line L of the multilooked images covers input rows L*stepLine to
+// (L+1)*stepLine, and its coherence window rows L*stepLine to
+// L*stepLine+lookLine; we call the stepLine rows of each output line a
+// band.  The image is done a chunk of bands at a time:
+//   - the rows of the chunk are read from master and slave, each row
+//     just once -- the rows the last chunk's coherence windows reached
+//     into are kept, not read again;
+//   - pass one forms the conjugate products of each band's rows (and
+//     the single look amplitude and phase, if those are wanted) and sums
+//     them, and the master and slave powers, down each column of the
+//     band;
+//   - pass two adds the band sums up into each output line's coherence
+//     window, and across into its multilook and coherence boxes.
+// The bands, then the output lines, of a chunk are handed out to the
+// threads IGRAM_BLOCK_BANDS at a time.
+
+#define IGRAM_BLOCK_BANDS 4
+
+// Number of threads asf_igram_coh works with; 0 means one per
+// processor.
+static int igram_thread_count = 0;
+
+void asf_igram_coh_set_thread_count(int thread_count)
+{
+  igram_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+typedef struct {
+  int ns, nl;
+  int lookLine, lookSample, stepLine, stepSample;
+  int ml_ns, ml_nl;
+  float ampScale;
+  int single_look;
+
+  // the rows of master and slave we have, first_row to last_row
+  int first_row, last_row;
+  complexFloat *master, *slave;
+
+  // the bands of this chunk, first_band to first_band+n_bands; band
+  // sums cover the rows of the band up to last_row
+  int first_band, n_bands;
+  double *band_re, *band_im, *band_a, *band_b;   // n_bands x ns
+
+  // single look output, for rows first_band*stepLine to sl_end_row
+  int sl_end_row;
+  float *amp, *phase;
+
+  // multilooked output, for lines first_band to first_band+n_lines
+  int n_lines;
+  float *ml_amp, *ml_phase, *coh;
+
+  int n_units;
+  gint next_unit;
+} igram_chunk;
+
+typedef struct {
+  igram_chunk *c;
+  double *sum_re, *sum_im, *sum_a, *sum_b;        // ns each
+  void (*func)(igram_chunk *c, int unit, gpointer worker);
+} igram_worker;
+
+// Adds row 'row' of the chunk into the column sums
+static void add_row(igram_chunk *c, int row, double *re, double *im,
+                    double *a, double *b, float *amp, float *phase)
+{
+  const complexFloat *m = c->master + (size_t)(row - c->first_row)*c->ns;
+  const complexFloat *s = c->slave + (size_t)(row - c->first_row)*c->ns;
+  int ii;
+
+  for (ii=0; ii<c->ns; ii++) {
+    // Complex multiplication for interferogram generation
+    double igram_real = m[ii].real*s[ii].real + m[ii].imag*s[ii].imag;
+    double igram_imag = m[ii].imag*s[ii].real - m[ii].real*s[ii].imag;
+    re[ii] += igram_real;
+    im[ii] += igram_imag;
+    a[ii] += (double)m[ii].real*m[ii].real + (double)m[ii].imag*m[ii].imag;
+    b[ii] += (double)s[ii].real*s[ii].real + (double)s[ii].imag*s[ii].imag;
+    if (amp) {
+      amp[ii] = sqrt(igram_real*igram_real + igram_imag*igram_imag);
+      if (FLOAT_EQUIVALENT(igram_real, 0.0) ||
+          FLOAT_EQUIVALENT(igram_imag, 0.0))
+        phase[ii] = 0.0;
+      else
+        phase[ii] = atan2(igram_imag, igram_real);
+    }
+  }
+}
+
+// Pass one: sum up a band, writing out its single look rows on the way
+static void do_band(igram_chunk *c, int unit, gpointer worker)
+{
+  int band = c->first_band + unit;
+  int start = band*c->stepLine;
+  int end = MIN(start + c->stepLine, c->last_row);
+  size_t off = (size_t)unit*c->ns;
+  int row;
+
+  memset(c->band_re + off, 0, sizeof(double)*c->ns);
+  memset(c->band_im + off, 0, sizeof(double)*c->ns);
+  memset(c->band_a + off, 0, sizeof(double)*c->ns);
+  memset(c->band_b + off, 0, sizeof(double)*c->ns);
+  for (row=start; row<end; row++) {
+    float *amp = NULL, *phase = NULL;
+    if (c->single_look && row < c->sl_end_row) {
+      size_t sl = (size_t)(row - c->first_band*c->stepLine)*c->ns;
+      amp = c->amp + sl;
+      phase = c->phase + sl;
+    }
+    add_row(c, row, c->band_re + off, c->band_im + off, c->band_a + off,
+            c->band_b + off, amp, phase);
+  }
+}
+
+// Pass two: multilook and coherence for output line first_band+unit
+static void do_line(igram_chunk *c, int unit, gpointer worker)
+{
+  igram_worker *w = worker;
+  int line = c->first_band + unit;
+  int start = line*c->stepLine;
+  int end = MIN(start + c->lookLine, c->nl);
+  float *ml_amp = c->ml_amp + (size_t)unit*c->ml_ns;
+  float *ml_phase = c->ml_phase + (size_t)unit*c->ml_ns;
+  float *coh = c->coh + (size_t)unit*c->ml_ns;
+  int band, col, ii, row;
+
+  // Sum the window's rows down each column: whole bands where we can,
+  // and the rows of any band the window only reaches part way into
+  memset(w->sum_re, 0, sizeof(double)*c->ns);
+  memset(w->sum_im, 0, sizeof(double)*c->ns);
+  memset(w->sum_a, 0, sizeof(double)*c->ns);
+  memset(w->sum_b, 0, sizeof(double)*c->ns);
+  for (band=line; band*c->stepLine < end; band++) {
+    int band_end = MIN((band+1)*c->stepLine, c->last_row);
+    if (band_end <= end) {
+      size_t off = (size_t)(band - c->first_band)*c->ns;
+      for (ii=0; ii<c->ns; ii++) {
+        w->sum_re[ii] += c->band_re[off+ii];
+        w->sum_im[ii] += c->band_im[off+ii];
+        w->sum_a[ii] += c->band_a[off+ii];
+        w->sum_b[ii] += c->band_b[off+ii];
+      }
+    }
+    else {
+      for (row=band*c->stepLine; row<end; row++)
+        add_row(c, row, w->sum_re, w->sum_im, w->sum_a, w->sum_b,
+                NULL, NULL);
+    }
+  }
+
+  for (col=0; col<c->ml_ns; col++) {
+    int inCol = col*c->stepSample;
+    int limitSample = MIN(c->lookSample, c->ns - inCol);
+    double igram_real = 0.0, igram_imag = 0.0, sum_a = 0.0, sum_b = 0.0;
+
+    // Multilook: the line's own band, over stepSample columns
+    size_t off = (size_t)unit*c->ns + inCol;
+    for (ii=0; ii<c->stepSample; ii++) {
+      igram_real += c->band_re[off+ii];
+      igram_imag += c->band_im[off+ii];
+    }
+    ml_amp[col] = sqrt(igram_real*igram_real + igram_imag*igram_imag)*
+      c->ampScale;
+    if (FLOAT_EQUIVALENT(igram_real, 0.0) ||
+        FLOAT_EQUIVALENT(igram_imag, 0.0))
+      ml_phase[col] = 0.0;
+    else
+      ml_phase[col] = atan2(igram_imag, igram_real);
+
+    // Coherence: the window's column sums, over lookSample columns
+    igram_real = igram_imag = 0.0;
+    for (ii=0; ii<limitSample; ii++) {
+      igram_real += w->sum_re[inCol+ii];
+      igram_imag += w->sum_im[inCol+ii];
+      sum_a += w->sum_a[inCol+ii];
+      sum_b += w->sum_b[inCol+ii];
+    }
+    if (FLOAT_EQUIVALENT((sum_a*sum_b), 0.0))
+      coh[col] = 0.0;
+    else {
+      coh[col] = (float) (sqrt(igram_real*igram_real +
+                               igram_imag*igram_imag) / sqrt(sum_a*sum_b));
+      if (coh[col] > 1.0001)
+        asfPrintError("Coherence %f is more than 1 -- "
+                      "you shouldn't have seen this!\n", coh[col]);
+    }
+  }
+}
 
-#define AMP(cpx) sqrt((cpx).real*(cpx).real + (cpx).imag*(cpx).imag)
-#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+static gpointer igram_thread(gpointer data)
+{
+  igram_worker *w = data;
+  igram_chunk *c = w->c;
+  int first, ii;
+
+  while ((first = g_atomic_int_add(&c->next_unit, IGRAM_BLOCK_BANDS))
+         < c->n_units)
+  {
+    int last = MIN(first + IGRAM_BLOCK_BANDS, c->n_units);
+    for (ii=first; ii<last; ii++)
+      w->func(c, ii, w);
+  }
+  return NULL;
+}
+
+// Runs func for units 0 to n_units of the chunk, across the threads
+static void igram_chunk_run(igram_chunk *c, igram_worker *workers,
+                            int n_threads, int n_units,
+                            void (*func)(igram_chunk *, int, gpointer))
+{
+  int ii;
+  int n_blocks = (n_units + IGRAM_BLOCK_BANDS - 1) / IGRAM_BLOCK_BANDS;
+  if (n_threads > n_blocks) n_threads = n_blocks;
+  if (n_threads < 1) return;
+
+  c->n_units = n_units;
+  c->next_unit = 0;
+  GThread **threads = g_new(GThread *, n_threads);
+  for (ii=0; ii<n_threads; ++ii) {
+    workers[ii].c = c;
+    workers[ii].func = func;
+  }
+  for (ii=1; ii<n_threads; ++ii)
+    threads[ii] = g_thread_new("asf_igram_coh", igram_thread, &workers[ii]);
+  igram_thread(&workers[0]);
+  for (ii=1; ii<n_threads; ++ii)
+    g_thread_join(threads[ii]);
+  g_free(threads);
+}
 
 int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 		  char *masterFile, char *slaveFile, char *outBase,
 		  float *average)
+{
+  return asf_igram_coh_ext(lookLine, lookSample, stepLine, stepSample,
+                           masterFile, slaveFile, outBase, TRUE, average);
+}
+
+int asf_igram_coh_ext(int lookLine, int lookSample, int stepLine,
+                      int stepSample, char *masterFile, char *slaveFile,
+                      char *outBase, int single_look, float *average)
 {
   char ampFile[255], phaseFile[255]; //, igramFile[512];
   char cohFile[512], ml_ampFile[255], ml_phaseFile[255]; //, ml_igramFile[512];
-  FILE *fpMaster, *fpSlave, *fpAmp, *fpPhase, *fpCoh, *fpAmp_ml, *fpPhase_ml;
-  int line, sample_count, line_count, count;
-  float	bin_high, bin_low, max=0.0, sum_a, sum_b, ampScale;
+  FILE *fpMaster, *fpSlave, *fpAmp=NULL, *fpPhase=NULL, *fpCoh;
+  FILE *fpAmp_ml, *fpPhase_ml;
+  int ii, line, sample_count, line_count, count, n_threads, chunk_bands;
+  int total_bands;
+  float	bin_high, bin_low, max=0.0;
   double hist_sum=0.0, percent, percent_sum;
   long long hist_val[HIST_SIZE], hist_cnt=0;
   meta_parameters *inMeta,*outMeta, *ml_outMeta;
-  complexFloat *master, *slave, *sum_igram, *sum_ml_igram;
-  float *amp, *phase, *sum_cpx_a, *sum_cpx_b, *coh, *pCoh;
-  float *ml_amp, *ml_phase;
+  igram_chunk c;
+  igram_worker *workers;
 
   // FIXME: Processing flow with two-banded interferogram needed - backed out
   //        for now
@@ -35,21 +273,22 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 
   // Read input meta file
   inMeta = meta_read(masterFile);
-  line_count = inMeta->general->line_count; 
+  line_count = inMeta->general->line_count;
   sample_count = inMeta->general->sample_count;
-  ampScale = 1.0/(stepLine*stepSample);
 
-  // Generate metadata for single-look images 
+  // Generate metadata for single-look images
   outMeta = meta_read(masterFile);
   outMeta->general->data_type = REAL32;
 
-  // Write metadata for interferometric amplitude
-  outMeta->general->image_data_type = AMPLITUDE_IMAGE;
-  meta_write(outMeta, ampFile);
+  if (single_look) {
+    // Write metadata for interferometric amplitude
+    outMeta->general->image_data_type = AMPLITUDE_IMAGE;
+    meta_write(outMeta, ampFile);
 
-  // Write metadata for interferometric phase
-  outMeta->general->image_data_type = PHASE_IMAGE;
-  meta_write(outMeta, phaseFile);
+    // Write metadata for interferometric phase
+    outMeta->general->image_data_type = PHASE_IMAGE;
+    meta_write(outMeta, phaseFile);
+  }
 
   /*
   // Write metadata for interferogram
@@ -57,8 +296,8 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
   outMeta->general->band_count = 2;
   strcpy(outMeta->general->bands, "IGRAM-AMP,IGRAM-PHASE");
   meta_write(outMeta, igramFile);
-  */	
-     
+  */
+
   // Generate metadata for multilooked images
   ml_outMeta = meta_read(masterFile);
   ml_outMeta->general->data_type = REAL32;
@@ -94,24 +333,54 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
   meta_write(ml_outMeta, ml_igramFile);
   */
 
-  // Allocate memory
-  master = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count*lookLine);
-  slave = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count*lookLine);
-  amp = (float *) MALLOC(sizeof(float)*sample_count*lookLine);
-  phase = (float *) MALLOC(sizeof(float)*sample_count*lookLine);
-  ml_amp = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  ml_phase = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  coh = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  sum_cpx_a = (float *) MALLOC(sizeof(float)*sample_count);
-  sum_cpx_b = (float *) MALLOC(sizeof(float)*sample_count);
-  sum_igram = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count);
-  sum_ml_igram = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count);
+  c.ns = sample_count;
+  c.nl = line_count;
+  c.lookLine = lookLine;
+  c.lookSample = lookSample;
+  c.stepLine = stepLine;
+  c.stepSample = stepSample;
+  c.ml_ns = ml_outMeta->general->sample_count;
+  c.ml_nl = ml_outMeta->general->line_count;
+  c.ampScale = 1.0/(stepLine*stepSample);
+  c.single_look = single_look;
+
+  // Allocate memory: enough for a chunk of bands, and the rows their
+  // coherence windows reach beyond it
+  n_threads = igram_thread_count > 0 ? igram_thread_count
+    : g_get_num_processors();
+  chunk_bands = n_threads*IGRAM_BLOCK_BANDS;
+  int max_rows = chunk_bands*stepLine + MAX(lookLine - stepLine, 0);
+  int max_bands = chunk_bands + (lookLine + stepLine - 1)/stepLine;
+  size_t ns = sample_count;
+  c.master = (complexFloat *) MALLOC(sizeof(complexFloat)*ns*max_rows);
+  c.slave = (complexFloat *) MALLOC(sizeof(complexFloat)*ns*max_rows);
+  c.band_re = (double *) MALLOC(sizeof(double)*ns*max_bands);
+  c.band_im = (double *) MALLOC(sizeof(double)*ns*max_bands);
+  c.band_a = (double *) MALLOC(sizeof(double)*ns*max_bands);
+  c.band_b = (double *) MALLOC(sizeof(double)*ns*max_bands);
+  c.amp = c.phase = NULL;
+  if (single_look) {
+    c.amp = (float *) MALLOC(sizeof(float)*ns*chunk_bands*stepLine);
+    c.phase = (float *) MALLOC(sizeof(float)*ns*chunk_bands*stepLine);
+  }
+  c.ml_amp = (float *) MALLOC(sizeof(float)*c.ml_ns*chunk_bands);
+  c.ml_phase = (float *) MALLOC(sizeof(float)*c.ml_ns*chunk_bands);
+  c.coh = (float *) MALLOC(sizeof(float)*c.ml_ns*chunk_bands);
+  workers = (igram_worker *) MALLOC(sizeof(igram_worker)*n_threads);
+  for (ii=0; ii<n_threads; ii++) {
+    workers[ii].sum_re = (double *) MALLOC(sizeof(double)*ns);
+    workers[ii].sum_im = (double *) MALLOC(sizeof(double)*ns);
+    workers[ii].sum_a = (double *) MALLOC(sizeof(double)*ns);
+    workers[ii].sum_b = (double *) MALLOC(sizeof(double)*ns);
+  }
 
   // Open files
   fpMaster = FOPEN(masterFile,"rb");
   fpSlave = FOPEN(slaveFile,"rb");
-  fpAmp = FOPEN(ampFile,"wb");
-  fpPhase = FOPEN(phaseFile,"wb");
+  if (single_look) {
+    fpAmp = FOPEN(ampFile,"wb");
+    fpPhase = FOPEN(phaseFile,"wb");
+  }
   fpAmp_ml = FOPEN(ml_ampFile,"wb");
   fpPhase_ml = FOPEN(ml_phaseFile,"wb");
   //FILE *fpIgram = FOPEN(igramFile, "wb");
@@ -123,141 +392,85 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 
   asfPrintStatus("   Calculating interferogram and coherence ...\n\n");
 
-  for (line=0; line<line_count; line+=stepLine)
+  // The last band may be short, and have no multilooked line of its own,
+  // but its rows still go into the single look images
+  total_bands = (line_count + stepLine - 1)/stepLine;
+  c.first_row = c.last_row = 0;
+  for (line=0; line<total_bands; line+=chunk_bands)
   {
-    register int offset, row, column, limitLine;
-    double igram_real, igram_imag;
-    int inCol;
-    limitLine=MIN(lookLine, line_count-line);
-
-    printf("Percent completed %3.0f\r",(float)line/line_count*100.0);
-
-    pCoh = coh;
-
-    // Read in the next lines of data
-    get_complexFloat_lines(fpMaster, inMeta, line, limitLine, master);
-    get_complexFloat_lines(fpSlave, inMeta, line, limitLine, slave);
-
-    // Add the remaining rows into sum vectors
-    offset = sample_count;
-    for (column=0; column<sample_count; column++)
-    {
-      offset = column;
-      sum_cpx_a[column] = 0.0;
-      sum_cpx_b[column] = 0.0;
-      sum_igram[column].real = 0.0;
-      sum_igram[column].imag = 0.0;
-      sum_ml_igram[column].real = 0.0;
-      sum_ml_igram[column].imag = 0.0;
-      igram_real = 0.0;
-      igram_imag = 0.0;
-
-      for (row=0; row<limitLine; row++)
-      {
-	// Complex multiplication for interferogram generation
-	igram_real = master[offset].real*slave[offset].real + 
-	  master[offset].imag*slave[offset].imag;
-        igram_imag = master[offset].imag*slave[offset].real - 
-	  master[offset].real*slave[offset].imag;
-        amp[offset] = sqrt(igram_real*igram_real + igram_imag*igram_imag);
-        if (FLOAT_EQUIVALENT(igram_real, 0.0) || 
-	    FLOAT_EQUIVALENT(igram_imag, 0.0))
-	  phase[offset]=0.0;
-        else
-	  phase[offset] = atan2(igram_imag, igram_real);
-
-       	sum_cpx_a[column] += AMP(master[offset])*AMP(master[offset]);
-      	sum_cpx_b[column] += AMP(slave[offset])*AMP(slave[offset]);
-       	sum_igram[column].real += igram_real;
-	sum_igram[column].imag += igram_imag;
-	if (line % stepLine == 0 && row < stepLine) {
-	  sum_ml_igram[column].real += igram_real;
-	  sum_ml_igram[column].imag += igram_imag;
-	}
-
-	offset += sample_count;
-      }
-
-      ml_amp[column] = 
-	sqrt(sum_ml_igram[column].real*sum_ml_igram[column].real + 
-	     sum_ml_igram[column].imag*sum_ml_igram[column].imag)*ampScale;
-      if (FLOAT_EQUIVALENT(sum_ml_igram[column].real, 0.0) || 
-	  FLOAT_EQUIVALENT(sum_ml_igram[column].imag, 0.0))
-	ml_phase[column] = 0.0;
-      else
-	ml_phase[column] = atan2(sum_ml_igram[column].imag, 
-				 sum_ml_igram[column].real);
+    int next = MIN(line + chunk_bands, total_bands);
+    int first_row = line*stepLine;
+    int last_row = MIN(line_count,
+                       MAX(next*stepLine, (next-1)*stepLine + lookLine));
+
+    // Keep the rows the last chunk read that this one needs, and read
+    // the rest
+    if (c.last_row > first_row) {
+      size_t keep = (size_t)(c.last_row - first_row)*ns;
+      memmove(c.master, c.master + (size_t)(first_row - c.first_row)*ns,
+              sizeof(complexFloat)*keep);
+      memmove(c.slave, c.slave + (size_t)(first_row - c.first_row)*ns,
+              sizeof(complexFloat)*keep);
+    }
+    else
+      c.last_row = first_row;
+    if (last_row > c.last_row) {
+      size_t have = (size_t)(c.last_row - first_row)*ns;
+      get_complexFloat_lines(fpMaster, inMeta, c.last_row,
+                             last_row - c.last_row, c.master + have);
+      get_complexFloat_lines(fpSlave, inMeta, c.last_row,
+                             last_row - c.last_row, c.slave + have);
+    }
+    c.first_row = first_row;
+    c.last_row = last_row;
+
+    c.first_band = line;
+    c.n_bands = (last_row + stepLine - 1)/stepLine - line;
+    c.sl_end_row = MIN(line_count, next*stepLine);
+    c.n_lines = MAX(0, MIN(next, c.ml_nl) - line);
+
+    igram_chunk_run(&c, workers, n_threads, c.n_bands, do_band);
+    igram_chunk_run(&c, workers, n_threads, c.n_lines, do_line);
+
+    // Write single-look and multilooked amplitude and phase, and coherence
+    if (single_look) {
+      put_float_lines(fpAmp, outMeta, first_row, c.sl_end_row - first_row,
+                      c.amp);
+      put_float_lines(fpPhase, outMeta, first_row, c.sl_end_row - first_row,
+                      c.phase);
+    }
+    if (c.n_lines > 0) {
+      put_float_lines(fpAmp_ml, ml_outMeta, line, c.n_lines, c.ml_amp);
+      put_float_lines(fpPhase_ml, ml_outMeta, line, c.n_lines, c.ml_phase);
+      put_float_lines(fpCoh, ml_outMeta, line, c.n_lines, c.coh);
     }
-
-    // Write single-look and multilooked amplitude and phase
-    put_float_lines(fpAmp, outMeta, line, stepLine, amp);
-    put_float_lines(fpPhase, outMeta, line, stepLine, phase);
-    put_float_line(fpAmp_ml, ml_outMeta, line/stepLine, ml_amp);
-    put_float_line(fpPhase_ml, ml_outMeta, line/stepLine, ml_phase);
     //put_band_float_lines(fpIgram, outMeta, 0, line, stepLine, amp);
     //put_band_float_lines(fpIgram, outMeta, 1, line, stepLine, phase);
     //put_band_float_line(fpIgram_ml, ml_outMeta, 0, line/stepLine, ml_amp);
     //put_band_float_line(fpIgram_ml, ml_outMeta, 1, line/stepLine, ml_phase);
 
-    // Calculate the coherence by adding from sum vectors
-    for (inCol=0; inCol<sample_count; inCol+=stepSample)
-    {
-      register int limitSample = MIN(lookSample,sample_count-inCol);
-      sum_a = 0.0;
-      sum_b = 0.0;
-      igram_real = 0.0;
-      igram_imag = 0.0;
-
-      // Step over multilook area and sum output columns
-      for (column=0; column<limitSample; column++)
-      {
-	igram_real += sum_igram[inCol+column].real;
-	igram_imag += sum_igram[inCol+column].imag;				
-	sum_a += sum_cpx_a[inCol+column];
-	sum_b += sum_cpx_b[inCol+column];
-      }
-
-      if (FLOAT_EQUIVALENT((sum_a*sum_b), 0.0))
-	*pCoh = 0.0;
-      else 
-      {
-	*pCoh = (float) sqrt(igram_real*igram_real + igram_imag*igram_imag) /
-	  sqrt(sum_a * sum_b);
-	if (*pCoh>1.0001)
-	{ 
-	  printf("   coh = %f -- setting to 1.0\n",*pCoh);
-	  printf("   You shouldn't have seen this!\n");
-	  printf("   Exiting.\n");
-          exit(EXIT_FAILURE);
-	  *pCoh=1.0;
-	}
-      }
-     pCoh++;
-    } 
-
-    // Write out values for coherence
-    put_float_line(fpCoh, ml_outMeta, line/stepLine, coh);
-
     // Keep filling coherence histogram
-    for (count=0; count<sample_count/stepSample; count++)
+    for (count=0; count<c.n_lines*c.ml_ns; count++)
     {
       register int tmp;
-      tmp = (int) (coh[count]*HIST_SIZE); /* Figure out which bin this value is in */
+      float coh = c.coh[count];
+      tmp = (int) (coh*HIST_SIZE); /* Figure out which bin this value is in */
       /* This shouldn't happen */
       if(tmp >= HIST_SIZE)
 	tmp = HIST_SIZE-1;
       if(tmp < 0)
 	tmp = 0;
-      
+
       hist_val[tmp]++;        // Increment that bin for the histogram
-      hist_sum += coh[count];   // Add up the values for the sum
+      hist_sum += coh;        // Add up the values for the sum
       hist_cnt++;             // Keep track of the total number of values
-      if (coh[count]>max) 
-	max = coh[count];  // Calculate maximum coherence
+      if (coh>max)
+	max = coh;            // Calculate maximum coherence
     }
-  } // End for line
 
-  printf("Percent completed %3.0f\n",(float)line/line_count*100.0);
+    for (ii=line; ii<line+c.n_lines; ii++)
+      asfLineMeter(ii, c.ml_nl);
+  } // End for line
 
   // Sum and print the statistics
   percent_sum = 0.0;
@@ -274,29 +487,41 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
   *average = (float)hist_sum/(float)hist_cnt;
   printf("   ---------------------------------------\n");
   printf("   Maximum Coherence: %.3f\n", max);
-  printf("   Average Coherence: %.3f  (%.1f / %lld) %f\n", 
+  printf("   Average Coherence: %.3f  (%.1f / %lld) %f\n",
 		 *average,hist_sum, hist_cnt, percent_sum);
 
   // Free and exit
-  FREE(master); 
-  FREE(slave);
-  FREE(amp); 
-  FREE(phase);
-  FREE(ml_amp); 
-  FREE(ml_phase); 
-  FREE(coh); 
-  FCLOSE(fpMaster); 
+  for (ii=0; ii<n_threads; ii++) {
+    FREE(workers[ii].sum_re);
+    FREE(workers[ii].sum_im);
+    FREE(workers[ii].sum_a);
+    FREE(workers[ii].sum_b);
+  }
+  FREE(workers);
+  FREE(c.master);
+  FREE(c.slave);
+  FREE(c.band_re);
+  FREE(c.band_im);
+  FREE(c.band_a);
+  FREE(c.band_b);
+  FREE(c.amp);
+  FREE(c.phase);
+  FREE(c.ml_amp);
+  FREE(c.ml_phase);
+  FREE(c.coh);
+  FCLOSE(fpMaster);
   FCLOSE(fpSlave);
-  FCLOSE(fpAmp); 
-  FCLOSE(fpPhase);
-  FCLOSE(fpAmp_ml); 
+  if (single_look) {
+    FCLOSE(fpAmp);
+    FCLOSE(fpPhase);
+  }
+  FCLOSE(fpAmp_ml);
   FCLOSE(fpPhase_ml);
   //FCLOSE(fpIgram);
   //FCLOSE(fpIgram_ml);
-  FCLOSE(fpCoh); 
+  FCLOSE(fpCoh);
   meta_free(inMeta);
   meta_free(outMeta);
   meta_free(ml_outMeta);
   return(0);
 }
-
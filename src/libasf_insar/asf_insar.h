@@ -52,6 +52,14 @@ int asf_coregister(int datatype, char *coregType, char *baseName, int deskew,
 int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 		  char *masterFile, char *slaveFile, char *outBase,
 		  float *average);
+/* As asf_igram_coh, but the single look interferogram amplitude and
+   phase are only written out if single_look is TRUE. */
+int asf_igram_coh_ext(int lookLine, int lookSample, int stepLine,
+		      int stepSample, char *masterFile, char *slaveFile,
+		      char *outBase, int single_look, float *average);
+/* Number of threads asf_igram_coh works with.  0 (the default) means
+   one per processor. */
+void asf_igram_coh_set_thread_count(int thread_count);
 
 // Prototypes from asf_phase_unwrap.c
 int dem2phase(char *demFile, char *baseFile, char *phaseFile);
@@ -81,6 +89,13 @@ int zeroify(char *inFile, char *testFile, char *outFile);
 
 // Prototypes from escher.c
 int escher(char *inFile, char *outFile);
+/* Unwraps tile_size x tile_size tiles (plus 'overlap' pixels of their
+   neighbours) of the interferogram separately, several at a time, and
+   ties them together.  0 for either gives the default. */
+int escher_tiled(char *inFile, char *outFile, int tile_size, int overlap);
+/* Number of threads escher_tiled unwraps tiles with.  0 (the default)
+   means one per processor. */
+void escher_set_thread_count(int thread_count);
 
 // Prototypes from refine_baseline.c
 int refine_baseline(char *phaseFile, char *seeds, char *oldBase, 
@@ -80,6 +80,15 @@ int dem2phase(char *demFile, char *baseFile, char *phaseFile)
   return(0);
 }
 
+// 'escher_tiled' is escher done a tile at a time, for interferograms
+// too big to unwrap in one piece
+static int unwrap_escher(char *algorithm, char *inFile, char *outFile)
+{
+  if (strcmp(algorithm, "escher_tiled") == 0)
+    return escher_tiled(inFile, outFile, 0, 0);
+  return escher(inFile, outFile);
+}
+
 int asf_phase_unwrap(char *algorithm, char *interferogram, char *metaFile, 
 		     char *demFile, char *baseline, double filter_strength, 
 		     int flattening, char *mask, char *unwrapped_phase)
@@ -137,7 +146,7 @@ int asf_phase_unwrap(char *algorithm, char *interferogram, char *metaFile,
     }
     if (flattening == 1) {
       asfPrintStatus("   Performing phase unwrapping ...\n");
-      check_return(escher(tmp,"unwrap_dem"), "phase unwrapping (escher)");
+      check_return(unwrap_escher(algorithm, tmp,"unwrap_dem"), "phase unwrapping (escher)");
       asfPrintStatus("   Adding known topographic phase again ...\n");
       sprintf(inFiles[0], "unwrap_dem.img");
       sprintf(inFiles[1], "dem_phase.img");
@@ -146,7 +155,7 @@ int asf_phase_unwrap(char *algorithm, char *interferogram, char *metaFile,
 		   "adding terrain induced phase back (raster_calc)");
     }
     else
-      check_return(escher(tmp,"unwrap"), "phase unwrapping (escher)");
+      check_return(unwrap_escher(algorithm, tmp,"unwrap"), "phase unwrapping (escher)");
 
     asfPrintStatus("   Reramping unwrapped phase ...\n");
     check_return(deramp("unwrap", baseline, "unwrap_nod", 1),
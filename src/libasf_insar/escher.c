@@ -3,6 +3,7 @@
 #include "asf_meta.h"
 #include "asf_endian.h"
 #include "asf_insar.h"
+#include <glib.h>
 
 // General constants
 #define MAXNAME         256
@@ -70,58 +71,95 @@ typedef struct _Point {
   int j;
 } Point;
 
-#define MAX_PLIST 1048576
+/* The points of the branch cut tree being grown, and for each point the
+   one it connects back to.  Grows as needed. */
 typedef struct _PList {
   int n;
-  Point p[1048576];
-  int c[1048576];
+  int max;
+  Point *p;
+  int *c;
 } PList;
 
-// Globals
-PList list;
-Uchar *mask;     /* phase-state mask  */
-Uchar *im;       /* integration mask  */
-float *phase;   /* input phase       */
-float *coh;     /* coherence 'rho'   */
-int wid;
-int len;
-int size;
+/* An image being unwrapped: the whole interferogram, or one tile of it */
+typedef struct _Grid {
+  int wid;
+  int len;
+  float *phase;   /* input phase, unwrapped in place */
+  Uchar *mask;    /* phase-state mask  */
+  Uchar *im;      /* integration mask  */
+  PList list;
+  int verbose;    /* whether to report progress as we go */
+} Grid;
 
 // Function declarations
-void loadWrappedPhase(char *phaseName);
-void groundBorder(void);
-void makeMask(void);
-void verifyCuts(void);
-Uchar chargeCalc(float ul, float ll, float lr, float ur);
-float phaseRemap(float in);
-void installCordon(char *cordonName);
-void cutMask(void);
-void generateCut(int x, int y);
-void makeBranchCut(int x1, int y1, int x2, int y2, Uchar orBy);
-void saveMask(Uchar *mask, char *maskName);
-void readMask(Uchar *mask, char *maskName);
-void finishUwp(void);
-void checkSeed(int *new_seedX, int *new_seedY);
-void integratePhase(int x, int y);
-void saveUwp(char *uwpName);
-void doStats();
-
-void loadWrappedPhase(char *f)
+static void groundBorder(Grid *g);
+static void makeMask(Grid *g);
+static Uchar chargeCalc(float ul, float ll, float lr, float ur);
+static float phaseRemap(float in);
+static void installCordon(Grid *g, Point *cordon, int n, int x0, int y0);
+static void cutMask(Grid *g);
+static void generateCut(Grid *g, int x, int y);
+static void makeBranchCut(Grid *g, int x1, int y1, int x2, int y2,
+                          Uchar orBy);
+static void finishUwp(Grid *g);
+static void checkSeed(Grid *g, int *new_seedX, int *new_seedY);
+static int integratePhase(Grid *g, int x, int y);
+static void doStats(Grid *g);
+
+static void plistAdd(PList *list, int i, int j, int c)
+{
+  if (list->n == list->max) {
+    list->max = list->max ? 2*list->max : 4096;
+    list->p = g_renew(Point, list->p, list->max);
+    list->c = g_renew(int, list->c, list->max);
+  }
+  list->p[list->n].i = i;
+  list->p[list->n].j = j;
+  list->c[list->n] = c;
+  list->n++;
+}
+
+static void gridAlloc(Grid *g, int wid, int len)
+{
+  g->wid = wid;
+  g->len = len;
+  g->phase = (float *)MALLOC(sizeof(float)*(size_t)wid*len);
+  g->mask = (Uchar *)CALLOC((size_t)wid*len, sizeof(Uchar));
+  g->im = (Uchar *)CALLOC((size_t)wid*len, sizeof(Uchar));
+  g->list.n = g->list.max = 0;
+  g->list.p = NULL;
+  g->list.c = NULL;
+  g->verbose = TRUE;
+}
+
+static void gridFree(Grid *g)
+{
+  FREE(g->phase);
+  FREE(g->mask);
+  FREE(g->im);
+  g_free(g->list.p);
+  g_free(g->list.c);
+}
+
+static void loadWrappedPhase(Grid *g, char *f)
 {
   FILE * fd;
   meta_parameters *meta;
 
   fd = FOPEN(f, "rb");
   meta = meta_read(f);
-  get_float_lines(fd, meta, 0, len, phase);
+  get_float_lines(fd, meta, 0, g->len, g->phase);
+  meta_free(meta);
   FCLOSE(fd);
 
   return;
 }
 
-void groundBorder()
+static void groundBorder(Grid *g)
 {
   int i, j;
+  int wid = g->wid, len = g->len;
+  Uchar *mask = g->mask;
 
   /* ground the left edge once and ground the right edge twice */
   for (j = 0; j < len; j++) {
@@ -141,7 +179,7 @@ void groundBorder()
 }
 
 
-float phaseRemap(float p)
+static float phaseRemap(float p)
 {
   p = (double)fmod((double)p,(double)TWOPI);
   if (p>PI) p-=TWOPI;
@@ -150,10 +188,12 @@ float phaseRemap(float p)
 }
 
 
-int isGoodSeed(int x,int y)
+static int isGoodSeed(Grid *g, int x,int y)
 {
 #define check_span 10 /*Make sure no cuts occur within this many pixels of seed*/
   int dx,dy;
+  int wid = g->wid, len = g->len;
+  Uchar *mask = g->mask;
   if ((x<check_span)||(x>=wid-check_span)||
       (y<check_span)||(y>=len-check_span))
     return 0;/*out-of-bounds*/
@@ -168,29 +208,60 @@ int isGoodSeed(int x,int y)
   return 1;/*If no cut is nearby, this is a good point*/
 }
 
-void checkSeed(int *x, int *y)
+static void checkSeed(Grid *g, int *x, int *y)
 {
   /* adjust seed point to reside on a usable (mask == ZERO) pixel */
-  while (!isGoodSeed(*x,*y))
+  while (!isGoodSeed(g,*x,*y))
   {
     asfPrintStatus("\n   seed point (%d, %d) is not ZERO.\n", *x, *y);
     /*Pick a new, random seed point.*/
-    *x=(rand()&0x7fff)*wid/0x7fff;
-    *y=(rand()&0x7fff)*len/0x7fff;
+    *x=(rand()&0x7fff)*g->wid/0x7fff;
+    *y=(rand()&0x7fff)*g->len/0x7fff;
     asfPrintStatus("\n   auto-adjusted seed point to (%d, %d).\n", *x, *y);
   }
   asfPrintStatus("\n   checkSeed() finished\n\n");
   return;
 }
 
+/*
+ * Like checkSeed(), but for a tile: rather than picking random points
+ *   until one will do, look outward from the center of the tile, row by
+ *   row, so that the choice does not depend on which thread got here
+ *   first.  Returns FALSE if there is no usable point in the tile.
+ */
+static int findSeed(Grid *g, int *x, int *y)
+{
+  int cx = g->wid/2, cy = g->len/2;
+  int di, dj, i, j;
+
+  for (dj = 0; dj <= g->len/2; dj++) {
+    for (j = cy - dj; j <= cy + dj; j += (dj ? 2*dj : 1)) {
+      for (di = 0; di <= g->wid/2; di++) {
+        for (i = cx - di; i <= cx + di; i += (di ? 2*di : 1)) {
+          if (isGoodSeed(g, i, j)) {
+            *x = i;
+            *y = j;
+            return TRUE;
+          }
+        }
+      }
+    }
+  }
+  return FALSE;
+}
+
 /*
  * This function is a cursory test to check for 'residual' residues.
  *   If 'escher' is working properly it should give a null result.
  */
-void verifyCuts(void)
+#if DO_DEBUG_CHECKS
+static void verifyCuts(Grid *g)
 {
   int i, j, nSites = 0, nResidues = 0;
   float p0, p1, p2, p3;
+  int wid = g->wid, len = g->len;
+  Uchar *mask = g->mask;
+  float *phase = g->phase;
 
   asfPrintStatus("\nStarting the verification ...\n\n");
 
@@ -219,11 +290,15 @@ void verifyCuts(void)
     nResidues, nSites, 100.0*(float)(nResidues)/(float)(nSites));
   return;
 }
+#endif
 
-void makeMask()
+static void makeMask(Grid *g)
 {
   int i, j;
   float p0, p1, p2, p3;
+  int wid = g->wid, len = g->len;
+  Uchar *mask = g->mask;
+  float *phase = g->phase;
 
   for (j = 1; j < len - 2; j++) {
     for (i = 1; i < wid - 2; i++) {
@@ -240,7 +315,7 @@ void makeMask()
   return;
 }
 
-Uchar chargeCalc(float p0, float p1, float p2, float p3)
+static Uchar chargeCalc(float p0, float p1, float p2, float p3)
 {
   register float d0, d1, d2, d3, od0, od1, od2, od3, sum;
 
@@ -292,23 +367,29 @@ Uchar chargeCalc(float p0, float p1, float p2, float p3)
 #endif
 }
 
-void installCordon(char *cordonFnm)
+/*
+ * Reads the points to ground out from the cordon file, if there is one.
+ *   Returns the number of points, and the points in *cordon.
+ */
+static int readCordon(char *cordonFnm, Point **cordon)
 {
-  int i, n, x, y;
+  int n = 0, max = 0;
+  Point p;
   FILE *fp;
 
-  if (fileExist(cordonFnm)) {
-    n = fileNumLines(cordonFnm);
+  *cordon = NULL;
+  if (fileExists(cordonFnm)) {
     fp = FOPEN(cordonFnm,"r");
-    for (i = 0; i < n; i++) {
-      fscanf(fp,"%d", &x);
-      fscanf(fp,"%d", &y);
-      mask[ y*wid + x] |= GROUNDED;
+    while (fscanf(fp,"%d %d", &p.i, &p.j) == 2) {
+      if (n == max) {
+        max = max ? 2*max : 256;
+        *cordon = g_renew(Point, *cordon, max);
+      }
+      (*cordon)[n++] = p;
     }
     fclose(fp);
     //printf("\ngrounded out %d points from cordon file '%s'\n\n",
     //  n, cordonFnm);
-    doStats();
   }
   else {
     /*The "cordon" file almost never exists; so this shouldn't be an error!
@@ -317,29 +398,41 @@ void installCordon(char *cordonFnm)
             cordonFnm);*/
   }
 
-  return;
+  return n;
 }
 
-void saveMask(unsigned char *m, char *f)
+/* Grounds the cordon points that fall in g, which starts at (x0, y0) */
+static void installCordon(Grid *g, Point *cordon, int n, int x0, int y0)
 {
-  char fnm[256];
+  int i, x, y;
+
+  for (i = 0; i < n; i++) {
+    x = cordon[i].i - x0;
+    y = cordon[i].j - y0;
+    if (x >= 0 && x < g->wid && y >= 0 && y < g->len)
+      g->mask[ y*g->wid + x] |= GROUNDED;
+  }
 
-  create_name(fnm,f,"_mask.img");
-  writeVector(m, fnm, CHAR, size);
   return;
 }
 
-void readMask(unsigned char *m, char *fnm)
+static void saveMask(Grid *g, char *f)
 {
-  if (!size)
-    Exit("   escher:  readMask():  zero mask size");
-  readVector(m, fnm, CHAR, size);
+  char fnm[256];
+  FILE *fp;
+
+  create_name(fnm,f,"_mask.img");
+  fp = FOPEN(fnm, "wb");
+  ASF_FWRITE(g->mask, sizeof(Uchar), (size_t)g->wid*g->len, fp);
+  FCLOSE(fp);
   return;
 }
 
-void cutMask(void)
+static void cutMask(Grid *g)
 {
   int i, j;
+  int wid = g->wid, len = g->len;
+  Uchar *mask = g->mask;
 
   /*
    * This function contains two loops over (wid-3)x(len-3) potential
@@ -415,12 +508,12 @@ void cutMask(void)
 #endif
 
   /* initialize the number of points in 'list' to zero */
-  list.n = 0;
+  g->list.n = 0;
 
   /* loop over (wid-3)x(len-3) residue sites */
   for (j = 1; j < len-2; j++) {
     register Uchar *maskLineStart=mask+wid*j;
-    if (!(j%(len/8)))  
+    if (g->verbose && !(j%(len/8)))
       asfPrintStatus("     ...at %d of %d\n", j, len);
     for (i = 1; i < wid-2; i++) {
       /*
@@ -428,7 +521,7 @@ void cutMask(void)
        * and is not already in a cut
        */
       if (*(maskLineStart+i) & SOME_CHARGE && !(*(maskLineStart+i) & IN_CUT)) {
-        generateCut(i, j);
+        generateCut(g, i, j);
       }
     }
   }
@@ -443,8 +536,11 @@ void cutMask(void)
  * and which has a total charge of zero. Furthermore, we want the
  * number of points involved in the branch cut to be minimized.
  */
-void generateCut(int i, int j)
+static void generateCut(Grid *g, int i, int j)
 {
+  int wid = g->wid, len = g->len;
+  Uchar *mask = g->mask;
+  PList *list = &g->list;
   Uchar tV;                        /* test value */
   int point, point_i, point_j;
   int subR, subRmo;
@@ -462,7 +558,7 @@ void generateCut(int i, int j)
   else if (mask[ j*wid + i] & NEGATIVE_CHARGE)
     tC = -1;
   else
-    Exit("   generateCut() called with no charge at (%d,%d)",i,j);
+    asfPrintError("generateCut() called with no charge at (%d,%d)\n",i,j);
 
   /* calculate the maximum possible radius box around this point */
   maxR = min(i + 1, j + 1);
@@ -470,10 +566,8 @@ void generateCut(int i, int j)
   maxR = min(maxR, len - j);
 
   /* set the number of points in the list to 1, and point 0 to (i, j) */
-  list.n      = 1;
-  list.p[0].i = i;
-  list.p[0].j = j;
-  list.c[0]   = 0;   /* point 0 connects to itself */
+  list->n = 0;
+  plistAdd(list, i, j, 0);   /* point 0 connects to itself */
 
   /* set this point in the mask to IN_TREE */
   mask[ j*wid + i] |= IN_TREE;
@@ -490,10 +584,10 @@ void generateCut(int i, int j)
 
     /* loop over the charge points in the current tree      */
     /*   (These may include cut charges from earlier trees) */
-    for (point = 0; point < list.n; point++) {
+    for (point = 0; point < list->n; point++) {
 
-      point_i = list.p[point].i;
-      point_j = list.p[point].j;
+      point_i = list->p[point].i;
+      point_j = list->p[point].j;
 
       /* loop over ALL the pixels in the box of radius r around this point */
       /* do this by starting with a box of radius 2 and working out */
@@ -534,7 +628,8 @@ void generateCut(int i, int j)
             /* test to see if the test value is grounded */
             if (tV & GROUNDED) {
               /* logical error check */
-              if (tV & IN_TREE) Exit("tV is both GROUNDED && IN_TREE");
+              if (tV & IN_TREE)
+                asfPrintError("tV is both GROUNDED && IN_TREE\n");
               /* new total charge is zero automatically */
               tC    =    0;
               /*
@@ -543,14 +638,8 @@ void generateCut(int i, int j)
                */
               scram = TRUE;
 
-              /* increment number of points in the list, set last location */
-              list.n++;
-              if (list.n > 1000000)
-                 Exit("list exceeded 1 million points");
-              list.p[(list.n)-1].i = k;
-              list.p[(list.n)-1].j = l;
-              /* connect this guy to point number 'point' */
-              list.c[(list.n)-1]   = point;
+              /* add (k, l) to the list, connected to point number 'point' */
+              plistAdd(list, k, l, point);
 
               /*
                * connect all points with GROUNDED lines
@@ -558,15 +647,15 @@ void generateCut(int i, int j)
                */
               /* start at the second point on the list */
               /* loop to the last point on the list    */
-              for (p = 1; p <= (list.n)-1; p++) {
+              for (p = 1; p <= (list->n)-1; p++) {
                 /* set (p_i, p_j) to 'p-th' point in the list */
-                p_i  = list.p[p].i;
-                p_j  = list.p[p].j;
+                p_i  = list->p[p].i;
+                p_j  = list->p[p].j;
                 /* connection index is carried in c[] array   */
-                cIdx = list.c[p];
-                p_ii = list.p[cIdx].i;
-                p_jj = list.p[cIdx].j;
-                makeBranchCut(p_i, p_j, p_ii, p_jj, (IN_CUT | GROUNDED));
+                cIdx = list->c[p];
+                p_ii = list->p[cIdx].i;
+                p_jj = list->p[cIdx].j;
+                makeBranchCut(g, p_i, p_j, p_ii, p_jj, (IN_CUT | GROUNDED));
               }
 
             }  /* end if test value tV is GROUNDED */
@@ -582,14 +671,9 @@ void generateCut(int i, int j)
                * is not already part of a cut */
               if (!(tV & IN_CUT)) { tC += 3 - 2*((int)(tV & SOME_CHARGE)); }
               /* label all points from (point_i, _j) to (k, l) as IN_CUT */
-              makeBranchCut(point_i, point_j, k, l, IN_CUT);
-              /* increment number of points in the list, set last location */
-              list.n++;
-              if (list.n > 1000000) Exit("list exceeded 1 million points");
-              list.p[(list.n)-1].i = k;
-              list.p[(list.n)-1].j = l;
-              /* connect this guy to point number 'point' */
-              list.c[(list.n)-1]   = point;
+              makeBranchCut(g, point_i, point_j, k, l, IN_CUT);
+              /* add (k, l) to the list, connected to point number 'point' */
+              plistAdd(list, k, l, point);
 
               /* mark this point as being on the current tree */
               mask[ l*wid + k] |= IN_TREE;
@@ -636,7 +720,7 @@ void generateCut(int i, int j)
   /* I think we can just about take this out pretty soon */
   if (!scram) {
     asfPrintStatus("(%d, %d), maxR = %d, r = %d, rmo = %d, list.n = %d\n",
-      i, j, maxR, r, rmo, list.n);
+      i, j, maxR, r, rmo, list->n);
     asfPrintError("Error in generateCut()");
   }
 #endif
@@ -647,9 +731,9 @@ void generateCut(int i, int j)
    * there is a list of points on the current
    * tree which should be marked 'NOT_IN_TREE'.
    */
-  for (point = 0; point < list.n; point++) {
-    point_i = list.p[point].i;
-    point_j = list.p[point].j;
+  for (point = 0; point < list->n; point++) {
+    point_i = list->p[point].i;
+    point_j = list->p[point].j;
     mask[ point_j*wid + point_i] &= NOT_IN_TREE;
   }
 
@@ -657,18 +741,18 @@ void generateCut(int i, int j)
   /* debug test... */
   /* I think we can just about take this out pretty soon */
   count = 0;
-  for (point = 0; point < list.n; point++) {
-    point_i = list.p[point].i;
-    point_j = list.p[point].j;
+  for (point = 0; point < list->n; point++) {
+    point_i = list->p[point].i;
+    point_j = list->p[point].j;
     if (!(mask[ point_j*wid + point_i] & IN_CUT)) { count++; }
   }
   if (count) {
     asfPrintStatus("   at point (%d, %d), the debug test for IN_CUT returned:"
 		   "\n",i,j);
-    asfPrintStatus("   \t%d bad of %d in the list\n", count, list.n);
-    for (point = 0; point < list.n; point++) {
-      point_i = list.p[point].i;
-      point_j = list.p[point].j;
+    asfPrintStatus("   \t%d bad of %d in the list\n", count, list->n);
+    for (point = 0; point < list->n; point++) {
+      point_i = list->p[point].i;
+      point_j = list->p[point].j;
       if (!(mask[ point_j*wid + point_i] & IN_CUT)) { count++; }
       asfPrintStatus("   %d: (%d, %d)\n\tmask %d\n\tmask & IN_CUT %d\n",
         point, point_i, point_j, (int)(mask[point_j*wid+point_i)),
@@ -677,12 +761,12 @@ void generateCut(int i, int j)
         (int)(mask[point_j*wid+point_i] & GROUNDED),
         (int)(mask[point_j*wid+point_i] & SOME_CHARGE));
     }
-    Exit("   generateCut() failed logical test");
+    asfPrintError("generateCut() failed logical test\n");
   }
 #endif
 
   /* reset number of points on list to zero */
-  list.n = 0;
+  list->n = 0;
 
   return;
 }
@@ -692,8 +776,11 @@ void generateCut(int i, int j)
  * The purpose of this function is to do a logical or of 'orVal' with every
  *   pixel in the mask array from (i, j) to (ii, jj) inclusive.
  */
-void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
+static void makeBranchCut(Grid *g, int i, int j, int ii, int jj,
+                          Uchar orVal)
 {
+  int   wid = g->wid;
+  Uchar *mask = g->mask;
   int   dx, dy;        /* differences in coord values               */
   int   adx, ady;      /* absolute values of diffs                  */
   int   lc, sc;        /* int and short coords                     */
@@ -718,7 +805,7 @@ void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
     lcd   = dx;
     if      (dx < 0) dc1 =  1;
     else if (dx > 0) dc1 = -1;
-    else             Exit("makeBranchCut():  logic error 1");
+    else             asfPrintError("makeBranchCut():  logic error 1\n");
     slope = (float)(dy)/(float)(dx);
   }
   else           {
@@ -728,7 +815,7 @@ void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
     lcd   = dy;
     if      (dy < 0) dc1 =  1;
     else if (dy > 0) dc1 = -1;
-    else             Exit("makeBranchCut():  logic error 2");
+    else             asfPrintError("makeBranchCut():  logic error 2\n");
     slope = (float)(dx)/(float)(dy);
   }
 
@@ -752,35 +839,41 @@ void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
   return;
 }
 
-void finishUwp(void)
+static void finishUwp(Grid *g)
 {
   int i, j;
+  int wid = g->wid;
 
-  for (j = 0; j < len; j++) {
-    register float *lineStart=&phase[wid*j];
+  for (j = 0; j < g->len; j++) {
+    register float *lineStart=&g->phase[wid*j];
     for (i = 0; i < wid; i++)
-      if (!(mask[j*wid+i]&INTEGRATED))
+      if (!(g->mask[j*wid+i]&INTEGRATED))
        *(lineStart+i) = 0.0;/*Set non-integrated phases to zero*/
   }
 
   return;
 }
 
-void saveUwp(char *f)
+static void saveUwp(Grid *g, char *f)
 {
   meta_parameters *meta;
 
   FILE *fd = FOPEN(f, "wb");
   meta = meta_read(f);
-  put_float_lines(fd, meta, 0, len, phase);
+  put_float_lines(fd, meta, 0, g->len, g->phase);
+  meta_free(meta);
   FCLOSE(fd);
 
   return;
 }
 
 
-void integratePhase(int i, int j)
+static int integratePhase(Grid *g, int i, int j)
 {
+  int    wid = g->wid;
+  Uchar  *mask = g->mask;
+  Uchar  *im = g->im;
+  float  *phase = g->phase;
   int    u, v;      /* starting point coordinates                         */
   Uchar  s;         /* temp status value                                  */
   int    t = 0;     /* total number of pixels integrated for this region  */
@@ -815,7 +908,8 @@ void integratePhase(int i, int j)
     phase[v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going up...");
+    if (g->verbose)
+      asfPrintStatus("   from seed point, started out by going up...");
   }
 
   /* try 2:  go right one pixel to (i + 1, j) */
@@ -827,7 +921,8 @@ void integratePhase(int i, int j)
     phase[ v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going right...\n");
+    if (g->verbose)
+      asfPrintStatus("   from seed point, started out by going right...\n");
   }
 
   /* try 3:  go down one pixel to (i, j + 1) */
@@ -839,7 +934,8 @@ void integratePhase(int i, int j)
     phase[ v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going down...\n");
+    if (g->verbose)
+      asfPrintStatus("   from seed point, started out by going down...\n");
   }
 
   /* try 4:  go left one pixel to (i - 1, j) */
@@ -851,7 +947,8 @@ void integratePhase(int i, int j)
     phase[ v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("\n   from seed point, started out by going left...\n");
+    if (g->verbose)
+      asfPrintStatus("\n   from seed point, started out by going left...\n");
   }
 
   /* fall through:  No good 4-nbrs found */
@@ -870,7 +967,8 @@ void integratePhase(int i, int j)
    */
   while (u != i || v != j || !(im[j*wid+i] & TRIED_L)){
 
-    if (!(t%100000)) asfPrintStatus ("\r   total integrated = %d", t);
+    if (g->verbose && !(t%100000))
+      asfPrintStatus ("\r   total integrated = %d", t);
 
     /* s = temp value of 'im' at pixel (u, v) */
     s        = im[v*wid + u];
@@ -984,13 +1082,16 @@ void integratePhase(int i, int j)
 
   }  /* end of the big 'while-not-done' loop */
 
-  asfPrintStatus("\nUnwrapped %d pixels...\n", t);
-  return;
+  if (g->verbose)
+    asfPrintStatus("\nUnwrapped %d pixels...\n", t);
+  return t;
 }
 
 
-void doStats()
+static void doStats(Grid *g)
 {
+  int    wid = g->wid, len = g->len;
+  Uchar  *mask = g->mask;
   int    i, j, k;
   int    nZero     = 0;
   int    nPlus     = 0;
@@ -1049,56 +1150,482 @@ int escher(char *inFile, char *outFile)
   int seedX=-1,seedY=-1; 
   char szWrap[MAXNAME], szUnwrap[MAXNAME];
   meta_parameters *meta;
+  Point *cordon;
+  int nCordon;
+  Grid grid, *g = &grid;
 
   create_name(szWrap, inFile, ".img");
   create_name(szUnwrap, outFile, ".img");
 
   meta = meta_read(szWrap);
-  wid = meta->general->sample_count;
-  len = meta->general->line_count;
+  gridAlloc(g, meta->general->sample_count, meta->general->line_count);
   if ((seedX == -1)&&(seedY == -1))
   {
-    seedX = wid/2;
-    seedY = len/2;
+    seedX = g->wid/2;
+    seedY = g->len/2;
   }
   
   meta_write(meta, szUnwrap);
 
-  size = wid*len;
-  mask = (Uchar *)calloc(size, sizeof(Uchar));
-  im = (Uchar *)calloc(size, sizeof(Uchar));
-  phase = (float *)MALLOC(sizeof(float)*size);
-
   /* perform steps*/
   asfPrintStatus("\nGenerating phase unwrapping mask ...\n\n");
-  loadWrappedPhase(szWrap);
-  groundBorder();
-  makeMask();
-  doStats();
+  loadWrappedPhase(g, szWrap);
+  groundBorder(g);
+  makeMask(g);
+  doStats(g);
   asfPrintStatus("\n\nGrounding remaining residues ...\n\n");
-  installCordon("cordon");
+  nCordon = readCordon("cordon", &cordon);
+  if (nCordon) {
+    installCordon(g, cordon, nCordon, 0, 0);
+    doStats(g);
+  }
+  g_free(cordon);
   asfPrintStatus("\n\nDefining branch cuts ...\n\n");
-  cutMask();
-  doStats();
+  cutMask(g);
+  doStats(g);
 
 #if DO_DEBUG_CHECKS
-  saveMask((char *)mask, "test");
+  saveMask(g, "test");
 
-  verifyCuts();                                           
+  verifyCuts(g);
 #endif
 
   asfPrintStatus("\n\nIntegrating the phase ...\n\n");
-  checkSeed(&seedX, &seedY);
-  integratePhase(seedX, seedY);
-  doStats();
-  finishUwp();
-  saveMask(mask, szUnwrap);
-  saveUwp(szUnwrap);
+  checkSeed(g, &seedX, &seedY);
+  integratePhase(g, seedX, seedY);
+  doStats(g);
+  finishUwp(g);
+  saveMask(g, szUnwrap);
+  saveUwp(g, szUnwrap);
   
   // Clean up
-  FREE(mask);
-  FREE(im);
-  FREE(phase);
+  gridFree(g);
+  meta_free(meta);
+
+  return(0);
+}
+
+/*
+ * Tiled unwrapping
+ *
+ * escher_tiled() cuts the interferogram into tiles, and unwraps each
+ *   one (along with a margin of its neighbours) on its own, just as
+ *   escher() does the whole image, several tiles at a time.  The tile's
+ *   border is grounded, so cuts are free to end there.
+ *
+ * Each tile's unwrapped phase is then off from its neighbours' by some
+ *   whole number of cycles.  Where two tiles overlap, every pixel both
+ *   of them integrated votes for that number.  The tiles are tied
+ *   together along a maximum spanning tree of the tile grid, weighted by
+ *   the winning votes, so that the best supported offsets are the ones
+ *   used, and each tile's own part of the image is written out with its
+ *   offset added.
+ *
+ * Until they are written out the unwrapped tiles wait in a scratch file
+ *   next to the output, so the memory needed goes with the tile size and
+ *   the number of threads, not with the size of the scene.
+ */
+
+#define ESCHER_TILE_SIZE    1024
+#define ESCHER_TILE_OVERLAP 64
+
+// Number of threads escher_tiled unwraps tiles with; 0 means one per
+// processor.
+static int escher_thread_count = 0;
+
+void escher_set_thread_count(int thread_count)
+{
+  escher_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+typedef struct {
+  int x0, y0, ns, nl;           /* the tile's own part of the image     */
+  int ex0, ey0, ens, enl;       /* that and its margin, within the image */
+  int integrated;               /* number of pixels unwrapped           */
+  int offset;                   /* cycles to add, once reconciled       */
+} Tile;
+
+/* Two neighbouring tiles, and what their overlap says about them */
+typedef struct {
+  int a, b;
+  int cycles;                   /* b's offset minus a's                 */
+  int votes;                    /* pixels that say so                   */
+  int disagree;                 /* pixels that say otherwise            */
+} TileEdge;
+
+typedef struct {
+  meta_parameters *meta;
+  FILE *fpIn;
+  FILE *fpScratch;
+  GMutex io_lock;               /* for both files                       */
+  Tile *tiles;
+  int nx, ny;
+  long long slot_size;          /* bytes for each tile in fpScratch     */
+  Point *cordon;
+  int nCordon;
+  int first, count;             /* the tiles being unwrapped            */
+  gint next;                    /* the next of those to hand out        */
+} TileJob;
+
+typedef struct {
+  TileJob *job;
+  Grid g;
+} TileWorker;
+
+static void unwrapTile(TileJob *job, Tile *t, Grid *g)
+{
+  size_t ii, n = (size_t)t->ens*t->enl;
+  int x, y;
+
+  g->wid = t->ens;
+  g->len = t->enl;
+  g->list.n = 0;
+  memset(g->mask, 0, n);
+  memset(g->im, 0, n);
+
+  g_mutex_lock(&job->io_lock);
+  get_partial_float_lines(job->fpIn, job->meta, t->ey0, t->enl,
+                          t->ex0, t->ens, g->phase);
+  g_mutex_unlock(&job->io_lock);
+
+  groundBorder(g);
+  makeMask(g);
+  installCordon(g, job->cordon, job->nCordon, t->ex0, t->ey0);
+  cutMask(g);
+  t->integrated = findSeed(g, &x, &y) ? integratePhase(g, x, y) : 0;
+
+  /* pixels not reached don't get a vote, and come out as 0 in the end */
+  for (ii = 0; ii < n; ii++)
+    if (!(g->mask[ii] & INTEGRATED))
+      g->phase[ii] = NAN;
+
+  g_mutex_lock(&job->io_lock);
+  FSEEK64(job->fpScratch, (t - job->tiles)*job->slot_size, SEEK_SET);
+  ASF_FWRITE(g->phase, sizeof(float), n, job->fpScratch);
+  ASF_FWRITE(g->mask, sizeof(Uchar), n, job->fpScratch);
+  g_mutex_unlock(&job->io_lock);
+}
+
+static gpointer tileThread(gpointer data)
+{
+  TileWorker *w = data;
+  TileJob *job = w->job;
+  int k;
+
+  while ((k = g_atomic_int_add(&job->next, 1)) < job->count)
+    unwrapTile(job, &job->tiles[job->first + k], &w->g);
+  return NULL;
+}
+
+static void tileChunkRun(TileJob *job, TileWorker *workers, int n_threads)
+{
+  GThread **threads;
+  int ii;
+
+  if (n_threads > job->count) n_threads = job->count;
+  job->next = 0;
+  threads = (GThread **)MALLOC(sizeof(GThread *)*n_threads);
+  for (ii = 1; ii < n_threads; ii++)
+    threads[ii] = g_thread_new("escher", tileThread, &workers[ii]);
+  tileThread(&workers[0]);
+  for (ii = 1; ii < n_threads; ii++)
+    g_thread_join(threads[ii]);
+  FREE(threads);
+}
+
+/* Reads the unwrapped phase of tile t within the given rectangle back
+   from the scratch file */
+static void readTileRect(TileJob *job, Tile *t, int x0, int y0, int ns,
+                         int nl, float *buf)
+{
+  int y;
+
+  for (y = 0; y < nl; y++) {
+    FSEEK64(job->fpScratch, (t - job->tiles)*job->slot_size +
+            sizeof(float)*((long long)(y0 + y - t->ey0)*t->ens +
+                           (x0 - t->ex0)), SEEK_SET);
+    ASF_FREAD(buf + (size_t)y*ns, sizeof(float), ns, job->fpScratch);
+  }
+}
+
+static int compareInts(const void *a, const void *b)
+{
+  int ia = *(const int *)a, ib = *(const int *)b;
+  return ia < ib ? -1 : ia > ib;
+}
+
+/* Counts the votes of the pixels in the given rectangle, which both of
+   the edge's tiles cover */
+static void voteEdge(TileJob *job, TileEdge *e, int x0, int y0, int ns,
+                     int nl, float *bufA, float *bufB, int *cycles)
+{
+  int ii, n = 0, run;
+
+  readTileRect(job, &job->tiles[e->a], x0, y0, ns, nl, bufA);
+  readTileRect(job, &job->tiles[e->b], x0, y0, ns, nl, bufB);
+  for (ii = 0; ii < ns*nl; ii++)
+    if (!isnan(bufA[ii]) && !isnan(bufB[ii]))
+      cycles[n++] = (int)floor((bufA[ii] - bufB[ii])/TWOPI + 0.5);
+
+  qsort(cycles, n, sizeof(int), compareInts);
+  e->cycles = 0;
+  e->votes = 0;
+  for (ii = 0; ii < n; ii += run) {
+    for (run = 1; ii + run < n && cycles[ii + run] == cycles[ii]; run++)
+      ;
+    if (run > e->votes) {
+      e->votes = run;
+      e->cycles = cycles[ii];
+    }
+  }
+  e->disagree = n - e->votes;
+}
+
+static int compareEdgeVotes(const void *a, const void *b)
+{
+  const TileEdge *ea = a, *eb = b;
+  return eb->votes < ea->votes ? -1 : eb->votes > ea->votes;
+}
+
+static int findRoot(int *parent, int k)
+{
+  while (parent[k] != k)
+    k = parent[k] = parent[parent[k]];
+  return k;
+}
+
+/*
+ * Works out each tile's offset from the edges: the edges with the most
+ *   votes go into the spanning tree first, and then the offsets are
+ *   passed along the tree from one tile in each connected group.
+ *   Returns the number of such groups.
+ */
+static int reconcileTiles(Tile *tiles, int nx, int ny, TileEdge *edges,
+                          int nEdges)
+{
+  int nTiles = nx*ny;
+  int *parent = (int *)MALLOC(sizeof(int)*nTiles);
+  int *adj = (int *)MALLOC(sizeof(int)*4*nTiles);
+  int *nAdj = (int *)CALLOC(nTiles, sizeof(int));
+  int *queue = (int *)MALLOC(sizeof(int)*nTiles);
+  int *done = (int *)CALLOC(nTiles, sizeof(int));
+  int ii, k, head, tail, nGroups = 0;
+
+  for (ii = 0; ii < nTiles; ii++)
+    parent[ii] = ii;
+  qsort(edges, nEdges, sizeof(TileEdge), compareEdgeVotes);
+  for (ii = 0; ii < nEdges && edges[ii].votes > 0; ii++) {
+    int ra = findRoot(parent, edges[ii].a), rb = findRoot(parent, edges[ii].b);
+    if (ra != rb) {
+      parent[ra] = rb;
+      adj[4*edges[ii].a + nAdj[edges[ii].a]++] = ii;
+      adj[4*edges[ii].b + nAdj[edges[ii].b]++] = ii;
+    }
+  }
+
+  /* start from the middle tile, as escher() starts from the middle */
+  for (k = 0; k <= nTiles; k++) {
+    int root = k == 0 ? (ny/2)*nx + nx/2 : k - 1;
+    if (done[root])
+      continue;
+    if (tiles[root].integrated)
+      nGroups++;
+    tiles[root].offset = 0;
+    done[root] = TRUE;
+    queue[0] = root;
+    for (head = 0, tail = 1; head < tail; head++) {
+      int t = queue[head];
+      for (ii = 0; ii < nAdj[t]; ii++) {
+        TileEdge *e = &edges[adj[4*t + ii]];
+        int other = e->a == t ? e->b : e->a;
+        if (done[other])
+          continue;
+        tiles[other].offset = tiles[t].offset +
+          (e->a == t ? e->cycles : -e->cycles);
+        done[other] = TRUE;
+        queue[tail++] = other;
+      }
+    }
+  }
+
+  FREE(parent);
+  FREE(adj);
+  FREE(nAdj);
+  FREE(queue);
+  FREE(done);
+  return nGroups;
+}
+
+int escher_tiled(char *inFile, char *outFile, int tile_size, int overlap)
+{
+  char szWrap[MAXNAME], szUnwrap[MAXNAME], szMask[MAXNAME];
+  char szScratch[MAXNAME];
+  TileJob job;
+  TileWorker *workers;
+  TileEdge *edges;
+  int wid, len, tx, ty, ii, nEdges = 0, nTiles, nGroups;
+  int n_threads, rows_per_chunk, maxW, maxH;
+  long long integrated = 0, disagree = 0;
+
+  if (tile_size <= 0) tile_size = ESCHER_TILE_SIZE;
+  if (overlap <= 0) overlap = ESCHER_TILE_OVERLAP;
+  if (tile_size < 4*check_span)
+    asfPrintError("Tiles must be at least %d pixels across.\n",
+                  4*check_span);
+
+  create_name(szWrap, inFile, ".img");
+  create_name(szUnwrap, outFile, ".img");
+  create_name(szMask, szUnwrap, "_mask.img");
+  create_name(szScratch, szUnwrap, "_tiles.tmp");
+
+  job.meta = meta_read(szWrap);
+  wid = job.meta->general->sample_count;
+  len = job.meta->general->line_count;
+  meta_write(job.meta, szUnwrap);
+
+  /* lay out the tiles */
+  job.nx = (wid + tile_size - 1)/tile_size;
+  job.ny = (len + tile_size - 1)/tile_size;
+  nTiles = job.nx*job.ny;
+  job.tiles = (Tile *)CALLOC(nTiles, sizeof(Tile));
+  for (ty = 0; ty < job.ny; ty++) {
+    for (tx = 0; tx < job.nx; tx++) {
+      Tile *t = &job.tiles[ty*job.nx + tx];
+      t->x0 = tx*tile_size;
+      t->y0 = ty*tile_size;
+      t->ns = MIN(tile_size, wid - t->x0);
+      t->nl = MIN(tile_size, len - t->y0);
+      t->ex0 = MAX(0, t->x0 - overlap);
+      t->ey0 = MAX(0, t->y0 - overlap);
+      t->ens = MIN(wid, t->x0 + t->ns + overlap) - t->ex0;
+      t->enl = MIN(len, t->y0 + t->nl + overlap) - t->ey0;
+    }
+  }
+  maxW = MIN(wid, tile_size + 2*overlap);
+  maxH = MIN(len, tile_size + 2*overlap);
+  job.slot_size = (long long)maxW*maxH*(sizeof(float) + sizeof(Uchar));
+
+  job.fpIn = FOPEN(szWrap, "rb");
+  job.fpScratch = FOPEN(szScratch, "w+b");
+  g_mutex_init(&job.io_lock);
+  job.nCordon = readCordon("cordon", &job.cordon);
+
+  n_threads = escher_thread_count > 0 ? escher_thread_count
+    : g_get_num_processors();
+  workers = (TileWorker *)MALLOC(sizeof(TileWorker)*n_threads);
+  for (ii = 0; ii < n_threads; ii++) {
+    workers[ii].job = &job;
+    gridAlloc(&workers[ii].g, maxW, maxH);
+    workers[ii].g.verbose = FALSE;
+  }
+
+  /* buffers for the votes: the largest overlap is 2*overlap by a tile */
+  int maxVote = 2*overlap*tile_size;
+  float *bufA = (float *)MALLOC(sizeof(float)*maxVote);
+  float *bufB = (float *)MALLOC(sizeof(float)*maxVote);
+  int *cycles = (int *)MALLOC(sizeof(int)*maxVote);
+  edges = (TileEdge *)MALLOC(sizeof(TileEdge)*(2*nTiles + 1));
+
+  asfPrintStatus("\nUnwrapping %d tiles of %dx%d pixels, with %d pixels "
+                 "of overlap, on %d thread(s) ...\n\n", nTiles, tile_size,
+                 tile_size, overlap, n_threads);
+
+  /* enough rows of tiles at a time to keep all the threads busy */
+  rows_per_chunk = MAX(1, (n_threads + job.nx - 1)/job.nx);
+  for (ty = 0; ty < job.ny; ty += rows_per_chunk) {
+    int ty1 = MIN(job.ny, ty + rows_per_chunk), tr;
+    job.first = ty*job.nx;
+    job.count = (ty1 - ty)*job.nx;
+    tileChunkRun(&job, workers, n_threads);
+
+    /* the votes between these tiles, and with the row above */
+    for (tr = ty; tr < ty1; tr++) {
+      for (tx = 0; tx < job.nx; tx++) {
+        Tile *b = &job.tiles[tr*job.nx + tx];
+        if (tx > 0) {
+          Tile *a = b - 1;
+          TileEdge *e = &edges[nEdges++];
+          e->a = a - job.tiles;
+          e->b = b - job.tiles;
+          voteEdge(&job, e, b->ex0, a->y0, a->ex0 + a->ens - b->ex0, a->nl,
+                   bufA, bufB, cycles);
+        }
+        if (tr > 0) {
+          Tile *a = b - job.nx;
+          TileEdge *e = &edges[nEdges++];
+          e->a = a - job.tiles;
+          e->b = b - job.tiles;
+          voteEdge(&job, e, a->x0, b->ey0, a->ns, a->ey0 + a->enl - b->ey0,
+                   bufA, bufB, cycles);
+        }
+      }
+    }
+    asfPrintStatus("   ...unwrapped %d of %d tiles\n", ty1*job.nx, nTiles);
+  }
+
+  for (ii = 0; ii < nEdges; ii++)
+    disagree += edges[ii].disagree;
+  nGroups = reconcileTiles(job.tiles, job.nx, job.ny, edges, nEdges);
+  asfPrintStatus("\n   %lld overlapping pixels disagreed with the offsets "
+                 "between their tiles\n", disagree);
+  if (nGroups > 1)
+    asfPrintStatus("   the tiles fell into %d groups that could not be "
+                   "tied together\n", nGroups);
+
+  /* write out each tile's own part, its offset added */
+  asfPrintStatus("\nWriting the unwrapped phase ...\n\n");
+  FILE *fpOut = FOPEN(szUnwrap, "wb");
+  FILE *fpMask = FOPEN(szMask, "wb");
+  float *line = (float *)MALLOC(sizeof(float)*wid);
+  Uchar *maskLine = (Uchar *)MALLOC(sizeof(Uchar)*wid);
+  int x, y;
+  for (y = 0; y < len; y++) {
+    ty = y/tile_size;
+    for (tx = 0; tx < job.nx; tx++) {
+      Tile *t = &job.tiles[ty*job.nx + tx];
+      long long pos = (long long)(y - t->ey0)*t->ens + (t->x0 - t->ex0);
+      FSEEK64(job.fpScratch, (t - job.tiles)*job.slot_size +
+              sizeof(float)*pos, SEEK_SET);
+      ASF_FREAD(line + t->x0, sizeof(float), t->ns, job.fpScratch);
+      FSEEK64(job.fpScratch, (t - job.tiles)*job.slot_size +
+              sizeof(float)*(long long)t->ens*t->enl + pos, SEEK_SET);
+      ASF_FREAD(maskLine + t->x0, sizeof(Uchar), t->ns, job.fpScratch);
+      for (x = t->x0; x < t->x0 + t->ns; x++) {
+        if (isnan(line[x])) {
+          line[x] = 0.0;
+        }
+        else {
+          line[x] += TWOPI*t->offset;
+          integrated++;
+        }
+      }
+    }
+    put_float_lines(fpOut, job.meta, y, 1, line);
+    ASF_FWRITE(maskLine, sizeof(Uchar), wid, fpMask);
+    asfLineMeter(y, len);
+  }
+  asfPrintStatus("\nUnwrapped %lld of %lld pixels\n", integrated,
+                 (long long)wid*len);
+
+  // Clean up
+  FCLOSE(fpOut);
+  FCLOSE(fpMask);
+  FCLOSE(job.fpIn);
+  FCLOSE(job.fpScratch);
+  remove(szScratch);
+  g_mutex_clear(&job.io_lock);
+  for (ii = 0; ii < n_threads; ii++)
+    gridFree(&workers[ii].g);
+  FREE(workers);
+  FREE(line);
+  FREE(maskLine);
+  FREE(bufA);
+  FREE(bufB);
+  FREE(cycles);
+  FREE(edges);
+  FREE(job.tiles);
+  g_free(job.cordon);
+  meta_free(job.meta);
 
   return(0);
 }
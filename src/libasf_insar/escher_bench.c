@@ -0,0 +1,190 @@
+// Unwraps synthetic fringes -- a phase ramp with a hill on it, plus
+// some noise so that there are residues to cut -- of a few sizes, with
+// escher() and with escher_tiled(), and reports how long each took, how
+// much memory it needed, how much of the image got unwrapped, and how
+// much of that is right (to within the whole number of cycles the
+// unwrapped phase is always off by).
+//
+// Each run is done in a child process, so that the peak memory use
+// reported is that run's own.
+//
+// Usage: escher_bench [tile size [size ...]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_insar.h"
+
+#define NOISE 0.5
+
+// The phase before wrapping, at (x, y) of a size x size image.  There
+// are the same number of fringes whatever the size.
+static double
+true_phase (int size, int x, int y)
+{
+  double u = (double) x / size, v = (double) y / size;
+  double du = u - 0.4, dv = v - 0.6;
+  return 2 * M_PI * (20 * u + 12 * v)
+    + 60 * exp (-(du * du + dv * dv) / 0.02);
+}
+
+static void
+make_fringes (int size, const char *name)
+{
+  meta_parameters *meta = raw_init ();
+  meta->general->line_count = size;
+  meta->general->sample_count = size;
+  meta->general->data_type = REAL32;
+  meta->general->image_data_type = AMPLITUDE_IMAGE;
+  meta->general->band_count = 1;
+  strcpy (meta->general->bands, "PHASE");
+  meta_write (meta, name);
+
+  GRand *rand = g_rand_new_with_seed (1234);
+  float *line = g_new (float, size);
+  FILE *fp = fopenImage (name, "wb");
+  int x, y;
+  for ( y = 0 ; y < size ; y++ ) {
+    for ( x = 0 ; x < size ; x++ ) {
+      double noise = NOISE * sqrt (-2 * log (1 - g_rand_double (rand)))
+        * cos (2 * M_PI * g_rand_double (rand));
+      double wrapped = fmod (true_phase (size, x, y) + noise + M_PI,
+                             2 * M_PI);
+      if ( wrapped < 0 ) {
+        wrapped += 2 * M_PI;
+      }
+      line[x] = wrapped - M_PI;
+    }
+    put_float_line (fp, meta, y, line);
+  }
+  FCLOSE (fp);
+  g_free (line);
+  g_rand_free (rand);
+  meta_free (meta);
+}
+
+// Runs the unwrapping in a child, and returns the seconds it took and
+// the peak memory it used, in MB.
+static void
+run (int tile_size, const char *in, const char *out, double *seconds,
+     double *megabytes)
+{
+  int fds[2];
+  double result[2];
+  if ( pipe (fds) != 0 ) {
+    asfPrintError ("Could not make a pipe\n");
+  }
+  pid_t pid = fork ();
+  if ( pid < 0 ) {
+    asfPrintError ("Could not start the unwrapping run\n");
+  }
+  if ( pid == 0 ) {
+    struct rusage usage;
+    GTimer *timer = g_timer_new ();
+    close (fds[0]);
+    quietflag = TRUE;
+    if ( tile_size ) {
+      escher_tiled ((char *) in, (char *) out, tile_size, 0);
+    }
+    else {
+      escher ((char *) in, (char *) out);
+    }
+    result[0] = g_timer_elapsed (timer, NULL);
+    getrusage (RUSAGE_SELF, &usage);
+    result[1] = usage.ru_maxrss / 1024.0;
+    if ( write (fds[1], result, sizeof (result)) != sizeof (result) ) {
+      _exit (EXIT_FAILURE);
+    }
+    _exit (EXIT_SUCCESS);
+  }
+  // Only the child writes, so that if it dies without doing so the read
+  // sees end of file rather than waiting forever.
+  close (fds[1]);
+  ssize_t got = read (fds[0], result, sizeof (result));
+  close (fds[0]);
+  waitpid (pid, NULL, 0);
+  if ( got != sizeof (result) ) {
+    asfPrintError ("The unwrapping run failed\n");
+  }
+  *seconds = result[0];
+  *megabytes = result[1];
+}
+
+// How much of the unwrapped image isn't 0, and how much of that is off
+// from the true phase by the most common whole number of cycles.
+static void
+check (int size, const char *out, double *unwrapped, double *right)
+{
+  meta_parameters *meta = meta_read (out);
+  FILE *fp = fopenImage (out, "rb");
+  float *line = g_new (float, size);
+  GHashTable *counts = g_hash_table_new (g_direct_hash, g_direct_equal);
+  long long n = 0, best = 0;
+  int x, y;
+  for ( y = 0 ; y < size ; y++ ) {
+    get_float_line (fp, meta, y, line);
+    for ( x = 0 ; x < size ; x++ ) {
+      if ( line[x] == 0.0 ) {
+        continue;
+      }
+      int cycles = (int) floor ((line[x] - true_phase (size, x, y))
+                                / (2 * M_PI) + 0.5);
+      gpointer key = GINT_TO_POINTER (cycles);
+      long long count
+        = GPOINTER_TO_SIZE (g_hash_table_lookup (counts, key)) + 1;
+      g_hash_table_insert (counts, key, GSIZE_TO_POINTER (count));
+      if ( count > best ) {
+        best = count;
+      }
+      n++;
+    }
+  }
+  *unwrapped = 100.0 * n / ((double) size * size);
+  *right = n ? 100.0 * best / n : 0.0;
+  g_hash_table_destroy (counts);
+  g_free (line);
+  FCLOSE (fp);
+  meta_free (meta);
+}
+
+int
+main (int argc, char **argv)
+{
+  int tile_size = argc > 1 ? atoi (argv[1]) : 1024;
+  int default_sizes[] = { 1024, 2048, 4096, 8192 };
+  int n_sizes = argc > 2 ? argc - 2 : (int) G_N_ELEMENTS (default_sizes);
+
+  printf ("%6s %8s %10s %10s %10s %10s\n", "size", "mode", "seconds", "MB",
+          "unwrapped", "right");
+  int ii;
+  for ( ii = 0 ; ii < n_sizes ; ii++ ) {
+    int size = argc > 2 ? atoi (argv[ii + 2]) : default_sizes[ii];
+    make_fringes (size, "escher_bench_in.img");
+    int tiled;
+    for ( tiled = 0 ; tiled <= 1 ; tiled++ ) {
+      double seconds, megabytes, unwrapped, right;
+      run (tiled ? tile_size : 0, "escher_bench_in.img",
+           "escher_bench_out.img", &seconds, &megabytes);
+      check (size, "escher_bench_out.img", &unwrapped, &right);
+      printf ("%6d %8s %10.2f %10.1f %9.2f%% %9.3f%%\n", size,
+              tiled ? "tiled" : "whole", seconds, megabytes, unwrapped,
+              right);
+    }
+  }
+
+  unlink ("escher_bench_in.img");
+  unlink ("escher_bench_in.meta");
+  unlink ("escher_bench_out.img");
+  unlink ("escher_bench_out.meta");
+  unlink ("escher_bench_out_mask.img");
+
+  return 0;
+}
@@ -1019,7 +1019,8 @@ int write_config(char *configFile, dem_config *cfg)
     if (!shortFlag)
       fprintf(fConfig, "\n# Name of the phase unwrapping algorithm used.\n"
 	      "# Currently two phase unwrapping algorithms are supported. 'escher' is an\n"
-	      "# implementation of Goldstein's branch cut algorithm. 'snaphu' has been\n"
+	      "# implementation of Goldstein's branch cut algorithm ('escher_tiled' does\n"
+	      "# the same a tile at a time, for large interferograms). 'snaphu' has been\n"
 	      "# developed and is distributed by Stanford University. It uses a minimum\n"
 	      "# cost flow network.\n\n");
     fprintf(fConfig, "algorithm = %s\n", cfg->unwrap->algorithm);
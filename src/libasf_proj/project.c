@@ -7,6 +7,7 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include <glib.h>
 #include "proj_api.h"
 #include "spheroids.h"
 
@@ -43,19 +44,38 @@ int putenv(char *);
 int setenv(const char *, const char *, int);
 #endif
 
+// The projection description routines below return a buffer which
+// stays valid until the next call in the same thread, so they (and
+// the projection routines using them) can be used from several
+// threads at once.
+static char *description_buffer(GPrivate *key)
+{
+    char *buf = g_private_get(key);
+    if (!buf) {
+        buf = g_malloc(128);
+        g_private_set(key, buf);
+    }
+    return buf;
+}
+
+G_LOCK_DEFINE_STATIC(proj_lib_path);
+
 static void set_proj_lib_path(datum_type_t datum)
 {
     static int set_path_already = FALSE;
+    // putenv keeps the string we give it, so it can't be on the stack
+    static char proj_putenv[255];
     if (datum == NAD27_DATUM) {
+        G_LOCK(proj_lib_path);
         if (!set_path_already) {
             // point to the grid shift files
-            char proj_putenv[255];
             sprintf(proj_putenv, "PROJ_LIB=%s/proj", get_asf_share_dir());
             putenv(proj_putenv);
             //sprintf(proj_putenv, "%s/proj", get_asf_share_dir());
             //setenv("PROJ_LIB", proj_putenv, TRUE);
             set_path_already = TRUE;
         }
+        G_UNLOCK(proj_lib_path);
     }
 }
 
@@ -90,12 +110,13 @@ static const char * datum_str(datum_type_t datum)
 int test_nad27(double lat, double lon)
 {
     projPJ ll_proj, utm_proj;
-    ll_proj = pj_init_plus(latlon_description);
+    projCtx ctx = pj_ctx_alloc();
+    ll_proj = pj_init_plus_ctx(ctx, latlon_description);
 
     char desc[255];
     int zone = utm_zone(lon);
     sprintf(desc, "+proj=utm +zone=%d +datum=NAD27", zone);
-    utm_proj = pj_init_plus(desc);
+    utm_proj = pj_init_plus_ctx(ctx, desc);
 /*
     double *px, *py, *pz;
     px = MALLOC(sizeof(double));
@@ -110,18 +131,20 @@ int test_nad27(double lat, double lon)
     pj_transform (ll_proj, utm_proj, 1, 1, px, py, pz);
 
     int ret = TRUE;
-    if (pj_errno == -38) // -38 indicates error with the grid shift files
+    int err = pj_ctx_get_errno(ctx);
+    if (err == -38) // -38 indicates error with the grid shift files
     {
         ret = FALSE;
     }
-    else if (pj_errno != 0) // some other error (pj errors are negative,
-    {                       // system errors are positive)
+    else if (err != 0) // some other error (pj errors are negative,
+    {                  // system errors are positive)
         asfPrintError("libproj Error: %s (test_nad27)\n", 
-		      pj_strerrno(pj_errno));
+		      pj_strerrno(err));
     }
 
     pj_free(ll_proj);
     pj_free(utm_proj);
+    pj_ctx_free(ctx);
 
     return ret;
 }
@@ -153,6 +176,10 @@ static int project_worker_arr(const char * projection_description,
   projPJ geographic_projection, output_projection;
   int i, ok = TRUE;
 
+  // Use a proj context of our own, so errors from other threads
+  // projecting at the same time can't get mixed up with ours.
+  projCtx ctx = pj_ctx_alloc();
+
   // This section is a bit confusing.  The interfaces to the single
   // point functions allow the user to a pass ASF_PROJ_NO_HEIGHT value
   // if they don't care about height.  The array functions allow the
@@ -246,12 +273,12 @@ static int project_worker_arr(const char * projection_description,
   //printf("proj: +from %s +to %s\n",
   //       latlon_description, projection_description);
 
-  geographic_projection = pj_init_plus (latlon_description);
+  geographic_projection = pj_init_plus_ctx (ctx, latlon_description);
 
-  if (pj_errno != 0)
+  if (pj_ctx_get_errno(ctx) != 0)
   {
       asfPrintError("libproj Error: %s (initializing geographic projection)\n",
-		    pj_strerrno(pj_errno));
+		    pj_strerrno(pj_ctx_get_errno(ctx)));
       ok = FALSE;
   }
 
@@ -259,13 +286,13 @@ static int project_worker_arr(const char * projection_description,
   {
       assert (geographic_projection != NULL);
 
-      output_projection = pj_init_plus (projection_description);
+      output_projection = pj_init_plus_ctx (ctx, projection_description);
 
-      if (pj_errno != 0)
+      if (pj_ctx_get_errno(ctx) != 0)
       {
 	printf("proj: %s\n", projection_description);
     asfPrintError("libproj Error: %s (initializing output projection)\n", 
-		  pj_strerrno(pj_errno));
+		  pj_strerrno(pj_ctx_get_errno(ctx)));
     ok = FALSE;
       }
 
@@ -276,10 +303,10 @@ static int project_worker_arr(const char * projection_description,
     pj_transform (geographic_projection, output_projection, length, 1,
       px, py, pz);
 
-    if (pj_errno != 0)
+    if (pj_ctx_get_errno(ctx) != 0)
     {
         asfPrintWarning("libproj error: %s (projection transformation)\n", 
-			pj_strerrno(pj_errno));
+			pj_strerrno(pj_ctx_get_errno(ctx)));
         ok = FALSE;
     }
 
@@ -289,6 +316,8 @@ static int project_worker_arr(const char * projection_description,
       pj_free(geographic_projection);
   }
 
+  pj_ctx_free(ctx);
+
   // Free memory temporarily allocated for height values that we don't
   // really care about.
   if ( dcah ) {
@@ -310,6 +339,9 @@ project_worker_arr_inv(const char * projection_description,
   projPJ geographic_projection, output_projection;
   int i, ok = TRUE;
 
+  // Own proj context, as in project_worker_arr.
+  projCtx ctx = pj_ctx_alloc();
+
   // Same issue here as above.  Because both single and array
   // functions ultimately call this routine, and we allow the user to
   // specify that they don't care about heights by passing certain
@@ -396,12 +428,12 @@ project_worker_arr_inv(const char * projection_description,
   //printf("proj: +from %s +to %s\n",
   //       projection_description, latlon_description);
 
-  geographic_projection = pj_init_plus ( latlon_description );
+  geographic_projection = pj_init_plus_ctx (ctx, latlon_description);
 
-  if (pj_errno != 0)
+  if (pj_ctx_get_errno(ctx) != 0)
   {
       asfPrintError("libproj Error: %s (initializing inverse geographic "
-		    "projection)\n", pj_strerrno(pj_errno));
+		    "projection)\n", pj_strerrno(pj_ctx_get_errno(ctx)));
       ok = FALSE;
   }
 
@@ -409,12 +441,12 @@ project_worker_arr_inv(const char * projection_description,
   {
       assert (geographic_projection != NULL);
 
-      output_projection = pj_init_plus (projection_description);
+      output_projection = pj_init_plus_ctx (ctx, projection_description);
 
-      if (pj_errno != 0)
+      if (pj_ctx_get_errno(ctx) != 0)
       {
     asfPrintError("libproj Error: %s\n (initializing inverse output "
-		  "projection)\n", pj_strerrno(pj_errno));
+		  "projection)\n", pj_strerrno(pj_ctx_get_errno(ctx)));
     ok = FALSE;
       }
 
@@ -425,10 +457,10 @@ project_worker_arr_inv(const char * projection_description,
     pj_transform (output_projection, geographic_projection, length, 1,
       plon, plat, pheight);
 
-    if (pj_errno != 0)
+    if (pj_ctx_get_errno(ctx) != 0)
     {
         asfPrintWarning("libproj error: %s (inverse projection transformation)"
-			"\n", pj_strerrno(pj_errno));
+			"\n", pj_strerrno(pj_ctx_get_errno(ctx)));
         ok = FALSE;
     }
 
@@ -438,6 +470,8 @@ project_worker_arr_inv(const char * projection_description,
       pj_free(geographic_projection);
   }
 
+  pj_ctx_free(ctx);
+
   // Free memory temporarily allocated for height values that we don't
   // really care about.
   if ( dcah ) {
@@ -475,7 +509,8 @@ static double utm_nudge(double lon_0)
 
 char *utm_projection_description(project_parameters_t *pps, datum_type_t datum)
 {
-  static char utm_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *utm_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM || datum == NAD27_DATUM || datum == NAD83_DATUM) {
@@ -571,7 +606,8 @@ project_utm_arr_inv (project_parameters_t * pps,
 ****************************************************************************/
 char *ps_projection_desc(project_parameters_t *pps, datum_type_t datum)
 {
-  static char ps_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *ps_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM || datum == NAD27_DATUM || datum == NAD83_DATUM ||
@@ -641,7 +677,8 @@ project_ps_arr_inv(project_parameters_t * pps,
 ****************************************************************************/
 char *lamaz_projection_desc(project_parameters_t *pps, datum_type_t datum)
 {
-  static char lamaz_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *lamaz_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM || datum == NAD27_DATUM || datum == NAD83_DATUM) {
@@ -721,7 +758,8 @@ project_lamaz_arr_inv(project_parameters_t *pps,
 ****************************************************************************/
 char *lamcc_projection_desc(project_parameters_t *pps, datum_type_t datum)
 {
-  static char lamcc_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *lamcc_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM || datum == NAD27_DATUM || datum == NAD83_DATUM) {
@@ -807,7 +845,8 @@ project_lamcc_arr_inv(project_parameters_t *pps,
 // Mercator
 char *mer_projection_desc(project_parameters_t *pps, datum_type_t datum)
 {
-  static char mer_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *mer_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM) {
@@ -888,7 +927,8 @@ project_mer_arr_inv(project_parameters_t *pps,
 // Sinusoidal
 char *sin_projection_desc(project_parameters_t *pps)
 {
-  static char sin_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *sin_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   sprintf(sin_projection_description,
@@ -954,7 +994,8 @@ project_sin_arr_inv(project_parameters_t *pps,
 // Equirectangular
 char *eqr_projection_desc(project_parameters_t *pps, datum_type_t datum)
 {
-  static char eqr_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *eqr_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM) {
@@ -1024,7 +1065,8 @@ project_eqr_arr_inv(project_parameters_t *pps,
 // Equidistant
 char *eqc_projection_desc(project_parameters_t *pps, datum_type_t datum)
 {
-  static char eqc_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *eqc_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM) {
@@ -1094,7 +1136,8 @@ project_eqc_arr_inv(project_parameters_t *pps,
 // EASE grid - Global
 char *ease_global_projection_desc(project_parameters_t *pps)
 {
-  static char ease_global_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *ease_global_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   sprintf(ease_global_projection_description,
@@ -1153,7 +1196,8 @@ project_ease_global_arr_inv(project_parameters_t *pps,
 char * albers_projection_desc(project_parameters_t * pps,
 			      datum_type_t datum)
 {
-  static char albers_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *albers_projection_description = description_buffer (&key);
 
   /* Establish description of output projection. */
   if (datum == WGS84_DATUM || datum == NAD27_DATUM || datum == NAD83_DATUM) {
@@ -1250,7 +1294,8 @@ project_albers_arr_inv(project_parameters_t *pps,
 
 static char * pseudo_projection_description(datum_type_t datum)
 {
-  static char pseudo_projection_description[128];
+  static GPrivate key = G_PRIVATE_INIT (g_free);
+  char *pseudo_projection_description = description_buffer (&key);
 
   asfRequire(datum != HUGHES_DATUM,
              "Using a Hughes-1980 ellipsoid with a pseudo lat/long "
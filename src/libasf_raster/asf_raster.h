@@ -121,6 +121,9 @@ void calc_stats_from_file(const char *inFile, char *band, double mask, double *m
 void calc_stats_from_file_ext(const char *inFile, char *band, double mask, 
         double *min, double *max, double *mean, double *stdDev, double *valid,
 			  gsl_histogram **histogram);
+void calc_stats_from_file_sampled(const char *inFile, char *band, double mask,
+        long long max_samples, double *min, double *max, double *mean,
+        double *stdDev, gsl_histogram **histogram);
 void calc_stats(float *data, long long pixel_count, double mask, double *min,
 		double *max, double *mean, double *stdDev);
 void calc_stats_ext(float *data, long long pixel_count, double mask, int report,
@@ -150,6 +153,59 @@ void kernel_filter(char *inFile, char *outFile, filter_type_t filter,
 float interpolate(interpolate_type_t interpolation, FloatImage *inbuf, float yLine,
 		  float xSample, weighting_type_t weighting, int sinc_points);
 
+/* Prototypes from memory_image.c ********************************************/
+// A whole image held in memory, laid out as in its .img file (the lines
+// of each band one after another), but always as floats.  The metadata
+// keeps the data type the image has on disk, which is what
+// memory_image_store writes.  Lets processing stages pass images along
+// without writing temporary files.  memory_image_new takes a copy of
+// meta and fills the image with zeros.
+typedef struct {
+  meta_parameters *meta;
+  float *data;
+} MemoryImage;
+
+MemoryImage *memory_image_new(meta_parameters *meta);
+MemoryImage *memory_image_new_from_file(const char *file);
+float *memory_image_line(MemoryImage *self, int band, int line);
+int memory_image_store(MemoryImage *self, const char *file);
+void memory_image_free(MemoryImage *self);
+// Memory needed to hold the image described by meta, and the size of
+// its .img file.
+size_t memory_image_bytes(const meta_parameters *meta);
+size_t memory_image_file_bytes(const meta_parameters *meta);
+
+/* Prototypes from line_filter.c *********************************************/
+// A line-local processing stage (calibration, say) that, instead of
+// writing its output image, is applied to the lines of its input as the
+// next stage reads them.  in_file is the stage's input, meta the
+// metadata of the output it would have written.  func turns a line of
+// the input into the same line of the output, in place; the output must
+// have the input's size and bands.
+typedef void line_filter_func(void *data, int band, int line, float *buf);
+
+typedef struct {
+  char *in_file;             // .img file of the stage's input
+  meta_parameters *in_meta;
+  meta_parameters *meta;     // metadata of the stage's output
+  line_filter_func *func;
+  void *data;
+  void (*free_data)(void *data);   // may be NULL
+} LineFilter;
+
+// Takes a copy of meta.  line_filter_free frees data with free_data.
+LineFilter *line_filter_new(const char *in_file, meta_parameters *meta,
+                            line_filter_func *func, void *data,
+                            void (*free_data)(void *data));
+// Reads a line of the stage's output, from fp open on in_file.
+void line_filter_get_line(LineFilter *self, FILE *fp, int band, int line,
+                          float *buf);
+// float_image_band_new_from_metadata for the stage's output.
+FloatImage *line_filter_band_float_image(LineFilter *self, int band);
+// Writes the stage's output after all, to file (.img and .meta).
+int line_filter_store(LineFilter *self, const char *file);
+void line_filter_free(LineFilter *self);
+
 /* Prototypes from trim.c ****************************************************/
 int trim(char *infile, char *outfile, long long startX, long long startY,
 	 long long sizeX, long long sizeY);
@@ -160,6 +216,12 @@ void trim_wedges(char *infile, char *outfile);
 void trim_latlon(char *infile, char *outfile, double lat_min, double lat_max,
                  double lon_min, double lon_max);
 void trim_to(char *infile, char *outfile, char *metadata_file);
+MemoryImage *trim_to_memory(char *infile, long long startX, long long startY,
+                            long long sizeX, long long sizeY);
+MemoryImage *memory_image_trim(MemoryImage *in, long long startX,
+                               long long startY, long long sizeX,
+                               long long sizeY);
+MemoryImage *memory_image_trim_zeros(MemoryImage *in, int *startX, int *endX);
 void subset_by_latlon(char *infile, char *outfile, double *lat, double *lon, 
   int nCoords);
 void subset_by_map(char *infile, char *outfile, double minX, double maxX,
@@ -170,6 +232,9 @@ void clip_to_polygon(char *inFile, char *outFile, double *lat, double *lon,
 // Prototypes from raster_calc.c
 int raster_calc(char *outFile, char *expression, int input_count, 
 		char **inFiles);
+// Number of threads raster_calc evaluates the expression with.  0 (the
+// default) means one per processor.
+void raster_calc_set_thread_count(int thread_count);
 
 /* Prototypes from fftMatch.c ************************************************/
 int fftMatch(char *inFile1, char *inFile2, char *corrFile,
@@ -179,6 +244,9 @@ void fftMatch_withOffsetFile(char *inFile1, char *inFile2, char *corrFile,
 int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
 	     float *dx, float *dy, float *certainty,
              int size, double tolerance, int overlap);
+/* Number of threads fftMatch_gridded matches tiles with.  0 (the
+   default) means one per processor. */
+void fftMatch_set_thread_count(int thread_count);
 int fftMatch_proj(char *inFile1, char *inFile2, float *offsetX, float *offsetY,
                 float *certainty);
 int fftMatch_either(char *inFile1, char *inFile2, float *offsetX,
@@ -21,6 +21,22 @@ banded_float_image_new(int nbands, size_t size_x, size_t size_y)
     return self;
 }
 
+BandedFloatImage *
+banded_float_image_new_from_metadata(meta_parameters *meta, const char *file)
+{
+    BandedFloatImage *self = MALLOC(sizeof(BandedFloatImage));
+
+    int nbands = meta->general->band_count;
+    self->images = MALLOC(sizeof(FloatImage*)*nbands);
+    self->nbands = nbands;
+
+    int i;
+    for (i=0; i<nbands; ++i)
+        self->images[i] = float_image_band_new_from_metadata(meta, i, file);
+
+    return self;
+}
+
 BandedFloatImage *
 banded_float_image_new_with_value(int nbands, ssize_t size_x, ssize_t size_y, 
 				  float value)
@@ -96,6 +112,18 @@ banded_float_image_get_band(BandedFloatImage *self, int nband)
     return self->images[nband];
 }
 
+void
+banded_float_image_sample_row(BandedFloatImage *self, int nband,
+                              size_t count, const double *x, const double *y,
+                              float_image_sample_method_t sample_method,
+                              float *out)
+{
+    banded_image_self_test(self);
+    assert(nband >= 0 && nband < self->nbands);
+    float_image_sample_row(self->images[nband], count, x, y, sample_method,
+                           out);
+}
+
 ssize_t
 banded_float_image_get_size_x(BandedFloatImage *self)
 {
@@ -19,6 +19,11 @@ typedef struct
 BandedFloatImage *
 banded_float_image_new(int nbands, size_t size_x, size_t size_y);
 
+// Create a new image with one band for each band of the image file
+// described by meta (see float_image_band_new_from_metadata).
+BandedFloatImage *
+banded_float_image_new_from_metadata(meta_parameters *meta, const char *file);
+
 BandedFloatImage *
 banded_float_image_new_with_value(int nBands, ssize_t size_x, ssize_t size_y, 
 				  float value);
@@ -41,6 +46,13 @@ banded_float_image_set_pixel(BandedFloatImage *self, int nband,
 FloatImage *
 banded_float_image_get_band(BandedFloatImage *self, int nband);
 
+// Sample band nband at count points, as float_image_sample_row does.
+void
+banded_float_image_sample_row(BandedFloatImage *self, int nband,
+                              size_t count, const double *x, const double *y,
+                              float_image_sample_method_t sample_method,
+                              float *out);
+
 BandedFloatImage *
 banded_float_image_new_from_model_scaled (BandedFloatImage *model,
                                           ssize_t scale_factor);
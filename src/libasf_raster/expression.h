@@ -3,28 +3,37 @@
 #ifndef _EXPRESSION_H_
 #define _EXPRESSION_H_
 
-char *expression2cookie(const char *expr,int nvars);
-double evaluate(char *cookie,const double *variables);
-
-/* Internal Variables.*/
-typedef enum {
-	tokOperator,tokConstant,tokVariable
-}tokenType;
-
-typedef double (*evalFunc)(const void *tok,const double *vars,double a,double b);
-
-typedef struct token {
-	tokenType type;
-	char op; /*For operators, the operator (+,-,/,*).*/
-	int precedence; /*For operators, the precedence.*/
-	int index;/*For variables, the variable's index.*/
-	evalFunc eval; /*Evaluation function.*/
-	double val; /*For constants, the value of the constant.*/
-} token;
-
-
-/*Tokenizer functions.*/
-int expressionMalformed(const char *expr,int nvars);
-void setTokenExpression(const char *expr);
-token *nextToken(void);
+/* An expression (see raster_calc.c for the syntax) compiled into a
+   program that evaluates it a whole row of pixels at a time. */
+typedef struct calc_program calc_program;
+
+/* Compile expr, which may use the variables a, b, ... (nvars of them),
+   and x and y.  Prints what is wrong with expr and returns NULL if it
+   does not make sense. */
+calc_program *calc_program_new(const char *expr, int nvars);
+void calc_program_free(calc_program *prog);
+
+/* Whether the program uses variable var (0 for a, 1 for b, ...) */
+int calc_program_uses_var(const calc_program *prog, int var);
+
+/* Whether the expression uses the nodata constant */
+int calc_program_uses_nodata(const calc_program *prog);
+
+/* The no data value of each of the variables (MAGIC_UNSET_DOUBLE for
+   none), and the value to write where any of them is no data -- which
+   is also what the nodata constant in the expression stands for.
+   Until this is called, no data values are not looked for, and
+   nodata is 0. */
+void calc_program_set_nodata(calc_program *prog, const double *var_nodata,
+                             double out_nodata);
+
+/* Number of doubles of scratch space calc_program_eval_row needs.  Each
+   thread evaluating the program needs its own. */
+int calc_program_scratch_size(const calc_program *prog);
+
+/* Evaluate the program for the ns pixels of row y: vars[i] is the row
+   of variable i, and the results go into out. */
+void calc_program_eval_row(const calc_program *prog, const float **vars,
+                           int ns, int y, double *scratch, float *out);
+
 #endif
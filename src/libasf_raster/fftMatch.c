@@ -1,9 +1,9 @@
 #include "asf.h"
 #include "asf_meta.h"
 #include <math.h>
-#include "fft.h"
-#include "fft2d.h"
+#include "fft_plan.h"
 #include "asf_raster.h"
+#include <glib.h>
 
 #if defined(mingw) // MAXFLOAT not available on mingw
 #define MAXFLOAT 3.4028234663852886e+38
@@ -18,16 +18,60 @@
 #define modX(x,ns) ((x+ns)%ns)  /*Return x, wrapped to [0..ns-1]*/
 #define modY(y,nl) ((y+nl)%nl)  /*Return y, wrapped to [0..nl-1]*/
 
-/* readImg: reads the image file given by in
-   into the (nl x ns) float array dest.  Reads a total of
-   (delY x delX) pixels into topleft corner of dest, starting
-   at (startY , startX) in the input file.
+/* Where the images being matched come from: an open image file, or
+   a window of an image that is already in memory. */
+typedef struct match_source {
+  FILE *fp;               /* Image file (NULL for an image in memory) */
+  meta_parameters *meta;  /*   and its metadata */
+  float *buf;             /*   and a line buffer for reading it */
+  const float *data;      /* Top left pixel of the image in memory */
+  int stride;             /*   and the floats between its lines */
+  int line_count, sample_count;
+} match_source_t;
+
+static void file_source(match_source_t *src, FILE *fp, meta_parameters *meta)
+{
+  src->fp = fp;
+  src->meta = meta;
+  src->buf = (float *)MALLOC(sizeof(float)*meta->general->sample_count);
+  src->data = NULL;
+  src->stride = 0;
+  src->line_count = meta->general->line_count;
+  src->sample_count = meta->general->sample_count;
+}
+
+static void memory_source(match_source_t *src, const float *data, int stride,
+                          int line_count, int sample_count)
+{
+  src->fp = NULL;
+  src->meta = NULL;
+  src->buf = NULL;
+  src->data = data;
+  src->stride = stride;
+  src->line_count = line_count;
+  src->sample_count = sample_count;
+}
+
+static const float *source_line(match_source_t *src, int y)
+{
+  if (src->fp) {
+    get_float_line(src->fp, src->meta, y, src->buf);
+    return src->buf;
+  }
+  return src->data + (long)src->stride*y;
+}
+
+/* readImg: reads the image given by src
+   into the (nl x ns) float array dest, whose rows are rs floats
+   apart (rs >= ns).  Reads a total of (delY x delX) pixels into
+   topleft corner of dest, starting at (startY , startX) in the
+   input image.  Everything else in dest is zeroed.
 */
-static void readImage(FILE *in,meta_parameters *meta,
+static void readImage(match_source_t *src,
               int startX,int startY,int delX,int delY,
-              float add,float *sum, float *dest, int nl, int ns)
+              float add,float *sum, float *dest, int nl, int ns, int rs)
 {
-  float *inBuf=(float *)MALLOC(sizeof(float)*(meta->general->sample_count));
+  const float *inBuf;
   register int x,y,l;
   double tempSum=0;
 
@@ -41,8 +85,8 @@ static void readImage(FILE *in,meta_parameters *meta,
 
   /*Read portion of input image into topleft of dest array.*/
   for (y=0;y<delY;y++) {
-      l=ns*y;
-      get_float_line(in,meta,startY+y,inBuf);
+      l=rs*y;
+      inBuf=source_line(src,startY+y);
       if (sum==NULL) {
           for (x=0;x<delX;x++) {
               if (fabs(inBuf[startX+x]) < maxval && meta_is_valid_double(inBuf[startX+x])) {
@@ -59,22 +103,21 @@ static void readImage(FILE *in,meta_parameters *meta,
               }
           }
       }
-      for (x=delX;x<ns;x++) {
+      for (x=delX;x<rs;x++) {
           dest[l+x]=0.0; /*Fill rest of line with zeros.*/
       }
   }
 
   /*Fill remainder of array (bottom portion) with zero lines.*/
   for (y=delY;y<nl;y++) {
-      l=ns*y;
-      for (x=0;x<ns;x++) {
+      l=rs*y;
+      for (x=0;x<rs;x++) {
           dest[l+x]=0.0; /*Fill rest of in2 with zeros.*/
       }
   }
   if (sum!=NULL) {
       *sum=(float)tempSum;
   }
-  FREE(inBuf);
 }
 
 
@@ -156,36 +199,55 @@ static void findPeak(float *corrImage,float *dx,float *dy,float *doubt,
 }
 
 
-/* las_fftProd: reads both given files, and correlates them into the
-created outReal (nl x ns) float array.*/
-static void fftProd(FILE *in1F,meta_parameters *metaMaster,
-            FILE *in2F,meta_parameters *metaSlave,float *outReal[],
-            int ns, int nl, int mX, int mY,
-            int chipX, int chipY, int chipDX, int chipDY,
-            int searchX, int searchY)
+/* Sizes for correlating a master image with a slave: the (nl x ns)
+fft size, where the chip from the slave goes, and how far from there to
+search for the peak.*/
+typedef struct match_layout {
+  int nl,ns;
+  int chipX, chipY;        /*Chip location (top left corner) in second image*/
+  int chipDX,chipDY;       /*Chip size in second image.*/
+  int searchX,searchY;     /*Maximum distance to search for peak*/
+} match_layout_t;
+
+/*Set up search chip size, for the fft size already in lay.*/
+static void layoutChip(match_layout_t *lay, const match_source_t *slave)
+{
+  lay->chipDX=MINI(slave->sample_count,lay->ns)*3/4;
+  lay->chipDY=MINI(slave->line_count,lay->nl)*3/4;
+  lay->chipX=MINI(slave->sample_count,lay->ns)/8;
+  lay->chipY=MINI(slave->line_count,lay->nl)/8;
+  lay->searchX=MINI(slave->sample_count,lay->ns)*3/8;
+  lay->searchY=MINI(slave->line_count,lay->nl)*3/8;
+}
+
+/* las_fftProd: reads both given images, and correlates them into the
+(nl x ns) float array in2.  in1 and in2 must both have room for nl rows
+of the plan's row stride: the transforms are done in place, in the
+padded rows, and the result is packed back down to ns floats per row.*/
+static void fftProd(match_source_t *master, match_source_t *slave,
+            const match_layout_t *lay, const fft2d_real_plan *plan,
+            float *in1, float *in2)
 {
+  int ns=lay->ns, nl=lay->nl;
+  int chipDX=lay->chipDX, chipDY=lay->chipDY;
   float scaleFact=1.0/(chipDX*chipDY);
-  register float *in1,*in2,*out;
+  int rs=fft2d_real_row_stride(plan);
+  register float *out=in2;
   register int x,y,l;
   float aveChip;
 
-  in1=(float *)MALLOC(sizeof(float)*ns*nl);
-  in2=(float *)MALLOC(sizeof(float)*ns*nl);
-  out=in2;
-  *outReal=in2;
-
   /*Read image 2 (chip)*/
   //asfPrintStatus("Reading Image 2\n");
-  readImage(in2F,metaSlave,
-            chipX,chipY,chipDX,chipDY,
-            0.0,&aveChip,in2,nl,ns);
+  readImage(slave,
+            lay->chipX,lay->chipY,chipDX,chipDY,
+            0.0,&aveChip,in2,nl,ns,rs);
 
   /*Compute average brightness of chip.*/
   aveChip/=-(float)chipDY*chipDX;
 
   /*Subtract this average off of image 2(chip):*/
   for (y=0;y<chipDY;y++) {
-    l=ns*y;
+    l=rs*y;
     for (x=0;x<chipDX;x++) {
       in2[l+x]=(in2[l+x]+aveChip)*scaleFact;
     }
@@ -193,48 +255,48 @@ static void fftProd(FILE *in1F,meta_parameters *metaMaster,
 
   /*FFT image 2 */
   //asfPrintStatus("FFT Image 2\n");
-  rfft2d(in2,mY,mX);
+  fft2d_real_forward(plan,in2);
 
   /*Read image 1: Much easier, now that we know the average brightness. */
   //asfPrintStatus("Reading Image 1\n");
-  readImage(in1F,metaMaster,
-            0,0,MINI(metaMaster->general->sample_count,ns),
-            MINI(metaMaster->general->line_count,nl),
-            aveChip,NULL,in1,nl,ns);
+  readImage(master,
+            0,0,MINI(master->sample_count,ns),
+            MINI(master->line_count,nl),
+            aveChip,NULL,in1,nl,ns,rs);
 
   /*FFT Image 1 */
   //asfPrintStatus("FFT Image 1\n");
-  rfft2d(in1,mY,mX);
+  fft2d_real_forward(plan,in1);
 
-  /*Conjugate in2.*/
-  //asfPrintStatus("Conjugate Image 2\n");
+  /*Take complex product of in1 and the conjugate of in2 into out.*/
+  //asfPrintStatus("Complex Product\n");
   for (y=0;y<nl;y++) {
-    l=ns*y;
-    x = (y < 2) ? 1 : 0;
-    //if (y<2) x=1; else x=0;
-    for (;x<ns/2;x++) {
-      in2[l+2*x+1]*=-1.0;
+    complexFloat *c1=(complexFloat *)(in1+rs*y);
+    complexFloat *c2=(complexFloat *)(out+rs*y);
+    for (x=0;x<rs/2;x++) {
+      float re=c1[x].real*c2[x].real+c1[x].imag*c2[x].imag;
+      float im=c1[x].imag*c2[x].real-c1[x].real*c2[x].imag;
+      c2[x].real=re;
+      c2[x].imag=im;
     }
   }
 
-  /*Take complex product of in1 and in2 into out.*/
-  //asfPrintStatus("Complex Product\n");
-  rspect2dprod(in1,in2,out,nl,ns);
-
   /*Zero out the low frequencies of the correlation image.*/
   //asfPrintStatus("Zero low frequencies.\n");
   for (y=0;y<4;y++) {
-    l=ns*y;
+    l=rs*y;
     for (x=0;x<8;x++) out[l+x]=0;
-    l=ns*(nl-1-y);
+    l=rs*(nl-1-y);
     for (x=0;x<8;x++) out[l+x]=0;
   }
 
   /*Inverse-fft the product*/
   //asfPrintStatus("I-FFT\n");
-  rifft2d(out,mY,mX);
+  fft2d_real_inverse(plan,out);
 
-  FREE(in1);/*Note: in2 shouldn't be freed, because we return it.*/
+  /*Drop the row padding.*/
+  for (y=1;y<nl;y++)
+    memmove(out+ns*y,out+rs*y,sizeof(float)*ns);
 }
 
 static int mini(int a, int b)
@@ -242,41 +304,6 @@ static int mini(int a, int b)
   return a<b ? a : b;
 }
 
-static int fftMatchBF(char *file1, char *file2, float *dx, float *dy, float *cert, double tol)
-{
-  int qf_saved = quietflag;
-  quietflag = TRUE;
-  int ok = FALSE;
-
-  float dx1=0, dx2=0, dy1=0, dy2=0, cert1=0, cert2=0;
-  fftMatch(file1, file2, NULL, &dx1, &dy1, &cert1);
-  if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<tol) {
-    *dx = *dy = *cert = 0;
-  }
-  else {
-    fftMatch(file2, file1, NULL, &dx2, &dy2, &cert2);
-    if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<tol) {
-      *dx = *dy = *cert = 0;
-    }
-    else if (fabs(dx1 + dx2) > .25 || fabs(dy1 + dy2) > .25) {
-      *dx = *dy = *cert = 0;
-    }
-    else {
-      *dx = (dx1 - dx2) * 0.5;
-      *dy = (dy1 - dy2) * 0.5;
-      *cert = cert1 < cert2 ? cert1 : cert2; 
-      ok = TRUE;
-    }
-  }
-
-  quietflag = qf_saved;
-  //asfPrintStatus("Result %s:\n"
-  //               "dx1=%8.2f dy1=%8.2f cert=%f\n"
-  //               "dx2=%8.2f dy2=%8.2f cert=%f\n", ok?"Yes":"No", dx1, dy1, cert1, dx2, dy2, cert2);
-
-  return ok; 
-}
-
 typedef struct offset_point {
   int x_pos;
   int y_pos;
@@ -415,6 +442,121 @@ static void print_matches(offset_point_t *matches, int num_x, int num_y, FILE *f
   fprintf(fp, "Total Average Offset: %8.3f\n", avg);
 }
 
+// Number of threads fftMatch_gridded matches tiles with; 0 means one
+// per processor.
+static int match_thread_count = 0;
+
+void fftMatch_set_thread_count(int thread_count)
+{
+  match_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+// Reads the top left (nl x ns) pixels of an image into memory.
+static float *read_image_window(char *inFile, int nl, int ns)
+{
+  meta_parameters *meta = meta_read(inFile);
+  FILE *fp = fopenImage(inFile, "rb");
+  float *img = (float *)MALLOC(sizeof(float)*ns*(size_t)nl);
+  float *buf = (float *)MALLOC(sizeof(float)*meta->general->sample_count);
+  int ii;
+  for (ii=0; ii<nl; ++ii) {
+    get_float_line(fp, meta, ii, buf);
+    memcpy(img + (size_t)ii*ns, buf, sizeof(float)*ns);
+  }
+  FREE(buf);
+  FCLOSE(fp);
+  meta_free(meta);
+  return img;
+}
+
+// Everything the threads matching the tiles of a grid share.  Both
+// images are in memory, ns floats per line, and every tile is
+// size x size, so every match has the same layout and fft plan.
+typedef struct {
+  const float *img1, *img2;
+  int ns, size;
+  double tol;
+  match_layout_t lay;
+  const fft2d_real_plan *plan;
+  offset_point_t *matches;
+  int len;
+  gint next;              // Next tile to match (atomic)
+} grid_match_t;
+
+// Matches chip b against chip a, like fftMatch on the two files would.
+static void match_chips(const grid_match_t *g, match_source_t *a,
+                        match_source_t *b, float *in1, float *in2,
+                        float *dx, float *dy, float *cert)
+{
+  float doubt;
+  fftProd(a, b, &g->lay, g->plan, in1, in2);
+  findPeak(in2, dx, dy, &doubt, g->lay.nl, g->lay.ns,
+           g->lay.chipX, g->lay.chipY, g->lay.searchX, g->lay.searchY);
+  *cert = 1-doubt;
+}
+
+// Matches the tile at (tile_x,tile_y) both ways, and checks that the
+// two matches agree.
+static int match_tile(const grid_match_t *g, int tile_x, int tile_y,
+                      float *in1, float *in2,
+                      float *dx, float *dy, float *cert)
+{
+  match_source_t chip1, chip2;
+  size_t offset = (size_t)tile_y*g->ns + tile_x;
+  memory_source(&chip1, g->img1 + offset, g->ns, g->size, g->size);
+  memory_source(&chip2, g->img2 + offset, g->ns, g->size, g->size);
+
+  int ok = FALSE;
+  double tol = g->tol;
+  float dx1=0, dx2=0, dy1=0, dy2=0, cert1=0, cert2=0;
+  match_chips(g, &chip1, &chip2, in1, in2, &dx1, &dy1, &cert1);
+  if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<tol) {
+    *dx = *dy = *cert = 0;
+  }
+  else {
+    match_chips(g, &chip2, &chip1, in1, in2, &dx2, &dy2, &cert2);
+    if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<tol) {
+      *dx = *dy = *cert = 0;
+    }
+    else if (fabs(dx1 + dx2) > .25 || fabs(dy1 + dy2) > .25) {
+      *dx = *dy = *cert = 0;
+    }
+    else {
+      *dx = (dx1 - dx2) * 0.5;
+      *dy = (dy1 - dy2) * 0.5;
+      *cert = cert1 < cert2 ? cert1 : cert2; 
+      ok = TRUE;
+    }
+  }
+
+  return ok; 
+}
+
+// Takes tiles from the grid until there are none left.  Each thread
+// has its own fft buffers.
+static gpointer grid_match_thread(gpointer data)
+{
+  grid_match_t *g = data;
+  int rs = fft2d_real_row_stride(g->plan);
+  float *in1 = (float *)MALLOC(sizeof(float)*rs*g->lay.nl);
+  float *in2 = (float *)MALLOC(sizeof(float)*rs*g->lay.nl);
+  int kk;
+
+  while ((kk = g_atomic_int_add(&g->next, 1)) < g->len) {
+    offset_point_t *m = &g->matches[kk];
+    float dx, dy, cert;
+    int ok = match_tile(g, m->x_pos, m->y_pos, in1, in2, &dx, &dy, &cert);
+    m->cert = cert;
+    m->x_offset = dx;
+    m->y_offset = dy;
+    m->valid = ok && cert>g->tol;
+  }
+
+  FREE(in1);
+  FREE(in2);
+  return NULL;
+}
+
 int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
                      float *avgLocX, float *avgLocY, float *certainty,
                      int size, double tol, int overlap)
@@ -433,8 +575,6 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
   asfPrintStatus("Tile overlap is %d pixels\n", overlap);
   asfPrintStatus("Match tolerance is %.2f\n", tol);
 
-  long long lsz = (long long)size;
-
   int num_x = (ns - size) / (size - overlap);
   int num_y = (nl - size) / (size - overlap);
   int len = num_x*num_y;
@@ -458,38 +598,57 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
           asfPrintError("Bad tile_x: %d %d %d %d %d\n", jj, num_x, tile_x, size, ns);
         tile_x = ns - size;
       }
-      //asfPrintStatus("Matching tile starting at (L,S) (%d,%d)\n", tile_y, tile_x);
-      char trim_append[64];
-      sprintf(trim_append, "_chip_%05d_%05d", tile_y, tile_x);
-      char *trim_chip1 = appendToBasename(inFile1, trim_append);
-      char *trim_chip2 = appendToBasename(inFile2, trim_append);
-      trim(inFile1, trim_chip1, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      trim(inFile2, trim_chip2, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      //char smooth_append[64];
-      //sprintf(smooth_append, "_smooth_chip_%05d_%05d", tile_x, tile_y);
-      //char *smooth_chip1 = appendToBasename(inFile1, smooth_append);
-      //smooth(trim_chip1, smooth_chip1, 3, EDGE_TRUNCATE);
-      float dx, dy, cert;
-      int ok = fftMatchBF(trim_chip1, trim_chip2, &dx, &dy, &cert, tol);
       matches[kk].x_pos = tile_x;
       matches[kk].y_pos = tile_y;
-      matches[kk].cert = cert;
-      matches[kk].x_offset = dx;
-      matches[kk].y_offset = dy;
-      matches[kk].valid = ok && cert>tol;
-      asfPrintStatus("%s: %5d %5d dx=%7.3f, dy=%7.3f, cert=%5.3f\n",
-                     matches[kk].valid?"GOOD":"BAD ", tile_y, tile_x, dx, dy, cert);
-      if (matches[kk].valid) ++nvalid;
       ++kk;
-      //printf("%4.1f ", dx);
-      removeImgAndMeta(trim_chip1);
-      FREE(trim_chip1);
-      removeImgAndMeta(trim_chip2);
-      FREE(trim_chip2);
-      //unlink(smooth_chip1);
-      //FREE(smooth_chip1);
     }
-    //printf("\n");
+  }
+
+  // Read the overlapping parts of both images once, and match the
+  // tiles from memory, spread over a pool of threads.
+  grid_match_t g;
+  g.img1 = read_image_window(inFile1, nl, ns);
+  g.img2 = read_image_window(inFile2, nl, ns);
+  g.ns = ns;
+  g.size = size;
+  g.tol = tol;
+  g.matches = matches;
+  g.len = len;
+  g.next = 0;
+
+  // The fft size fftMatch would pick for a tile.
+  int mX = (int)(log((float)size)/log(2.0)+0.5);
+  int mY = mX;
+  if (mX > 13) mX = 13;
+  if (mY > 15) mY = 15;
+  g.lay.ns = 1<<mX;
+  g.lay.nl = 1<<mY;
+  match_source_t tile;
+  memory_source(&tile, NULL, ns, size, size);
+  layoutChip(&g.lay, &tile);
+  g.plan = fft2d_real_plan_get(g.lay.nl, g.lay.ns);
+
+  int n_threads = match_thread_count > 0 ? match_thread_count
+                                         : (int)g_get_num_processors();
+  if (n_threads > len) n_threads = len;
+  if (n_threads < 1) n_threads = 1;
+  GThread **threads = g_new(GThread *, n_threads);
+  for (ii=1; ii<n_threads; ++ii)
+    threads[ii] = g_thread_new("fftMatch", grid_match_thread, &g);
+  grid_match_thread(&g);
+  for (ii=1; ii<n_threads; ++ii)
+    g_thread_join(threads[ii]);
+  g_free(threads);
+
+  FREE((float *)g.img1);
+  FREE((float *)g.img2);
+
+  for (kk=0; kk<len; ++kk) {
+    asfPrintStatus("%s: %5d %5d dx=%7.3f, dy=%7.3f, cert=%5.3f\n",
+                   matches[kk].valid?"GOOD":"BAD ", matches[kk].y_pos,
+                   matches[kk].x_pos, matches[kk].x_offset,
+                   matches[kk].y_offset, matches[kk].cert);
+    if (matches[kk].valid) ++nvalid;
   }
 
   //print_matches(matches, num_x, num_y, stdout);
@@ -831,12 +990,14 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
   int nl,ns;
   int mX,mY;               /*Invariant: 2^mX=ns; 2^mY=nl.*/
   int chipX, chipY;        /*Chip location (top left corner) in second image*/
-  int chipDX,chipDY;       /*Chip size in second image.*/
   int searchX,searchY;     /*Maximum distance to search for peak*/
 
   int x,y;
   float doubt;
-  float *corrImage=NULL;
+  float *in1,*corrImage;
+  fft2d_real_plan *plan;
+  match_layout_t lay;
+  match_source_t master, slave;
   FILE *corrF=NULL,*in1F,*in2F;
   meta_parameters *metaMaster, *metaSlave, *metaOut;
 
@@ -844,6 +1005,8 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
   in2F = fopenImage(inFile2,"rb");
   metaMaster = meta_read(inFile1);
   metaSlave = meta_read(inFile2);
+  file_source(&master,in1F,metaMaster);
+  file_source(&slave,in2F,metaSlave);
 
   /*Round to find nearest power of 2 for FFT size.*/
   mX = (int)(log((float)(metaMaster->general->sample_count))/log(2.0)+0.5);
@@ -857,7 +1020,8 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
 
   /* Test chip size to see if we have enough memory for it */
   /* Reduce it if necessary, but not below 1024x1024 (which needs 4 Mb of memory) */
-  float *test_mem = (float *)malloc(sizeof(float)*ns*nl*2);
+  /* (The rows are padded by two floats for the transforms.) */
+  float *test_mem = (float *)malloc(sizeof(float)*(ns+2)*nl*2);
   if (!test_mem && !quietflag) asfPrintStatus("\n");
   while (!test_mem) {
       mX--;
@@ -868,20 +1032,21 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
           asfPrintError("FFT Size too small (%dx%d)...\n", ns, nl);
       }
       if (!quietflag) asfPrintStatus("   Not enough memory... reducing FFT Size to %dx%d\n", ns, nl);
-      test_mem = (float *)malloc(sizeof(float)*ns*nl*2);
+      test_mem = (float *)malloc(sizeof(float)*(ns+2)*nl*2);
   }
   FREE(test_mem);
   if (!quietflag) asfPrintStatus("\n");
 
   /*Set up search chip size.*/
-  chipDX=MINI(metaSlave->general->sample_count,ns)*3/4;
-  chipDY=MINI(metaSlave->general->line_count,nl)*3/4;
-  chipX=MINI(metaSlave->general->sample_count,ns)/8;
-  chipY=MINI(metaSlave->general->line_count,nl)/8;
-  searchX=MINI(metaSlave->general->sample_count,ns)*3/8;
-  searchY=MINI(metaSlave->general->line_count,nl)*3/8;
+  lay.ns=ns;
+  lay.nl=nl;
+  layoutChip(&lay,&slave);
+  chipX=lay.chipX;
+  chipY=lay.chipY;
+  searchX=lay.searchX;
+  searchY=lay.searchY;
 
-  fft2dInit(mY, mX);
+  plan = fft2d_real_plan_get(nl, ns);
 
   if (!quietflag && ns*nl*2*sizeof(float)>20*1024*1024) {
     asfPrintStatus(
@@ -899,8 +1064,10 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
   }
 
   /*Perform the correlation.*/
-  fftProd(in1F,metaMaster,in2F,metaSlave,&corrImage,ns,nl,mX,mY,
-          chipX,chipY,chipDX,chipDY,searchX,searchY);
+  in1=(float *)MALLOC(sizeof(float)*fft2d_real_row_stride(plan)*nl);
+  corrImage=(float *)MALLOC(sizeof(float)*fft2d_real_row_stride(plan)*nl);
+  fftProd(&master,&slave,&lay,plan,in1,corrImage);
+  FREE(in1);
 
   /*Optionally write out correlation image.*/
   if (corrFile) {
@@ -931,6 +1098,8 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
                    "   Certainty: %f%%\n",*bestLocX,*bestLocY,100*(1-doubt));
   }
 
+  FREE(master.buf);
+  FREE(slave.buf);
   meta_free(metaSlave);
   meta_free(metaMaster);
   FCLOSE(in1F);
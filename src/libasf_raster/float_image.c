@@ -12,6 +12,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <setjmp.h>
+#ifndef win32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#endif
 
 #include <glib.h>
 #if GLIB_CHECK_VERSION (2, 6, 0)
@@ -42,8 +46,9 @@ round (double arg)
 
 #include "asf_glib.h"
 
-// Default cache size to use is 16 megabytes.
-static const size_t default_cache_size = 16 * 1048576;
+// Default cache size to use is 16 megabytes, unless changed with
+// float_image_set_default_cache_size.
+static size_t default_cache_size = 16 * 1048576;
 // This class wide data element keeps track of the number of temporary
 // tile files opened by the current process, in order to give them
 // unique names.
@@ -149,9 +154,12 @@ initialize_tile_cache_file (GString **tile_file_name)
 
 // This routine does the work common to several of the differenct
 // creation routines.  Basicly, it does everything but fill in the
-// contents of the disk tile store.
+// contents of the disk tile store.  If the image turns out to need
+// tiling and use_tile_file is false, no tile file is created, and the
+// caller must arrange for tiles to come from somewhere else.
 static FloatImage *
-initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
+initialize_float_image_structure (ssize_t size_x, ssize_t size_y,
+                                  gboolean use_tile_file)
 {
   // Allocate instance memory.
   FloatImage *self = g_new0 (FloatImage, 1);
@@ -279,7 +287,9 @@ initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
 
   // Get a new empty tile cache file pointer.
   self->tile_file_name = NULL;
-  self->tile_file = initialize_tile_cache_file (&(self->tile_file_name));
+  if ( use_tile_file ) {
+    self->tile_file = initialize_tile_cache_file (&(self->tile_file_name));
+  }
 
   // Objects are born with one reference.
   self->reference_count = 1;
@@ -397,7 +407,7 @@ float_image_new (ssize_t size_x, ssize_t size_y)
 {
   g_assert (size_x > 0 && size_y > 0);
 
-  FloatImage *self = initialize_float_image_structure (size_x, size_y);
+  FloatImage *self = initialize_float_image_structure (size_x, size_y, TRUE);
 
   // If we need a tile file for an image of this size, prepare it.
   if ( self->tile_file != NULL ) {
@@ -454,7 +464,7 @@ float_image_new_with_value (ssize_t size_x, ssize_t size_y, float value)
 {
   g_assert (size_x > 0 && size_y > 0);
 
-  FloatImage *self = initialize_float_image_structure (size_x, size_y);
+  FloatImage *self = initialize_float_image_structure (size_x, size_y, TRUE);
 
   // If we need a tile file for an image of this size, prepare it.
   if ( self->tile_file != NULL ) {
@@ -724,7 +734,7 @@ float_image_new_from_file_pointer (ssize_t size_x, ssize_t size_y,
 {
   g_assert (size_x > 0 && size_y > 0);
 
-  FloatImage *self = initialize_float_image_structure (size_x, size_y);
+  FloatImage *self = initialize_float_image_structure (size_x, size_y, TRUE);
 
   FILE *fp = file_pointer;      // Convenience alias.
 
@@ -906,6 +916,78 @@ float_image_new_from_file_pointer (ssize_t size_x, ssize_t size_y,
   return self;
 }
 
+FloatImage *
+float_image_new_from_file_mapped (ssize_t size_x, ssize_t size_y,
+                                  const char *file, off_t offset,
+                                  float_image_byte_order_t byte_order)
+{
+#ifdef win32
+  return float_image_new_from_file (size_x, size_y, file, offset,
+                                    byte_order);
+#else
+  g_assert (size_x > 0 && size_y > 0);
+
+  // Pixels have to be properly aligned in memory for us to use them
+  // in place.
+  if ( offset % sizeof (float) != 0 ) {
+    return float_image_new_from_file (size_x, size_y, file, offset,
+                                      byte_order);
+  }
+
+  size_t map_length = offset + (off_t) size_x * size_y * sizeof (float);
+  g_assert (is_large_enough (file, map_length));
+
+  int fd = open (file, O_RDONLY);
+  // FIXME: we need some error handling and propagation here.
+  g_assert (fd >= 0);
+  void *map_address = mmap (NULL, map_length, PROT_READ, MAP_PRIVATE, fd, 0);
+  int return_code = close (fd);
+  g_assert (return_code == 0);
+
+  // Mapping really big files can fail if we are short on address
+  // space, in which case the tile file will have to do.
+  if ( map_address == MAP_FAILED ) {
+    return float_image_new_from_file (size_x, size_y, file, offset,
+                                      byte_order);
+  }
+
+  FloatImage *self = initialize_float_image_structure (size_x, size_y, FALSE);
+
+  const float *pixels = (const float *) ((const char *) map_address + offset);
+  gboolean swap = non_native_byte_order (byte_order);
+
+  // If everything fits in the first tile, we just copy it there and
+  // have no further use for the mapping.
+  if ( self->tile_queue == NULL ) {
+    self->tile_addresses[0] = self->cache;
+    size_t ii;
+    for ( ii = 0 ; ii < self->size_y ; ii++ ) {
+      float *row_address = self->tile_addresses[0] + ii * self->tile_size;
+      memcpy (row_address, pixels + ii * self->size_x,
+              self->size_x * sizeof (float));
+      if ( swap ) {
+        g_assert (sizeof (float) == 4);
+        size_t jj;
+        for ( jj = 0 ; jj < self->size_x ; jj++ ) {
+          swap_bytes_32 ((unsigned char *) &(row_address[jj]));
+        }
+      }
+    }
+    return_code = munmap (map_address, map_length);
+    g_assert (return_code == 0);
+  }
+  // Otherwise tiles will be loaded from the mapping as needed.
+  else {
+    self->map_address = map_address;
+    self->map_length = map_length;
+    self->map_pixels = pixels;
+    self->map_swap = swap;
+  }
+
+  return self;
+#endif
+}
+
 FloatImage *
 float_image_new_from_file_scaled (ssize_t size_x, ssize_t size_y,
                                   ssize_t original_size_x,
@@ -1119,6 +1201,17 @@ float_image_band_new_from_metadata(meta_parameters *meta,
     int nl = meta->general->line_count;
     int ns = meta->general->sample_count;
 
+    // Data files are big endian.  When no conversion is needed, we can
+    // read tiles directly from the file rather than making a copy.
+    if (meta->general->data_type == REAL32 &&
+        !(meta->general->radiometry >= r_SIGMA_DB &&
+          meta->general->radiometry <= r_GAMMA_DB))
+    {
+        off_t offset = (off_t) band * nl * ns * sizeof(float);
+        return float_image_new_from_file_mapped(ns, nl, file, offset,
+                   FLOAT_IMAGE_BYTE_ORDER_BIG_ENDIAN);
+    }
+
     FILE * fp = FOPEN(file, "rb");
     FloatImage * fi = float_image_new(ns, nl);
 
@@ -1169,6 +1262,134 @@ cached_tile_to_disk (FloatImage *self, size_t tile_offset)
   g_assert (write_count == self->tile_area);
 }
 
+// Read the tile with flattened offset tile_offset from the disk file
+// into memory at tile_address.
+static void
+read_tile_from_tile_file (FloatImage *self, size_t tile_offset,
+                          float *tile_address)
+{
+  g_assert (self->tile_file != NULL);
+  g_assert (tile_offset < self->tile_count);
+
+  int return_code
+    = FSEEK64 (self->tile_file,
+              (off_t) tile_offset * self->tile_area * sizeof (float),
+              SEEK_SET);
+  g_assert (return_code == 0);
+  clearerr (self->tile_file);
+  size_t read_count = fread (tile_address, sizeof (float), self->tile_area,
+                             self->tile_file);
+  if ( read_count < self->tile_area ) {
+    if ( ferror (self->tile_file) ) {
+      perror ("error reading tile cache file");
+      g_assert_not_reached ();
+    }
+    if ( feof (self->tile_file) ) {
+      fprintf (stderr,
+               "nothing left to read in tile cache file at offset %lld\n",
+               FTELL64 (self->tile_file));
+      g_assert_not_reached ();
+    }
+  }
+  g_assert (read_count == self->tile_area);
+}
+
+// Copy the tile with flattened offset tile_offset out of the memory
+// mapped source image into memory at tile_address.  The parts of edge
+// tiles which lie outside the image are zero filled, as they are in
+// tile files.
+static void
+read_tile_from_mapping (FloatImage *self, size_t tile_offset,
+                        float *tile_address)
+{
+  g_assert (self->map_address != NULL);
+  g_assert (tile_offset < self->tile_count);
+
+  size_t ts = self->tile_size;  // Convenience alias.
+
+  // Image coordinates of the upper left pixel of the tile.
+  size_t x0 = (tile_offset % self->tile_count_x) * ts;
+  size_t y0 = (tile_offset / self->tile_count_x) * ts;
+
+  // Portion of the tile which actually lies in the image.
+  size_t effective_width = MIN (ts, self->size_x - x0);
+  size_t effective_height = MIN (ts, self->size_y - y0);
+
+  size_t ii;
+  for ( ii = 0 ; ii < effective_height ; ii++ ) {
+    float *row_address = tile_address + ii * ts;
+    memcpy (row_address, self->map_pixels + (y0 + ii) * self->size_x + x0,
+            effective_width * sizeof (float));
+    if ( self->map_swap ) {
+      size_t jj;
+      for ( jj = 0 ; jj < effective_width ; jj++ ) {
+        swap_bytes_32 ((unsigned char *) &(row_address[jj]));
+      }
+    }
+    if ( effective_width < ts ) {
+      memset (row_address + effective_width, 0,
+              (ts - effective_width) * sizeof (float));
+    }
+  }
+  if ( effective_height < ts ) {
+    memset (tile_address + effective_height * ts, 0,
+            (ts - effective_height) * ts * sizeof (float));
+  }
+}
+
+// Read the tile with flattened offset tile_offset from wherever tiles
+// are stored for self into memory at tile_address.
+static void
+read_tile (FloatImage *self, size_t tile_offset, float *tile_address)
+{
+  if ( self->map_address != NULL ) {
+    read_tile_from_mapping (self, tile_offset, tile_address);
+  }
+  else {
+    read_tile_from_tile_file (self, tile_offset, tile_address);
+  }
+}
+
+// Stop reading tiles from the memory mapped source image, copying all
+// of the tiles into a new tile file instead.  The mapping is private
+// and read only, so this has to happen before any tile is modified.
+static void
+detach_mapping (FloatImage *self)
+{
+#ifndef win32
+  g_assert (self->map_address != NULL);
+  g_assert (self->tile_file == NULL);
+
+  self->tile_file = initialize_tile_cache_file (&(self->tile_file_name));
+
+  float *buffer = g_new (float, self->tile_area);
+  size_t ii;
+  for ( ii = 0 ; ii < self->tile_count ; ii++ ) {
+    read_tile_from_mapping (self, ii, buffer);
+    size_t write_count = fwrite (buffer, sizeof (float), self->tile_area,
+                                 self->tile_file);
+    // If we wrote less than expected,
+    if ( write_count < self->tile_area ) {
+      // it must have been a write error (probably no space left),
+      g_assert (ferror (self->tile_file));
+      // so print an error message,
+      fprintf (stderr,
+               "Error writing tile cache file for FloatImage instance: %s\n",
+               strerror (errno));
+      // and exit.
+      exit (EXIT_FAILURE);
+    }
+  }
+  g_free (buffer);
+
+  int return_code = munmap (self->map_address, self->map_length);
+  g_assert (return_code == 0);
+  self->map_address = NULL;
+  self->map_length = 0;
+  self->map_pixels = NULL;
+#endif
+}
+
 // Return true iff tile (x, y) is already loaded into the memory cache.
 static gboolean
 tile_is_loaded (FloatImage *self, ssize_t x, ssize_t y)
@@ -1188,8 +1409,8 @@ static float *
 load_tile (FloatImage *self, ssize_t x, ssize_t y)
 {
   // Make sure we haven't screwed up somehow and not created a tile
-  // file when in fact we should have.
-  g_assert (self->tile_file != NULL);
+  // file (or mapped the source image) when in fact we should have.
+  g_assert (self->tile_file != NULL || self->map_address != NULL);
 
   g_assert (!tile_is_loaded (self, x, y));
 
@@ -1205,7 +1426,11 @@ load_tile (FloatImage *self, ssize_t x, ssize_t y)
     // Displace tile loaded longest ago.
     size_t oldest_tile
       = GPOINTER_TO_INT (g_queue_pop_tail (self->tile_queue));
-    cached_tile_to_disk (self, oldest_tile);
+    // Tiles read from a mapping are never modified (see
+    // detach_mapping), so they don't have to be saved anywhere.
+    if ( self->tile_file != NULL ) {
+      cached_tile_to_disk (self, oldest_tile);
+    }
     tile_address = self->tile_addresses[oldest_tile];
     self->tile_addresses[oldest_tile] = NULL;
   }
@@ -1223,29 +1448,231 @@ load_tile (FloatImage *self, ssize_t x, ssize_t y)
                      GINT_TO_POINTER ((int) tile_offset));
 
   // Load the tile data.
-  int return_code
-    = FSEEK64 (self->tile_file,
-              (off_t) tile_offset * self->tile_area * sizeof (float),
-              SEEK_SET);
-  g_assert (return_code == 0);
-  clearerr (self->tile_file);
-  size_t read_count = fread (tile_address, sizeof (float), self->tile_area,
-                             self->tile_file);
-  if ( read_count < self->tile_area ) {
-    if ( ferror (self->tile_file) ) {
-      perror ("error reading tile cache file");
-      g_assert_not_reached ();
+  read_tile (self, tile_offset, tile_address);
+
+  return tile_address;
+}
+
+static void synchronize_tile_file_with_memory_cache (FloatImage *self);
+
+// Number of independently locked shards the concurrent tile cache is
+// split into.
+static const size_t concurrent_shard_count = 16;
+
+// Smallest number of tiles we allow a concurrent cache shard to hold.
+// Pins are only ever held for a few pixel lookups, so a shard can't
+// stay completely pinned for long, but we don't want loaders spinning
+// waiting for a slot either.
+static const size_t minimum_tiles_per_shard = 4;
+
+// One shard of the concurrent tile cache.  The shard lock is held
+// while tiles are loaded into or displaced from the shard, but never
+// by readers of tiles which are already loaded.
+typedef struct {
+  GMutex lock;              // Protects everything in the shard.
+  float *slab;              // Memory for the tiles in this shard.
+  size_t slot_count;        // Number of tiles slab can hold.
+  size_t slots_used;        // Number of slots handed out so far.
+  GQueue *tile_queue;       // Tile offsets kept in load order.
+} concurrent_shard_t;
+
+struct float_image_concurrent_cache {
+  size_t shard_count;
+  concurrent_shard_t *shards;
+  // Cached tile addresses, laid out like the tile_addresses field of
+  // FloatImage.  Only accessed with the g_atomic_pointer_* functions.
+  float **tile_addresses;
+  // Number of readers currently using each tile.  Only accessed with
+  // the g_atomic_int_* functions.
+  gint *pins;
+  // The stdio tile file has a single file position, so seeks and reads
+  // from the different shards have to be serialized.
+  GMutex tile_file_lock;
+};
+
+// Load tile tile_offset into the concurrent cache, unless some other
+// thread beat us to it.  If the shard is full, the tile loaded
+// longest ago which nobody has pinned is displaced.
+static void
+concurrent_load_tile (FloatImage *self, size_t tile_offset)
+{
+  struct float_image_concurrent_cache *cc = self->concurrent;
+  concurrent_shard_t *shard = &(cc->shards[tile_offset % cc->shard_count]);
+
+  g_mutex_lock (&(shard->lock));
+
+  // Somebody else may have loaded the tile while we waited for the lock.
+  if ( g_atomic_pointer_get (&(cc->tile_addresses[tile_offset])) != NULL ) {
+    g_mutex_unlock (&(shard->lock));
+    return;
+  }
+
+  float *tile_address = NULL;
+  while ( tile_address == NULL ) {
+    if ( shard->slots_used < shard->slot_count ) {
+      tile_address = shard->slab + shard->slots_used * self->tile_area;
+      shard->slots_used++;
+      break;
     }
-    if ( feof (self->tile_file) ) {
-      fprintf (stderr,
-               "nothing left to read in tile cache file at offset %lld\n",
-               FTELL64 (self->tile_file));
-      g_assert_not_reached ();
+    // Look for the oldest unpinned tile.  A reader that pins a tile
+    // always rechecks the tile address after bumping the pin count,
+    // so once we have cleared the address and then still see no pins,
+    // nobody can be using the tile anymore.  If a pin shows up in
+    // between, we put the address back and leave the tile alone.
+    GList *link;
+    for ( link = g_queue_peek_tail_link (shard->tile_queue) ; link != NULL ;
+          link = link->prev ) {
+      size_t victim = GPOINTER_TO_INT (link->data);
+      if ( g_atomic_int_get (&(cc->pins[victim])) != 0 ) {
+        continue;
+      }
+      float *victim_address
+        = g_atomic_pointer_get (&(cc->tile_addresses[victim]));
+      g_atomic_pointer_set (&(cc->tile_addresses[victim]), NULL);
+      if ( g_atomic_int_get (&(cc->pins[victim])) != 0 ) {
+        g_atomic_pointer_set (&(cc->tile_addresses[victim]), victim_address);
+        continue;
+      }
+      g_queue_delete_link (shard->tile_queue, link);
+      tile_address = victim_address;
+      break;
+    }
+    // Every tile in the shard is pinned at the moment.  Pins don't
+    // last long, so give the readers a chance to finish up.
+    if ( tile_address == NULL ) {
+      g_mutex_unlock (&(shard->lock));
+      g_thread_yield ();
+      g_mutex_lock (&(shard->lock));
     }
   }
-  g_assert (read_count == self->tile_area);
 
-  return tile_address;
+  if ( self->map_address != NULL ) {
+    read_tile_from_mapping (self, tile_offset, tile_address);
+  }
+  else {
+    g_mutex_lock (&(cc->tile_file_lock));
+    read_tile_from_tile_file (self, tile_offset, tile_address);
+    g_mutex_unlock (&(cc->tile_file_lock));
+  }
+
+  // Publishing the address is a full memory barrier, so readers who
+  // see it also see the tile data.
+  g_assert (tile_offset < INT_MAX);
+  g_queue_push_head (shard->tile_queue, GINT_TO_POINTER ((int) tile_offset));
+  g_atomic_pointer_set (&(cc->tile_addresses[tile_offset]), tile_address);
+
+  g_mutex_unlock (&(shard->lock));
+}
+
+// Pin tile tile_offset in the concurrent cache, loading it if
+// necessary, and return its address.  The tile stays put until the
+// matching concurrent_unpin_tile call.
+static float *
+concurrent_pin_tile (FloatImage *self, size_t tile_offset)
+{
+  struct float_image_concurrent_cache *cc = self->concurrent;
+
+  for ( ; ; ) {
+    float *tile_address
+      = g_atomic_pointer_get (&(cc->tile_addresses[tile_offset]));
+    if ( G_LIKELY (tile_address != NULL) ) {
+      g_atomic_int_inc (&(cc->pins[tile_offset]));
+      // Make sure the tile wasn't displaced before our pin landed.
+      if ( G_LIKELY (g_atomic_pointer_get (&(cc->tile_addresses[tile_offset]))
+                     == tile_address) ) {
+        return tile_address;
+      }
+      g_atomic_int_add (&(cc->pins[tile_offset]), -1);
+    }
+    concurrent_load_tile (self, tile_offset);
+  }
+}
+
+static void
+concurrent_unpin_tile (FloatImage *self, size_t tile_offset)
+{
+  g_atomic_int_add (&(self->concurrent->pins[tile_offset]), -1);
+}
+
+void
+float_image_begin_concurrent_reads (FloatImage *self, size_t cache_space)
+{
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+  g_assert (self->concurrent == NULL);
+
+  // Images which fit entirely in memory are never modified by reads,
+  // so there is nothing to do for them.
+  if ( self->tile_file == NULL && self->map_address == NULL ) {
+    return;
+  }
+
+  // The concurrent cache reads tiles straight from the tile file, so
+  // it had better be up to date.
+  if ( self->tile_file != NULL ) {
+    synchronize_tile_file_with_memory_cache (self);
+  }
+
+  struct float_image_concurrent_cache *cc
+    = g_new0 (struct float_image_concurrent_cache, 1);
+
+  if ( cache_space == 0 ) {
+    cache_space = self->cache_space;
+  }
+  size_t tiles_in_cache = cache_space / (self->tile_area * sizeof (float));
+  if ( tiles_in_cache > self->tile_count ) {
+    tiles_in_cache = self->tile_count;
+  }
+
+  cc->shard_count = concurrent_shard_count;
+  if ( cc->shard_count > self->tile_count ) {
+    cc->shard_count = self->tile_count;
+  }
+  size_t tiles_per_shard
+    = (tiles_in_cache + cc->shard_count - 1) / cc->shard_count;
+  if ( tiles_per_shard < minimum_tiles_per_shard ) {
+    tiles_per_shard = minimum_tiles_per_shard;
+  }
+
+  cc->shards = g_new0 (concurrent_shard_t, cc->shard_count);
+  size_t ii;
+  for ( ii = 0 ; ii < cc->shard_count ; ii++ ) {
+    concurrent_shard_t *shard = &(cc->shards[ii]);
+    g_mutex_init (&(shard->lock));
+    shard->slab = g_new (float, tiles_per_shard * self->tile_area);
+    shard->slot_count = tiles_per_shard;
+    shard->slots_used = 0;
+    shard->tile_queue = g_queue_new ();
+  }
+
+  cc->tile_addresses = g_new0 (float *, self->tile_count);
+  cc->pins = g_new0 (gint, self->tile_count);
+  g_mutex_init (&(cc->tile_file_lock));
+
+  self->concurrent = cc;
+}
+
+void
+float_image_end_concurrent_reads (FloatImage *self)
+{
+  struct float_image_concurrent_cache *cc = self->concurrent;
+
+  if ( cc == NULL ) {
+    return;
+  }
+
+  size_t ii;
+  for ( ii = 0 ; ii < cc->shard_count ; ii++ ) {
+    g_mutex_clear (&(cc->shards[ii].lock));
+    g_free (cc->shards[ii].slab);
+    g_queue_free (cc->shards[ii].tile_queue);
+  }
+  g_free (cc->shards);
+  g_free (cc->tile_addresses);
+  g_free (cc->pins);
+  g_mutex_clear (&(cc->tile_file_lock));
+  g_free (cc);
+
+  self->concurrent = NULL;
 }
 
 float
@@ -1268,6 +1695,14 @@ float_image_get_pixel (FloatImage *self, ssize_t x, ssize_t y)
   // Offset of tile x, y, where tiles are viewed as pixels normally are.
   size_t tile_offset = self->tile_count_x * pc_y.quot + pc_x.quot;
 
+  // In concurrent mode, the tile has to be pinned while we look.
+  if ( self->concurrent != NULL ) {
+    float *tile_address = concurrent_pin_tile (self, tile_offset);
+    float result = tile_address[self->tile_size * pc_y.rem + pc_x.rem];
+    concurrent_unpin_tile (self, tile_offset);
+    return result;
+  }
+
   // Address of data for tile containing pixel of interest (may still
   // have to be loaded from disk cache).
   float *tile_address = self->tile_addresses[tile_offset];
@@ -1288,6 +1723,14 @@ float_image_set_pixel (FloatImage *self, ssize_t x, ssize_t y, float value)
   g_assert (x >= 0 && (size_t) x <= self->size_x);
   g_assert (y >= 0 && (size_t) y <= self->size_y);
 
+  // Concurrent mode is read only.
+  g_assert (self->concurrent == NULL);
+
+  // We can't modify tiles read from a mapped source image.
+  if ( G_UNLIKELY (self->map_address != NULL) ) {
+    detach_mapping (self);
+  }
+
   // Get the pixel coordinates, including tile and pixel-in-tile.
   g_assert (sizeof (long int) >= sizeof (size_t));
   ldiv_t pc_x = ldiv (x, self->tile_size), pc_y = ldiv (y, self->tile_size);
@@ -1672,6 +2115,64 @@ float_image_apply_kernel (FloatImage *self, ssize_t x, ssize_t y,
   return sum;
 }
 
+// Number of points in each of the splines used for bicubic sampling.
+#define bicubic_spline_size 4
+
+// Spline workspace used for bicubic sampling.  Each thread gets its
+// own, so images in concurrent read mode can be sampled from many
+// threads at once.
+typedef struct {
+  // Splines in the x direction, and their lookup accelerators.
+  double x_indicies[bicubic_spline_size];
+  double values[bicubic_spline_size];
+  gsl_spline *xss[bicubic_spline_size];
+  gsl_interp_accel *xias[bicubic_spline_size];
+  // Spline between splines in the y direction, and lookup accelerator.
+  double y_spline_indicies[bicubic_spline_size];
+  double y_spline_values[bicubic_spline_size];
+  gsl_spline *ys;
+  gsl_interp_accel *yia;
+} bicubic_workspace_t;
+
+static void
+bicubic_workspace_free (gpointer data)
+{
+  bicubic_workspace_t *ws = data;
+  size_t ii;
+  for ( ii = 0 ; ii < bicubic_spline_size ; ii++ ) {
+    gsl_spline_free (ws->xss[ii]);
+    gsl_interp_accel_free (ws->xias[ii]);
+  }
+  gsl_spline_free (ws->ys);
+  gsl_interp_accel_free (ws->yia);
+  g_free (ws);
+}
+
+static GPrivate bicubic_workspace_key
+  = G_PRIVATE_INIT (bicubic_workspace_free);
+
+// Return the bicubic spline workspace for the calling thread,
+// allocating it the first time through.
+static bicubic_workspace_t *
+get_bicubic_workspace (void)
+{
+  bicubic_workspace_t *ws = g_private_get (&bicubic_workspace_key);
+
+  if ( G_UNLIKELY (ws == NULL) ) {
+    ws = g_new0 (bicubic_workspace_t, 1);
+    size_t ii;
+    for ( ii = 0 ; ii < bicubic_spline_size ; ii++ ) {
+      ws->xss[ii] = gsl_spline_alloc (gsl_interp_cspline, bicubic_spline_size);
+      ws->xias[ii] = gsl_interp_accel_alloc ();
+    }
+    ws->ys = gsl_spline_alloc (gsl_interp_cspline, bicubic_spline_size);
+    ws->yia = gsl_interp_accel_alloc ();
+    g_private_set (&bicubic_workspace_key, ws);
+  }
+
+  return ws;
+}
+
 float
 float_image_sample (FloatImage *self, float x, float y,
                     float_image_sample_method_t sample_method)
@@ -1706,14 +2207,23 @@ float_image_sample (FloatImage *self, float x, float y,
         size_t tx = xb / ts, ty = yb / ts;
         // Tile offset in flattened list of tile addresses.
         size_t tile_offset = ty * self->tile_count_x + tx;
-        float *tile_address = self->tile_addresses[tile_offset];
-        if ( G_UNLIKELY (tile_address == NULL) ) {
-          tile_address = load_tile (self, tx, ty);
+        float *tile_address;
+        if ( self->concurrent != NULL ) {
+          tile_address = concurrent_pin_tile (self, tile_offset);
+        }
+        else {
+          tile_address = self->tile_addresses[tile_offset];
+          if ( G_UNLIKELY (tile_address == NULL) ) {
+            tile_address = load_tile (self, tx, ty);
+          }
         }
         ul = tile_address[ybto * self->tile_size + xbto];
         ur = tile_address[ybto * self->tile_size + xato];
         ll = tile_address[yato * self->tile_size + xbto];
         lr = tile_address[yato * self->tile_size + xato];
+        if ( self->concurrent != NULL ) {
+          concurrent_unpin_tile (self, tile_offset);
+        }
       }
       else {
         // We are spanning a tile edge, so we just get the pixels
@@ -1733,41 +2243,20 @@ float_image_sample (FloatImage *self, float x, float y,
     break;
   case FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC:
     {
-      static gboolean first_time_through = TRUE;
-      // Splines in the x direction, and their lookup accelerators.
-      static double *x_indicies;
-      static double *values;
-      static gsl_spline **xss;
-      static gsl_interp_accel **xias;
-      // Spline between splines in the y direction, and lookup accelerator.
-      static double *y_spline_indicies;
-      static double *y_spline_values;
-      static gsl_spline *ys;
-      static gsl_interp_accel *yia;
-
       // All these splines have size 4.
-      const size_t ss = 4;
+      const size_t ss = bicubic_spline_size;
 
       size_t ii;                // Index variable.
 
-      if ( first_time_through ) {
-        // Allocate memory for the splines in the x direction.
-        x_indicies = g_new (double, ss);
-        values = g_new (double, ss);
-        xss = g_new (gsl_spline *, ss);
-        xias = g_new (gsl_interp_accel *, ss);
-        for ( ii = 0 ; ii < ss ; ii++ ) {
-          xss[ii] = gsl_spline_alloc (gsl_interp_cspline, ss);
-          xias[ii] = gsl_interp_accel_alloc ();
-        }
-
-        // Allocate memory for the spline in the y direction.
-        y_spline_indicies = g_new (double, ss);
-        y_spline_values = g_new (double, ss);
-        ys = gsl_spline_alloc (gsl_interp_cspline, ss);
-        yia = gsl_interp_accel_alloc ();
-        first_time_through = FALSE;
-      }
+      bicubic_workspace_t *ws = get_bicubic_workspace ();
+      double *x_indicies = ws->x_indicies;
+      double *values = ws->values;
+      gsl_spline **xss = ws->xss;
+      gsl_interp_accel **xias = ws->xias;
+      double *y_spline_indicies = ws->y_spline_indicies;
+      double *y_spline_values = ws->y_spline_values;
+      gsl_spline *ys = ws->ys;
+      gsl_interp_accel *yia = ws->yia;
 
       // Get the values for the nearest 16 points.
       size_t jj;                // Index variable.
@@ -1797,6 +2286,183 @@ float_image_sample (FloatImage *self, float x, float y,
   }
 }
 
+// The tile the row sampler is currently reading from.  Points along a
+// row mostly come from the same tile as the point before, so we hang
+// on to its address (and its pin, in concurrent mode) until a point
+// comes along which needs a different one.
+typedef struct {
+  FloatImage *image;
+  ssize_t tile_offset;          // Offset of the held tile, or -1 for none.
+  float *tile_address;
+} tile_cursor_t;
+
+static void
+tile_cursor_release (tile_cursor_t *tc)
+{
+  if ( tc->tile_offset >= 0 && tc->image->concurrent != NULL ) {
+    concurrent_unpin_tile (tc->image, tc->tile_offset);
+  }
+  tc->tile_offset = -1;
+  tc->tile_address = NULL;
+}
+
+// Return the address of tile tx, ty.  Outside of concurrent mode, the
+// address is only good until the next tile gets loaded, so anything
+// which might load a tile without going through the cursor has to
+// release it first.
+static float *
+tile_cursor_get (tile_cursor_t *tc, size_t tx, size_t ty)
+{
+  FloatImage *self = tc->image;
+  size_t tile_offset = ty * self->tile_count_x + tx;
+
+  if ( G_LIKELY ((ssize_t) tile_offset == tc->tile_offset) ) {
+    return tc->tile_address;
+  }
+
+  tile_cursor_release (tc);
+
+  float *tile_address;
+  if ( self->concurrent != NULL ) {
+    tile_address = concurrent_pin_tile (self, tile_offset);
+  }
+  else {
+    tile_address = self->tile_addresses[tile_offset];
+    if ( G_UNLIKELY (tile_address == NULL) ) {
+      tile_address = load_tile (self, tx, ty);
+    }
+  }
+
+  tc->tile_offset = tile_offset;
+  tc->tile_address = tile_address;
+
+  return tile_address;
+}
+
+// Weights of the four samples at -1, 0, 1 and 2 in the value at t (in
+// [0, 1]) of the natural cubic spline through them, which is what the
+// gsl_interp_cspline splines used by float_image_sample come to.
+static void
+cubic_spline_weights (double t, double *w)
+{
+  double a = ((1 - t) * (1 - t) * (1 - t) - (1 - t)) / 6;
+  double b = (t * t * t - t) / 6;
+
+  w[0] = (8 * a - 2 * b) / 5;
+  w[1] = (1 - t) + (12 * b - 18 * a) / 5;
+  w[2] = t + (12 * a - 18 * b) / 5;
+  w[3] = (8 * b - 2 * a) / 5;
+}
+
+void
+float_image_sample_row (FloatImage *self, size_t count, const double *x,
+                        const double *y,
+                        float_image_sample_method_t sample_method,
+                        float *out)
+{
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  size_t ts = self->tile_size;  // Convenience alias.
+  tile_cursor_t tc = { self, -1, NULL };
+
+  size_t ii;
+  switch ( sample_method ) {
+
+  case FLOAT_IMAGE_SAMPLE_METHOD_NEAREST_NEIGHBOR:
+    for ( ii = 0 ; ii < count ; ii++ ) {
+      float xf = x[ii], yf = y[ii];
+      g_assert (xf >= 0.0 && xf <= (double) self->size_x - 1.0);
+      g_assert (yf >= 0.0 && yf <= (double) self->size_y - 1.0);
+      size_t px = round (xf), py = round (yf);
+      float *tile_address = tile_cursor_get (&tc, px / ts, py / ts);
+      out[ii] = tile_address[(py % ts) * ts + px % ts];
+    }
+    break;
+
+  case FLOAT_IMAGE_SAMPLE_METHOD_BILINEAR:
+    for ( ii = 0 ; ii < count ; ii++ ) {
+      float xf = x[ii], yf = y[ii];
+      g_assert (xf >= 0.0 && xf <= (double) self->size_x - 1.0);
+      g_assert (yf >= 0.0 && yf <= (double) self->size_y - 1.0);
+      size_t xb = floor (xf), yb = floor (yf), xa = ceil (xf), ya = ceil (yf);
+      float ul, ur, ll, lr;
+      if ( G_LIKELY (xb / ts == xa / ts && yb / ts == ya / ts) ) {
+        float *tile_address = tile_cursor_get (&tc, xb / ts, yb / ts);
+        size_t xbto = xb % ts, ybto = yb % ts, xato = xa % ts, yato = ya % ts;
+        ul = tile_address[ybto * ts + xbto];
+        ur = tile_address[ybto * ts + xato];
+        ll = tile_address[yato * ts + xbto];
+        lr = tile_address[yato * ts + xato];
+      }
+      else {
+        tile_cursor_release (&tc);
+        ul = float_image_get_pixel (self, xb, yb);
+        ur = float_image_get_pixel (self, xa, yb);
+        ll = float_image_get_pixel (self, xb, ya);
+        lr = float_image_get_pixel (self, xa, ya);
+      }
+      // Same arithmetic as float_image_sample, so the results match
+      // exactly.
+      float ux = ul + (ur - ul) * (xf - floor (xf));
+      float lx = ll + (lr - ll) * (xf - floor (xf));
+      out[ii] = ux + (lx - ux) * (yf - floor (yf));
+    }
+    break;
+
+  case FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC:
+    for ( ii = 0 ; ii < count ; ii++ ) {
+      float xf = x[ii], yf = y[ii];
+      g_assert (xf >= 0.0 && xf <= (double) self->size_x - 1.0);
+      g_assert (yf >= 0.0 && yf <= (double) self->size_y - 1.0);
+      ssize_t xb = floor (xf), yb = floor (yf);
+      double wx[4], wy[4];
+      cubic_spline_weights (xf - floor (xf), wx);
+      cubic_spline_weights (yf - floor (yf), wy);
+
+      // The 4x4 neighborhood, from the tile if it lies in one and
+      // needs no reflection at the image edges.
+      float p[4][4];
+      size_t jj, kk;
+      if ( G_LIKELY (xb >= 1 && (size_t) xb + 2 < self->size_x
+                     && yb >= 1 && (size_t) yb + 2 < self->size_y
+                     && (xb - 1) / ts == (xb + 2) / ts
+                     && (yb - 1) / ts == (yb + 2) / ts) ) {
+        float *tile_address = tile_cursor_get (&tc, xb / ts, yb / ts);
+        const float *row = tile_address + ((yb - 1) % ts) * ts + (xb - 1) % ts;
+        for ( jj = 0 ; jj < 4 ; jj++, row += ts ) {
+          for ( kk = 0 ; kk < 4 ; kk++ ) {
+            p[jj][kk] = row[kk];
+          }
+        }
+      }
+      else {
+        tile_cursor_release (&tc);
+        for ( jj = 0 ; jj < 4 ; jj++ ) {
+          for ( kk = 0 ; kk < 4 ; kk++ ) {
+            p[jj][kk] = float_image_get_pixel_with_reflection (self,
+                                                               xb - 1 + kk,
+                                                               yb - 1 + jj);
+          }
+        }
+      }
+
+      double sum = 0;
+      for ( jj = 0 ; jj < 4 ; jj++ ) {
+        double row_value = (wx[0] * p[jj][0] + wx[1] * p[jj][1]
+                            + wx[2] * p[jj][2] + wx[3] * p[jj][3]);
+        sum += wy[jj] * row_value;
+      }
+      out[ii] = sum;
+    }
+    break;
+
+  default:
+    g_assert_not_reached ();
+  }
+
+  tile_cursor_release (&tc);
+}
+
 gboolean
 float_image_equals (FloatImage *self, FloatImage *other, float epsilon)
 {
@@ -1892,6 +2558,11 @@ float_image_freeze (FloatImage *self, FILE *file_pointer)
 
   g_assert (file_pointer != NULL);
 
+  // Frozen instances are always thawed with a tile file.
+  if ( self->map_address != NULL ) {
+    detach_mapping (self);
+  }
+
   size_t write_count = fwrite (&(self->size_x), sizeof (size_t), 1, fp);
   g_assert (write_count == 1);
 
@@ -2676,6 +3347,43 @@ float_image_export_as_csv (FloatImage *self, const char * filename)
   return 0;
 }
 
+size_t
+float_image_get_default_cache_size (void)
+{
+  return default_cache_size;
+}
+
+void
+float_image_set_default_cache_size (size_t size)
+{
+  // The cache must hold a whole number of pixels, and be big enough
+  // for reasonably sized tiles.
+  size -= size % sizeof (float);
+  g_assert (size >= 1048576);
+
+  default_cache_size = size;
+}
+
+size_t
+float_image_set_default_cache_size_from_ram (double fraction)
+{
+  g_assert (fraction > 0.0 && fraction <= 1.0);
+
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  long page_count = sysconf (_SC_PHYS_PAGES);
+  long page_size = sysconf (_SC_PAGESIZE);
+  if ( page_count > 0 && page_size > 0 ) {
+    double ram = (double) page_count * page_size;
+    size_t size = (size_t) MIN (ram * fraction, (double) SSIZE_MAX);
+    if ( size >= 1048576 ) {
+      float_image_set_default_cache_size (size);
+    }
+  }
+#endif
+
+  return default_cache_size;
+}
+
 size_t
 float_image_get_cache_size (FloatImage * UNUSED(self))
 {
@@ -2712,6 +3420,15 @@ float_image_unref (FloatImage *self)
 void
 float_image_free (FloatImage *self)
 {
+  float_image_end_concurrent_reads (self);
+
+#ifndef win32
+  if ( self->map_address != NULL ) {
+    int return_code = munmap (self->map_address, self->map_length);
+    g_assert (return_code == 0);
+  }
+#endif
+
   // Close the tile file (which shouldn't have to remove it since its
   // already unlinked), if we were ever using it.
   if ( self->tile_file != NULL ) {
@@ -5,8 +5,10 @@
 // accesses are spatially correlated.  A variety of useful methods are
 // implemented (filtering, subsetting, interpolating, etc.)
 //
-// Don't try to access the same instance concurrently.  Split your
-// images up into separate instances if you must parallelize things.
+// Don't try to access the same instance concurrently, except for
+// reading from an instance which has been put into concurrent read
+// mode (see "Concurrent Read Access" below).  Split your images up
+// into separate instances if you must parallelize anything else.
 //
 // For many methods, arguments of type ssize_t are used, but are not
 // allowed to be negative.  This is to help prevent people from
@@ -52,6 +54,14 @@ typedef struct {
   FILE *tile_file;          // File with tiles stored contiguously.
   GString *tile_file_name;  // Name of the tile file
   int reference_count;      // For optional reference counting.
+  // Memory mapped source file that tiles are read from instead of
+  // from a tile file (see float_image_new_from_file_mapped), if any.
+  void *map_address;        // Start of the mapping, or NULL.
+  size_t map_length;        // Length of the mapping in bytes.
+  const float *map_pixels;  // First image pixel in the mapping.
+  gboolean map_swap;        // True iff mapped pixels need byte swapping.
+  // Shared tile cache used while in concurrent read mode, or NULL.
+  struct float_image_concurrent_cache *concurrent;
 } FloatImage;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -133,6 +143,18 @@ float_image_new_from_file_pointer (ssize_t size_x, ssize_t size_y,
                    FILE *file_pointer, off_t offset,
                    float_image_byte_order_t byte_order);
 
+// This method is like new_from_file, but instead of copying the whole
+// image into a temporary tile file up front, the file is memory mapped
+// and tiles are copied (and byte swapped if necessary) straight out of
+// it as they are needed.  The file itself is never modified: if the
+// image is changed, it is first copied into a tile file in the usual
+// way.  On platforms without mmap, or if the file can't be mapped,
+// this method just falls back on new_from_file.
+FloatImage *
+float_image_new_from_file_mapped (ssize_t size_x, ssize_t size_y,
+                                  const char *file, off_t offset,
+                                  float_image_byte_order_t byte_order);
+
 // Form a low quality reduced resolution version of the
 // original_size_x by original_size_y image in file.  The new image
 // will be size_x by size_y pixels.  This method is like new_from_file
@@ -148,7 +170,8 @@ float_image_new_from_file_scaled (ssize_t size_x, ssize_t size_y,
                   float_image_byte_order_t byte_order);
 
 // The function that does it all, generating an instance of FloatImage
-// from a file and the metadata
+// from a file and the metadata.  REAL32 images which don't need
+// converting from decibels are read using new_from_file_mapped.
 FloatImage *
 float_image_new_from_metadata(meta_parameters *meta, const char *file);
 
@@ -326,6 +349,24 @@ float
 float_image_sample (FloatImage *self, float x, float y,
             float_image_sample_method_t sample_method);
 
+// Sample the image at the count points (x[ii], y[ii]), putting the
+// results in out[ii].  The results are the same as those of
+// float_image_sample (the bicubic ones to within float rounding), but
+// the tile holding each point is only looked up (or pinned, in
+// concurrent read mode) when it differs from the one holding the
+// point before, and the interpolation weights are worked out directly
+// instead of through general purpose splines.  So this is much faster
+// for runs of nearby points, like the input points for an output row
+// of a geocoding or resampling.  The points must lie in the image, as
+// for float_image_sample.  The coordinates are doubles for the
+// convenience of callers, but are rounded to float first, just as
+// they would be by a call to float_image_sample.
+void
+float_image_sample_row (FloatImage *self, size_t count, const double *x,
+                        const double *y,
+                        float_image_sample_method_t sample_method,
+                        float *out);
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Comparing Images
@@ -503,6 +544,59 @@ float_image_get_cache_size (FloatImage *self);
 void
 float_image_set_cache_size (FloatImage *self, size_t size);
 
+// Get the memory cache size given to new instances, in bytes.
+size_t
+float_image_get_default_cache_size (void);
+
+// Set the memory cache size given to new instances to size bytes.
+// The compiled in default is 16 megabytes.  Images small enough to fit
+// entirely in the cache are simply kept in memory.  Remember that the
+// cache is allocated for every image instantiated.
+void
+float_image_set_default_cache_size (size_t size);
+
+// Set the default cache size to fraction of the physical memory in the
+// machine, and return the new default.  If the amount of physical
+// memory can't be determined, the default is left alone.
+size_t
+float_image_set_default_cache_size_from_ram (double fraction);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Concurrent Read Access
+//
+// An instance can be switched into a read-only mode in which any
+// number of threads may call the get_pixel, get_region, get_row,
+// get_pixel_with_reflection, apply_kernel and sample methods on it at
+// the same time.  No method which modifies the image may be called
+// while in this mode.
+//
+// In concurrent mode a separate tile cache is used.  It is split into
+// shards (tiles are assigned to shards round robin in the usual
+// flattened tile order), each protected by its own lock which is only
+// taken when a tile has to be loaded.  Readers of tiles already in the
+// cache never take a lock: they pin the tile by bumping its pin count,
+// and a tile is only displaced from the cache when nobody has it
+// pinned.  Pixel lookups which hit the cache therefore never wait on a
+// tile load, even one happening in the same shard.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Put self into concurrent read mode, using a tile cache of
+// cache_space bytes, which is shared by all the reading threads.  If
+// cache_space is 0, the normal per image cache size is used, which is
+// probably too small when lots of threads are reading from different
+// parts of the image.  Any modified tiles in the normal cache are
+// written to the tile file first, so this method may not be cheap.
+void
+float_image_begin_concurrent_reads (FloatImage *self, size_t cache_space);
+
+// Return self to normal (single threaded, read-write) mode, freeing
+// the concurrent tile cache.  No other thread may be accessing self
+// when this method is called.
+void
+float_image_end_concurrent_reads (FloatImage *self);
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Reference Counting or Freeing Instances
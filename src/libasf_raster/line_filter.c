@@ -0,0 +1,91 @@
+// Line-local processing stages that are applied to their input as the
+// next stage reads it, instead of writing a whole output image.  See
+// asf_raster.h.
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_raster.h"
+
+LineFilter *line_filter_new(const char *in_file, meta_parameters *meta,
+                            line_filter_func *func, void *data,
+                            void (*free_data)(void *data))
+{
+  LineFilter *self = MALLOC(sizeof(LineFilter));
+  self->in_file = appendExt(in_file, ".img");
+  self->in_meta = meta_read(in_file);
+  self->meta = meta_copy(meta);
+  self->func = func;
+  self->data = data;
+  self->free_data = free_data;
+  return self;
+}
+
+void line_filter_get_line(LineFilter *self, FILE *fp, int band, int line,
+                          float *buf)
+{
+  get_band_float_line(fp, self->in_meta, band, line, buf);
+  self->func(self->data, band, line, buf);
+}
+
+FloatImage *line_filter_band_float_image(LineFilter *self, int band)
+{
+  int nl = self->meta->general->line_count;
+  int ns = self->meta->general->sample_count;
+  int db = self->meta->general->radiometry >= r_SIGMA_DB &&
+    self->meta->general->radiometry <= r_GAMMA_DB;
+  int ii, jj;
+
+  // Same as float_image_band_new_from_metadata, but the lines go
+  // through the filter on the way in.
+  FILE *fp = FOPEN(self->in_file, "rb");
+  FloatImage *fi = float_image_new(ns, nl);
+  float *buf = MALLOC(sizeof(float)*ns);
+  for (ii=0; ii<nl; ++ii) {
+    line_filter_get_line(self, fp, band, ii, buf);
+    for (jj=0; jj<ns; ++jj)
+      float_image_set_pixel(fi, jj, ii, db ? pow(10, buf[jj]/10.0) : buf[jj]);
+    asfPercentMeter((float)ii/(float)(nl-1));
+  }
+  FREE(buf);
+  FCLOSE(fp);
+
+  return fi;
+}
+
+int line_filter_store(LineFilter *self, const char *file)
+{
+  int nl = self->meta->general->line_count;
+  int ns = self->meta->general->sample_count;
+  int b, ii;
+
+  char *img = appendExt(file, ".img");
+  FILE *fpIn = FOPEN(self->in_file, "rb");
+  FILE *fpOut = FOPEN(img, "wb");
+  float *buf = MALLOC(sizeof(float)*ns);
+  for (b=0; b<self->meta->general->band_count; ++b) {
+    for (ii=0; ii<nl; ++ii) {
+      line_filter_get_line(self, fpIn, b, ii, buf);
+      put_band_float_line(fpOut, self->meta, b, ii, buf);
+      asfLineMeter(ii, nl);
+    }
+  }
+  FREE(buf);
+  FCLOSE(fpIn);
+  FCLOSE(fpOut);
+  FREE(img);
+
+  meta_write(self->meta, file);
+  return 0;
+}
+
+void line_filter_free(LineFilter *self)
+{
+  if (self) {
+    if (self->free_data)
+      self->free_data(self->data);
+    FREE(self->in_file);
+    meta_free(self->in_meta);
+    meta_free(self->meta);
+    FREE(self);
+  }
+}
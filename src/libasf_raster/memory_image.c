@@ -0,0 +1,97 @@
+// Whole images kept in memory, so that processing stages can hand their
+// results to each other without writing and re-reading temporary files.
+// See asf_raster.h.
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_raster.h"
+
+static size_t sample_size(data_type_t data_type)
+{
+  switch (data_type) {
+    case ASF_BYTE:          return 1;
+    case INTEGER16:         return 2;
+    case INTEGER32:         return 4;
+    case REAL32:            return 4;
+    case REAL64:            return 8;
+    case COMPLEX_BYTE:      return 2;
+    case COMPLEX_INTEGER16: return 4;
+    case COMPLEX_INTEGER32: return 8;
+    case COMPLEX_REAL32:    return 8;
+    case COMPLEX_REAL64:    return 16;
+    default:
+      asfPrintError("memory_image: Unexpected data type: %d\n", data_type);
+      return 0;
+  }
+}
+
+static size_t pixel_count(const meta_parameters *meta)
+{
+  return (size_t)meta->general->band_count * meta->general->line_count *
+    meta->general->sample_count;
+}
+
+size_t memory_image_bytes(const meta_parameters *meta)
+{
+  return pixel_count(meta) * sizeof(float);
+}
+
+size_t memory_image_file_bytes(const meta_parameters *meta)
+{
+  return pixel_count(meta) * sample_size(meta->general->data_type);
+}
+
+MemoryImage *memory_image_new(meta_parameters *meta)
+{
+  MemoryImage *self = MALLOC(sizeof(MemoryImage));
+  self->meta = meta_copy(meta);
+  self->data = CALLOC(pixel_count(meta), sizeof(float));
+  return self;
+}
+
+MemoryImage *memory_image_new_from_file(const char *file)
+{
+  meta_parameters *meta = meta_read(file);
+  MemoryImage *self = memory_image_new(meta);
+  int nl = meta->general->line_count;
+  int b;
+
+  FILE *fp = fopenImage(file, "rb");
+  for (b=0; b<meta->general->band_count; ++b)
+    get_band_float_lines(fp, meta, b, 0, nl, memory_image_line(self, b, 0));
+  FCLOSE(fp);
+
+  meta_free(meta);
+  return self;
+}
+
+float *memory_image_line(MemoryImage *self, int band, int line)
+{
+  size_t ns = self->meta->general->sample_count;
+  size_t nl = self->meta->general->line_count;
+  return self->data + ((size_t)band*nl + line)*ns;
+}
+
+int memory_image_store(MemoryImage *self, const char *file)
+{
+  int nl = self->meta->general->line_count;
+  int b;
+
+  meta_write(self->meta, file);
+  FILE *fp = fopenImage(file, "wb");
+  for (b=0; b<self->meta->general->band_count; ++b)
+    put_band_float_lines(fp, self->meta, b, 0, nl,
+                         memory_image_line(self, b, 0));
+  FCLOSE(fp);
+
+  return 0;
+}
+
+void memory_image_free(MemoryImage *self)
+{
+  if (self) {
+    meta_free(self->meta);
+    FREE(self->data);
+    FREE(self);
+  }
+}
@@ -3,244 +3,704 @@
 #include "asf_raster.h"
 #include "expression.h"
 #include <ctype.h>
+#include <glib.h>
 
 #define VERSION 2.0
 #define MAXIMGS 20
 
-char *expression2cookie(const char *expr, int nvars)
+// Expressions are made of:
+//   numbers, and the constants pi and nodata
+//   a, b, c, ...  the pixel values of the first, second, third, ...
+//                 input image
+//   x, y          the sample and line of the pixel
+//   + - * / % ^   arithmetic (% being a modulus that is never negative
+//                 for a positive divisor; division or modulus by zero
+//                 gives the left hand side unchanged)
+//   < <= > >= == != && || !
+//                 comparisons and logic, giving 1 for true, 0 for false
+//   log10(v) log(v) exp(v) sqrt(v) abs(v) floor(v) sin(v) cos(v)
+//   atan2(v,w) min(v,w) max(v,w)
+//   where(c,v,w)  v where c is true (not 0), w elsewhere; if() is the
+//                 same thing
+// with the usual precedence, ^ being left associative.  Quotes around
+// the expression (as left behind by shell quoting) are ignored.
+//
+// Where any of the images used by the expression has its no data value,
+// so does the output, and the nodata constant is that value.
+//
+// The expression is compiled into a program for a little machine whose
+// registers are runs of CALC_SEGMENT pixels, so that each instruction
+// is a simple loop over a stretch of a row -- the dispatch on the
+// operator happens once per stretch, not once per pixel.
+
+#define CALC_SEGMENT 512
+
+typedef enum {
+  CALC_CONST, CALC_VAR, CALC_X, CALC_Y,
+  CALC_ADD, CALC_SUB, CALC_MUL, CALC_DIV, CALC_MOD, CALC_POW,
+  CALC_LT, CALC_LE, CALC_GT, CALC_GE, CALC_EQ, CALC_NE, CALC_AND, CALC_OR,
+  CALC_NEG, CALC_NOT,
+  CALC_LOG10, CALC_LOG, CALC_EXP, CALC_SQRT, CALC_ABS, CALC_FLOOR,
+  CALC_SIN, CALC_COS, CALC_ATAN2, CALC_MIN, CALC_MAX,
+  CALC_WHERE
+} calc_op;
+
+static const struct {
+  const char *name;
+  calc_op op;
+  int nargs;
+} calc_functions[] = {
+  { "log10", CALC_LOG10, 1 },
+  { "log", CALC_LOG, 1 },
+  { "exp", CALC_EXP, 1 },
+  { "sqrt", CALC_SQRT, 1 },
+  { "abs", CALC_ABS, 1 },
+  { "floor", CALC_FLOOR, 1 },
+  { "sin", CALC_SIN, 1 },
+  { "cos", CALC_COS, 1 },
+  { "atan2", CALC_ATAN2, 2 },
+  { "min", CALC_MIN, 2 },
+  { "max", CALC_MAX, 2 },
+  { "where", CALC_WHERE, 3 },
+  { "if", CALC_WHERE, 3 },
+};
+
+// The parsed expression
+typedef struct calc_node {
+  calc_op op;
+  double val;                   // CALC_CONST
+  int var;                      // CALC_VAR
+  struct calc_node *arg[3];
+} calc_node;
+
+// An instruction: dst = op(a, b, c), all registers
+typedef struct {
+  calc_op op;
+  int dst, a, b, c;
+  int var;
+  double val;
+} calc_instr;
+
+struct calc_program {
+  calc_instr *code;
+  int n_code;
+  int n_regs;
+  int nvars;
+  int uses_var[MAXIMGS];
+  int uses_nodata;
+  int nodata_set;
+  double var_nodata[MAXIMGS];
+  double nodata;
+};
+
+// Carry out one instruction for n pixels, starting at sample x0.
+static void calc_instr_run(const calc_instr *in, double *regs,
+                           const float **vars, int x0, int y, int n)
 {
-  token **outputStack = (token **) MALLOC(200*sizeof(token));
-  int outputPtr = 0;
-  token **operandStack = (token **)MALLOC(200*sizeof(token));
-  int operandPtr = 0;
-  
-  token *next;
-  if (expressionMalformed(expr,nvars))
-    return NULL;
-  setTokenExpression(expr);
-  while (NULL != (next = nextToken())) {
-    if (next->type == tokOperator) {
-      if (next->op == ')') {
-	while (operandStack[operandPtr-1]->op != '(')
-	  outputStack[outputPtr++] = operandStack[--operandPtr];
-	operandPtr--; // Pop off (
-      }
-      else {
-	int precedence=0;
-	if (operandPtr-1 >= 0 && operandStack[operandPtr-1]->op != '(')
-	  precedence = operandStack[operandPtr-1]->precedence;
-	if (next->precedence <= precedence)
-	  outputStack[outputPtr++] = operandStack[--operandPtr]; 
-	operandStack[operandPtr++] = next;
+  double *d = regs + in->dst*CALC_SEGMENT;
+  const double *a = regs + in->a*CALC_SEGMENT;
+  const double *b = regs + in->b*CALC_SEGMENT;
+  const double *c = regs + in->c*CALC_SEGMENT;
+  int ii;
+
+  switch (in->op) {
+    case CALC_CONST:
+      for (ii=0; ii<n; ++ii) d[ii] = in->val;
+      break;
+    case CALC_VAR: {
+      const float *v = vars[in->var] + x0;
+      for (ii=0; ii<n; ++ii) d[ii] = v[ii];
+      break;
+    }
+    case CALC_X:
+      for (ii=0; ii<n; ++ii) d[ii] = x0 + ii;
+      break;
+    case CALC_Y:
+      for (ii=0; ii<n; ++ii) d[ii] = y;
+      break;
+    case CALC_ADD:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] + b[ii];
+      break;
+    case CALC_SUB:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] - b[ii];
+      break;
+    case CALC_MUL:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] * b[ii];
+      break;
+    case CALC_DIV:
+      for (ii=0; ii<n; ++ii) d[ii] = b[ii] == 0 ? a[ii] : a[ii] / b[ii];
+      break;
+    case CALC_MOD:
+      for (ii=0; ii<n; ++ii) {
+        if (b[ii] == 0)
+          d[ii] = a[ii];
+        else {
+          double mod = fmod(a[ii], b[ii]);
+          d[ii] = mod < 0 ? mod + b[ii] : mod;
+        }
       }
-    } 
-    else // Just push variables and constants.
-      outputStack[outputPtr++] = next;
+      break;
+    case CALC_POW:
+      for (ii=0; ii<n; ++ii) d[ii] = pow(a[ii], b[ii]);
+      break;
+    case CALC_LT:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] < b[ii];
+      break;
+    case CALC_LE:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] <= b[ii];
+      break;
+    case CALC_GT:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] > b[ii];
+      break;
+    case CALC_GE:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] >= b[ii];
+      break;
+    case CALC_EQ:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] == b[ii];
+      break;
+    case CALC_NE:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] != b[ii];
+      break;
+    case CALC_AND:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] != 0 && b[ii] != 0;
+      break;
+    case CALC_OR:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] != 0 || b[ii] != 0;
+      break;
+    case CALC_NEG:
+      for (ii=0; ii<n; ++ii) d[ii] = -a[ii];
+      break;
+    case CALC_NOT:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] == 0;
+      break;
+    case CALC_LOG10:
+      for (ii=0; ii<n; ++ii) d[ii] = log10(a[ii]);
+      break;
+    case CALC_LOG:
+      for (ii=0; ii<n; ++ii) d[ii] = log(a[ii]);
+      break;
+    case CALC_EXP:
+      for (ii=0; ii<n; ++ii) d[ii] = exp(a[ii]);
+      break;
+    case CALC_SQRT:
+      for (ii=0; ii<n; ++ii) d[ii] = sqrt(a[ii]);
+      break;
+    case CALC_ABS:
+      for (ii=0; ii<n; ++ii) d[ii] = fabs(a[ii]);
+      break;
+    case CALC_FLOOR:
+      for (ii=0; ii<n; ++ii) d[ii] = floor(a[ii]);
+      break;
+    case CALC_SIN:
+      for (ii=0; ii<n; ++ii) d[ii] = sin(a[ii]);
+      break;
+    case CALC_COS:
+      for (ii=0; ii<n; ++ii) d[ii] = cos(a[ii]);
+      break;
+    case CALC_ATAN2:
+      for (ii=0; ii<n; ++ii) d[ii] = atan2(a[ii], b[ii]);
+      break;
+    case CALC_MIN:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] < b[ii] ? a[ii] : b[ii];
+      break;
+    case CALC_MAX:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] > b[ii] ? a[ii] : b[ii];
+      break;
+    case CALC_WHERE:
+      for (ii=0; ii<n; ++ii) d[ii] = a[ii] != 0 ? b[ii] : c[ii];
+      break;
   }
-  while (operandPtr != 0)
-    outputStack[outputPtr++] = operandStack[--operandPtr];
-  outputStack[outputPtr++] = NULL;
-  return (char *) outputStack;
 }
 
-double evaluate(char *cookie,const double *variables)
+// Parser: a recursive descent over the expression, one function per
+// precedence level, building calc_nodes.
+
+typedef struct {
+  const char *expr;
+  const char *p;
+  int nvars;
+  int error;
+  int uses_nodata;
+} calc_parser;
+
+static calc_node *calc_node_new(calc_op op, calc_node *a, calc_node *b,
+                                calc_node *c)
+{
+  calc_node *node = CALLOC(1, sizeof(calc_node));
+  node->op = op;
+  node->arg[0] = a;
+  node->arg[1] = b;
+  node->arg[2] = c;
+  return node;
+}
+
+static void calc_node_free(calc_node *node)
 {
-  token **tokenStack = (token **) cookie;
-  double evalStack[100] = {0.0,0.0,0.0};
-  int evalPtr = 2;
-  while (*tokenStack) {
-    evalStack[evalPtr] = (*tokenStack)->eval(
-      (void *)*tokenStack,variables,evalStack[evalPtr-2],evalStack[evalPtr-1]);
-    if ((*tokenStack++)->type == tokOperator) {
-      evalStack[evalPtr-2] = evalStack[evalPtr];
-      evalPtr--;
-    } 
-    else 
-      evalPtr++;
+  if (node) {
+    calc_node_free(node->arg[0]);
+    calc_node_free(node->arg[1]);
+    calc_node_free(node->arg[2]);
+    FREE(node);
   }
-  return evalStack[evalPtr-1];
 }
 
-// Check the number of parenthesis and other validity of expression.
-int expressionMalformed(const char *expr, int nvars)
+static int calc_node_nargs(calc_op op)
 {
-  int i,strln = strlen(expr);
-  int nParens;
-  // Check for empty expressions.
-  if (strln == 0 || (strln == 1 && expr[0] == '\n')) {
-      printf("The empty string is not an expression.\n");
-      return 1; 
-  } 
-  for  (i=1; i<strln; i++)
-    if (expr[i-1] == '(' && expr[i] == ')') {
-      printf("() means nothing to me.\n");
+  switch (op) {
+    case CALC_CONST: case CALC_VAR: case CALC_X: case CALC_Y:
+      return 0;
+    case CALC_NEG: case CALC_NOT: case CALC_LOG10: case CALC_LOG:
+    case CALC_EXP: case CALC_SQRT: case CALC_ABS: case CALC_FLOOR:
+    case CALC_SIN: case CALC_COS:
       return 1;
+    case CALC_WHERE:
+      return 3;
+    default:
+      return 2;
+  }
+}
+
+// An operator node, folded into a constant when all its arguments are
+// constants.  The folding runs the same instruction as the program
+// would, so the results are the same either way.
+static calc_node *calc_op_node(calc_op op, calc_node *a, calc_node *b,
+                               calc_node *c)
+{
+  calc_node *node = calc_node_new(op, a, b, c);
+  int ii, nargs = calc_node_nargs(op);
+  for (ii=0; ii<nargs; ++ii)
+    if (!node->arg[ii] || node->arg[ii]->op != CALC_CONST ||
+        node->arg[ii]->var == -1)
+      return node;
+
+  double regs[4*CALC_SEGMENT];
+  calc_instr in = { op, 3, 0, 1, 2, 0, 0 };
+  for (ii=0; ii<nargs; ++ii)
+    regs[ii*CALC_SEGMENT] = node->arg[ii]->val;
+  calc_instr_run(&in, regs, NULL, 0, 0, 1);
+  for (ii=0; ii<nargs; ++ii) {
+    calc_node_free(node->arg[ii]);
+    node->arg[ii] = NULL;
+  }
+  node->op = CALC_CONST;
+  node->val = regs[3*CALC_SEGMENT];
+  return node;
+}
+
+static void calc_skip_space(calc_parser *ps)
+{
+  // quotes are left over from quoting the expression for the shell
+  while (*ps->p && (isspace((unsigned char)*ps->p) || *ps->p == '\'' ||
+                    *ps->p == '"'))
+    ps->p++;
+}
+
+static void calc_syntax_error(calc_parser *ps, const char *what)
+{
+  if (!ps->error) {
+    printf("%s in the expression '%s' at '%s'.\n", what, ps->expr,
+           *ps->p ? ps->p : "the end");
+    ps->error = TRUE;
+  }
+}
+
+// Consumes the operator op, if it comes next.
+static int calc_accept(calc_parser *ps, const char *op)
+{
+  calc_skip_space(ps);
+  size_t len = strlen(op);
+  if (strncmp(ps->p, op, len) != 0)
+    return FALSE;
+  // don't take "<" from "<=", and so on
+  if (len == 1 && ps->p[1] == '=' && strchr("<>=!", op[0]))
+    return FALSE;
+  ps->p += len;
+  return TRUE;
+}
+
+static calc_node *calc_parse_expr(calc_parser *ps);
+static calc_node *calc_parse_unary(calc_parser *ps);
+
+static calc_node *calc_parse_primary(calc_parser *ps)
+{
+  calc_skip_space(ps);
+  const char *start = ps->p;
+
+  if (calc_accept(ps, "(")) {
+    calc_node *node = calc_parse_expr(ps);
+    if (!calc_accept(ps, ")"))
+      calc_syntax_error(ps, "Missing ')'");
+    return node;
+  }
+
+  if (isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+    // the number is scanned by hand so that strtod() does not take,
+    // say, "0x1" as hexadecimal
+    const char *q = ps->p;
+    while (isdigit((unsigned char)*q)) q++;
+    if (*q == '.') {
+      q++;
+      while (isdigit((unsigned char)*q)) q++;
     }
-  // Check for the correct number of parenthesis.
-  nParens = 0;
-  for (i=0; i<strln; i++) {
-    if (expr[i] == '(')
-      nParens++;
-    else if (expr[i] == ')')
-      nParens--;
-    if (nParens < 0) {
-      printf("The parenthesis do not match properly.\n");
-      return 1;
+    if ((*q == 'e' || *q == 'E') &&
+        (isdigit((unsigned char)q[1]) ||
+         ((q[1] == '-' || q[1] == '+') && isdigit((unsigned char)q[2])))) {
+      q += 2;
+      while (isdigit((unsigned char)*q)) q++;
     }
+    char *num = g_strndup(ps->p, q - ps->p);
+    calc_node *node = calc_node_new(CALC_CONST, NULL, NULL, NULL);
+    node->val = g_ascii_strtod(num, NULL);
+    g_free(num);
+    ps->p = q;
+    return node;
   }
-  if (nParens != 0) {
-    printf("Your parenthesis do not match.\n");
-    return 1;
-  }
-  // Check to make sure all our variables are the right ones.
-  for (i=0; i<strln; i++)
-    if (isalpha(expr[i]))
-      if (tolower(expr[i])-'a' >= nvars &&
-	  tolower(expr[i]) != 'x' &&
-	  tolower(expr[i]) != 'y') {
-	printf("The variable '%c' is undefined.\n",expr[i]);
-	return 1;
+
+  if (isalpha((unsigned char)*ps->p)) {
+    const char *q = ps->p;
+    while (isalnum((unsigned char)*q) || *q == '_') q++;
+    char *name = g_ascii_strdown(ps->p, q - ps->p);
+    ps->p = q;
+    calc_node *node = NULL;
+
+    if (strlen(name) == 1) {
+      if (name[0] == 'x')
+        node = calc_node_new(CALC_X, NULL, NULL, NULL);
+      else if (name[0] == 'y')
+        node = calc_node_new(CALC_Y, NULL, NULL, NULL);
+      else if (name[0] - 'a' < ps->nvars && name[0] - 'a' < MAXIMGS) {
+        node = calc_node_new(CALC_VAR, NULL, NULL, NULL);
+        node->var = name[0] - 'a';
+      }
+      else {
+        ps->p = start;
+        calc_syntax_error(ps, "Undefined variable");
       }
-  // Check to make sure we never have two operators in a row.
-  for (i=1; i<strln; i++)
-    if (ispunct(expr[i-1]) && ispunct(expr[i]) &&
-	expr[i-1] != '(' && expr[i-1] != ')' &&
-	expr[i] != '(' && expr[i] != ')') {
-      printf("The characters %c and %c don't look right together.\n",
-	     expr[i-1], expr[i]);
-      return 1;
     }
-  // Check to make sure we never have two operands in a row.
-  for (i=1; i<strln; i++)
-    if (isalpha(expr[i-1]) && isalpha(expr[i])) {
-      printf("The characters %c and %c don't look right together.\n",
-	     expr[i-1], expr[i]);
-      return 1;
+    else if (strcmp(name, "pi") == 0) {
+      node = calc_node_new(CALC_CONST, NULL, NULL, NULL);
+      node->val = M_PI;
+    }
+    else if (strcmp(name, "nodata") == 0) {
+      // not a constant as far as folding goes, it isn't known yet
+      node = calc_node_new(CALC_CONST, NULL, NULL, NULL);
+      node->var = -1;
+      ps->uses_nodata = TRUE;
     }
-  return 0;
+    else {
+      int ii, nargs = 0;
+      for (ii=0; ii<(int)G_N_ELEMENTS(calc_functions); ++ii)
+        if (strcmp(name, calc_functions[ii].name) == 0)
+          break;
+      if (ii == (int)G_N_ELEMENTS(calc_functions)) {
+        ps->p = start;
+        calc_syntax_error(ps, "Unknown function");
+      }
+      else if (!calc_accept(ps, "(")) {
+        calc_syntax_error(ps, "Missing '(' after a function name");
+      }
+      else {
+        calc_node *args[3] = { NULL, NULL, NULL };
+        for (nargs=0; nargs<calc_functions[ii].nargs; ++nargs) {
+          if (nargs > 0 && !calc_accept(ps, ","))
+            break;
+          args[nargs] = calc_parse_expr(ps);
+        }
+        if (nargs != calc_functions[ii].nargs || !calc_accept(ps, ")")) {
+          ps->p = start;
+          calc_syntax_error(ps, "Wrong number of arguments");
+        }
+        node = calc_op_node(calc_functions[ii].op, args[0], args[1], args[2]);
+      }
+    }
+    g_free(name);
+    return node;
+  }
+
+  calc_syntax_error(ps, *ps->p ? "Unexpected character" :
+                    "Unexpected end");
+  return NULL;
 }
 
-/* Evaluation functions:*/
-#define EVALFUNC(name) double name(const void *tok,const double *vars,double a, double b); \
-  double name(const void *tok,const double *vars,double a, double b)
-EVALFUNC(addOp) { return a+b;}
-EVALFUNC(subOp) { return a-b;}
-EVALFUNC(mulOp) { return a*b;}
-EVALFUNC(divOp) { if (b == 0) return a; return a/b;}
-EVALFUNC(modOp)
+static calc_node *calc_parse_power(calc_parser *ps)
 {
-  double mod;
-  if (b == 0) 
-    return a;
-  mod = fmod(a,b);
-  if (mod < 0)
-    mod += b;
-  return mod;
+  calc_node *node = calc_parse_primary(ps);
+  while (!ps->error && calc_accept(ps, "^")) {
+    // allows for 2^-1
+    calc_node *rhs = calc_parse_unary(ps);
+    node = calc_op_node(CALC_POW, node, rhs, NULL);
+  }
+  return node;
 }
-EVALFUNC(powOp){return pow(a,b);}
-EVALFUNC(valOp)
+
+static calc_node *calc_parse_unary(calc_parser *ps)
 {
-  return ((token *)tok)->val;
+  if (calc_accept(ps, "-"))
+    return calc_op_node(CALC_NEG, calc_parse_unary(ps), NULL, NULL);
+  if (calc_accept(ps, "+"))
+    return calc_parse_unary(ps);
+  if (calc_accept(ps, "!"))
+    return calc_op_node(CALC_NOT, calc_parse_unary(ps), NULL, NULL);
+  return calc_parse_power(ps);
 }
-EVALFUNC(varOp)
+
+static calc_node *calc_parse_product(calc_parser *ps)
 {
-  return vars[((token *)tok)->index];
+  calc_node *node = calc_parse_unary(ps);
+  while (!ps->error) {
+    calc_op op;
+    if (calc_accept(ps, "*")) op = CALC_MUL;
+    else if (calc_accept(ps, "/")) op = CALC_DIV;
+    else if (calc_accept(ps, "%")) op = CALC_MOD;
+    else break;
+    node = calc_op_node(op, node, calc_parse_unary(ps), NULL);
+  }
+  return node;
 }
 
-// Tokenizer Interface: Hacks up a string into
-// parts I call tokens-- these can be operators,
-// variables, or constants.
+static calc_node *calc_parse_sum(calc_parser *ps)
+{
+  calc_node *node = calc_parse_product(ps);
+  while (!ps->error) {
+    calc_op op;
+    if (calc_accept(ps, "+")) op = CALC_ADD;
+    else if (calc_accept(ps, "-")) op = CALC_SUB;
+    else break;
+    node = calc_op_node(op, node, calc_parse_product(ps), NULL);
+  }
+  return node;
+}
 
-char *currExpression;
-int expressionIndex,expressionLength; 
+static calc_node *calc_parse_comparison(calc_parser *ps)
+{
+  calc_node *node = calc_parse_sum(ps);
+  while (!ps->error) {
+    calc_op op;
+    if (calc_accept(ps, "<=")) op = CALC_LE;
+    else if (calc_accept(ps, ">=")) op = CALC_GE;
+    else if (calc_accept(ps, "==")) op = CALC_EQ;
+    else if (calc_accept(ps, "!=")) op = CALC_NE;
+    else if (calc_accept(ps, "<")) op = CALC_LT;
+    else if (calc_accept(ps, ">")) op = CALC_GT;
+    else break;
+    node = calc_op_node(op, node, calc_parse_sum(ps), NULL);
+  }
+  return node;
+}
 
-void setTokenExpression(const char *expr)
+static calc_node *calc_parse_and(calc_parser *ps)
 {
-  expressionLength = strlen(expr);
-  currExpression = (char *) CALLOC(expressionLength+1, sizeof(char));
-  strcpy(currExpression,expr);
-  expressionIndex = 0;
+  calc_node *node = calc_parse_comparison(ps);
+  while (!ps->error && calc_accept(ps, "&&"))
+    node = calc_op_node(CALC_AND, node, calc_parse_comparison(ps), NULL);
+  return node;
 }
 
-token *nextToken(void)
+static calc_node *calc_parse_expr(calc_parser *ps)
 {
-  int index = expressionIndex;
-  token *t;
-  int c;
-  /*Skip over white space.*/
-  while (index < expressionLength &&
-	 ((currExpression[index] == ' ')||
-	  (currExpression[index] == '\t')||
-	  (currExpression[index] == '\n')))
-    index++;
-  /*Parse the next token, if any:*/
-  if (!(index<expressionLength))
-    {
-      expressionIndex = index;
-      return NULL;
-    }
-  t = (token *)MALLOC(sizeof(token));
-  c = currExpression[index++];
-  t->type = tokOperator;
-  t->op = c;
-  switch (c)
-    {
-    case '+':
-      t->eval = addOp; t->precedence = 1; 
-      break;
-    case '-':
-      t->eval = subOp; t->precedence = 1; 
-      break;
-    case '*':
-      t->eval = mulOp; t->precedence = 2;
-      break;
-    case '/':
-      t->eval = divOp; t->precedence = 2;
-      break;
-    case '%':
-      t->eval = modOp; t->precedence = 2;
-      break;
-    case '^':
-      t->eval = powOp; t->precedence = 3;
-      break;
-    case '(':
-      t->precedence = 10; 
-      break;
-    case ')':
-      t->precedence = 10;
-      break;
-    default:
-      if (isdigit(c)) { // This is a constant.
-	t->type = tokConstant;
-	t->eval = valOp;
-	sscanf(&currExpression[--index], "%lf", &t->val);
-	while (isdigit(currExpression[index]) || currExpression[index] == '.')
-	  index++;
-      }
-      else if (isalpha(c)) { // This is a variable.
-	t->type = tokVariable;
-	t->eval = varOp;
-	t->index = tolower(c)-'a';
-      } 
-      else {
-	printf("Unrecognized symbol '%c'\n", c);
-	free(t);
-	return NULL;
+  calc_node *node = calc_parse_and(ps);
+  while (!ps->error && calc_accept(ps, "||"))
+    node = calc_op_node(CALC_OR, node, calc_parse_and(ps), NULL);
+  return node;
+}
+
+// Compiles node into code that leaves its value in register reg, using
+// only the registers from reg up.
+static void calc_compile(calc_program *prog, const calc_node *node, int reg)
+{
+  int ii, nargs = calc_node_nargs(node->op);
+  for (ii=0; ii<nargs; ++ii)
+    calc_compile(prog, node->arg[ii], reg+ii);
+
+  calc_instr *in = &prog->code[prog->n_code++];
+  in->op = node->op;
+  in->dst = reg;
+  in->a = reg;
+  in->b = nargs > 1 ? reg+1 : reg;
+  in->c = nargs > 2 ? reg+2 : reg;
+  in->var = node->var;
+  in->val = node->val;
+  if (node->op == CALC_VAR)
+    prog->uses_var[node->var] = TRUE;
+  if (reg + MAX(nargs, 1) > prog->n_regs)
+    prog->n_regs = reg + MAX(nargs, 1);
+}
+
+static int calc_node_count(const calc_node *node)
+{
+  return node ? 1 + calc_node_count(node->arg[0]) +
+    calc_node_count(node->arg[1]) + calc_node_count(node->arg[2]) : 0;
+}
+
+calc_program *calc_program_new(const char *expr, int nvars)
+{
+  calc_parser ps;
+  ps.expr = ps.p = expr;
+  ps.nvars = nvars;
+  ps.error = FALSE;
+  ps.uses_nodata = FALSE;
+
+  calc_node *root = calc_parse_expr(&ps);
+  calc_skip_space(&ps);
+  if (!ps.error && *ps.p)
+    calc_syntax_error(&ps, "Unexpected character");
+  if (ps.error) {
+    calc_node_free(root);
+    return NULL;
+  }
+
+  calc_program *prog = CALLOC(1, sizeof(calc_program));
+  prog->code = CALLOC(calc_node_count(root), sizeof(calc_instr));
+  prog->nvars = nvars;
+  prog->uses_nodata = ps.uses_nodata;
+  calc_compile(prog, root, 0);
+  calc_node_free(root);
+  return prog;
+}
+
+void calc_program_free(calc_program *prog)
+{
+  if (prog) {
+    FREE(prog->code);
+    FREE(prog);
+  }
+}
+
+int calc_program_uses_var(const calc_program *prog, int var)
+{
+  return var >= 0 && var < MAXIMGS && prog->uses_var[var];
+}
+
+int calc_program_uses_nodata(const calc_program *prog)
+{
+  return prog->uses_nodata;
+}
+
+void calc_program_set_nodata(calc_program *prog, const double *var_nodata,
+                             double out_nodata)
+{
+  int ii;
+  prog->nodata_set = TRUE;
+  prog->nodata = out_nodata;
+  for (ii=0; ii<prog->nvars && ii<MAXIMGS; ++ii)
+    prog->var_nodata[ii] = var_nodata[ii];
+  for (ii=0; ii<prog->n_code; ++ii)
+    if (prog->code[ii].op == CALC_CONST && prog->code[ii].var == -1)
+      prog->code[ii].val = out_nodata;
+}
+
+int calc_program_scratch_size(const calc_program *prog)
+{
+  return prog->n_regs*CALC_SEGMENT;
+}
+
+void calc_program_eval_row(const calc_program *prog, const float **vars,
+                           int ns, int y, double *scratch, float *out)
+{
+  int x0, ii, jj;
+  for (x0=0; x0<ns; x0+=CALC_SEGMENT) {
+    int n = MIN(CALC_SEGMENT, ns - x0);
+    for (ii=0; ii<prog->n_code; ++ii)
+      calc_instr_run(&prog->code[ii], scratch, vars, x0, y, n);
+    for (jj=0; jj<n; ++jj)
+      out[x0+jj] = scratch[jj];
+  }
+
+  if (prog->nodata_set) {
+    float nodata = prog->nodata;
+    for (ii=0; ii<prog->nvars && ii<MAXIMGS; ++ii) {
+      if (prog->uses_var[ii] && meta_is_valid_double(prog->var_nodata[ii])) {
+        float var_nodata = prog->var_nodata[ii];
+        for (jj=0; jj<ns; ++jj)
+          if (vars[ii][jj] == var_nodata)
+            out[jj] = nodata;
       }
     }
-  expressionIndex = index;
-  return t;
+  }
 }
 
-int raster_calc(char *outFile, char *expression, int input_count, 
+// Number of threads raster_calc evaluates the expression with; 0 means
+// one per processor.
+static int calc_thread_count = 0;
+
+void raster_calc_set_thread_count(int thread_count)
+{
+  calc_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+// The image is done a chunk of lines at a time: the lines of the chunk
+// are read from each of the inputs, blocks of CALC_BLOCK_LINES lines
+// are handed out to the threads, then the chunk is written out.
+#define CALC_BLOCK_LINES 16
+
+typedef struct {
+  const calc_program *prog;
+  int input_count;
+  int ns;
+  int first_line, n_lines;
+  float *inBuf[MAXIMGS];        // n_lines x each input's sample count
+  int in_ns[MAXIMGS];
+  float *outBuf;                // n_lines x ns
+  gint next_block;
+} calc_chunk;
+
+typedef struct {
+  calc_chunk *c;
+  double *scratch;
+} calc_worker;
+
+static gpointer calc_thread(gpointer data)
+{
+  calc_worker *w = data;
+  calc_chunk *c = w->c;
+  int first, ii, yy;
+
+  while ((first = g_atomic_int_add(&c->next_block, CALC_BLOCK_LINES))
+         < c->n_lines)
+  {
+    int last = MIN(first + CALC_BLOCK_LINES, c->n_lines);
+    for (yy=first; yy<last; ++yy) {
+      const float *vars[MAXIMGS];
+      for (ii=0; ii<c->input_count; ++ii)
+        vars[ii] = c->inBuf[ii] + (size_t)yy*c->in_ns[ii];
+      calc_program_eval_row(c->prog, vars, c->ns, c->first_line + yy,
+                            w->scratch, c->outBuf + (size_t)yy*c->ns);
+    }
+  }
+  return NULL;
+}
+
+static void calc_chunk_run(calc_chunk *c, calc_worker *workers,
+                           int n_threads)
+{
+  int ii;
+  int n_blocks = (c->n_lines + CALC_BLOCK_LINES - 1) / CALC_BLOCK_LINES;
+  if (n_threads > n_blocks) n_threads = n_blocks;
+
+  c->next_block = 0;
+  GThread **threads = g_new(GThread *, n_threads);
+  for (ii=0; ii<n_threads; ++ii)
+    workers[ii].c = c;
+  for (ii=1; ii<n_threads; ++ii)
+    threads[ii] = g_thread_new("raster_calc", calc_thread, &workers[ii]);
+  calc_thread(&workers[0]);
+  for (ii=1; ii<n_threads; ++ii)
+    g_thread_join(threads[ii]);
+  g_free(threads);
+}
+
+int raster_calc(char *outFile, char *expression, int input_count,
 		char **inFiles)
 {
-  int ii, xx, yy;
+  int ii, yy;
   meta_parameters *inMeta, *outMeta;
   meta_parameters *metas[MAXIMGS];
-  char *cookie;
-  float *inBuf[MAXIMGS], *outBuf;
+  calc_program *prog;
   FILE *fpIn[MAXIMGS], *fpOut;
+  double var_nodata[MAXIMGS];
+
+  if (input_count > MAXIMGS)
+    asfPrintError("raster_calc can take at most %d images.\n", MAXIMGS);
 
   inMeta = meta_read(inFiles[0]);
   int ns = inMeta->general->sample_count;
@@ -255,44 +715,82 @@ int raster_calc(char *outFile, char *expression, int input_count,
       if (tmpMeta->general->sample_count < inMeta->general->sample_count)
         ns = tmpMeta->general->sample_count;
     }
-    inBuf[ii] = (float*) MALLOC( sizeof(float)*tmpMeta->general->sample_count);
     metas[ii] = tmpMeta;
   }
+
+  prog = calc_program_new(expression, input_count);
+  if (NULL == prog)
+    exit(EXIT_FAILURE);
+
+  // the output's no data value is the first one of the inputs used that
+  // has one, 0 if none does but the expression uses nodata
   fpOut = fopenImage(outFile, "wb");
   outMeta = meta_copy(inMeta);
   outMeta->general->line_count = nl;
   outMeta->general->sample_count = ns;
+  outMeta->general->no_data = MAGIC_UNSET_DOUBLE;
+  for (ii=0; ii<input_count; ii++) {
+    var_nodata[ii] = metas[ii]->general->no_data;
+    if (calc_program_uses_var(prog, ii) &&
+        meta_is_valid_double(var_nodata[ii]) &&
+        !meta_is_valid_double(outMeta->general->no_data))
+      outMeta->general->no_data = var_nodata[ii];
+  }
+  if (calc_program_uses_nodata(prog) &&
+      !meta_is_valid_double(outMeta->general->no_data))
+    outMeta->general->no_data = 0;
+  calc_program_set_nodata(prog, var_nodata,
+                          meta_is_valid_double(outMeta->general->no_data) ?
+                          outMeta->general->no_data : 0);
   meta_write(outMeta, outFile);
 
-  outBuf = (float *) MALLOC(sizeof(float)*outMeta->general->sample_count);
-  cookie = expression2cookie(expression, input_count);
-  if (NULL == cookie)
-    exit(EXIT_FAILURE);
-  for (yy=0; yy<outMeta->general->line_count; yy++) {
-    double variables[26];
+  int n_threads = calc_thread_count > 0 ? calc_thread_count
+    : g_get_num_processors();
+  int chunk_lines = n_threads*CALC_BLOCK_LINES;
+  calc_chunk chunk;
+  calc_worker *workers = MALLOC(sizeof(calc_worker)*n_threads);
+  chunk.prog = prog;
+  chunk.input_count = input_count;
+  chunk.ns = ns;
+  for (ii=0; ii<input_count; ii++) {
+    chunk.in_ns[ii] = metas[ii]->general->sample_count;
+    chunk.inBuf[ii] = (float *) MALLOC(sizeof(float)*chunk.in_ns[ii]*
+                                       (size_t)chunk_lines);
+  }
+  chunk.outBuf = (float *) MALLOC(sizeof(float)*ns*(size_t)chunk_lines);
+  for (ii=0; ii<n_threads; ii++)
+    workers[ii].scratch =
+      MALLOC(sizeof(double)*calc_program_scratch_size(prog));
 
-    variables['y'-'a'] = yy;
+  for (yy=0; yy<nl; yy+=chunk_lines) {
+    chunk.first_line = yy;
+    chunk.n_lines = MIN(chunk_lines, nl - yy);
 
+    // only the images the expression uses need reading
     for (ii=0; ii<input_count; ii++)
-      get_float_line(fpIn[ii], metas[ii], yy, inBuf[ii]);
+      if (calc_program_uses_var(prog, ii))
+        get_float_lines(fpIn[ii], metas[ii], yy, chunk.n_lines,
+                        chunk.inBuf[ii]);
 
-    for (xx=0; xx<outMeta->general->sample_count; xx++) {
-      variables['x'-'a'] = xx;
-      for (ii=0; ii<input_count; ii++)
-        variables[ii] = inBuf[ii][xx];
-      outBuf[xx] = evaluate(cookie,variables);
-    }
-    put_float_line(fpOut, outMeta, yy, outBuf);
-    asfLineMeter(yy, outMeta->general->line_count);
+    calc_chunk_run(&chunk, workers, n_threads);
+
+    put_float_lines(fpOut, outMeta, yy, chunk.n_lines, chunk.outBuf);
+    for (ii=0; ii<chunk.n_lines; ii++)
+      asfLineMeter(yy + ii, nl);
   }
 
-  for (ii=0; ii<input_count; ++ii) { 
-    FREE(inBuf[ii]);
-    meta_free(metas[ii]); 
+  for (ii=0; ii<input_count; ++ii) {
+    FREE(chunk.inBuf[ii]);
+    meta_free(metas[ii]);
     FCLOSE(fpIn[ii]);
   }
+  for (ii=0; ii<n_threads; ii++)
+    FREE(workers[ii].scratch);
+  FREE(workers);
 
-  FREE(outBuf);
+  FREE(chunk.outBuf);
+  calc_program_free(prog);
+  meta_free(inMeta);
   meta_free(outMeta);
   FCLOSE(fpOut);
   return (0);
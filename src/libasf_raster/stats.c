@@ -390,6 +390,122 @@ calc_stats_from_file_ext(const char *inFile, char *band, double mask,
     *histogram = hist;
 }
 
+/* Like calc_stats_from_file, but in one pass over the band, and only
+   over every so many lines when the band has more than max_samples
+   pixels (max_samples <= 0 reads every line).  A few million samples
+   pin down the mean, standard deviation and histogram about as well as
+   the whole band does, so this is a cheap way to get the numbers for
+   the sigma and histogram scalings; the min and max of a sample may
+   miss the extremes, though.  Pass NULL for histogram if you don't
+   need one: when every line is read, the histogram takes a second pass,
+   since its range isn't known until the end of the first. */
+void
+calc_stats_from_file_sampled(const char *inFile, char *band, double mask,
+                             long long max_samples, double *min, double *max,
+                             double *mean, double *stdDev,
+                             gsl_histogram **histogram)
+{
+    meta_parameters *meta = meta_read(inFile);
+    int nl = meta->general->line_count;
+    int ns = meta->general->sample_count;
+    int band_number, ii, jj;
+
+    if (!band || strlen(band) == 0 || strcmp(band, "???") == 0 ||
+        meta->general->band_count == 1) {
+      band_number = 0;
+    }
+    else {
+      band_number = get_band_number(meta->general->bands,
+                                    meta->general->band_count, band);
+    }
+    long offset = (long)nl * band_number;
+
+    int line_step = 1;
+    if (max_samples > 0 && (long long)nl*ns > max_samples)
+      line_step = (int)(((long long)nl*ns + max_samples - 1) / max_samples);
+    int sampled = line_step > 1;
+
+    // Keep the sampled values for the histogram, so it doesn't need
+    // another read.
+    float *values = NULL;
+    long long n_values = 0;
+    if (histogram && sampled)
+      values = MALLOC(sizeof(float) * ((long long)(nl/line_step + 1) * ns));
+
+    float *data = MALLOC(sizeof(float) * ns);
+    long long pixel_count = 0;
+    double m = 0.0, s = 0.0;
+
+    *min = 999999;
+    *max = -999999;
+
+    // Welford's running mean and variance
+    FILE *fp = FOPEN(inFile, "rb");
+    if (sampled)
+      asfPrintStatus("\nCalculating statistics from one line in %d...\n",
+                     line_step);
+    else
+      asfPrintStatus("\nCalculating min, max, mean and standard deviation..."
+                     "\n");
+    for (ii=line_step/2; ii<nl; ii+=line_step) {
+        asfPercentMeter((double)ii/(double)nl);
+        get_float_line(fp, meta, ii + offset, data);
+
+        for (jj=0; jj<ns; ++jj) {
+          if (meta_is_valid_double(data[jj])) {
+            if (ISNAN(mask) || !FLOAT_EQUIVALENT(data[jj], mask)) {
+                double d = data[jj] - m;
+                if (data[jj] < *min) *min = data[jj];
+                if (data[jj] > *max) *max = data[jj];
+                ++pixel_count;
+                m += d / pixel_count;
+                s += d * (data[jj] - m);
+                if (values)
+                  values[n_values++] = data[jj];
+            }
+          }
+        }
+    }
+    asfPercentMeter(1.0);
+
+    *mean = pixel_count > 0 ? m : 0.0;
+    *stdDev = pixel_count > 1 ? sqrt(s/(pixel_count - 1)) : 0.0;
+
+    // Guard against weird data
+    if(!(*min<*max)) *max = *min + 1;
+
+    if (histogram) {
+      const int num_bins = 256;
+      gsl_histogram *hist = gsl_histogram_alloc (num_bins);
+      gsl_histogram_set_ranges_uniform (hist, *min, *max);
+      if (values) {
+        long long kk;
+        for (kk=0; kk<n_values; ++kk)
+          gsl_histogram_increment (hist, values[kk]);
+      }
+      else {
+        asfPrintStatus("\nCalculating histogram...\n");
+        for (ii=0; ii<nl; ++ii) {
+          asfPercentMeter((double)ii/(double)nl);
+          get_float_line(fp, meta, ii + offset, data);
+          for (jj=0; jj<ns; ++jj) {
+            if (meta_is_valid_double(data[jj])) {
+              if (ISNAN(mask) || !FLOAT_EQUIVALENT(data[jj], mask))
+                gsl_histogram_increment (hist, data[jj]);
+            }
+          }
+        }
+        asfPercentMeter(1.0);
+      }
+      *histogram = hist;
+    }
+
+    FCLOSE(fp);
+    FREE(values);
+    FREE(data);
+    meta_free(meta);
+}
+
 void
 calc_stats_rmse_from_file(const char *inFile, char *band, double mask,
                           double *min, double *max, double *mean,
@@ -0,0 +1,144 @@
+// Stress test and benchmark for reading a single float_image instance
+// from many threads at once (see float_image_begin_concurrent_reads).
+// Every thread samples random points all over an image too big for
+// one tile and checks the results, and we report how many samples per
+// second we get for different numbers of threads.
+//
+// Usage: test_fi_concurrent [size [samples_per_thread [max_threads]]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "float_image.h"
+#include "asf.h"
+
+// The image pixels are a simple function of position, so every
+// thread can check the values it gets without a reference copy.
+static float
+pixel_value (size_t x, size_t y)
+{
+  return (float) ((x % 1000) + 1000 * (y % 1000));
+}
+
+typedef struct {
+  FloatImage *image;
+  size_t sample_count;
+  guint32 seed;
+  float_image_sample_method_t method;
+  size_t errors;
+} worker_args_t;
+
+static gpointer
+sample_worker (gpointer data)
+{
+  worker_args_t *args = data;
+  FloatImage *fi = args->image;
+  GRand *rand = g_rand_new_with_seed (args->seed);
+
+  size_t ii;
+  for ( ii = 0 ; ii < args->sample_count ; ii++ ) {
+    size_t x = g_rand_int_range (rand, 0, fi->size_x);
+    size_t y = g_rand_int_range (rand, 0, fi->size_y);
+    float v;
+    if ( args->method == FLOAT_IMAGE_SAMPLE_METHOD_NEAREST_NEIGHBOR ) {
+      v = float_image_get_pixel (fi, x, y);
+    }
+    else {
+      v = float_image_sample (fi, x, y, args->method);
+    }
+    if ( fabs (v - pixel_value (x, y)) > 0.01 ) {
+      args->errors++;
+    }
+  }
+
+  g_rand_free (rand);
+
+  return NULL;
+}
+
+// Sample the image from thread_count threads at once, and return the
+// number of samples per second achieved.
+static double
+run_threads (FloatImage *fi, int thread_count, size_t samples_per_thread,
+             float_image_sample_method_t method)
+{
+  GThread **threads = g_new (GThread *, thread_count);
+  worker_args_t *args = g_new0 (worker_args_t, thread_count);
+
+  GTimer *timer = g_timer_new ();
+
+  int ii;
+  for ( ii = 0 ; ii < thread_count ; ii++ ) {
+    args[ii].image = fi;
+    args[ii].sample_count = samples_per_thread;
+    args[ii].seed = 1234 + ii;
+    args[ii].method = method;
+    threads[ii] = g_thread_new ("sampler", sample_worker, &args[ii]);
+  }
+
+  size_t errors = 0;
+  for ( ii = 0 ; ii < thread_count ; ii++ ) {
+    g_thread_join (threads[ii]);
+    errors += args[ii].errors;
+  }
+
+  double elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  asfRequire (errors == 0, "%lu of %lu samples had the wrong value\n",
+              (unsigned long) errors,
+              (unsigned long) (samples_per_thread * thread_count));
+
+  g_free (args);
+  g_free (threads);
+
+  return samples_per_thread * thread_count / elapsed;
+}
+
+int main (int argc, char **argv)
+{
+  size_t size = argc > 1 ? atoi (argv[1]) : 6000;
+  size_t samples_per_thread = argc > 2 ? atoi (argv[2]) : 2000000;
+  int max_threads = argc > 3 ? atoi (argv[3]) : (int) g_get_num_processors ();
+
+  asfPrintStatus ("Creating %lux%lu test image...\n",
+                  (unsigned long) size, (unsigned long) size);
+  // Small tiles, so that there are lots of them for the concurrent
+  // cache below to shuffle in and out.
+  float_image_set_default_cache_size (2 * 1048576);
+  FloatImage *fi = float_image_new (size, size);
+  size_t ii, jj;
+  for ( ii = 0 ; ii < size ; ii++ ) {
+    for ( jj = 0 ; jj < size ; jj++ ) {
+      float_image_set_pixel (fi, jj, ii, pixel_value (jj, ii));
+    }
+  }
+
+  // Use a cache of only a few MB, so that the shards are kept busy
+  // evicting tiles while other threads are still reading (and pinning)
+  // them.
+  float_image_begin_concurrent_reads (fi, 4 * 1048576);
+
+  asfPrintStatus ("%8s %18s %18s\n", "threads", "get_pixel/sec",
+                  "bilinear/sec");
+  int thread_count;
+  for ( thread_count = 1 ; thread_count <= max_threads ; thread_count *= 2 ) {
+    double nn_rate
+      = run_threads (fi, thread_count, samples_per_thread,
+                     FLOAT_IMAGE_SAMPLE_METHOD_NEAREST_NEIGHBOR);
+    double bl_rate
+      = run_threads (fi, thread_count, samples_per_thread,
+                     FLOAT_IMAGE_SAMPLE_METHOD_BILINEAR);
+    asfPrintStatus ("%8d %18.0f %18.0f\n", thread_count, nn_rate, bl_rate);
+  }
+
+  float_image_end_concurrent_reads (fi);
+  float_image_free (fi);
+
+  asfPrintStatus ("Tests passed!\n");
+
+  return 0;
+}
@@ -27,35 +27,13 @@ static double max4(double a, double b, double c, double d)
     return max2(max2(a,b), max2(c,d));
 }
 
-int trim(char *infile, char *outfile,
-         long long startX, long long startY,
-         long long sizeX, long long sizeY)
+// Metadata for the sizeX by sizeY window at startX, startY of the image
+// described by metaIn.
+static meta_parameters *trim_meta(meta_parameters *metaIn,
+                                  long long startX, long long startY,
+                                  long long sizeX, long long sizeY)
 {
-  meta_parameters *metaIn, *metaOut;
-  long long pixelSize, offset;
-  long long b,x,y,lastReadY,firstReadX,numInX;
-  FILE *in,*out;
-  char *buffer;
-
-  // Check the pixel size
-  metaIn = meta_read(infile);
-  pixelSize = metaIn->general->data_type;
-  if (pixelSize==3) pixelSize=4;         // INTEGER32
-  else if (pixelSize==5) pixelSize=8;    // REAL64
-  else if (pixelSize==6) pixelSize=2;    // COMPLEX_BYTE
-  else if (pixelSize==7) pixelSize=4;    // COMPLEX_INTEGER16
-  else if (pixelSize==8) pixelSize=8;    // COMPLEX_INTEGER32
-  else if (pixelSize==9) pixelSize=8;    // COMPLEX_REAL32
-  else if (pixelSize==10) pixelSize=16;  // COMPLEX_REAL64
-
-  const int inMaxX = metaIn->general->sample_count;
-  const int inMaxY = metaIn->general->line_count;
-
-  if (sizeX < 0) sizeX = inMaxX - startX;
-  if (sizeY < 0) sizeY = inMaxY - startY;
-
-  /* Write out metadata */
-  metaOut = meta_read(infile);
+  meta_parameters *metaOut = meta_copy(metaIn);
   metaOut->general->line_count = sizeY;
   metaOut->general->sample_count = sizeX;
   if (metaOut->sar) {
@@ -87,6 +65,39 @@ int trim(char *infile, char *outfile,
   }
   */
 	meta_get_corner_coords(metaOut);
+
+  return metaOut;
+}
+
+int trim(char *infile, char *outfile,
+         long long startX, long long startY,
+         long long sizeX, long long sizeY)
+{
+  meta_parameters *metaIn, *metaOut;
+  long long pixelSize, offset;
+  long long b,x,y,lastReadY,firstReadX,numInX;
+  FILE *in,*out;
+  char *buffer;
+
+  // Check the pixel size
+  metaIn = meta_read(infile);
+  pixelSize = metaIn->general->data_type;
+  if (pixelSize==3) pixelSize=4;         // INTEGER32
+  else if (pixelSize==5) pixelSize=8;    // REAL64
+  else if (pixelSize==6) pixelSize=2;    // COMPLEX_BYTE
+  else if (pixelSize==7) pixelSize=4;    // COMPLEX_INTEGER16
+  else if (pixelSize==8) pixelSize=8;    // COMPLEX_INTEGER32
+  else if (pixelSize==9) pixelSize=8;    // COMPLEX_REAL32
+  else if (pixelSize==10) pixelSize=16;  // COMPLEX_REAL64
+
+  const int inMaxX = metaIn->general->sample_count;
+  const int inMaxY = metaIn->general->line_count;
+
+  if (sizeX < 0) sizeX = inMaxX - startX;
+  if (sizeY < 0) sizeY = inMaxY - startY;
+
+  /* Write out metadata */
+  metaOut = trim_meta(metaIn, startX, startY, sizeX, sizeY);
   meta_write(metaOut, outfile);
 
   /* If everything's OK, then allocate a buffer big enough for one line of 
@@ -185,6 +196,114 @@ void trim_zeros(char *infile, char *outfile, int * startX, int * endX)
   trim(infile, outfile, *startX, 0, *endX, nl);
 }
 
+// The part of each line that trimming copies from the input image: input
+// samples start at firstX+startX, and output lines firstY up to lastY
+// come from the input.  Everything else is zero fill.
+static void trim_window(long long inMaxX, long long inMaxY,
+                        long long startX, long long startY,
+                        long long sizeX, long long sizeY,
+                        long long *firstX, long long *numX,
+                        long long *firstY, long long *lastY)
+{
+  *firstX = MAXI(0,-startX);
+  *numX = MINI(MINI(sizeX,inMaxX-(*firstX+startX)),sizeX-*firstX);
+  *firstY = MAXI(0,-startY);
+  *lastY = MINI(sizeY,inMaxY-startY);
+}
+
+// Same as trim(), but the result is kept in memory instead of written out.
+MemoryImage *trim_to_memory(char *infile, long long startX, long long startY,
+                            long long sizeX, long long sizeY)
+{
+  meta_parameters *metaIn = meta_read(infile);
+  const int inMaxX = metaIn->general->sample_count;
+  const int inMaxY = metaIn->general->line_count;
+  long long b, y, firstX, numX, firstY, lastY;
+
+  if (sizeX < 0) sizeX = inMaxX - startX;
+  if (sizeY < 0) sizeY = inMaxY - startY;
+
+  meta_parameters *metaOut = trim_meta(metaIn, startX, startY, sizeX, sizeY);
+  MemoryImage *out = memory_image_new(metaOut);
+  meta_free(metaOut);
+
+  trim_window(inMaxX, inMaxY, startX, startY, sizeX, sizeY,
+              &firstX, &numX, &firstY, &lastY);
+
+  if (numX > 0) {
+    float *buf = MALLOC(sizeof(float)*inMaxX);
+    FILE *in = fopenImage(infile, "rb");
+    for (b=0; b<metaIn->general->band_count; ++b) {
+      for (y=firstY; y<lastY; ++y) {
+        get_band_float_line(in, metaIn, b, y+startY, buf);
+        memcpy(memory_image_line(out, b, y) + firstX, buf + firstX + startX,
+               sizeof(float)*numX);
+      }
+    }
+    FCLOSE(in);
+    FREE(buf);
+  }
+
+  meta_free(metaIn);
+  return out;
+}
+
+// Same as trim(), for an image that is already in memory.
+MemoryImage *memory_image_trim(MemoryImage *in, long long startX,
+                               long long startY, long long sizeX,
+                               long long sizeY)
+{
+  const int inMaxX = in->meta->general->sample_count;
+  const int inMaxY = in->meta->general->line_count;
+  long long b, y, firstX, numX, firstY, lastY;
+
+  if (sizeX < 0) sizeX = inMaxX - startX;
+  if (sizeY < 0) sizeY = inMaxY - startY;
+
+  meta_parameters *metaOut = trim_meta(in->meta, startX, startY, sizeX, sizeY);
+  MemoryImage *out = memory_image_new(metaOut);
+  meta_free(metaOut);
+
+  trim_window(inMaxX, inMaxY, startX, startY, sizeX, sizeY,
+              &firstX, &numX, &firstY, &lastY);
+
+  if (numX > 0) {
+    for (b=0; b<in->meta->general->band_count; ++b) {
+      for (y=firstY; y<lastY; ++y) {
+        memcpy(memory_image_line(out, b, y) + firstX,
+               memory_image_line(in, b, y+startY) + firstX + startX,
+               sizeof(float)*numX);
+      }
+    }
+  }
+
+  return out;
+}
+
+// Same as trim_zeros(), for an image that is already in memory.
+MemoryImage *memory_image_trim_zeros(MemoryImage *in, int *startX, int *endX)
+{
+  int i;
+  int ns = in->meta->general->sample_count;
+  int nl = in->meta->general->line_count;
+
+  *startX = ns-1;
+  *endX = 0;
+
+  for (i=0; i<nl; ++i) {
+      int left = 0, right = ns-1;
+      float *buf = memory_image_line(in, 0, i);
+      while (buf[left] == 0.0 && left<ns-1) ++left;
+      while (buf[right] == 0.0 && right>0) --right;
+      if (left < *startX) *startX = left;
+      if (right > *endX) *endX = right;
+  }
+
+  *endX -= *startX;
+
+  return memory_image_trim(in, *startX, 0, *endX, nl);
+}
+
 void trim_zeros_ext(char *infile, char *outfile, int update_meta,
                     int do_top, int do_left)
 {
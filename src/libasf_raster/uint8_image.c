@@ -1759,6 +1759,83 @@ uint8_image_sample (UInt8Image *self, double x, double y,
   }
 }
 
+void
+uint8_image_sample_row (UInt8Image *self, size_t count, const double *x,
+                        const double *y,
+                        uint8_image_sample_method_t sample_method,
+                        float *out)
+{
+  size_t ts = self->tile_size;  // Convenience alias.
+  // Offset and address of the tile the last point came from.  Points
+  // along a row mostly share a tile with the point before, so the
+  // lookup is skipped for them.
+  ssize_t held_offset = -1;
+  uint8_t *held_address = NULL;
+
+  size_t ii;
+  switch ( sample_method ) {
+
+  case UINT8_IMAGE_SAMPLE_METHOD_NEAREST_NEIGHBOR:
+  case UINT8_IMAGE_SAMPLE_METHOD_BILINEAR:
+    for ( ii = 0 ; ii < count ; ii++ ) {
+      g_assert (x[ii] >= 0.0 && x[ii] <= (double) self->size_x - 1.0);
+      g_assert (y[ii] >= 0.0 && y[ii] <= (double) self->size_y - 1.0);
+      size_t xb, yb, xa, ya;
+      if ( sample_method == UINT8_IMAGE_SAMPLE_METHOD_NEAREST_NEIGHBOR ) {
+        xb = xa = round (x[ii]);
+        yb = ya = round (y[ii]);
+      }
+      else {
+        xb = floor (x[ii]);
+        yb = floor (y[ii]);
+        xa = ceil (x[ii]);
+        ya = ceil (y[ii]);
+      }
+      uint8_t ul, ur, ll, lr;
+      if ( G_LIKELY (xb / ts == xa / ts && yb / ts == ya / ts) ) {
+        size_t tile_offset = (yb / ts) * self->tile_count_x + xb / ts;
+        if ( G_UNLIKELY ((ssize_t) tile_offset != held_offset) ) {
+          held_address = self->tile_addresses[tile_offset];
+          if ( G_UNLIKELY (held_address == NULL) ) {
+            held_address = load_tile (self, xb / ts, yb / ts);
+          }
+          held_offset = tile_offset;
+        }
+        size_t xbto = xb % ts, ybto = yb % ts, xato = xa % ts, yato = ya % ts;
+        ul = held_address[ybto * ts + xbto];
+        ur = held_address[ybto * ts + xato];
+        ll = held_address[yato * ts + xbto];
+        lr = held_address[yato * ts + xato];
+      }
+      else {
+        // get_pixel may load over the tile we were holding on to.
+        held_offset = -1;
+        ul = uint8_image_get_pixel (self, xb, yb);
+        ur = uint8_image_get_pixel (self, xa, yb);
+        ll = uint8_image_get_pixel (self, xb, ya);
+        lr = uint8_image_get_pixel (self, xa, ya);
+      }
+      if ( sample_method == UINT8_IMAGE_SAMPLE_METHOD_NEAREST_NEIGHBOR ) {
+        out[ii] = ul;
+      }
+      else {
+        double ux = ul + (ur - ul) * (x[ii] - floor (x[ii]));
+        double lx = ll + (lr - ll) * (x[ii] - floor (x[ii]));
+        out[ii] = ux + (lx - ux) * (y[ii] - floor (y[ii]));
+      }
+    }
+    break;
+
+  case UINT8_IMAGE_SAMPLE_METHOD_BICUBIC:
+    // See uint8_image_sample.
+    asfPrintError ("BICUBIC resampling for BYTE data is not supported.\n");
+    break;
+
+  default:
+    g_assert_not_reached ();
+  }
+}
+
 gboolean
 uint8_image_equals (UInt8Image *self, UInt8Image *other)
 {
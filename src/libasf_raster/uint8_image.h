@@ -300,6 +300,16 @@ double
 uint8_image_sample (UInt8Image *self, double x, double y,
 		    uint8_image_sample_method_t sample_method);
 
+// Sample the image at the count points (x[ii], y[ii]), putting the
+// values uint8_image_sample would return in out[ii].  Runs of points
+// from the same tile (as along an output row) only look the tile up
+// once.  Like uint8_image_sample, this doesn't do bicubic sampling.
+void
+uint8_image_sample_row (UInt8Image *self, size_t count, const double *x,
+                        const double *y,
+                        uint8_image_sample_method_t sample_method,
+                        float *out);
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Comparing Images
@@ -33,6 +33,7 @@
 #include "poly.h"
 #include "asf_meta.h"
 #include "float_image.h"
+#include "asf_raster.h"
 
 /* For use by the "classifier" in the polarimetry calculations
    Used by: classify.c and polarimetry.c
@@ -70,6 +71,13 @@ int deskew_dem(char *inDemSlant, char *inDemGround, char *outName,
                char *inSarName, int doRadiometric, char *inMaskName,
                char *outMaskName, int fill_holes, int fill_value,
                int which_gr_dem, int use_nearest_neighbor);
+int deskew_dem_mem(char *inDemSlant, char *inDemGround, MemoryImage **out,
+                   MemoryImage *inSar, int doRadiometric, char *inMaskName,
+                   MemoryImage **outMask, int fill_holes, int fill_value,
+                   int which_gr_dem, int use_nearest_neighbor);
+/* Number of threads deskew_dem calculates the radiometric corrections
+   with.  0 (the default) means one per processor. */
+void deskew_dem_set_thread_count(int thread_count);
 
 /* Prototypes from create_dem_grid.c */
 int create_dem_grid(const char *demName, const char *sarName,
@@ -163,6 +171,10 @@ void cpx2cloude_pottier16(const char *inFile, const char *outFile,
                           int tc_flag);
 void cpx2debug(const char *inFile, const char *outFile);
 void cpx2freeman_durden(const char *inFile, const char *outFile, int tc_flag);
+/* Number of threads polarimetric_decomp does the Cloude-Pottier and
+   Freeman-Durden decompositions with.  0 (the default) means one per
+   processor. */
+void polarimetric_decomp_set_thread_count(int thread_count);
 
 void make_entropy_alpha_boundary(const char *fname, int size);
 
@@ -175,6 +187,12 @@ void faraday_correct(const char *inFile, const char *outFile, double threshold,
 // calibrate.c
 int asf_calibrate(const char *inFile, const char *outFile, 
 		  radiometry_t radiometry, int wh_scaleFlag);
+// The calibration asf_calibrate would do, as a LineFilter, so that the
+// next processing step can calibrate the lines as it reads them.  NULL
+// for Woods Hole scaled dual-pol data, which doesn't calibrate line by
+// line.
+LineFilter *asf_calibrate_filter(const char *inFile,
+				 radiometry_t radiometry, int wh_scaleFlag);
 int asf_logscale(const char *inFile, const char *outFile);
 
 // calc_number_looks.c
@@ -4,24 +4,27 @@
 #include "asf.h"
 #include <assert.h>
 
-int asf_calibrate(const char *inFile, const char *outFile, 
-		  radiometry_t outRadiometry, int wh_scaleFlag)
+// Checks that inFile can be calibrated to outRadiometry, and returns
+// the metadata of the calibrated image.  *dbFlag is set for decibel
+// output.
+static meta_parameters *calibrated_meta(meta_parameters *metaIn,
+					radiometry_t *outRadiometry,
+					int wh_scaleFlag, int *dbFlag)
 {
-  meta_parameters *metaIn = meta_read(inFile);
-  meta_parameters *metaOut = meta_read(inFile);
+  meta_parameters *metaOut = meta_copy(metaIn);
 
   if (!metaIn->calibration) {
     asfPrintError("This data cannot be calibrated, missing calibration block.\n");
   }
 
   // Check for valid output radiometry
-  if (outRadiometry == r_AMP || outRadiometry == r_POWER)
+  if (*outRadiometry == r_AMP || *outRadiometry == r_POWER)
     asfPrintError("Invalid radiometry (%s) passed into calibration function!\n",
-		  radiometry2str(outRadiometry));
+		  radiometry2str(*outRadiometry));
 
   // Check whether output radiometry fits with Woods Hole scaling flag
-  if (wh_scaleFlag && outRadiometry >= r_SIGMA && outRadiometry <= r_GAMMA)
-    outRadiometry += 3;
+  if (wh_scaleFlag && *outRadiometry >= r_SIGMA && *outRadiometry <= r_GAMMA)
+    *outRadiometry += 3;
 
   // This can only work if the image is in some SAR geometry
   // Exception: UAVSAR comes in gamma radiometry - dB could be applied to this
@@ -32,12 +35,12 @@ int asf_calibrate(const char *inFile, const char *outFile,
 
   radiometry_t inRadiometry = metaIn->general->radiometry;
   asfPrintStatus("Calibrating %s image to %s image\n\n", 
-		 radiometry2str(inRadiometry), radiometry2str(outRadiometry));
+		 radiometry2str(inRadiometry), radiometry2str(*outRadiometry));
   // FIXME: This function should be able to remap between different
   //        radiometry projections.
   if (metaIn->general->radiometry == r_GAMMA && 
       strcmp(metaIn->general->sensor, "UAVSAR") == 0) {
-    if (outRadiometry == r_GAMMA_DB)
+    if (*outRadiometry == r_GAMMA_DB)
       ;
     else
       asfPrintError("Currently no radiometry remapping of UAVSAR data "
@@ -53,31 +56,137 @@ int asf_calibrate(const char *inFile, const char *outFile,
       strcmp_case(metaIn->general->sensor, "RSAT-1") == 0)
     asfPrintWarning("The noise floor removal is not applied to the data!\n");
 
-  metaOut->general->radiometry = outRadiometry;
-  int dbFlag = FALSE;
-  if (outRadiometry >= r_SIGMA && outRadiometry <= r_GAMMA)
+  metaOut->general->radiometry = *outRadiometry;
+  *dbFlag = FALSE;
+  if (*outRadiometry >= r_SIGMA && *outRadiometry <= r_GAMMA)
     metaOut->general->no_data = 0.0;
-  if (outRadiometry >= r_SIGMA_DB && outRadiometry <= r_GAMMA_DB) {
+  if (*outRadiometry >= r_SIGMA_DB && *outRadiometry <= r_GAMMA_DB) {
     metaOut->general->no_data = -40.0;
-    dbFlag = TRUE;
+    *dbFlag = TRUE;
   }
   if (metaIn->general->image_data_type != POLARIMETRIC_IMAGE) {
-    if (outRadiometry == r_SIGMA || outRadiometry == r_SIGMA_DB)
+    if (*outRadiometry == r_SIGMA || *outRadiometry == r_SIGMA_DB)
       metaOut->general->image_data_type = SIGMA_IMAGE;
-    else if (outRadiometry == r_BETA || outRadiometry == r_BETA_DB)
+    else if (*outRadiometry == r_BETA || *outRadiometry == r_BETA_DB)
       metaOut->general->image_data_type = BETA_IMAGE;
-    else if (outRadiometry == r_GAMMA || outRadiometry == r_GAMMA_DB)
+    else if (*outRadiometry == r_GAMMA || *outRadiometry == r_GAMMA_DB)
       metaOut->general->image_data_type = GAMMA_IMAGE;
   }
   if (wh_scaleFlag)
     metaOut->general->data_type = ASF_BYTE;
 
+  return metaOut;
+}
+
+static int is_dualpol_wh_scaled(meta_parameters *metaIn, int wh_scaleFlag)
+{
+  return wh_scaleFlag &&
+    strncmp_case(metaIn->general->mode, "FBD", 3) == 0;
+}
+
+// Calibration of one band at a time, as a LineFilter.
+typedef struct {
+  meta_parameters *metaIn, *metaOut;
+  char **bands;
+  int band_count;
+  int dbFlag, wh_scaleFlag;
+  cal_line_t **cal;         // Per band, made when first needed.
+} cal_filter_t;
+
+static void cal_filter_line(void *data, int band, int line, float *buf)
+{
+  cal_filter_t *cf = data;
+  int sample_count = cf->metaIn->general->sample_count;
+  int jj;
+
+  if (strstr(cf->bands[band], "PHASE") != NULL)
+    return; // PHASE band, do nothing
+
+  // Taking the remapping of other radiometries out for the moment
+  //if (inRadiometry >= r_SIGMA && inRadiometry <= r_BETA_DB)
+  //bufIn[jj] = cal2amp(metaIn, incid, jj, bands[kk], bufIn[jj]);
+  if (!cf->cal[band])
+    cf->cal[band] = cal_line_new(cf->metaOut, cf->bands[band], cf->dbFlag);
+  cal_line_apply(cf->cal[band], line, buf);
+
+  if (cf->wh_scaleFlag) {
+    for (jj=0; jj<sample_count; jj++) {
+      if (FLOAT_EQUIVALENT(buf[jj], cf->metaIn->general->no_data))
+	buf[jj] = 0;
+      else
+	buf[jj] = (buf[jj] + 31) / 0.15 + 1.5;
+    }
+  }
+}
+
+static void cal_filter_free(void *data)
+{
+  cal_filter_t *cf = data;
+  int kk;
+  for (kk=0; kk<cf->band_count; ++kk) {
+    FREE(cf->bands[kk]);
+    cal_line_free(cf->cal[kk]);
+  }
+  FREE(cf->bands);
+  FREE(cf->cal);
+  meta_free(cf->metaIn);
+  meta_free(cf->metaOut);
+  FREE(cf);
+}
+
+LineFilter *asf_calibrate_filter(const char *inFile,
+				 radiometry_t outRadiometry, int wh_scaleFlag)
+{
+  meta_parameters *metaIn = meta_read(inFile);
+
+  // Woods Hole scaled dual-pol data gets a third band, the difference
+  // of the other two, so it isn't line by line.
+  if (is_dualpol_wh_scaled(metaIn, wh_scaleFlag)) {
+    meta_free(metaIn);
+    return NULL;
+  }
+
+  cal_filter_t *cf = MALLOC(sizeof(cal_filter_t));
+  cf->metaIn = metaIn;
+  cf->metaOut = calibrated_meta(metaIn, &outRadiometry, wh_scaleFlag,
+				&cf->dbFlag);
+  cf->wh_scaleFlag = wh_scaleFlag;
+  cf->band_count = metaIn->general->band_count;
+  cf->bands = extract_band_names(metaIn->general->bands, cf->band_count);
+  cf->cal = CALLOC(cf->band_count, sizeof(cal_line_t *));
+
+  int kk;
+  char *radiometry = radiometry2str(outRadiometry);
+  for (kk=0; kk<cf->band_count; kk++) {
+    if (kk==0)
+      sprintf(cf->metaOut->general->bands, "%s-%s", 
+	      radiometry, cf->bands[kk]);
+    else {
+      char tmp[255];
+      sprintf(tmp, ",%s-%s", radiometry, cf->bands[kk]);
+      strcat(cf->metaOut->general->bands, tmp);
+    }
+  }
+  free(radiometry);
+
+  return line_filter_new(inFile, cf->metaOut, cal_filter_line, cf,
+			 cal_filter_free);
+}
+
+// Woods Hole scaled dual-pol data: both bands, and their difference.
+static void calibrate_dualpol_wh(const char *inFile, const char *outFile,
+				 radiometry_t outRadiometry)
+{
+  meta_parameters *metaIn = meta_read(inFile);
+  int dbFlag;
+  meta_parameters *metaOut = calibrated_meta(metaIn, &outRadiometry, TRUE,
+					     &dbFlag);
+
   char *input = appendExt(inFile, ".img");
   char *output = appendExt(outFile, ".img");
   FILE *fpIn = FOPEN(input, "rb");
   FILE *fpOut = FOPEN(output, "wb");
 
-  int dualpol = strncmp_case(metaIn->general->mode, "FBD", 3) == 0 ? 1 : 0;
   int band_count = metaIn->general->band_count;
   int sample_count = metaIn->general->sample_count;
   int line_count = metaIn->general->line_count;
@@ -86,100 +195,53 @@ int asf_calibrate(const char *inFile, const char *outFile,
 
   float *bufIn = (float *) MALLOC(sizeof(float)*sample_count);
   float *bufOut = (float *) MALLOC(sizeof(float)*sample_count);
-  float *bufIn2 = NULL, *bufOut2 = NULL, *bufOut3 = NULL;
-  if (dualpol && wh_scaleFlag) {
-    bufIn2 = (float *) MALLOC(sizeof(float)*sample_count);
-    bufOut2 = (float *) MALLOC(sizeof(float)*sample_count);
-    bufOut3 = (float *) MALLOC(sizeof(float)*sample_count);
-    metaOut->general->band_count = 3;
-    sprintf(metaOut->general->bands, "%s,%s,%s-%s", 
-	    bands[0], bands[1], bands[0], bands[1]);
-  }
+  float *bufIn2 = (float *) MALLOC(sizeof(float)*sample_count);
+  float *bufOut2 = (float *) MALLOC(sizeof(float)*sample_count);
+  float *bufOut3 = (float *) MALLOC(sizeof(float)*sample_count);
+  metaOut->general->band_count = 3;
+  sprintf(metaOut->general->bands, "%s,%s,%s-%s", 
+	  bands[0], bands[1], bands[0], bands[1]);
 
   int ii, jj, kk;
   float cal_dn, cal_dn2;
-  double incid;
-  if (dualpol && wh_scaleFlag) {
-    metaOut->general->image_data_type = RGB_STACK;
-    for (ii=0; ii<line_count; ii++) {
-      get_band_float_line(fpIn, metaIn, 0, ii, bufIn);
-      get_band_float_line(fpIn, metaIn, 1, ii, bufIn2);
-      for (jj=0; jj<sample_count; jj++) {
-	// Taking the remapping of other radiometries out for the moment
-	//if (inRadiometry >= r_SIGMA && inRadiometry <= r_BETA_DB)
-	//bufIn[jj] = cal2amp(metaIn, incid, jj, bands[kk], bufIn[jj]);
-	incid = meta_incid(metaIn, ii, jj);
-	cal_dn = 
-	  get_cal_dn(metaOut, incid, jj, bufIn[jj], bands[0], dbFlag);
-	cal_dn2 = 
-	  get_cal_dn(metaOut, incid, jj, bufIn2[jj], bands[1], dbFlag);
-	if (FLOAT_EQUIVALENT(cal_dn, metaIn->general->no_data) ||
-	    cal_dn == cal_dn2) {
-	  bufOut[jj] = 0;
-	  bufOut2[jj] = 0;
-	  bufOut3[jj] = 0;
-	}
-	else {
-	  bufOut[jj] = (cal_dn + 31) / 0.15 + 1.5;
-	  bufOut2[jj] = (cal_dn2 + 31) / 0.15 + 1.5;
-	  bufOut3[jj] = bufOut[jj] - bufOut2[jj];
-	}
-      }
-      put_band_float_line(fpOut, metaOut, 0, ii, bufOut);
-      put_band_float_line(fpOut, metaOut, 1, ii, bufOut2);
-      put_band_float_line(fpOut, metaOut, 2, ii, bufOut3);
-      asfLineMeter(ii, line_count);
-    }
-  }
-  else {
-    for (kk=0; kk<band_count; kk++) {
-      for (ii=0; ii<line_count; ii++) {
-	get_band_float_line(fpIn, metaIn, kk, ii, bufIn);
-	for (jj=0; jj<sample_count; jj++) {
-	  // Taking the remapping of other radiometries out for the moment
-	  //if (inRadiometry >= r_SIGMA && inRadiometry <= r_BETA_DB)
-	  //bufIn[jj] = cal2amp(metaIn, incid, jj, bands[kk], bufIn[jj]);
-	  if (strstr(bands[kk], "PHASE") == NULL) {
-	    incid = meta_incid(metaIn, ii, jj);
-	    cal_dn =
-	      get_cal_dn(metaOut, incid, jj, bufIn[jj], bands[kk], dbFlag);
-	    if (wh_scaleFlag) {
-	      if (FLOAT_EQUIVALENT(cal_dn, metaIn->general->no_data))
-		bufOut[jj] = 0;
-	      else
-		bufOut[jj] = (cal_dn + 31) / 0.15 + 1.5;
-	    }
-	    else
-	      bufOut[jj] = cal_dn;
-	  }
-	  else // PHASE band, do nothing
-	    bufOut[jj] = bufIn[jj];
-	}
-	put_band_float_line(fpOut, metaOut, kk, ii, bufOut);
-	asfLineMeter(ii, line_count);
+  cal_line_t *cal = cal_line_new(metaOut, bands[0], dbFlag);
+  cal_line_t *cal2 = cal_line_new(metaOut, bands[1], dbFlag);
+  metaOut->general->image_data_type = RGB_STACK;
+  for (ii=0; ii<line_count; ii++) {
+    get_band_float_line(fpIn, metaIn, 0, ii, bufIn);
+    get_band_float_line(fpIn, metaIn, 1, ii, bufIn2);
+    cal_line_apply(cal, ii, bufIn);
+    cal_line_apply(cal2, ii, bufIn2);
+    for (jj=0; jj<sample_count; jj++) {
+      cal_dn = bufIn[jj];
+      cal_dn2 = bufIn2[jj];
+      if (FLOAT_EQUIVALENT(cal_dn, metaIn->general->no_data) ||
+	  cal_dn == cal_dn2) {
+	bufOut[jj] = 0;
+	bufOut2[jj] = 0;
+	bufOut3[jj] = 0;
       }
-      char *radiometry = radiometry2str(outRadiometry);
-      if (kk==0)
-	sprintf(metaOut->general->bands, "%s-%s", 
-		radiometry, bands[kk]);
       else {
-	char tmp[255];
-	sprintf(tmp, ",%s-%s", radiometry, bands[kk]);
-	strcat(metaOut->general->bands, tmp);
+	bufOut[jj] = (cal_dn + 31) / 0.15 + 1.5;
+	bufOut2[jj] = (cal_dn2 + 31) / 0.15 + 1.5;
+	bufOut3[jj] = bufOut[jj] - bufOut2[jj];
       }
-      free(radiometry);
     }
+    put_band_float_line(fpOut, metaOut, 0, ii, bufOut);
+    put_band_float_line(fpOut, metaOut, 1, ii, bufOut2);
+    put_band_float_line(fpOut, metaOut, 2, ii, bufOut3);
+    asfLineMeter(ii, line_count);
   }
   meta_write(metaOut, outFile);
+  cal_line_free(cal);
+  cal_line_free(cal2);
   meta_free(metaIn);
   meta_free(metaOut);
   FREE(bufIn);
   FREE(bufOut);
-  if (dualpol) {
-    FREE(bufIn2);
-    FREE(bufOut2);
-    FREE(bufOut3);
-  }
+  FREE(bufIn2);
+  FREE(bufOut2);
+  FREE(bufOut3);
   for (kk=0; kk<band_count; ++kk)
     FREE(bands[kk]);
   FREE(bands);
@@ -187,6 +249,18 @@ int asf_calibrate(const char *inFile, const char *outFile,
   FCLOSE(fpOut);
   FREE(input);
   FREE(output);
+}
+
+int asf_calibrate(const char *inFile, const char *outFile, 
+		  radiometry_t outRadiometry, int wh_scaleFlag)
+{
+  LineFilter *cal = asf_calibrate_filter(inFile, outRadiometry, wh_scaleFlag);
+  if (cal) {
+    line_filter_store(cal, outFile);
+    line_filter_free(cal);
+  }
+  else
+    calibrate_dualpol_wh(inFile, outFile, outRadiometry);
 
   return FALSE;
 }
@@ -81,6 +81,7 @@ BUGS:
 #include "asf_raster.h"
 #include <string.h>
 #include <assert.h>
+#include <glib.h>
 
 struct deskew_dem_data {
         int numLines, numSamples;
@@ -569,63 +570,123 @@ static Vector get_satpos(meta_parameters *meta, int line)
   return satpos;
 }
 
-static void calculate_vectors_for_line(meta_parameters *meta_img, float *demLine, int line, Vector **vectorLine, Vector *nextVectors, Vector *verticals)
+// The ground points (ECEF) of one line of the SAR image, as a structure
+// of arrays.
+typedef struct {
+  double *x, *y, *z;
+} point_row;
+
+// Three lines of ground points (above, at and below the line being
+// corrected), and for the bottom one, the unit vertical and the point
+// at the same place on the line after it (the "next" point).  All of it
+// is in one block of memory, and rolled down the image by swapping
+// pointers.  The lat/lon of the line after the bottom one is kept, since
+// the next push needs it again.
+typedef struct {
+  point_row row[3];
+  point_row vertical, next;
+  double *lat, *lon, *next_lat, *next_lon;
+  int next_line;                // line next_lat/next_lon are for
+  double *block;
+} rolling_rows;
+
+static void rolling_rows_init(rolling_rows *r, int ns)
+{
+  int ii;
+  point_row *rows[5] = { &r->row[0], &r->row[1], &r->row[2],
+                         &r->vertical, &r->next };
+  r->block = MALLOC(sizeof(double)*ns*19);
+  for (ii=0; ii<5; ++ii) {
+    rows[ii]->x = r->block + ns*(3*ii);
+    rows[ii]->y = r->block + ns*(3*ii+1);
+    rows[ii]->z = r->block + ns*(3*ii+2);
+  }
+  r->lat = r->block + ns*15;
+  r->lon = r->block + ns*16;
+  r->next_lat = r->block + ns*17;
+  r->next_lon = r->block + ns*18;
+  r->next_line = -1;
+}
+
+static void rolling_rows_free(rolling_rows *r)
+{
+  FREE(r->block);
+}
+
+static void set_point(point_row *row, int sample, Vector *v)
+{
+  row->x[sample] = v->x;
+  row->y[sample] = v->y;
+  row->z[sample] = v->z;
+}
+
+static void get_point(point_row *row, int sample, Vector *v)
+{
+  v->x = row->x[sample];
+  v->y = row->y[sample];
+  v->z = row->z[sample];
+}
+
+// Drops the top row, and puts the given line in at the bottom.
+static void push_next_point_line(rolling_rows *r, meta_parameters *meta_img,
+                                 float *demLine, int line)
 {
   int jj;
-  double lat, lon;
   int ns = meta_img->general->sample_count;
+  double *tmp;
+  Vector v, v2;
+
+  point_row top = r->row[0];
+  r->row[0] = r->row[1];
+  r->row[1] = r->row[2];
+  r->row[2] = top;
 
+  if (r->next_line == line) {
+    tmp = r->lat; r->lat = r->next_lat; r->next_lat = tmp;
+    tmp = r->lon; r->lon = r->next_lon; r->next_lon = tmp;
+  }
+  else
+    meta_get_latLon_row(meta_img, line, 0, 1, ns, 0, r->lat, r->lon);
+
+  for(jj = 0; jj < ns; ++jj) {
+    geodetic_to_ecef(r->lat[jj], r->lon[jj], demLine[jj], &v);
+    set_point(&r->row[2], jj, &v);
+
+    geodetic_to_ecef(r->lat[jj], r->lon[jj], demLine[jj]+100, &v2);
+    vector_subtract(&v, &v2);
+    vector_multiply(&v, 1./vector_magnitude(&v));
+    set_point(&r->vertical, jj, &v);
+  }
+
+  meta_get_latLon_row(meta_img, line+1, 0, 1, ns, 0, r->next_lat, r->next_lon);
+  r->next_line = line+1;
   for(jj = 0; jj < ns; ++jj) {
-    Vector *v = MALLOC(sizeof(Vector));
-    meta_get_latLon(meta_img, line, jj, 0, &lat, &lon);
-    geodetic_to_ecef(lat, lon, demLine[jj], v);
-    vectorLine[jj] = v;
-
-    Vector v2;
-    geodetic_to_ecef(lat, lon, demLine[jj], &verticals[jj]);
-    geodetic_to_ecef(lat, lon, demLine[jj]+100, &v2);
-    vector_subtract(&verticals[jj], &v2);
-    vector_multiply(&verticals[jj], 1./vector_magnitude(&verticals[jj]));
-
-    meta_get_latLon(meta_img, line+1, jj, 0, &lat, &lon);
-    geodetic_to_ecef(lat, lon, demLine[jj], &nextVectors[jj]);
+    geodetic_to_ecef(r->next_lat[jj], r->next_lon[jj], demLine[jj], &v);
+    set_point(&r->next, jj, &v);
   }
 }
 
-static void push_next_vector_line(Vector ***localVectors, Vector *nextVectors, Vector *verticals, meta_parameters *meta_img, float *demLine, int line)
+static void cross(Vector *a, Vector *b, Vector *c)
 {
-  int ns = meta_img->general->sample_count;
-  Vector **vectorsLine = MALLOC(sizeof(Vector*)*ns);
-  calculate_vectors_for_line(meta_img, demLine, line, vectorsLine, nextVectors, verticals);
-
-  int i;
-  for(i = 0; i < ns; i++)
-    if(localVectors[0] != NULL)
-      vector_free(localVectors[0][i]);
-  FREE(localVectors[0]);
-
-  localVectors[0] = localVectors[1];
-  localVectors[1] = localVectors[2];
-  localVectors[2] = vectorsLine;
+  c->x = a->y * b->z - a->z * b->y;
+  c->y = a->z * b->x - a->x * b->z;
+  c->z = a->x * b->y - a->y * b->x;
 }
 
-static Vector * calculate_normal(Vector ***localVectors, int sample)
+static void calculate_normal(rolling_rows *r, int sample, Vector *normal)
 {
-  Vector *v1, *v2, *normal;
+  Vector v1, v2, tmp;
 
-  v1 = vector_copy(localVectors[0][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
+  get_point(&r->row[0], sample, &v1);
+  get_point(&r->row[2], sample, &tmp);
+  vector_subtract(&v1, &tmp);
 
-  v2 = vector_copy(localVectors[1][sample-1]);
-  vector_subtract(v2, localVectors[1][sample+1]);
+  get_point(&r->row[1], sample-1, &v2);
+  get_point(&r->row[1], sample+1, &tmp);
+  vector_subtract(&v2, &tmp);
 
-  normal = vector_cross(v2, v1);
+  cross(&v2, &v1, normal);
   vector_multiply(normal, 1./vector_magnitude(normal));
-
-  vector_free(v1);
-  vector_free(v2);
-  
-  return normal;
 }
 
 /*
@@ -653,25 +714,22 @@ calculate_correction(meta_parameters *meta_in, int line, int samp,
                      Vector *satpos, Vector *n, Vector *p, Vector *p_next)
 {
   // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, 1./vector_magnitude(R));
+  Vector R = *satpos;
+  vector_subtract(&R, p);
+  vector_multiply(&R, 1./vector_magnitude(&R));
 
-  Vector *x = vector_copy(p);
-  vector_subtract(x, p_next);
-  vector_multiply(x, 1./vector_magnitude(x));
+  Vector x = *p;
+  vector_subtract(&x, p_next);
+  vector_multiply(&x, 1./vector_magnitude(&x));
 
   // Rx: R cross x -- image plane normal
-  Vector *Rx = vector_cross(R,x);
+  Vector Rx;
+  cross(&R, &x, &Rx);
 
   // cos(phi) is the correction factor we need
-  double cosphi = vector_dot(Rx,n);
+  double cosphi = vector_dot(&Rx,n);
   //if (cosphi < 0) cosphi = -cosphi;
 
-  vector_free(x);
-  vector_free(R);
-  vector_free(Rx);
-
   // need to remove old correction factor (sin of the incidence angle)
   double incid = meta_incid(meta_in, line, samp);
   return cosphi / sin(incid);
@@ -720,46 +778,196 @@ static void get_dem_line(FILE * inDemGroundFp, meta_parameters *metaDEMground, F
   }
 }
 
-static void push_dem_lines(FILE * inDemGroundFp, meta_parameters *metaDEMground, FILE *inDemSlantFp,
-                         meta_parameters *metaDEMSlant, int which_gr_dem, struct deskew_dem_data *d,
-                         int line, float *tmpbuf, float **backconverted_dem, float **grDem_geo_out, float **grDem_rad_out)
+// DEM lines for a chunk of the image (with the line on either side),
+// as get_dem_line makes them.
+typedef struct {
+  int first, n;                 // lines first .. first+n-1 are held
+  int ns;
+  float *rad, *geo, *backconverted;
+} dem_rows;
+
+static void dem_rows_init(dem_rows *rows, int max_lines, int ns)
 {
-  float *geoDemLine, *radDemLine, *backconvertedDemLine;
-  if(line >= d->numLines) {
-    geoDemLine = radDemLine = backconvertedDemLine = NULL;
-  }
-  else {
-    geoDemLine = MALLOC(sizeof(float)*d->numSamples);
-    radDemLine = MALLOC(sizeof(float)*d->numSamples);
-    backconvertedDemLine = MALLOC(sizeof(float)*d->numSamples);
+  rows->first = rows->n = 0;
+  rows->ns = ns;
+  rows->rad = MALLOC(sizeof(float)*ns*max_lines);
+  rows->geo = MALLOC(sizeof(float)*ns*max_lines);
+  rows->backconverted = MALLOC(sizeof(float)*ns*max_lines);
+}
+
+static void dem_rows_free(dem_rows *rows)
+{
+  FREE(rows->rad);
+  FREE(rows->geo);
+  FREE(rows->backconverted);
+}
 
+static void load_dem_rows(FILE * inDemGroundFp, meta_parameters *metaDEMground, FILE *inDemSlantFp,
+                          meta_parameters *metaDEMSlant, int which_gr_dem, struct deskew_dem_data *d,
+                          int first, int last, float *tmpbuf, dem_rows *rows)
+{
+  int line, ns = rows->ns;
+  if (first < 0) first = 0;
+  if (last > d->numLines - 1) last = d->numLines - 1;
+  rows->first = first;
+  rows->n = last - first + 1;
+  for (line = first; line <= last; ++line) {
+    int ii = line - first;
     get_dem_line(inDemGroundFp, metaDEMground, inDemSlantFp, metaDEMSlant, which_gr_dem,
-                 d, line, tmpbuf, backconvertedDemLine, geoDemLine, radDemLine);
+                 d, line, tmpbuf, rows->backconverted + ii*ns, rows->geo + ii*ns,
+                 rows->rad + ii*ns);
   }
+}
+
+// A line of one of the DEMs in rows, NULL off the top or bottom of the image
+static float *dem_row(dem_rows *rows, float *which, int line)
+{
+  if (line < rows->first || line >= rows->first + rows->n)
+    return NULL;
+  return which + (line - rows->first)*rows->ns;
+}
+
+// Number of threads deskew_dem calculates the radiometric corrections
+// with; 0 means one per processor.
+static int deskew_thread_count = 0;
 
-  FREE(grDem_geo_out[0]);
-  FREE(backconverted_dem[0]);
-  FREE(grDem_rad_out[0]);
+void deskew_dem_set_thread_count(int thread_count)
+{
+  deskew_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+// The radiometric corrections are calculated a chunk of lines at a time,
+// in blocks of DESKEW_BLOCK_LINES handed out to the threads.  Each block
+// starts its own rolling rows, so it costs two extra lines of
+// geolocation.
+#define DESKEW_BLOCK_LINES 16
+
+typedef struct {
+  meta_parameters *meta;        // of the SAR image
+  dem_rows *dem;
+  int numLines;
+  int first_line, n_lines;      // the lines of the chunk
+  float *corr, *angles;         // results, n_lines x ns each
+  gint next_block;
+} deskew_chunk;
+
+typedef struct {
+  deskew_chunk *c;
+  rolling_rows rows;
+  int last_pushed;              // bottom line in rows, -1 if none
+} deskew_worker;
+
+// The corrections (sign included, negative means layover) and terrain
+// slope angles for the lines of the block starting at first (relative
+// to the chunk).
+static void deskew_block(deskew_chunk *c, deskew_worker *w, int first, int last)
+{
+  meta_parameters *meta = c->meta;
+  dem_rows *dem = c->dem;
+  int ns = meta->general->sample_count;
+  int ii, x;
+
+  for (ii = first; ii < last; ++ii) {
+    int y = c->first_line + ii;
+    float *corrections = c->corr + ii*ns;
+    float *angles = c->angles + ii*ns;
+
+    if (y == 0 || y >= c->numLines - 1) {
+      for (x = 0; x < ns; ++x) {
+        corrections[x] = 1.0;
+        angles[x] = 0;
+      }
+      continue;
+    }
 
-  int x;
-  for(x = 0; x < 2; x++) {
-    grDem_rad_out[x] = grDem_rad_out[x+1];
-    grDem_geo_out[x] = grDem_geo_out[x+1];
-    backconverted_dem[x] = backconverted_dem[x+1];
+    if (w->last_pushed != y) {
+      push_next_point_line(&w->rows, meta, dem_row(dem, dem->rad, y-1), y-1);
+      push_next_point_line(&w->rows, meta, dem_row(dem, dem->rad, y), y);
+    }
+    push_next_point_line(&w->rows, meta, dem_row(dem, dem->rad, y+1), y+1);
+    w->last_pushed = y+1;
+
+    // method from rtc
+    rolling_rows *r = &w->rows;
+    Vector satpos = get_satpos(meta, y);
+    for (x = 1; x < ns-1; ++x) {
+      Vector normal, p, p_next, vertical;
+      calculate_normal(r, x, &normal);
+      get_point(&r->row[1], x, &p);
+      get_point(&r->next, x, &p_next);
+      get_point(&r->vertical, x, &vertical);
+      corrections[x] = calculate_correction(meta, y, x, &satpos, &normal, &p, &p_next);
+      angles[x] = R2D * acos(vector_dot(&normal, &vertical));
+    }
+    corrections[0] = corrections[ns-1] = 1.0;
+    angles[0] = angles[ns-1] = 0;
   }
+}
+
+static gpointer deskew_thread(gpointer data)
+{
+  deskew_worker *w = data;
+  deskew_chunk *c = w->c;
+  int first;
+
+  while ((first = g_atomic_int_add(&c->next_block, DESKEW_BLOCK_LINES))
+         < c->n_lines)
+    deskew_block(c, w, first, MIN(first + DESKEW_BLOCK_LINES, c->n_lines));
+  return NULL;
+}
+
+static void deskew_chunk_corrections(deskew_chunk *c, deskew_worker *workers,
+                                     int n_threads)
+{
+  int ii;
+  int n_blocks = (c->n_lines + DESKEW_BLOCK_LINES - 1) / DESKEW_BLOCK_LINES;
+  if (n_threads > n_blocks) n_threads = n_blocks;
+
+  c->next_block = 0;
+  GThread **threads = g_new(GThread *, n_threads);
+  for (ii=0; ii<n_threads; ++ii)
+    workers[ii].c = c;
+  for (ii=1; ii<n_threads; ++ii)
+    threads[ii] = g_thread_new("deskew_dem", deskew_thread, &workers[ii]);
+  deskew_thread(&workers[0]);
+  for (ii=1; ii<n_threads; ++ii)
+    g_thread_join(threads[ii]);
+  g_free(threads);
+}
+
+/* deskew_dem reads the SAR image, and writes its output and the mask,
+   either through image files or through MemoryImages (see deskew_dem_mem).
+   Only one of fp and mem is set. */
+typedef struct {
+  FILE *fp;
+  MemoryImage *mem;
+} image_io;
+
+static void io_get_lines(image_io *io, meta_parameters *meta, int band,
+                         int line, int n, float *buf)
+{
+  if (io->mem)
+    memcpy(buf, memory_image_line(io->mem, band, line),
+           sizeof(float)*n*io->mem->meta->general->sample_count);
+  else
+    get_band_float_lines(io->fp, meta, band, line, n, buf);
+}
 
-  grDem_rad_out[2] = radDemLine;
-  grDem_geo_out[2] = geoDemLine;
-  backconverted_dem[2] = backconvertedDemLine;
+static void io_put_line(image_io *io, meta_parameters *meta, int band,
+                        int line, const float *buf)
+{
+  if (io->mem)
+    memcpy(memory_image_line(io->mem, band, line), buf,
+           sizeof(float)*io->mem->meta->general->sample_count);
+  else
+    put_band_float_line(io->fp, meta, band, line, buf);
 }
 
-static void filter_mask(char *maskName)
+static void filter_mask(image_io *mask, meta_parameters *meta)
 {
   int ii, jj;
-  meta_parameters *meta = meta_read(maskName);
   int nl = meta->general->line_count;
   int ns = meta->general->sample_count;
-  FILE *fp = fopenImage (maskName, "r+b");
   float *buf = MALLOC(sizeof(float)*ns*5);
 
   int iter=1;
@@ -769,7 +977,7 @@ static void filter_mask(char *maskName)
     int num_image=0; 
     for (ii=0; ii<nl-5; ++ii) {
 
-      get_float_lines(fp, meta, ii, 5, buf);
+      io_get_lines(mask, meta, 0, ii, 5, buf);
 
       int num_line = 0;
       int l = 2;         // this is the line we are working on, in the buffer
@@ -824,7 +1032,7 @@ static void filter_mask(char *maskName)
       }
        
       if (num_line>0)
-        put_float_line(fp, meta, ii+2, buf + 2*ns);
+        io_put_line(mask, meta, 0, ii+2, buf + 2*ns);
       num_image += num_line;
     }
     if (num_image == 0)
@@ -832,7 +1040,6 @@ static void filter_mask(char *maskName)
     total += num_image;
     ++iter;
   }
-  FCLOSE(fp);
 
   if (orig == 0) {
     asfPrintStatus("Layover smoothing took %d iterations.\n", iter);
@@ -844,19 +1051,22 @@ static void filter_mask(char *maskName)
 
   asfPrintStatus("Writing filtered mask...\n");
   FREE(buf); 
-  meta_free(meta);
 }
 
-/* inSarName can be NULL, in this case doRadiometric is ignored */
-/* inMaskName can be NULL, in this case outMaskName is ignored */
-int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
-            char *inSarName, int doRadiometric, char *inMaskName,
-            char *outMaskName, int fill_holes, int fill_value,
+/* Does the work of deskew_dem and deskew_dem_mem.  The SAR image comes
+   from inSarName or inSarImage, the output goes to outName or
+   *outImage, and the mask to outMaskName or *outMaskImage. */
+static int deskew_dem_io (char *inDemSlant, char *inDemGround,
+            char *outName, MemoryImage **outImage,
+            char *inSarName, MemoryImage *inSarImage, int doRadiometric,
+            char *inMaskName, char *outMaskName, MemoryImage **outMaskImage,
+            int fill_holes, int fill_value,
             int which_gr_dem, int use_nearest_neighbor)
 {
   float *inSarLine;
-  FILE *inDemSlantFp, *inDemGroundFp = NULL, *inSarFp, *outFp,
-    *inMaskFp = NULL, *outMaskFp = NULL;
+  FILE *inDemSlantFp, *inDemGroundFp = NULL, *inMaskFp = NULL;
+  image_io inSar = { NULL, NULL }, out = { NULL, NULL },
+    outMask = { NULL, NULL };
   meta_parameters *metaDEMslant, *metaDEMground = NULL, *outMeta,
     *inSarMeta, *inMaskMeta = NULL;
   char **bands = NULL;
@@ -867,11 +1077,10 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   int band_count = 1;           // in case no SAR image is passed in
   int save_locals = 0;          // locals calc doesn't seem to be working
 
-  inSarFlag = inSarName != NULL;
+  inSarFlag = inSarName != NULL || inSarImage != NULL;
   inMaskFlag = inMaskName != NULL;
-  outMaskFlag = outMaskName != NULL;
+  outMaskFlag = outMaskName != NULL || outMaskImage != NULL;
 
-  inSarFp = NULL;
   inSarMeta = NULL;
 
 /*Extract metadata*/
@@ -886,7 +1095,10 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
     return FALSE;
   }
   if (inSarFlag) {
-    inSarMeta = meta_read (inSarName);
+    if (inSarImage)
+      inSarMeta = meta_copy (inSarImage->meta);
+    else
+      inSarMeta = meta_read (inSarName);
     band_count = inSarMeta->general->band_count;
     d.meta = inSarMeta;
     if (inSarMeta->sar->image_type == 'P') {
@@ -940,9 +1152,13 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   if (inDemGround)
     inDemGroundFp = fopenImage (inDemGround, "rb");
 
-  outFp = fopenImage (outName, "wb");
+  if (outName)
+    out.fp = fopenImage (outName, "wb");
   if (inSarFlag) {
-    inSarFp = fopenImage (inSarName, "rb");
+    if (inSarImage)
+      inSar.mem = inSarImage;
+    else
+      inSar.fp = fopenImage (inSarName, "rb");
     outMeta->general->band_count = inSarMeta->general->band_count;
     strcpy (outMeta->general->bands, inSarMeta->general->bands);
   }
@@ -968,7 +1184,10 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   }
 
 /* output file's metadata is all set, now */
-  meta_write (outMeta, outName);
+  if (outName)
+    meta_write (outMeta, outName);
+  else
+    out.mem = *outImage = memory_image_new (outMeta);
 
 /* Blather at user about what is going on */
   strcpy (msg, "");
@@ -997,16 +1216,13 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
     inSarLine = NULL;
   }
 
-  float corrections[ns];
-  float angles[ns];
+  float *corrections;
+  float *angles;
+  float sideLine[ns];
   float maskLine[ns];
   float outLine[ns];
-  Vector verticals[ns];
-  float *localRadDemLines[3] = { NULL, NULL, NULL };
-  float *localGeoDemLines[3] = { NULL, NULL, NULL };
-  float *localbackconvertedDemLines[3] = { NULL, NULL, NULL };
-  Vector **localVectors[3] = { NULL, NULL, NULL };
-  Vector nextVectors[ns];
+  float *localGeoDemLines[3];
+  float *localbackconvertedDemLines[3];
 
   n_layover = n_shadow = n_user = 0;
 
@@ -1033,20 +1249,66 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
 /*Open the mask, if we have one*/
   if (inMaskFlag)
     inMaskFp = fopenImage (inMaskName, "rb");
-  if (outMaskFlag)
-    outMaskFp = fopenImage (outMaskName, "wb");
+  if (outMaskName) {
+    outMask.fp = fopenImage (outMaskName, "wb");
+  }
+  else if (outMaskImage) {
+    // the mask has just 1 band, see below
+    meta_parameters *maskMeta = meta_copy (outMeta);
+    maskMeta->general->band_count = 1;
+    strcpy (maskMeta->general->bands, "LAYOVER_MASK");
+    maskMeta->general->radiometry = r_AMP;
+    outMask.mem = *outMaskImage = memory_image_new (maskMeta);
+    meta_free (maskMeta);
+  }
 
-  push_dem_lines(inDemGroundFp, metaDEMground, inDemSlantFp, metaDEMslant, which_gr_dem,
-                 &d, 0, outLine, localbackconvertedDemLines, localGeoDemLines, localRadDemLines);
-  if(doRadiometric)
-    push_next_vector_line(localVectors, nextVectors, verticals, inSarMeta, localRadDemLines[2], 0);
+  // The image is done a chunk of lines at a time.  The DEM lines of the
+  // chunk (and the line on either side) are read first, then the
+  // radiometric corrections for the whole chunk are calculated by the
+  // threads, then the lines are finished here one by one.
+  int n_threads = deskew_thread_count > 0 ? deskew_thread_count
+    : g_get_num_processors();
+  int chunk_lines = n_threads*DESKEW_BLOCK_LINES;
+  dem_rows dem;
+  dem_rows_init(&dem, chunk_lines+2, ns);
+  deskew_chunk chunk;
+  deskew_worker *workers = NULL;
+  chunk.meta = inSarMeta;
+  chunk.dem = &dem;
+  chunk.numLines = d.numLines;
+  chunk.first_line = chunk.n_lines = 0;
+  chunk.corr = chunk.angles = NULL;
+  if (doRadiometric) {
+    chunk.corr = MALLOC(sizeof(float)*ns*chunk_lines);
+    chunk.angles = MALLOC(sizeof(float)*ns*chunk_lines);
+    workers = MALLOC(sizeof(deskew_worker)*n_threads);
+    for (x = 0; x < n_threads; ++x) {
+      rolling_rows_init(&workers[x].rows, ns);
+      workers[x].last_pushed = -1;
+    }
+  }
 
   /*Rectify data.*/
   for (y = 0; y < d.numLines; y++) {
-    push_dem_lines(inDemGroundFp, metaDEMground, inDemSlantFp, metaDEMslant, which_gr_dem,
-                   &d, y+1, outLine, localbackconvertedDemLines, localGeoDemLines, localRadDemLines);
-    if(y < d.numLines - 1 && doRadiometric)
-      push_next_vector_line(localVectors, nextVectors, verticals, inSarMeta, localRadDemLines[2], y+1);
+    if (y == chunk.first_line + chunk.n_lines) {
+      // start of a chunk
+      chunk.first_line = y;
+      chunk.n_lines = MIN(chunk_lines, d.numLines - y);
+      load_dem_rows(inDemGroundFp, metaDEMground, inDemSlantFp, metaDEMslant,
+                    which_gr_dem, &d, y-1, y+chunk.n_lines, outLine, &dem);
+      if (doRadiometric)
+        deskew_chunk_corrections(&chunk, workers, n_threads);
+    }
+    for (x = 0; x < 3; ++x) {
+      localGeoDemLines[x] = dem_row(&dem, dem.geo, y-1+x);
+      localbackconvertedDemLines[x] = dem_row(&dem, dem.backconverted, y-1+x);
+    }
+    if (doRadiometric) {
+      corrections = chunk.corr + (y-chunk.first_line)*ns;
+      angles = chunk.angles + (y-chunk.first_line)*ns;
+    }
+    else
+      corrections = angles = NULL;
 
     /* Make an empty mask */
     for (x = 0; x < ns; ++x)
@@ -1070,9 +1332,9 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
 
     // Record the incidence angles
     for (x=0; x<ns; ++x) {
-      corrections[x] = (float)(R2D*d.incidAng[x]);
+      sideLine[x] = (float)(R2D*d.incidAng[x]);
     }
-    put_band_float_line(sideProductsFp, side_meta, 0, y, corrections); 
+    put_band_float_line(sideProductsFp, side_meta, 0, y, sideLine); 
     put_band_float_line(sideProductsFp, side_meta, 1, y, localGeoDemLines[1]);
 
     // Record the local incidence angles
@@ -1081,9 +1343,8 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
       if (y > 0 && y < d.numLines - 1) {
         Vector satpos = get_satpos(inSarMeta, y);
         vector_multiply(&satpos, 1./vector_magnitude(&satpos));
-        corrections[0] = corrections[ns-1] = 0;
+        sideLine[0] = sideLine[ns-1] = 0;
         for (x=1; x<ns-1; ++x) {
-          //Vector *normal = calculate_normal(localVectors, x);
           Vector normal, R;
           normal.x=(localGeoDemLines[1][x-1]-localGeoDemLines[1][x+1])/(2*d.grPixelSize);
           normal.y=(localGeoDemLines[2][x]-localGeoDemLines[0][x])/(2*d.grPixelSize);
@@ -1092,25 +1353,22 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
           R.x = -d.sinIncidAng[x];
           R.y = 0;
           R.z = d.cosIncidAng[x];
-          corrections[x] = R2D * acos(vector_dot(&normal, &R));
-          //corrections[x] = calculate_local_incidence(&normal, &satpos, localVectors[1][x]);
+          sideLine[x] = R2D * acos(vector_dot(&normal, &R));
         }
       }
       else {
         for (x=0; x<ns; ++x)
-          corrections[x] = 0;
+          sideLine[x] = 0;
       }
-      put_band_float_line(sideProductsFp, side_meta, 2, y, corrections);
+      put_band_float_line(sideProductsFp, side_meta, 2, y, sideLine);
     }
 
     if (doRadiometric) {
       if (y > 0 && y < d.numLines - 1) {
 #ifndef ALTERNATIVE_NORMALS
-        // method from rtc
-        Vector satpos = get_satpos(inSarMeta, y);
+        // method from rtc -- the corrections were calculated along with
+        // the rest of the chunk (deskew_block)
         for(x=1; x < ns-1; ++x) {
-          Vector * normal = calculate_normal(localVectors, x);
-          corrections[x] = calculate_correction(inSarMeta, y, x, &satpos, normal, localVectors[1][x], &nextVectors[x]);
           // If the Ulander correction is ever negative, that is layover
           if (corrections[x] < 0) {
             if (maskLine[x] == MASK_NORMAL) {
@@ -1119,8 +1377,6 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
             }
             corrections[x] *= -1;
           }
-          angles[x] = R2D * acos(vector_dot(normal, &verticals[x]));
-          vector_free(normal);
         }
 #else
         // method we'd like to use here in deskew_dem
@@ -1143,24 +1399,16 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
           vector_free(RX);
         }
 #endif
-        // now store everything
-        put_band_float_line(sideProductsFp, side_meta, 2, y, corrections);
-        put_band_float_line(sideProductsFp, side_meta, 3, y, angles);
-      }
-      else {
-        for(x = 0; x < ns; x++) {
-          corrections[x] = 1.0;
-          angles[x] = 0;
-        }
-        put_band_float_line(sideProductsFp, side_meta, 2, y, corrections);
-        put_band_float_line(sideProductsFp, side_meta, 3, y, angles);
       }
+      // now store everything (the top and bottom lines have no correction)
+      put_band_float_line(sideProductsFp, side_meta, 2, y, corrections);
+      put_band_float_line(sideProductsFp, side_meta, 3, y, angles);
     }
 
     // do this line in all of the bands
     for (b = 0; b < band_count; ++b) {
       if (inSarFlag) {
-        get_band_float_line (inSarFp, inSarMeta, b, y, inSarLine);
+        io_get_lines (&inSar, inSarMeta, b, y, 1, inSarLine);
 
         geo_compensate (&d, localGeoDemLines[1], inSarLine, outLine,
                         ns, !use_nearest_neighbor, maskLine, y);
@@ -1179,10 +1427,10 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
       mask_float_line (ns, fill_value, outLine,
                        maskLine, localbackconvertedDemLines[1], &d, !fill_holes);
 
-      put_band_float_line (outFp, outMeta, b, y, outLine);
+      io_put_line (&out, outMeta, b, y, outLine);
     }
     if (outMaskFlag)
-      put_float_line (outMaskFp, outMeta, y, maskLine);
+      io_put_line (&outMask, outMeta, 0, y, maskLine);
 
     asfLineMeter (y, d.numLines);
   }
@@ -1198,8 +1446,6 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
 
 /*Write the updated mask*/
   if (outMaskFlag) {
-    FCLOSE (outMaskFp);
-
     // the mask has just 1 band, regardless of how many input has
     outMeta->general->band_count = 1;
     strcpy (outMeta->general->bands, "LAYOVER_MASK");
@@ -1208,10 +1454,15 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
     outMeta->general->radiometry = r_AMP;
 
     // write the mask's metadata, then print mask stats
-    meta_write (outMeta, outMaskName);
+    if (outMaskName) {
+      FCLOSE (outMask.fp);
+      meta_write (outMeta, outMaskName);
+      outMask.fp = fopenImage (outMaskName, "r+b");
+    }
   
     asfPrintStatus("Cleaning up layover/shadow mask...\n");
-    filter_mask(outMaskName);
+    filter_mask(&outMask, outMeta);
+    FCLOSE (outMask.fp);
 
     int tot = ns * d.numLines;
     asfPrintStatus ("Mask Statistics:\n"
@@ -1224,10 +1475,13 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   }
 
 /* Clean up & skidattle */
-  for(y = 0; y < 3; ++y) {
-    FREE(localRadDemLines[y]);
-    FREE(localGeoDemLines[y]);
-    FREE(localbackconvertedDemLines[y]);
+  dem_rows_free(&dem);
+  if (doRadiometric) {
+    for (x = 0; x < n_threads; ++x)
+      rolling_rows_free(&workers[x].rows);
+    FREE(workers);
+    FREE(chunk.corr);
+    FREE(chunk.angles);
   }
 
   for (y = 0; y < inSarMeta->general->band_count; y++) {
@@ -1235,23 +1489,14 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   }
   FREE(bands);
 
-  for(y = 0; y < 3; ++y) {
-    if (localVectors[y]) {
-      for(x = 0; x < ns; ++x) {
-        vector_free(localVectors[y][x]);
-      }
-    }
-    FREE(localVectors[y]);
-  }
-
   if (inSarFlag) {
     FREE (inSarLine);
-    FCLOSE (inSarFp);
+    FCLOSE (inSar.fp);
     meta_free (inSarMeta);
   }
   FCLOSE (inDemSlantFp);
   FCLOSE (inDemGroundFp);
-  FCLOSE (outFp);
+  FCLOSE (out.fp);
   meta_free (metaDEMslant);
   if (metaDEMground)
     meta_free (metaDEMground);
@@ -1272,3 +1517,34 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
 
   return TRUE;
 }
+
+/* inSarName can be NULL, in this case doRadiometric is ignored */
+/* inMaskName can be NULL, in this case outMaskName is ignored */
+int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
+            char *inSarName, int doRadiometric, char *inMaskName,
+            char *outMaskName, int fill_holes, int fill_value,
+            int which_gr_dem, int use_nearest_neighbor)
+{
+  return deskew_dem_io (inDemSlant, inDemGround, outName, NULL,
+                        inSarName, NULL, doRadiometric, inMaskName,
+                        outMaskName, NULL, fill_holes, fill_value,
+                        which_gr_dem, use_nearest_neighbor);
+}
+
+/* Same as deskew_dem, but the SAR image is taken from memory, and the
+   output image and mask are left in memory (in *out and *outMask) instead
+   of being written out.  The caller frees them with memory_image_free.
+   outMask can be NULL, if no mask is wanted. */
+int deskew_dem_mem (char *inDemSlant, char *inDemGround, MemoryImage **out,
+            MemoryImage *inSar, int doRadiometric, char *inMaskName,
+            MemoryImage **outMask, int fill_holes, int fill_value,
+            int which_gr_dem, int use_nearest_neighbor)
+{
+  *out = NULL;
+  if (outMask)
+    *outMask = NULL;
+  return deskew_dem_io (inDemSlant, inDemGround, NULL, out,
+                        NULL, inSar, doRadiometric, inMaskName,
+                        NULL, outMask, fill_holes, fill_value,
+                        which_gr_dem, use_nearest_neighbor);
+}
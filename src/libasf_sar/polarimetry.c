@@ -4,6 +4,7 @@
 #include "asf_nan.h"
 #include "asf_complex.h"
 #include <assert.h>
+#include <glib.h>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_complex.h>
 #include <gsl/gsl_complex_math.h>
@@ -11,6 +12,14 @@
 
 #define EPS 1.E-15
 
+// The coherency matrix T3 is Hermitian, so it is kept as its real
+// diagonal and the real and imaginary parts of its upper triangle.
+enum {
+  COH_T11, COH_T22, COH_T33,
+  COH_T12_RE, COH_T12_IM, COH_T13_RE, COH_T13_IM, COH_T23_RE, COH_T23_IM,
+  COH_ELEMENTS
+};
+
 typedef struct {
    int current_row;
    int nrows;  // # in held in memory, not total image rows
@@ -30,8 +39,16 @@ typedef struct {
    floatVector *pauli_buffer;
    floatVector **pauli_lines;
 
-   complexMatrix **coh_buffer;
-   complexMatrix ***coh_lines;
+   // coherency matrix of each pixel of the loaded rows, a row being
+   // COH_ELEMENTS planes of sample_count values each
+   float *coh_buffer;
+   float **coh_lines;
+
+   // the coherency matrices summed down each column of the loaded rows,
+   // kept up to date as rows come and go, and the number of pixels in
+   // each column sum that have any power
+   double *coh_sum;
+   int *coh_count;
 
    int amp_band;
    int hh_amp_band, hh_phase_band;
@@ -124,6 +141,10 @@ polarimetric_image_rows_new(meta_parameters *meta, int nrows, int multi)
       self->c3_data_buffer = CALLOC(nrows*ns, sizeof(quadPolC3Float));
       self->c3_lines = CALLOC(nrows, sizeof(quadPolC3Float*));
     }
+    else if (meta->general->image_data_type == POLARIMETRIC_T3_MATRIX) {
+      self->t3_data_buffer = CALLOC(nrows*ns, sizeof(quadPolT3Float));
+      self->t3_lines = CALLOC(nrows, sizeof(quadPolT3Float*));
+    }
 
     // initially, the line pointers point at their natural locations in
     // the buffer
@@ -137,6 +158,10 @@ polarimetric_image_rows_new(meta_parameters *meta, int nrows, int multi)
       for (i=0; i<nrows; ++i)
 	self->c3_lines[i] = &(self->c3_data_buffer[ns*i]);
     }
+    if (meta->general->image_data_type == POLARIMETRIC_T3_MATRIX) {
+      for (i=0; i<nrows; ++i)
+	self->t3_lines[i] = &(self->t3_data_buffer[ns*i]);
+    }
 
     // these guys are the pauli basis elements we've calculated for the
     // loaded rows
@@ -145,13 +170,14 @@ polarimetric_image_rows_new(meta_parameters *meta, int nrows, int multi)
     for (i=0; i<nrows; ++i)
         self->pauli_lines[i] = &(self->pauli_buffer[ns*i]);
 
-    // coherency matrix elements for the loaded rows
-    self->coh_buffer = MALLOC(nrows*ns*sizeof(complexMatrix*));
-    for (i=0; i<nrows*ns; ++i)
-        self->coh_buffer[i] = complex_matrix_new(3,3);
-    self->coh_lines = MALLOC(nrows*sizeof(complexMatrix**));
+    // coherency matrix elements for the loaded rows, and their column
+    // sums -- all zero, as are the rows off the top of the image
+    self->coh_buffer = CALLOC(nrows*ns*COH_ELEMENTS, sizeof(float));
+    self->coh_lines = MALLOC(nrows*sizeof(float*));
     for (i=0; i<nrows; ++i)
-        self->coh_lines[i] = &(self->coh_buffer[ns*i]);
+        self->coh_lines[i] = &(self->coh_buffer[ns*COH_ELEMENTS*i]);
+    self->coh_sum = CALLOC(ns*COH_ELEMENTS, sizeof(double));
+    self->coh_count = CALLOC(ns, sizeof(int));
 
     // band numbers in the input file
     self->amp_band = -1;
@@ -280,38 +306,85 @@ static void calculate_pauli_for_row(PolarimetricImageRows *self, int n)
 
 static void calculate_coherence_for_row(PolarimetricImageRows *self, int n)
 {
-    // [ A*A  B*A  C*A ]    A = HH + VV
-    // [ A*B  B*B  C*B ]    B = HH - VV
-    // [ A*C  B*C  C*C ]    C = 2*HV
+    // T3 = 0.5 * k k^H, with k = [ HH+VV, HH-VV, HV+VH ]
     int j, ns=self->meta->general->sample_count;
+    float *t11 = self->coh_lines[n] + COH_T11*ns;
+    float *t22 = self->coh_lines[n] + COH_T22*ns;
+    float *t33 = self->coh_lines[n] + COH_T33*ns;
+    float *t12_re = self->coh_lines[n] + COH_T12_RE*ns;
+    float *t12_im = self->coh_lines[n] + COH_T12_IM*ns;
+    float *t13_re = self->coh_lines[n] + COH_T13_RE*ns;
+    float *t13_im = self->coh_lines[n] + COH_T13_IM*ns;
+    float *t23_re = self->coh_lines[n] + COH_T23_RE*ns;
+    float *t23_im = self->coh_lines[n] + COH_T23_IM*ns;
+
     if (self->meta->general->image_data_type == POLARIMETRIC_S2_MATRIX ||
         self->meta->general->image_data_type == POLARIMETRIC_IMAGE) {
       for (j=0; j<ns; ++j) {
         quadPolS2Float q = self->s2_lines[n][j];
-        complexVector v = //complex_vector_normalize(
-          complex_vector_new(
-            complex_add(q.hh, q.vv),
-            complex_sub(q.hh, q.vv),
-            complex_add(q.hv, q.vh))/*)*/;
-        complexVector vc = complex_vector_conj(v);
-
-        complexMatrix *m = self->coh_lines[n][j];
-
-        complex_matrix_set(m,0,0,complex_mul(vc.A, v.A));
-        complex_matrix_set(m,0,1,complex_mul(vc.A, v.B));
-        complex_matrix_set(m,0,2,complex_mul(vc.A, v.C));
-
-        complex_matrix_set(m,1,0,complex_mul(vc.B, v.A));
-        complex_matrix_set(m,1,1,complex_mul(vc.B, v.B));
-        complex_matrix_set(m,1,2,complex_mul(vc.B, v.C));
+        complexFloat a = complex_add(q.hh, q.vv);
+        complexFloat b = complex_sub(q.hh, q.vv);
+        complexFloat c = complex_add(q.hv, q.vh);
+
+        t11[j] = 0.5*(a.real*a.real + a.imag*a.imag);
+        t22[j] = 0.5*(b.real*b.real + b.imag*b.imag);
+        t33[j] = 0.5*(c.real*c.real + c.imag*c.imag);
+        t12_re[j] = 0.5*(a.real*b.real + a.imag*b.imag);
+        t12_im[j] = 0.5*(a.imag*b.real - a.real*b.imag);
+        t13_re[j] = 0.5*(a.real*c.real + a.imag*c.imag);
+        t13_im[j] = 0.5*(a.imag*c.real - a.real*c.imag);
+        t23_re[j] = 0.5*(b.real*c.real + b.imag*c.imag);
+        t23_im[j] = 0.5*(b.imag*c.real - b.real*c.imag);
+      }
+    }
+    else if (self->meta->general->image_data_type == POLARIMETRIC_C3_MATRIX) {
+      // T3 = N C3 N^T, N being the change from the lexicographic basis
+      // [ HH, sqrt(2)*HV, VV ] to the Pauli basis
+      for (j=0; j<ns; ++j) {
+        quadPolC3Float q = self->c3_lines[n][j];
+        t11[j] = 0.5*(q.c11 + 2.0*q.c13_real + q.c33);
+        t22[j] = 0.5*(q.c11 - 2.0*q.c13_real + q.c33);
+        t33[j] = q.c22;
+        t12_re[j] = 0.5*(q.c11 - q.c33);
+        t12_im[j] = -q.c13_imag;
+        t13_re[j] = M_SQRT1_2*(q.c12_real + q.c23_real);
+        t13_im[j] = M_SQRT1_2*(q.c12_imag - q.c23_imag);
+        t23_re[j] = M_SQRT1_2*(q.c12_real - q.c23_real);
+        t23_im[j] = M_SQRT1_2*(q.c12_imag + q.c23_imag);
+      }
+    }
+    else if (self->meta->general->image_data_type == POLARIMETRIC_T3_MATRIX) {
+      for (j=0; j<ns; ++j) {
+        quadPolT3Float q = self->t3_lines[n][j];
+        t11[j] = q.t11;
+        t22[j] = q.t22;
+        t33[j] = q.t33;
+        t12_re[j] = q.t12_real;
+        t12_im[j] = q.t12_imag;
+        t13_re[j] = q.t13_real;
+        t13_im[j] = q.t13_imag;
+        t23_re[j] = q.t23_real;
+        t23_im[j] = q.t23_imag;
+      }
+    }
+}
 
-        complex_matrix_set(m,2,0,complex_mul(vc.C, v.A));
-        complex_matrix_set(m,2,1,complex_mul(vc.C, v.B));
-        complex_matrix_set(m,2,2,complex_mul(vc.C, v.C));
+// Add (sign=1) or take away (sign=-1) loaded row n's coherency matrices
+// to or from the column sums.
+static void coherence_sum_row(PolarimetricImageRows *self, int n, int sign)
+{
+    int j, k, ns=self->meta->general->sample_count;
+    const float *row = self->coh_lines[n];
 
-        //complex_matrix_scale(m,1./sqrt(2.0));
-        complex_matrix_scale(m,0.5);
-      }
+    for (k=0; k<COH_ELEMENTS; ++k) {
+      double *sum = self->coh_sum + k*ns;
+      const float *t = row + k*ns;
+      for (j=0; j<ns; ++j)
+        sum[j] += sign*t[j];
+    }
+    for (j=0; j<ns; ++j) {
+      if (row[COH_T11*ns+j] + row[COH_T22*ns+j] + row[COH_T33*ns+j] != 0)
+        self->coh_count[j] += sign;
     }
 }
 
@@ -324,8 +397,10 @@ static void polarimetric_image_rows_load_next_row(PolarimetricImageRows *self,
   // don't actually move any data -- update pointers into the
   // buffers
 
-  // FIRST -- slide row pointers
+  // FIRST -- the top row leaves the column sums, and we slide row pointers
   int k;
+  coherence_sum_row(self, 0, -1);
+  float *coh_top = self->coh_lines[0];
   for (k=0; k<self->nrows-1; ++k) {
     if (self->meta->general->image_data_type == POLARIMETRIC_S2_MATRIX ||
         self->meta->general->image_data_type == POLARIMETRIC_IMAGE)
@@ -335,6 +410,7 @@ static void polarimetric_image_rows_load_next_row(PolarimetricImageRows *self,
     else if (self->meta->general->image_data_type == POLARIMETRIC_T3_MATRIX)
       self->t3_lines[k] = self->t3_lines[k+1];
     self->pauli_lines[k] = self->pauli_lines[k+1];
+    self->coh_lines[k] = self->coh_lines[k+1];
   }
   
   // the next line to load will go into the spot we just dumped
@@ -347,6 +423,7 @@ static void polarimetric_image_rows_load_next_row(PolarimetricImageRows *self,
   else if (self->meta->general->image_data_type == POLARIMETRIC_T3_MATRIX)
     self->t3_lines[last] = self->t3_lines[0];
   self->pauli_lines[last] = self->pauli_lines[0];
+  self->coh_lines[last] = coh_top;
   
   self->current_row++;
   
@@ -523,7 +600,9 @@ static void polarimetric_image_rows_load_next_row(PolarimetricImageRows *self,
       self->pauli_lines[last][k].B = 0.0;
       self->pauli_lines[last][k].C = 0.0;
     }
+    memset(self->coh_lines[last], 0, sizeof(float)*ns*COH_ELEMENTS);
   }
+  coherence_sum_row(self, last, 1);
   
   free(amp_buf);
   if (self->meta->general->image_data_type == POLARIMETRIC_S2_MATRIX ||
@@ -604,6 +683,10 @@ static void polarimetric_image_rows_load_new_rows(PolarimetricImageRows *self,
   for (k=0; k<ns; ++k)
     self->amp[k] = 0.0;
 
+  // all of the rows are replaced, so the column sums start over
+  memset(self->coh_sum, 0, sizeof(double)*ns*COH_ELEMENTS);
+  memset(self->coh_count, 0, sizeof(int)*ns);
+
   for (i=0; i<self->nrows; ++i) {
     int row = self->current_row + i;
     get_band_float_line(fin, self->meta, amp_band, row, amp_buf);
@@ -678,6 +761,7 @@ static void polarimetric_image_rows_load_new_rows(PolarimetricImageRows *self,
     }
     else if (self->meta->general->image_data_type == POLARIMETRIC_T3_MATRIX) {
  
+      get_band_float_line(fin, self->meta, self->t11_band, row, amp_buf);
       for (k=0; k<ns; ++k)
 	self->t3_lines[i][k].t11 = amp_buf[k];
 
@@ -717,6 +801,7 @@ static void polarimetric_image_rows_load_new_rows(PolarimetricImageRows *self,
 
     calculate_pauli_for_row(self, i);
     calculate_coherence_for_row(self, i);
+    coherence_sum_row(self, i, 1);
   }
 
   // we multilook the amplitude data now, since we only keep one row
@@ -774,12 +859,10 @@ static void polarimetric_image_rows_free(PolarimetricImageRows* self)
     free(self->pauli_buffer);
     free(self->pauli_lines);
 
-    int i;
-    for (i=0; i<self->nrows*self->meta->general->sample_count; ++i)
-        complex_matrix_free(self->coh_buffer[i]);
-
     free(self->coh_buffer);
     free(self->coh_lines);
+    free(self->coh_sum);
+    free(self->coh_count);
 
     // do not free metadata pointer!
     free(self);
@@ -1016,7 +1099,8 @@ static void dump_class_map(const char *base_filename, int wide)
 
 static double calc_alpha_real(double e)
 {
-  // still not entirely clear why we have to put fabs() here
+  // alpha: acos(|e[0]|), e=unit eigenvector of coherence matrix.  The
+  // phase of e is arbitrary, so only the magnitude of e[0] means anything
   double alpha = acos(fabs(e));
 
   // alpha should be 0-90
@@ -1028,12 +1112,6 @@ static double calc_alpha_real(double e)
   return alpha;
 }
 
-static double calc_alpha(gsl_complex z)
-{
-  // alpha: acos(e[0]), e=eigenvector of coherence matrix
-  return calc_alpha_real(GSL_REAL(z));
-}
-
 static void add_boundary(int wide)
 {
   const char *boundary_file = "classifications/ea_boundary.txt";
@@ -1202,123 +1280,321 @@ static void do_pauli_bands(int band1, int band2, int band3,
   }
 }
 
-static void
-do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
-                   int class_band,
-                   PolarimetricImageRows *img_rows,
-                   int line, int l, int multi, int chunk_size,
-                   gsl_matrix_complex *T, gsl_vector *eval,
-                   gsl_matrix_complex *evec, gsl_eigen_hermv_workspace *ws,
-                   meta_parameters *outMeta, FILE *fout,
-                   float *buf, classifier_t *classifier)
+// The coherency matrices of output line "line", ensemble averaged over
+// the loaded rows, and over hw samples either side.  The averages are
+// running sums along the column sums, so each costs the same whatever
+// the window size.  Only pixels with any power are counted, so the
+// rows off the top and bottom of the image, and any blackfill, do not
+// count; a window without any power at all gets an all-zero matrix.
+static void coherence_window_row(PolarimetricImageRows *self, int hw,
+                                 float *out)
 {
-  if (entropy_band >= 0 || anisotropy_band >= 0 || alpha_band >= 0 || 
-      class_band >= 0)
-  {
-    int ns = outMeta->general->sample_count;
-    int onl = outMeta->general->line_count;
-
-    float *entropy = MALLOC(sizeof(float)*ns);
-    float *anisotropy = MALLOC(sizeof(float)*ns);
-    float *alpha = MALLOC(sizeof(float)*ns);
-
-    // size of the horizontal window, used for ensemble averaging
-    // actual window size is hw*2+1
-    int hw;
-    if (multi)
-      hw = 0; // no horizontal averaging
-    else
-      hw = 2; // 5 pixels averaging horizontally
+    int j, k, ns = self->meta->general->sample_count;
+    const double *sum = self->coh_sum;
+    const int *count = self->coh_count;
+    double acc[COH_ELEMENTS];
+    int n = 0;
+
+    for (k=0; k<COH_ELEMENTS; ++k)
+      acc[k] = 0.0;
+    for (j=0; j<hw && j<ns; ++j) {
+      for (k=0; k<COH_ELEMENTS; ++k)
+        acc[k] += sum[k*ns+j];
+      n += count[j];
+    }
 
-    // coherence -- do ensemble averaging for each element
-    int j;
     for (j=0; j<ns; ++j) {
-      int ii,jj,m;
-      for (ii=0; ii<3; ++ii) {
-        for (jj=0; jj<3; ++jj) {
-          gsl_complex c = gsl_complex_rect(0,0);
-          int k,n=0;
-          for (m=0; m<chunk_size; ++m) {
-            for (k=j-hw;k<=j+hw;++k) {
-              if (k>=0 && k<ns && m+line>l && m+line<onl-l) {
-                ++n;
-                complexFloat f =
-                  img_rows->coh_lines[m][k]->coeff[ii][jj];
-                c = gsl_complex_add_real(c, f.real);
-                c = gsl_complex_add_imag(c, f.imag);
-              }
-            }
-          }
-          if (n>1) {
-            gsl_complex_div_real(c, (float)n);
-          }
-          gsl_matrix_complex_set(T,ii,jj,c);
+      int in = j+hw, out_of = j-hw-1;
+      if (in < ns) {
+        for (k=0; k<COH_ELEMENTS; ++k)
+          acc[k] += sum[k*ns+in];
+        n += count[in];
+      }
+      if (out_of >= 0) {
+        for (k=0; k<COH_ELEMENTS; ++k)
+          acc[k] -= sum[k*ns+out_of];
+        n -= count[out_of];
+      }
+      if (n > 0) {
+        for (k=0; k<COH_ELEMENTS; ++k)
+          out[k*ns+j] = acc[k]/n;
+      }
+      else {
+        for (k=0; k<COH_ELEMENTS; ++k)
+          out[k*ns+j] = 0.0;
+      }
+    }
+}
+
+// Eigenvalues of a coherency matrix (see the COH_* elements), in order
+// of decreasing magnitude, and the magnitudes of the first components
+// of the matching unit eigenvectors -- all the decomposition needs.
+//
+// The eigenvalues are the roots of the characteristic cubic, found in
+// closed form with the trigonometric method, and each eigenvector is
+// the cross product of two rows of T - lambda*I.  That breaks down when
+// two eigenvalues (nearly) coincide, since then T - lambda*I has rank
+// one and the cross products all vanish; FALSE is returned in that case
+// so the caller can fall back to a general eigensolver.
+static int coherency_eigen(const double *t, double *eval, double *e0)
+{
+    double a = t[COH_T11], b = t[COH_T22], c = t[COH_T33];
+    double d_re = t[COH_T12_RE], d_im = t[COH_T12_IM];
+    double e_re = t[COH_T13_RE], e_im = t[COH_T13_IM];
+    double f_re = t[COH_T23_RE], f_im = t[COH_T23_IM];
+    double dd = d_re*d_re + d_im*d_im;
+    double ee = e_re*e_re + e_im*e_im;
+    double ff = f_re*f_re + f_im*f_im;
+    int i, k;
+
+    if (a == 0 && b == 0 && c == 0 && dd == 0 && ee == 0 && ff == 0) {
+      // what the general eigensolver says about an all-zero matrix
+      for (k=0; k<3; ++k) {
+        eval[k] = 0.0;
+        e0[k] = k == 0 ? 1.0 : 0.0;
+      }
+      return TRUE;
+    }
+
+    // with T = p*I + B: p is the mean eigenvalue, and the eigenvalues
+    // of B are 2*sqrt(r)*cos(phi + 2*pi*k/3), where r = tr(B^2)/6 and
+    // cos(3*phi) = det(B)/(2*r^(3/2))
+    double p = (a + b + c)/3.0;
+    double ap = a - p, bp = b - p, cp = c - p;
+    double r = (ap*ap + bp*bp + cp*cp + 2.0*(dd + ee + ff))/6.0;
+    // Re(d * f * conj(e))
+    double dfe = (d_re*f_re - d_im*f_im)*e_re + (d_re*f_im + d_im*f_re)*e_im;
+    double det = ap*bp*cp + 2.0*dfe - ap*ff - bp*ee - cp*dd;
+
+    if (r <= 0.0)
+      return FALSE;
+
+    double sr = sqrt(r);
+    double cos3phi = det/(2.0*r*sr);
+    if (cos3phi > 1.0) cos3phi = 1.0;
+    if (cos3phi < -1.0) cos3phi = -1.0;
+    double phi = acos(cos3phi)/3.0;
+
+    double lambda[3];
+    lambda[0] = p + 2.0*sr*cos(phi);
+    lambda[2] = p + 2.0*sr*cos(phi + 2.0*M_PI/3.0);
+    lambda[1] = 3.0*p - lambda[0] - lambda[2];
+
+    double scale = MAX(fabs(lambda[0]), fabs(lambda[2]));
+    double tol = 1e-12*scale*scale*scale*scale;
+    double u[3];
+
+    for (k=0; k<3; ++k) {
+      // the rows of T - lambda*I: (a', d, e), (d*, b', f), (e*, f*, c')
+      double row_re[3][3] = {
+        { a - lambda[k], d_re, e_re },
+        { d_re, b - lambda[k], f_re },
+        { e_re, f_re, c - lambda[k] } };
+      double row_im[3][3] = {
+        { 0.0, d_im, e_im },
+        { -d_im, 0.0, f_im },
+        { -e_im, -f_im, 0.0 } };
+
+      // the longest of the three cross products of pairs of rows
+      double best = 0.0, best_0 = 0.0;
+      for (i=0; i<3; ++i) {
+        const double *xr = row_re[i==2 ? 1 : 0], *xi = row_im[i==2 ? 1 : 0];
+        const double *yr = row_re[i==0 ? 1 : 2], *yi = row_im[i==0 ? 1 : 2];
+        // v = x cross y, without conjugation: each v_m is
+        // x_(m+1)*y_(m+2) - x_(m+2)*y_(m+1)
+        double len = 0.0, v0 = 0.0;
+        int m;
+        for (m=0; m<3; ++m) {
+          int m1 = (m+1)%3, m2 = (m+2)%3;
+          double vr = xr[m1]*yr[m2] - xi[m1]*yi[m2]
+            - xr[m2]*yr[m1] + xi[m2]*yi[m1];
+          double vi = xr[m1]*yi[m2] + xi[m1]*yr[m2]
+            - xr[m2]*yi[m1] - xi[m2]*yr[m1];
+          double vv = vr*vr + vi*vi;
+          len += vv;
+          if (m == 0)
+            v0 = vv;
+        }
+        if (len > best) {
+          best = len;
+          best_0 = v0;
         }
       }
-      
-      gsl_eigen_hermv(T, eval, evec, ws);
-      gsl_eigen_hermv_sort(eval, evec, GSL_EIGEN_SORT_ABS_DESC);
-      
-      double e1 = gsl_vector_get(eval, 0);
-      double e2 = gsl_vector_get(eval, 1);
-      double e3 = gsl_vector_get(eval, 2);
-      
-      double eT = e1+e2+e3;
-      
-      double P1 = e1/eT;
-      double P2 = e2/eT;
-      double P3 = e3/eT;
-      
-      double P1l3 = log3(P1);
-      double P2l3 = log3(P2);
-      double P3l3 = log3(P3);
-      
-      // If a Pn value is small enough, the log value will be NaN.
-      // In this case, the value of -Pn*log3(Pn) is supposed to be
-      // zero - we have to force it.
-      entropy[j] =
-        (meta_is_valid_double(P1l3) ? -P1*P1l3 : 0) +
-        (meta_is_valid_double(P2l3) ? -P2*P2l3 : 0) +
-        (meta_is_valid_double(P3l3) ? -P3*P3l3 : 0);
-      
-      // mathematically, entropy is limited to be between 0 and 1.
-      // however it sometimes is just a bit out of that range due
-      // to numerical anomalies
-      if (!meta_is_valid_double(entropy[j]))
-        entropy[j] = 0.0;
-      else if (entropy[j] < 0)
-        entropy[j] = 0.0;
-      else if (entropy[j] > 1)
-        entropy[j] = 1.0;
-      
-      if (e2+e3 != 0)
-        anisotropy[j] = (e2-e3)/(e2+e3);
-      else
-        anisotropy[j] = 0;
-      
-      // as for entropy, anisotropy is limited to be between 0 and 1.
-      // guard against numerical anomalies (usually this is due to
-      // one really big eigenvalue)
-      if (!meta_is_valid_double(anisotropy[j]))
-        anisotropy[j] = 0.0;
-      else if (anisotropy[j] < 0)
-        anisotropy[j] = 0.0;
-      else if (anisotropy[j] > 1)
-        anisotropy[j] = 1.0;
-      
-      // calculate the "mean alpha" (mean scattering angle)
-      // this is the polar angle when expressing each eigenvector
-      // in spherical coordinates.  the mean alpha is weighted by
-      // the eigenvector (so weight by P1-3)
-      double alpha1 = calc_alpha(gsl_matrix_complex_get(evec, 0, 0));
-      double alpha2 = calc_alpha(gsl_matrix_complex_get(evec, 0, 1));
-      double alpha3 = calc_alpha(gsl_matrix_complex_get(evec, 0, 2));
-      
-      alpha[j] = R2D*(P1*alpha1 + P2*alpha2 + P3*alpha3);
-      if (!meta_is_valid_double(alpha[j]))
-        alpha[j] = 0.0;
+      if (best <= tol)
+        return FALSE;
+      u[k] = sqrt(best_0/best);
     }
-    
+
+    // sort by decreasing magnitude, as gsl_eigen_hermv_sort() with
+    // GSL_EIGEN_SORT_ABS_DESC would -- only rounding can make the
+    // smallest of them negative
+    int order[3] = { 0, 1, 2 };
+    for (i=0; i<2; ++i) {
+      for (k=i+1; k<3; ++k) {
+        if (fabs(lambda[order[k]]) > fabs(lambda[order[i]])) {
+          int tmp = order[i];
+          order[i] = order[k];
+          order[k] = tmp;
+        }
+      }
+    }
+    for (k=0; k<3; ++k) {
+      eval[k] = lambda[order[k]];
+      e0[k] = u[order[k]];
+    }
+    return TRUE;
+}
+
+// Entropy, anisotropy and mean alpha from the eigenvalues (largest
+// first) of the coherency matrix, and the first components of its
+// eigenvectors.
+static void entropy_anisotropy_alpha(const double *eval, const double *e0,
+                                     float *entropy, float *anisotropy,
+                                     float *alpha)
+{
+    double e1 = eval[0];
+    double e2 = eval[1];
+    double e3 = eval[2];
+
+    double eT = e1+e2+e3;
+
+    double P1 = e1/eT;
+    double P2 = e2/eT;
+    double P3 = e3/eT;
+
+    double P1l3 = log3(P1);
+    double P2l3 = log3(P2);
+    double P3l3 = log3(P3);
+
+    // If a Pn value is small enough, the log value will be NaN.
+    // In this case, the value of -Pn*log3(Pn) is supposed to be
+    // zero - we have to force it.
+    *entropy =
+      (meta_is_valid_double(P1l3) ? -P1*P1l3 : 0) +
+      (meta_is_valid_double(P2l3) ? -P2*P2l3 : 0) +
+      (meta_is_valid_double(P3l3) ? -P3*P3l3 : 0);
+
+    // mathematically, entropy is limited to be between 0 and 1.
+    // however it sometimes is just a bit out of that range due
+    // to numerical anomalies
+    if (!meta_is_valid_double(*entropy))
+      *entropy = 0.0;
+    else if (*entropy < 0)
+      *entropy = 0.0;
+    else if (*entropy > 1)
+      *entropy = 1.0;
+
+    if (e2+e3 != 0)
+      *anisotropy = (e2-e3)/(e2+e3);
+    else
+      *anisotropy = 0;
+
+    // as for entropy, anisotropy is limited to be between 0 and 1.
+    // guard against numerical anomalies (usually this is due to
+    // one really big eigenvalue)
+    if (!meta_is_valid_double(*anisotropy))
+      *anisotropy = 0.0;
+    else if (*anisotropy < 0)
+      *anisotropy = 0.0;
+    else if (*anisotropy > 1)
+      *anisotropy = 1.0;
+
+    // calculate the "mean alpha" (mean scattering angle)
+    // this is the polar angle when expressing each eigenvector
+    // in spherical coordinates.  the mean alpha is weighted by
+    // the eigenvector (so weight by P1-3)
+    double alpha1 = calc_alpha_real(MIN(e0[0], 1.0));
+    double alpha2 = calc_alpha_real(MIN(e0[1], 1.0));
+    double alpha3 = calc_alpha_real(MIN(e0[2], 1.0));
+
+    *alpha = R2D*(P1*alpha1 + P2*alpha2 + P3*alpha3);
+    if (!meta_is_valid_double(*alpha))
+      *alpha = 0.0;
+}
+
+// gsl infrastructure for calculating eigen- vals & vecs for the
+// coherence matrices that coherency_eigen() can't do
+typedef struct {
+    gsl_matrix_complex *T;
+    gsl_vector *eval;
+    gsl_matrix_complex *evec;
+    gsl_eigen_hermv_workspace *ws;
+} hermv_fallback;
+
+static void hermv_fallback_init(hermv_fallback *h)
+{
+    h->T = gsl_matrix_complex_alloc(3,3);
+    h->eval = gsl_vector_alloc(3);
+    h->evec = gsl_matrix_complex_alloc(3,3);
+    h->ws = gsl_eigen_hermv_alloc(3);
+}
+
+static void hermv_fallback_free(hermv_fallback *h)
+{
+    gsl_vector_free(h->eval);
+    gsl_eigen_hermv_free(h->ws);
+    gsl_matrix_complex_free(h->evec);
+    gsl_matrix_complex_free(h->T);
+}
+
+static void hermv_fallback_eigen(hermv_fallback *h, const double *t,
+                                 double *eval, double *e0)
+{
+    int k;
+    gsl_matrix_complex_set(h->T, 0, 0, gsl_complex_rect(t[COH_T11], 0));
+    gsl_matrix_complex_set(h->T, 1, 1, gsl_complex_rect(t[COH_T22], 0));
+    gsl_matrix_complex_set(h->T, 2, 2, gsl_complex_rect(t[COH_T33], 0));
+    gsl_matrix_complex_set(h->T, 0, 1,
+      gsl_complex_rect(t[COH_T12_RE], t[COH_T12_IM]));
+    gsl_matrix_complex_set(h->T, 1, 0,
+      gsl_complex_rect(t[COH_T12_RE], -t[COH_T12_IM]));
+    gsl_matrix_complex_set(h->T, 0, 2,
+      gsl_complex_rect(t[COH_T13_RE], t[COH_T13_IM]));
+    gsl_matrix_complex_set(h->T, 2, 0,
+      gsl_complex_rect(t[COH_T13_RE], -t[COH_T13_IM]));
+    gsl_matrix_complex_set(h->T, 1, 2,
+      gsl_complex_rect(t[COH_T23_RE], t[COH_T23_IM]));
+    gsl_matrix_complex_set(h->T, 2, 1,
+      gsl_complex_rect(t[COH_T23_RE], -t[COH_T23_IM]));
+
+    gsl_eigen_hermv(h->T, h->eval, h->evec, h->ws);
+    gsl_eigen_hermv_sort(h->eval, h->evec, GSL_EIGEN_SORT_ABS_DESC);
+
+    for (k=0; k<3; ++k) {
+      eval[k] = gsl_vector_get(h->eval, k);
+      e0[k] = gsl_complex_abs(gsl_matrix_complex_get(h->evec, 0, k));
+    }
+}
+
+// Entropy, anisotropy and alpha for one line of averaged coherency
+// matrices (as from coherence_window_row).
+static void coherence_line(hermv_fallback *h, const float *coh, int ns,
+                           float *entropy, float *anisotropy, float *alpha)
+{
+    int j, k;
+    for (j=0; j<ns; ++j) {
+      double t[COH_ELEMENTS], eval[3], e0[3];
+      for (k=0; k<COH_ELEMENTS; ++k)
+        t[k] = coh[k*ns+j];
+      if (!coherency_eigen(t, eval, e0))
+        hermv_fallback_eigen(h, t, eval, e0);
+      entropy_anisotropy_alpha(eval, e0, &entropy[j], &anisotropy[j],
+                               &alpha[j]);
+    }
+}
+
+// Write out the entropy, anisotropy, alpha and classification bands
+// (whichever were asked for) for an output line, and count it in the
+// population histogram.
+static void
+do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
+                   int class_band, int line,
+                   float *entropy, float *anisotropy, float *alpha,
+                   meta_parameters *outMeta, FILE *fout,
+                   float *buf, classifier_t *classifier)
+{
+    int j, ns = outMeta->general->sample_count;
+
     if (entropy_band >= 0)
       put_band_float_line(fout, outMeta, entropy_band, line, entropy);
     if (anisotropy_band >= 0)
@@ -1344,57 +1620,10 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
       if (alpha_index<0) alpha_index=0;
       if (alpha_index>HIST_SIZE-1) alpha_index=HIST_SIZE-1;
       
-      //printf("%10.1f %10.1f %5d %5d --> %4d\n",
-      //       entropy[j], alpha[j],
-      //       entropy_index, alpha_index,
-      //      ea_hist[entropy_index][alpha_index]+1);
       int anisotropy_index = anisotropy[j]*(float)HIST_SIZE;
+      if (anisotropy_index>HIST_SIZE-1) anisotropy_index=HIST_SIZE-1;
       hist_vals[entropy_index][alpha_index][anisotropy_index] += 1;
     }
-
-    free(entropy);
-    free(anisotropy);
-    free(alpha);
-  }
-}
-
-static int verify_equal_re(const char *id, float lhs, float rhs)
-{
-  if (fabs(lhs - rhs) > .001) {
-    //printf("Not equal (%s): %f != %f\n", id, lhs, rhs);
-    return FALSE;
-  }
-  return TRUE;
-}
-
-static int verify_equal_cpx(const char *id, complexFloat lhs, complexFloat rhs)
-{
-  if (fabs(lhs.real - rhs.real) > .001 ||
-      fabs(lhs.imag - rhs.imag) > .001)
-  {
-    //printf("Not equal (%s): (%f,%f) != (%f,%f)\n", id,
-    //       lhs.real, lhs.imag, rhs.real, rhs.imag);
-    return FALSE;
-  }
-  return TRUE;
-}
-
-static int verify_fd(float hh2, float vv2, complexFloat hhvv, float fs,
-                     float fd, complexFloat alpha, complexFloat beta)
-{
-  int ok1,ok2,ok3;
-
-  // (1) hh2 = fs*beta*beta + fd*alpha*alpha
-  ok1 = verify_equal_re("Eq. 1", hh2, fs*complex_amp_sqr(beta) +
-                                      fd*complex_amp_sqr(alpha));
-  // (2) vv2 = fs + fd
-  ok2 = verify_equal_re("Eq. 2", vv2, fs+fd);
-
-  // (3) hhvv = fs*beta + fd*alpha
-  ok3 = verify_equal_cpx("Eq. 3", hhvv, complex_add(
-                           complex_scale(beta, fs), complex_scale(alpha, fd)));
-
-  return ok1 && ok2 && ok3;
 }
 
 static void solve_fd1(float hh2, float vv2, complexFloat hhvv,
@@ -1483,25 +1712,14 @@ static void solve_fd2(float hh2, float vv2, complexFloat hhvv,
   *alpha = complex_new(ar,ai);
 }
 
-static void do_freeman(int band1, int band2, int band3,
-                       PolarimetricImageRows *img_rows,
-                       int line, int l, int multi, int chunk_size,
-                       meta_parameters *outMeta, FILE *fout)
+// The Freeman-Durden inputs for an output line: <|HH|^2>, <|VV|^2>,
+// <|HV|^2> and <HH*conj(VV)>, averaged over the looks when multilooking.
+static void freeman_inputs(PolarimetricImageRows *img_rows,
+                           int l, int multi, int chunk_size, int ns,
+                           float *hh2, float *vv2, float *hv2,
+                           complexFloat *hhvv)
 {
-  if (band1 >= 0 || band2 >= 0 || band3 >= 0)
-  {
-    //if (outMeta->general->radiometry != r_SIGMA) {
-    //  asfPrintError("The Freeman/Durden decomposition requires "
-    //                "PowerScale (Sigma, non-db) data.\n");
-    //}
-
     int j, m;
-    int ns = outMeta->general->sample_count;
-
-    float *hh2 = MALLOC(sizeof(float)*ns);
-    float *vv2 = MALLOC(sizeof(float)*ns);
-    float *hv2 = MALLOC(sizeof(float)*ns);
-    complexFloat *hhvv = MALLOC(sizeof(complexFloat)*ns);
     float sf = 1.0 / (float)chunk_size;
 
     if (multi) {
@@ -1546,10 +1764,14 @@ static void do_freeman(int band1, int band2, int band3,
         hv2[j] = complex_amp_sqr(img_rows->s2_lines[l][j].hv);
       }
     }
+}
 
-    float *Ps = MALLOC(sizeof(float)*ns);
-    float *Pd = MALLOC(sizeof(float)*ns);
-    float *Pv = MALLOC(sizeof(float)*ns);
+// Ps, Pd and Pv (in dB) for one line of Freeman-Durden inputs.
+static void freeman_line(const float *hh2, const float *vv2, const float *hv2,
+                         const complexFloat *hhvv, int ns,
+                         float *Ps, float *Pd, float *Pv)
+{
+    int j;
 
     // now calculate fs, fd and alpha or beta for each sample, and
     // from those we can get the Ps, Pd, and Pv values
@@ -1567,9 +1789,6 @@ static void do_freeman(int band1, int band2, int band3,
         beta = complex_new(1, 0);
       }
 
-      // double-check the solution
-      verify_fd(hh2[j], vv2[j], hhvv[j], fs, fd, alpha, beta);
-
       // now calculate the final contributions from each scattering mechanism
       Ps[j] = fs * (1. + complex_amp_sqr(beta));
       Pd[j] = fd * (1. + complex_amp_sqr(alpha));
@@ -1589,25 +1808,129 @@ static void do_freeman(int band1, int band2, int band3,
 	Pv[j] = 0.0;
       }
     }
+}
+
+// Number of threads polarimetric_decomp does the Cloude-Pottier and
+// Freeman-Durden decompositions with; 0 means one per processor.
+static int decomp_thread_count = 0;
 
-    free(hh2);
-    free(vv2);
-    free(hv2);
-    free(hhvv);
+void polarimetric_decomp_set_thread_count(int thread_count)
+{
+  decomp_thread_count = thread_count > 0 ? thread_count : 0;
+}
 
-    if (band1 >= 0)
-      put_band_float_line(fout, outMeta, band1, line, Ps);
-    if (band2 >= 0)
-      put_band_float_line(fout, outMeta, band2, line, Pd);
-    if (band3 >= 0)
-      put_band_float_line(fout, outMeta, band3, line, Pv);
+// The decompositions are done a chunk of output lines at a time: the
+// inputs for each line of the chunk (the ensemble averaged coherency
+// matrices, the Freeman-Durden powers) are gathered as the rows go by,
+// then blocks of DECOMP_BLOCK_LINES lines are handed out to the
+// threads, then the lines are written out in order.
+#define DECOMP_BLOCK_LINES 4
 
-    free(Pd);
-    free(Ps);
-    free(Pv);
+typedef struct {
+  int ns;
+  int n_lines;                  // lines in the chunk so far
+  int coherence, freeman;       // which decompositions are wanted
+  float *coh;                   // COH_ELEMENTS*ns per line
+  float *entropy, *anisotropy, *alpha;
+  float *hh2, *vv2, *hv2;
+  complexFloat *hhvv;
+  float *Ps, *Pd, *Pv;
+  gint next_block;
+} decomp_chunk;
+
+typedef struct {
+  decomp_chunk *c;
+  hermv_fallback h;
+} decomp_worker;
+
+static void decomp_chunk_init(decomp_chunk *c, int chunk_lines, int ns,
+                              int coherence, int freeman)
+{
+  int n = chunk_lines*ns;
+  c->ns = ns;
+  c->n_lines = 0;
+  c->coherence = coherence;
+  c->freeman = freeman;
+  c->coh = c->entropy = c->anisotropy = c->alpha = NULL;
+  c->hh2 = c->vv2 = c->hv2 = c->Ps = c->Pd = c->Pv = NULL;
+  c->hhvv = NULL;
+  if (coherence) {
+    c->coh = MALLOC(sizeof(float)*n*COH_ELEMENTS);
+    c->entropy = MALLOC(sizeof(float)*n);
+    c->anisotropy = MALLOC(sizeof(float)*n);
+    c->alpha = MALLOC(sizeof(float)*n);
+  }
+  if (freeman) {
+    c->hh2 = MALLOC(sizeof(float)*n);
+    c->vv2 = MALLOC(sizeof(float)*n);
+    c->hv2 = MALLOC(sizeof(float)*n);
+    c->hhvv = MALLOC(sizeof(complexFloat)*n);
+    c->Ps = MALLOC(sizeof(float)*n);
+    c->Pd = MALLOC(sizeof(float)*n);
+    c->Pv = MALLOC(sizeof(float)*n);
   }
 }
 
+static void decomp_chunk_free(decomp_chunk *c)
+{
+  FREE(c->coh);
+  FREE(c->entropy);
+  FREE(c->anisotropy);
+  FREE(c->alpha);
+  FREE(c->hh2);
+  FREE(c->vv2);
+  FREE(c->hv2);
+  FREE(c->hhvv);
+  FREE(c->Ps);
+  FREE(c->Pd);
+  FREE(c->Pv);
+}
+
+static gpointer decomp_thread(gpointer data)
+{
+  decomp_worker *w = data;
+  decomp_chunk *c = w->c;
+  int ns = c->ns;
+  int first, ii;
+
+  while ((first = g_atomic_int_add(&c->next_block, DECOMP_BLOCK_LINES))
+         < c->n_lines)
+  {
+    int last = MIN(first + DECOMP_BLOCK_LINES, c->n_lines);
+    for (ii = first; ii < last; ++ii) {
+      if (c->coherence)
+        coherence_line(&w->h, c->coh + ii*ns*COH_ELEMENTS, ns,
+                       c->entropy + ii*ns, c->anisotropy + ii*ns,
+                       c->alpha + ii*ns);
+      if (c->freeman)
+        freeman_line(c->hh2 + ii*ns, c->vv2 + ii*ns, c->hv2 + ii*ns,
+                     c->hhvv + ii*ns, ns,
+                     c->Ps + ii*ns, c->Pd + ii*ns, c->Pv + ii*ns);
+    }
+  }
+  return NULL;
+}
+
+static void decomp_chunk_run(decomp_chunk *c, decomp_worker *workers,
+                             int n_threads)
+{
+  int ii;
+  int n_blocks = (c->n_lines + DECOMP_BLOCK_LINES - 1) / DECOMP_BLOCK_LINES;
+  if (n_threads > n_blocks) n_threads = n_blocks;
+
+  c->next_block = 0;
+  GThread **threads = g_new(GThread *, n_threads);
+  for (ii=0; ii<n_threads; ++ii)
+    workers[ii].c = c;
+  for (ii=1; ii<n_threads; ++ii)
+    threads[ii] = g_thread_new("polarimetric_decomp", decomp_thread,
+                               &workers[ii]);
+  decomp_thread(&workers[0]);
+  for (ii=1; ii<n_threads; ++ii)
+    g_thread_join(threads[ii]);
+  g_free(threads);
+}
+
 static void do_class_map(classifier_t *classifier, int class_band, int wide,
                          const char *outFile)
 {
@@ -1935,12 +2258,29 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
   //-----------------------------------------------------------------------
   // done setting up metadata, now write the data
 
-  // gsl infrastructure for calculating eigen- vals & vecs for the
-  // coherence matrix
-  gsl_matrix_complex *T = gsl_matrix_complex_alloc(3,3);
-  gsl_vector *eval = gsl_vector_alloc(3);
-  gsl_matrix_complex *evec = gsl_matrix_complex_alloc(3,3);
-  gsl_eigen_hermv_workspace *ws = gsl_eigen_hermv_alloc(3);
+  int coherence = entropy_band >= 0 || anisotropy_band >= 0 ||
+    alpha_band >= 0 || class_band >= 0;
+  int freeman = freeman_1_band >= 0 || freeman_2_band >= 0 ||
+    freeman_3_band >= 0;
+
+  // size of the horizontal window, used for ensemble averaging
+  // actual window size is hw*2+1
+  int hw;
+  if (multi)
+    hw = 0; // no horizontal averaging
+  else
+    hw = 2; // 5 pixels averaging horizontally
+
+  int n_threads = decomp_thread_count > 0 ? decomp_thread_count
+    : g_get_num_processors();
+  int chunk_lines = n_threads*DECOMP_BLOCK_LINES;
+  decomp_chunk chunk;
+  decomp_chunk_init(&chunk, chunk_lines, ns, coherence, freeman);
+  decomp_worker *workers = MALLOC(sizeof(decomp_worker)*n_threads);
+  if (coherence) {
+    for (i=0; i<n_threads; ++i)
+      hermv_fallback_init(&workers[i].h);
+  }
 
   // now loop through the lines of the output image
   for (i=0; i<onl; ++i) {
@@ -1964,16 +2304,43 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
       do_pauli_bands(pauli_1_band, pauli_2_band, pauli_3_band,
                      img_rows, i, l, multi, chunk_size, outMeta, fout, buf);
 
-
-      // Freeman-Durden
-      do_freeman(freeman_1_band, freeman_2_band, freeman_3_band,
-                 img_rows, i, l, multi, chunk_size, outMeta, fout);
-
-      // do any polarimetry that uses the coherence matrix
-      do_coherence_bands(entropy_band, anisotropy_band, alpha_band, class_band,
-                         img_rows, i, l, multi, chunk_size, T, eval, evec, ws,
-                         outMeta, fout, buf, classifier);
-                         
+      // gather what the Cloude-Pottier (anything that uses the
+      // coherence matrix) and Freeman-Durden decompositions need for
+      // this line, and once there is a full chunk of lines (or this is
+      // the last line), decompose them and write them out
+      if (coherence || freeman) {
+        int li = chunk.n_lines++;
+        if (coherence)
+          coherence_window_row(img_rows, hw,
+                               chunk.coh + li*ns*COH_ELEMENTS);
+        if (freeman)
+          freeman_inputs(img_rows, l, multi, chunk_size, ns,
+                         chunk.hh2 + li*ns, chunk.vv2 + li*ns,
+                         chunk.hv2 + li*ns, chunk.hhvv + li*ns);
+
+        if (chunk.n_lines == chunk_lines || i == onl-1) {
+          int first_line = i - li;
+          decomp_chunk_run(&chunk, workers, n_threads);
+          for (k=0; k<chunk.n_lines; ++k) {
+            int line = first_line + k;
+            if (coherence)
+              do_coherence_bands(entropy_band, anisotropy_band, alpha_band,
+                                 class_band, line, chunk.entropy + k*ns,
+                                 chunk.anisotropy + k*ns, chunk.alpha + k*ns,
+                                 outMeta, fout, buf, classifier);
+            if (freeman_1_band >= 0)
+              put_band_float_line(fout, outMeta, freeman_1_band, line,
+                                  chunk.Ps + k*ns);
+            if (freeman_2_band >= 0)
+              put_band_float_line(fout, outMeta, freeman_2_band, line,
+                                  chunk.Pd + k*ns);
+            if (freeman_3_band >= 0)
+              put_band_float_line(fout, outMeta, freeman_3_band, line,
+                                  chunk.Pv + k*ns);
+          }
+          chunk.n_lines = 0;
+        }
+      }
 
       // load the next row, if there are still more to go
       if (i<onl-1) {
@@ -2014,10 +2381,12 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
     do_class_map(classifier, class_band, wide, outFile);
   }
 
-  gsl_vector_free(eval);
-  gsl_eigen_hermv_free(ws);
-  gsl_matrix_complex_free(evec);
-  gsl_matrix_complex_free(T);
+  if (coherence) {
+    for (i=0; i<n_threads; ++i)
+      hermv_fallback_free(&workers[i].h);
+  }
+  free(workers);
+  decomp_chunk_free(&chunk);
 
   polarimetric_image_rows_free(img_rows);
 
@@ -132,6 +132,92 @@ fftMatchQ(char *file1, char *file2, float *dx, float *dy, float *cert,
   quietflag = qf_saved;
 }
 
+// Memory the terrain correction step may use to keep its intermediate
+// images in memory, see asf_terrcorr_set_memory_budget.
+static long long memory_budget = 0;
+
+void asf_terrcorr_set_memory_budget(long long bytes)
+{
+  memory_budget = bytes;
+}
+
+static long long get_memory_budget(void)
+{
+  if (memory_budget != 0)
+    return memory_budget;
+
+  // default: a quarter of the physical memory
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  long page_count = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (page_count > 0 && page_size > 0)
+    return (long long)page_count * page_size / 4;
+#endif
+  return 512*1048576LL;
+}
+
+// Memory needed by deskew_in_memory: at most, the padded SAR image, its
+// deskewed version & the layover/shadow mask, plus the trimmed copies of
+// the last two.
+static long long deskew_memory_needed(meta_parameters *metaSAR)
+{
+  long long pixels = (long long)metaSAR->general->line_count *
+    (metaSAR->general->sample_count + PAD);
+  return sizeof(float) * pixels * (2*metaSAR->general->band_count + 2);
+}
+
+// The terrain correction step of asf_terrcorr_ext, without the temporary
+// "_pad", "_dd" and "_ddm" files: the padded SAR image, and the deskewed
+// image and mask, are handed along in memory, and only the final image
+// and mask are written out.
+static void deskew_in_memory(meta_parameters *metaSAR,
+                             char *srFile, char *demTrimSlant,
+                             char *demGround, char *userMaskClipped,
+                             char *outFile, char *lsMaskFile,
+                             int trim_edges, int do_interp, int fill_value,
+                             int which_dem, int use_nearest_neighbor)
+{
+  int nl = metaSAR->general->line_count;
+  int ns = metaSAR->general->sample_count;
+  MemoryImage *pad, *dd, *ddm;
+
+  asfPrintStatus("Keeping intermediate images in memory.\n");
+  pad = trim_to_memory(srFile, 0, 0, ns + PAD, nl);
+  deskew_dem_mem(demTrimSlant, demGround, &dd, pad, FALSE, userMaskClipped,
+                 &ddm, do_interp, fill_value, which_dem, use_nearest_neighbor);
+
+  // What the temporary files would have cost: the pad file is written
+  // and read back, the deskewed image is written, then read twice by
+  // trim_zeros (or once to copy it), and the mask is written, read by
+  // the layover filter, and read again for trimming.
+  long long pad_bytes = memory_image_file_bytes(pad->meta);
+  long long mask_bytes = memory_image_file_bytes(ddm->meta);
+  long long avoided = (trim_edges ? 5 : 4)*pad_bytes + 3*mask_bytes;
+
+  memory_image_free(pad);
+
+  // See asf_terrcorr_ext on trimming the edges
+  if (trim_edges) {
+      int startx, endx;
+      MemoryImage *out = memory_image_trim_zeros(dd, &startx, &endx);
+      MemoryImage *mask = memory_image_trim(ddm, startx, 0, endx, nl);
+      memory_image_store(out, outFile);
+      memory_image_store(mask, lsMaskFile);
+      memory_image_free(out);
+      memory_image_free(mask);
+  }
+  else {
+      memory_image_store(dd, outFile);
+      memory_image_store(ddm, lsMaskFile);
+  }
+
+  memory_image_free(dd);
+  memory_image_free(ddm);
+
+  asfPrintStatus("Avoided about %.1f MB of temporary file I/O.\n",
+                 avoided / 1048576.0);
+}
+
 static int mini(int a, int b)
 {
   return a < b ? a : b;
@@ -1570,37 +1656,50 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
       ensure_ext(&demTrimSlant, "img");
       ensure_ext(&srFile, "img");
       asfPrintStatus("\nTerrain correcting slant range image...\n");
-      padFile = getOutName(output_dir, srFile, "_pad");
-      deskewDemFile = getOutName(output_dir, srFile, "_dd");
-      deskewDemMask = getOutName(output_dir, srFile, "_ddm");
-      trim(srFile, padFile, 0, 0, metaSAR->general->sample_count + PAD,
-           metaSAR->general->line_count);
-      deskew_dem(demTrimSlant, demGround, deskewDemFile, padFile, FALSE,
-                 userMaskClipped, deskewDemMask, do_interp, fill_value,
-                 which_dem, use_nearest_neighbor);
 
       // After deskew_dem, there will likely be zeros on the left & right edges
       // of the image, we trim those off before finishing up.  Skip this for
       // Palsar L1.1, as the geolocation of that kind of data won't survive
       // the trimming & subsequent resampling
-      if (!is_Palsar_L11) {
-          int startx, endx;
-          trim_zeros(deskewDemFile, outFile, &startx, &endx);
-          trim(deskewDemMask, lsMaskFile, startx, 0, endx,
-               metaSAR->general->line_count);
+
+      // These intermediate images are never kept, so hand them between
+      // the steps in memory when they fit in the memory budget.
+      if (deskew_memory_needed(metaSAR) <= get_memory_budget())
+      {
+          deskew_in_memory(metaSAR, srFile, demTrimSlant, demGround, userMaskClipped,
+                           outFile, lsMaskFile, !is_Palsar_L11, do_interp,
+                           fill_value, which_dem, use_nearest_neighbor);
       }
-      else {
-          copyImgAndMeta(deskewDemFile, outFile);
-          copyImgAndMeta(deskewDemMask, lsMaskFile);
+      else
+      {
+          padFile = getOutName(output_dir, srFile, "_pad");
+          deskewDemFile = getOutName(output_dir, srFile, "_dd");
+          deskewDemMask = getOutName(output_dir, srFile, "_ddm");
+          trim(srFile, padFile, 0, 0, metaSAR->general->sample_count + PAD,
+               metaSAR->general->line_count);
+          deskew_dem(demTrimSlant, demGround, deskewDemFile, padFile, FALSE,
+                     userMaskClipped, deskewDemMask, do_interp, fill_value,
+                     which_dem, use_nearest_neighbor);
+
+          if (!is_Palsar_L11) {
+              int startx, endx;
+              trim_zeros(deskewDemFile, outFile, &startx, &endx);
+              trim(deskewDemMask, lsMaskFile, startx, 0, endx,
+                   metaSAR->general->line_count);
+          }
+          else {
+              copyImgAndMeta(deskewDemFile, outFile);
+              copyImgAndMeta(deskewDemMask, lsMaskFile);
+          }
+
+          clean(padFile);
+          clean(deskewDemFile);
+          clean(deskewDemMask);
       }
 
       meta_free(metaSAR);
       metaSAR = meta_read(outFile);
 
-      clean(padFile);
-      clean(deskewDemFile);
-      clean(deskewDemMask);
-
 /*    
       Taking this out.  No need to degrade the image, now that we don't allow
       the user to specify a pixel size it should not be needed any longer,
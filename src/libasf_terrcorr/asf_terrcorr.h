@@ -52,6 +52,12 @@ int asf_terrcorr_ext(char *sarFile, char *demFile, char *inMaskFile,
                      int if_coreg_fails_use_zero_offsets, int save_ground_dem,
                      int save_incid_angles, int use_nearest_neighbor);
 
+/* Memory, in bytes, asf_terrcorr_ext may use to pass the images of the
+   terrain correction step from stage to stage in memory, instead of
+   through temporary files.  0 (the default) means a quarter of the
+   physical memory, a negative budget means always use files. */
+void asf_terrcorr_set_memory_budget(long long bytes);
+
 void
 clip_dem(meta_parameters *metaSAR, char *srFile, char *demFile,
          char *demClipped, char *what, char *otherFile, char *otherClipped,
@@ -77,6 +83,9 @@ int get_dem_chunk(char *dem_in, char *dem_out, meta_parameters *metaDEM,
 /* Prototypes from rtc.c */
 int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
         char *output_file, int save_incid_angles);
+/* Number of threads rtc calculates the corrections with.  0 (the
+   default) means one per processor. */
+void rtc_set_thread_count(int thread_count);
 int uavsar_rtc(const char *input_file, const char *correction_file,
                const char *annotation_file, const char *output_file);
 int make_gr_dem(meta_parameters *meta_sar, const char *demBase, const char *output_name);
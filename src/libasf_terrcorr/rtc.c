@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <string.h>
 #include "vector.h"
+#include <glib.h>
 
 static char *matrix[32] = 
   {"T11","T12_real","T12_imag","T13_real","T13_imag","T14_real","T14_imag",
@@ -96,112 +97,265 @@ static Vector get_satpos(meta_parameters *meta, int line)
   return satpos;
 }
 
-static void calculate_vectors_for_line(meta_parameters *meta_dem, meta_parameters *meta_img, int line, FILE *dem_fp, Vector **vectorLine, Vector *nextVectors)
+// The ground points (ECEF) of one line of the image, as a structure of
+// arrays.
+typedef struct {
+  double *x, *y, *z;
+} point_row;
+
+// The lines above, at and below the line being corrected.  All three
+// live in one block of memory, and are rolled down the image by
+// swapping pointers, so nothing is allocated per pixel or per line.
+typedef struct {
+  point_row row[3];
+  double *block;
+  double *lat, *lon;
+} rolling_rows;
+
+static void rolling_rows_init(rolling_rows *r, int ns)
+{
+  int ii;
+  r->block = MALLOC(sizeof(double)*ns*11);
+  for (ii=0; ii<3; ++ii) {
+    r->row[ii].x = r->block + ns*(3*ii);
+    r->row[ii].y = r->block + ns*(3*ii+1);
+    r->row[ii].z = r->block + ns*(3*ii+2);
+  }
+  r->lat = r->block + ns*9;
+  r->lon = r->block + ns*10;
+}
+
+static void rolling_rows_free(rolling_rows *r)
+{
+  FREE(r->block);
+}
+
+// Fills row with the ground points of the given line of the image.
+static void calculate_points_for_line(meta_parameters *meta_img, int line,
+                                      float *demLine, rolling_rows *r,
+                                      point_row *row)
 {
   int jj;
-  double lat, lon;
   int ns = meta_img->general->sample_count;
-  float demLine[ns];
-
-  get_float_line(dem_fp, meta_dem, line, demLine);
+  Vector v;
 
+  meta_get_latLon_row(meta_img, line, 0, 1, ns, 0, r->lat, r->lon);
   for(jj = 0; jj < ns; ++jj) {
-    Vector *v = MALLOC(sizeof(Vector));
-    meta_get_latLon(meta_img, line, jj, 0, &lat, &lon);
-    geodetic_to_ecef(lat, lon, demLine[jj], v);
-    vectorLine[jj] = v;
+    geodetic_to_ecef(r->lat[jj], r->lon[jj], demLine[jj], &v);
+    row->x[jj] = v.x;
+    row->y[jj] = v.y;
+    row->z[jj] = v.z;
   }
 }
 
-static void push_next_vector_line(Vector ***localVectors, Vector *nextVectors, meta_parameters *meta_dem, meta_parameters *meta_img, FILE *dem_fp, int line)
+// Drops the top row, and puts the given line in at the bottom.
+static void push_next_point_line(rolling_rows *r, meta_parameters *meta_img,
+                                 int line, float *demLine)
 {
-  int ns = meta_img->general->sample_count;
-  Vector **vectorsLine = MALLOC(sizeof(Vector*)*ns);
-  calculate_vectors_for_line(meta_dem, meta_img, line, dem_fp, vectorsLine, nextVectors);
-
-  int i;
-  for(i = 0; i < ns; i++)
-    if(localVectors[0] != NULL)
-      vector_free(localVectors[0][i]);
-  FREE(localVectors[0]);
-
-  localVectors[0] = localVectors[1];
-  localVectors[1] = localVectors[2];
-  localVectors[2] = vectorsLine;
+  point_row top = r->row[0];
+  r->row[0] = r->row[1];
+  r->row[1] = r->row[2];
+  r->row[2] = top;
+  calculate_points_for_line(meta_img, line, demLine, r, &r->row[2]);
+}
+
+static void get_point(point_row *row, int sample, Vector *p)
+{
+  p->x = row->x[sample];
+  p->y = row->y[sample];
+  p->z = row->z[sample];
 }
 
-static Vector * calculate_normal(Vector ***localVectors, int sample)
+static void cross(Vector *a, Vector *b, Vector *c)
 {
-  Vector *v1, *v2, *normal;
+  c->x = a->y * b->z - a->z * b->y;
+  c->y = a->z * b->x - a->x * b->z;
+  c->z = a->x * b->y - a->y * b->x;
+}
 
-  v1 = vector_copy(localVectors[0][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
+static void calculate_normal(rolling_rows *r, int sample, Vector *normal)
+{
+  Vector v1, v2, tmp;
 
-  v2 = vector_copy(localVectors[1][sample-1]);
-  vector_subtract(v2, localVectors[1][sample+1]);
+  get_point(&r->row[0], sample, &v1);
+  get_point(&r->row[2], sample, &tmp);
+  vector_subtract(&v1, &tmp);
 
-  normal = vector_cross(v2, v1);
-  vector_multiply(normal, 1./vector_magnitude(normal));
+  get_point(&r->row[1], sample-1, &v2);
+  get_point(&r->row[1], sample+1, &tmp);
+  vector_subtract(&v2, &tmp);
 
-  vector_free(v1);
-  vector_free(v2);
- /*
-  v1 = vector_copy(localVectors[1][sample]);
-  v2 = vector_copy(localVectors[1][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
-  vector_subtract(v2, localVectors[1][sample+1]);
-  normal = vector_cross(v1, v2);
+  cross(&v2, &v1, normal);
   vector_multiply(normal, 1./vector_magnitude(normal));
-  vector_free(v1);
-  vector_free(v2);
- */
-  return normal;
 }
 
 static float
 calculate_local_incidence(Vector *n, Vector *satpos, Vector *p)
-                          
 {
   // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, -1./vector_magnitude(R));
-
-  double local_incidence = acos(vector_dot(n,R)) * R2D;
-
-  vector_free(R);
+  Vector R = *satpos;
+  vector_subtract(&R, p);
+  vector_multiply(&R, -1./vector_magnitude(&R));
 
-  return local_incidence;
+  return acos(vector_dot(n,&R)) * R2D;
 }
 
 static float
-calculate_correction(meta_parameters *meta_in, int line, int samp,
-                     Vector *satpos, Vector *n, Vector *p, Vector *p_next, float incid_angle)
+calculate_correction(Vector *satpos, Vector *n, Vector *p, float incid_angle)
 {
-
   // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, 1./vector_magnitude(R));
+  Vector R = *satpos;
+  vector_subtract(&R, p);
+  vector_multiply(&R, 1./vector_magnitude(&R));
 
-  Vector *x = vector_cross(p,R);
-  vector_multiply(x, 1./vector_magnitude(x));
+  Vector x;
+  cross(p, &R, &x);
+  vector_multiply(&x, 1./vector_magnitude(&x));
 
   // Rx: R cross x -- image plane normal
-  Vector *Rx = vector_cross(R,x);
+  Vector Rx;
+  cross(&R, &x, &Rx);
 
   // cos(phi) is the correction factor we need
-  double cosphi = vector_dot(Rx,n);
+  double cosphi = vector_dot(&Rx,n);
   if (cosphi < 0) cosphi = -cosphi;
 
-  vector_free(x);
-  vector_free(R);
-  vector_free(Rx);
-
   // need to remove old correction factor (sin of the incidence angle)
   return cosphi / sin(incid_angle);
 }
 
+// Number of threads rtc calculates the corrections with; 0 means one
+// per processor.
+static int rtc_thread_count = 0;
+
+void rtc_set_thread_count(int thread_count)
+{
+  rtc_thread_count = thread_count > 0 ? thread_count : 0;
+}
+
+// The corrections are calculated for a chunk of lines at a time, in
+// blocks of RTC_BLOCK_LINES lines handed out to the threads.  Each block
+// starts its own three rows, so it costs two extra lines of geolocation.
+#define RTC_BLOCK_LINES 16
+
+// What the threads share while working on a chunk.  The DEM lines of
+// the chunk, and the line above and below it, are read beforehand.
+typedef struct {
+  meta_parameters *meta_in;
+  int first_line, n_lines;      // the lines of the chunk
+  float *dem;                   // DEM lines first_line-1 .. +n_lines
+  float *corr, *incid, *local;  // results, n_lines x ns each
+  int save_local;
+  gint next_block;
+} rtc_chunk;
+
+typedef struct {
+  rtc_chunk *c;
+  rolling_rows rows;
+} rtc_worker;
+
+// Corrections for the lines of the block starting at first, relative to
+// the chunk.
+static void rtc_block(rtc_chunk *c, rolling_rows *r, int first, int last)
+{
+  meta_parameters *meta_in = c->meta_in;
+  int ns = meta_in->general->sample_count;
+  int ii, jj;
+
+  // c->dem starts the line before the chunk
+  for (ii = first; ii < first + 2; ++ii)
+    push_next_point_line(r, meta_in, c->first_line + ii - 1, c->dem + ii*ns);
+
+  for (ii = first; ii < last; ++ii) {
+    int line = c->first_line + ii;
+    float *corr = c->corr + ii*ns;
+    float *incid = c->incid + ii*ns;
+    float *local = c->local + ii*ns;
+
+    push_next_point_line(r, meta_in, line + 1, c->dem + (ii+2)*ns);
+    Vector satpos = get_satpos(meta_in, line);
+    corr[0] = corr[ns-1] = 1;
+    incid[0] = incid[ns-1] = 0;
+
+    // calculate the Ulander correction for this line
+    for (jj = 1; jj < ns - 1; ++jj) {
+      Vector normal, p;
+      incid[jj] = meta_incid(meta_in, line, jj);
+      calculate_normal(r, jj, &normal);
+      get_point(&r->row[1], jj, &p);
+      corr[jj] = calculate_correction(&satpos, &normal, &p, incid[jj]);
+      if (c->save_local)
+        local[jj] = calculate_local_incidence(&normal, &satpos, &p);
+    }
+    local[0] = local[ns-1] = 0;
+  }
+}
+
+static gpointer rtc_thread(gpointer data)
+{
+  rtc_worker *w = data;
+  rtc_chunk *c = w->c;
+  int first;
+
+  while ((first = g_atomic_int_add(&c->next_block, RTC_BLOCK_LINES))
+         < c->n_lines)
+    rtc_block(c, &w->rows, first, MIN(first + RTC_BLOCK_LINES, c->n_lines));
+  return NULL;
+}
+
+static void rtc_chunk_corrections(rtc_chunk *c, rtc_worker *workers,
+                                  int n_threads)
+{
+  int ii;
+  int n_blocks = (c->n_lines + RTC_BLOCK_LINES - 1) / RTC_BLOCK_LINES;
+  if (n_threads > n_blocks) n_threads = n_blocks;
+
+  c->next_block = 0;
+  GThread **threads = g_new(GThread *, n_threads);
+  for (ii=0; ii<n_threads; ++ii)
+    workers[ii].c = c;
+  for (ii=1; ii<n_threads; ++ii)
+    threads[ii] = g_thread_new("rtc", rtc_thread, &workers[ii]);
+  rtc_thread(&workers[0]);
+  for (ii=1; ii<n_threads; ++ii)
+    g_thread_join(threads[ii]);
+  g_free(threads);
+}
+
+static void correct_line(FILE *fpIn, FILE *fpOut, meta_parameters *meta_in,
+                         meta_parameters *meta_out, char **bands, int line,
+                         float *corr, float *bufIn, float *bufOut)
+{
+  int ns = meta_in->general->sample_count;
+  int nb = meta_in->general->band_count;
+  int jj, kk;
+
+  // correct all the bands with the calculated scale factor
+  for (kk=0; kk<nb; ++kk) {
+    get_band_float_line(fpIn, meta_in, kk, line, bufIn);
+
+    // we never apply the correction to phase
+    if (strstr(bands[kk], "PHASE") != NULL) {
+      for (jj=0; jj<ns; ++jj)
+        bufOut[jj] = bufIn[jj];
+    }
+    // correct matrix element without applying calibration parameters
+    else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk])) {
+      for (jj=0; jj<ns; ++jj)
+        bufOut[jj] = bufIn[jj]*corr[jj];
+    }
+    // amplitude, or complex I or Q -- apply the radiometric correction
+    else {
+      for (jj=0; jj<ns; ++jj)
+        bufOut[jj] =
+          get_rad_cal_dn(meta_in, line, jj, bands[kk], bufIn[jj], corr[jj]);
+    }
+
+    // write out the corrected line
+    put_band_float_line(fpOut, meta_out, kk, line, bufOut);
+  }
+}
+
 int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
         char *output_file, int save_incid_angles)
 {
@@ -272,7 +426,6 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 
   int ns = meta_in->general->sample_count;
   int nl = meta_in->general->line_count;
-  int nb = meta_in->general->band_count;
   int dns = meta_dem->general->sample_count;
   int dnl = meta_dem->general->line_count;
   if (nl != dnl || ns != dns) {
@@ -280,9 +433,6 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
                    nl, ns, dnl, dns);
   }
 
-  Vector **localVectors[3] = { NULL, NULL, NULL };
-  Vector nextVectors[ns];
-
   FILE *fpIn = FOPEN(inputImg, "rb");
   FILE *fpOut = FOPEN(outputImg, "wb");
   FILE *dem_fp = FOPEN(demImg, "rb");
@@ -294,11 +444,7 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 
   asfPrintStatus("Applying radiometric correction...\n");
 
-  int ii, jj, kk;
-  for(ii = 1; ii < 3; ++ii) {
-    localVectors[ii] = MALLOC(sizeof(Vector**)*ns);
-    calculate_vectors_for_line(meta_in, meta_dem, ii - 1, dem_fp, localVectors[ii], nextVectors);
-  }
+  int ii, jj;
 
   for (jj=0; jj<ns; ++jj) {
     incid_angles[jj] = 0;
@@ -319,116 +465,73 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 
   // We aren't applying the correction to the edges of the image
   // (corr[jj] == 1 for the whole row)
-  for(kk = 0; kk < nb; ++kk) {
-    get_band_float_line(fpIn, meta_in, kk, 0, bufIn);
-    if (strstr(bands[kk], "PHASE") != NULL) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj];
-    }
-    else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk])) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj]*corr[jj];
-    }
-    else {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = 
-	  get_rad_cal_dn(meta_in, 0, jj, bands[kk], bufIn[jj], corr[jj]);
-    }
-    put_band_float_line(fpOut, meta_out, kk, 0, bufOut);
-  }
-
-  for(ii = 1; ii < nl - 1; ++ii) {
-    push_next_vector_line(localVectors, nextVectors, meta_dem, meta_in, dem_fp,
-			  ii + 1);
-    corr[0] = corr[ns-1] = 1;
-    Vector satpos = get_satpos(meta_in, ii);
-    incid_angles[0] = incid_angles[nl-1] = 0;
-
-    // calculate the Ulander correction for this line
-    for(jj = 1; jj < ns - 1; ++jj) {
-      incid_angles[jj] = meta_incid(meta_in, ii, jj);
-      Vector * normal = calculate_normal(localVectors, jj);
-      corr[jj] = calculate_correction(meta_in, ii, jj, &satpos, normal, 
-				      localVectors[1][jj], &nextVectors[jj], 
-				      incid_angles[jj]);
-      vector_free(normal);
-    }
-
-    // saving some intermediate products if requested
-    if(save_incid_angles) {
-      float *tmp_buf = MALLOC(sizeof(float)*ns);
-      for (jj=0; jj<ns; ++jj)
-        tmp_buf[jj] = incid_angles[jj] * R2D;
-      put_band_float_line(fpSide, side_meta, 0, ii, tmp_buf);
-      put_band_float_line(fpSide, side_meta, 2, ii, corr);
-      for (jj=0; jj<ns; ++jj)
-        tmp_buf[jj] = corr[jj] * sin(incid_angles[jj]);
-      put_band_float_line(fpSide, side_meta, 3, ii, tmp_buf);
-      for (jj=1; jj<ns-1; ++jj) {
-        Vector * normal = calculate_normal(localVectors, jj);
-        tmp_buf[jj] = calculate_local_incidence(normal, &satpos,
-				      localVectors[1][jj]);
-        vector_free(normal);
-      }
-      tmp_buf[jj] = tmp_buf[jj-1] = 0;
-      put_band_float_line(fpSide, side_meta, 1, ii, tmp_buf);
-      FREE(tmp_buf);
-    }
-
-    // correct all the bands with the calculated scale factor
-    for (kk=0; kk<nb; ++kk) {
-      get_band_float_line(fpIn, meta_in, kk, ii, bufIn);
-
-      // we never apply the correction to phase
-      if (strstr(bands[kk], "PHASE") != NULL) {
+  correct_line(fpIn, fpOut, meta_in, meta_out, bands, 0, corr, bufIn, bufOut);
+
+  // The lines in between, a chunk at a time: the corrections of the
+  // chunk are calculated by the threads, then the bands are corrected
+  // and written here.
+  int n_threads = rtc_thread_count > 0 ? rtc_thread_count
+    : g_get_num_processors();
+  int chunk_lines = n_threads*RTC_BLOCK_LINES;
+  rtc_chunk c;
+  c.meta_in = meta_in;
+  c.save_local = save_incid_angles;
+  c.dem = MALLOC(sizeof(float)*ns*(chunk_lines+2));
+  c.corr = MALLOC(sizeof(float)*ns*chunk_lines);
+  c.incid = MALLOC(sizeof(float)*ns*chunk_lines);
+  c.local = MALLOC(sizeof(float)*ns*chunk_lines);
+  float *tmp_buf = MALLOC(sizeof(float)*ns);
+  rtc_worker *workers = MALLOC(sizeof(rtc_worker)*n_threads);
+  for (ii=0; ii<n_threads; ++ii)
+    rolling_rows_init(&workers[ii].rows, ns);
+
+  for (c.first_line = 1; c.first_line < nl - 1; c.first_line += chunk_lines) {
+    c.n_lines = MIN(chunk_lines, nl - 1 - c.first_line);
+    for (ii = 0; ii < c.n_lines + 2; ++ii)
+      get_float_line(dem_fp, meta_dem, c.first_line + ii - 1, c.dem + ii*ns);
+
+    rtc_chunk_corrections(&c, workers, n_threads);
+
+    for (ii = 0; ii < c.n_lines; ++ii) {
+      int line = c.first_line + ii;
+      float *line_corr = c.corr + ii*ns;
+      float *line_incid = c.incid + ii*ns;
+
+      // saving some intermediate products if requested
+      if(save_incid_angles) {
         for (jj=0; jj<ns; ++jj)
-          bufOut[jj] = bufIn[jj];
-      }
-      // correct matrix element without applying calibration parameters
-      else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk])) {
-	for (jj=0; jj<ns; ++jj)
-	  bufOut[jj] = bufIn[jj]*corr[jj];
-      }
-      // amplitude, or complex I or Q -- apply the radiometric correction
-      else {
+          tmp_buf[jj] = line_incid[jj] * R2D;
+        put_band_float_line(fpSide, side_meta, 0, line, tmp_buf);
+        put_band_float_line(fpSide, side_meta, 1, line, c.local + ii*ns);
+        put_band_float_line(fpSide, side_meta, 2, line, line_corr);
         for (jj=0; jj<ns; ++jj)
-          bufOut[jj] = 
-	    get_rad_cal_dn(meta_in, ii, jj, bands[kk], bufIn[jj], corr[jj]);
+          tmp_buf[jj] = line_corr[jj] * sin(line_incid[jj]);
+        put_band_float_line(fpSide, side_meta, 3, line, tmp_buf);
       }
 
-      // write out the corrected line
-      put_band_float_line(fpOut, meta_out, kk, ii, bufOut);
+      correct_line(fpIn, fpOut, meta_in, meta_out, bands, line, line_corr,
+                   bufIn, bufOut);
+
+      asfLineMeter(line+1, nl);
     }
 
-    asfLineMeter(ii+1, nl);
+    // the bottom line reuses the corrections of the line above it
+    memcpy(corr, c.corr + (c.n_lines-1)*ns, sizeof(float)*ns);
   }
 
+  for (ii=0; ii<n_threads; ++ii)
+    rolling_rows_free(&workers[ii].rows);
+  FREE(workers);
+  FREE(tmp_buf);
+  FREE(c.dem);
+  FREE(c.corr);
+  FREE(c.incid);
+  FREE(c.local);
+
   // bottom line of the image, here we are cheating and reusing the previous
   // line's correction factors
-  for(kk = 0; kk < nb; ++kk) {
-    get_band_float_line(fpIn, meta_in, kk, nl-1, bufIn);
-    if (strstr(bands[kk], "PHASE") != NULL) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj];
-    }
-    else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk])) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj]*corr[jj];
-    }
-    else {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = 
-	  get_rad_cal_dn(meta_in, nl-1, jj, bands[kk], bufIn[jj], corr[jj]);
-    }
-    put_band_float_line(fpOut, meta_out, kk, nl-1, bufIn);
-  }
-
-  for(ii = 0; ii < 3; ++ii) {
-    for(jj = 0; jj < ns; ++jj) {
-      vector_free(localVectors[ii][jj]);
-    }
-    FREE(localVectors[ii]);
-  }
+  correct_line(fpIn, fpOut, meta_in, meta_out, bands, nl-1, corr,
+               bufIn, bufOut);
 
   FCLOSE(fpOut);
   FCLOSE(fpIn);
@@ -0,0 +1,90 @@
+// Counts the heap allocations, and times, the radiometric terrain
+// correction of a scene: rtc(), and deskew_dem() with radiometric
+// correction on, once for each thread count given.
+//
+// Before the rolling row buffers, both made every DEM pixel's position
+// vector, and each normal, its own allocation: about 11 allocations a
+// pixel in rtc (with the side products, which it always saves) and 7 in
+// deskew_dem.  Now they should only allocate per line or per chunk.
+//
+// Link with -Wl,--wrap=malloc (the Makefile target does) so that the
+// allocations get counted.
+//
+// Usage: rtc_bench <sar> <slant range dem> [threads ...]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_sar.h"
+#include "asf_terrcorr.h"
+
+static gint malloc_count = 0;
+
+void *__real_malloc (size_t size);
+
+void *
+__wrap_malloc (size_t size)
+{
+  g_atomic_int_inc (&malloc_count);
+  return __real_malloc (size);
+}
+
+static void
+report (const char *what, int threads, double seconds, int allocs,
+        double pixels)
+{
+  printf ("%-10s %2d thread(s): %8.3f s, %10d allocations, "
+          "%8.4f per pixel\n", what, threads, seconds, allocs,
+          allocs / pixels);
+}
+
+int
+main (int argc, char **argv)
+{
+  if ( argc < 3 ) {
+    fprintf (stderr, "Usage: %s <sar> <slant range dem> [threads ...]\n",
+             argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char *sar = argv[1], *dem_slant = argv[2];
+  meta_parameters *meta = meta_read (sar);
+  double pixels = (double) meta->general->line_count
+    * meta->general->sample_count;
+  meta_free (meta);
+
+  int default_threads[] = { 1, 0 };
+  int n_threads = argc > 3 ? argc - 3 : 2;
+  int ii;
+
+  quietflag = TRUE;
+  for ( ii = 0 ; ii < n_threads ; ii++ ) {
+    int threads = argc > 3 ? atoi (argv[3 + ii]) : default_threads[ii];
+    int used = threads > 0 ? threads : (int) g_get_num_processors ();
+    GTimer *timer = g_timer_new ();
+    int before;
+
+    rtc_set_thread_count (threads);
+    before = g_atomic_int_get (&malloc_count);
+    g_timer_start (timer);
+    rtc (sar, dem_slant, FALSE, NULL, "rtc_bench_rtc", TRUE);
+    report ("rtc", used, g_timer_elapsed (timer, NULL),
+            g_atomic_int_get (&malloc_count) - before, pixels);
+
+    deskew_dem_set_thread_count (threads);
+    before = g_atomic_int_get (&malloc_count);
+    g_timer_start (timer);
+    deskew_dem (dem_slant, NULL, "rtc_bench_deskew", sar, TRUE, NULL, NULL,
+                FALSE, LEAVE_MASK, 0, 0);
+    report ("deskew_dem", used, g_timer_elapsed (timer, NULL),
+            g_atomic_int_get (&malloc_count) - before, pixels);
+
+    g_timer_destroy (timer);
+  }
+
+  return EXIT_SUCCESS;
+}
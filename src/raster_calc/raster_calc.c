@@ -105,7 +105,14 @@ void usage(char *name)
  printf("\n"
 	"DESCRIPTION:\n"
 	"   Creates an output ASF tools format image based upon the\n"
-	"   mathematical expression you give it.\n");
+	"   mathematical expression you give it.  In the expression, a is\n"
+	"   the pixel value of the first input image, b of the second, and\n"
+	"   so on; x and y are the sample and line, and pi and nodata are\n"
+	"   constants.  Available are + - * / %% ^, the comparisons\n"
+	"   < <= > >= == != (giving 1 or 0), && || !, and the functions\n"
+	"   log10 log exp sqrt abs floor sin cos atan2 min max, and\n"
+	"   where(cond,v,w).  Pixels where any input used has its no data\n"
+	"   value are no data in the output.\n");
  printf("\n"
 	"Version %.2f, ASF SAR Tools\n"
 	"\n",VERSION);